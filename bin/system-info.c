@@ -392,7 +392,8 @@ print_graphics_details(JsonBuilder *builder,
 
         }
 
-      if (rendering_interface == SRT_RENDERING_INTERFACE_VULKAN)
+      if (rendering_interface == SRT_RENDERING_INTERFACE_VULKAN
+          || rendering_interface == SRT_RENDERING_INTERFACE_VAAPI)
         {
           g_autoptr(SrtObjectList) devices = srt_graphics_get_devices (g->data);
           const GList *iter;
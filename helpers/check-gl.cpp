@@ -24,13 +24,18 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdint>
+#include <cstdio>
 #include <set>
+#include <string>
 
 #include <X11/Xlib.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/gl.h>
 #include <GL/glx.h>
 
 extern "C" {
+#include <dlfcn.h>
 #include <getopt.h>
 };
 
@@ -39,41 +44,382 @@ const int HEIGHT = 200;
 
 static const char *argv0;
 
+enum class Platform {
+    GLX,
+    EGL_X11,
+    SURFACELESS,
+};
+
+/* libEGL is loaded at runtime rather than being linked, so that check-gl
+ * can still be used to check GLX on systems without EGL */
+struct EGLFunctions {
+    decltype(&::eglBindAPI) BindAPI;
+    decltype(&::eglChooseConfig) ChooseConfig;
+    decltype(&::eglCreateContext) CreateContext;
+    decltype(&::eglCreatePbufferSurface) CreatePbufferSurface;
+    decltype(&::eglCreateWindowSurface) CreateWindowSurface;
+    decltype(&::eglDestroyContext) DestroyContext;
+    decltype(&::eglDestroySurface) DestroySurface;
+    decltype(&::eglGetConfigAttrib) GetConfigAttrib;
+    decltype(&::eglGetDisplay) GetDisplay;
+    decltype(&::eglGetProcAddress) GetProcAddress;
+    decltype(&::eglInitialize) Initialize;
+    decltype(&::eglMakeCurrent) MakeCurrent;
+    decltype(&::eglQueryString) QueryString;
+    decltype(&::eglSwapBuffers) SwapBuffers;
+    decltype(&::eglTerminate) Terminate;
+};
+
+template<typename T>
+static void load_egl_symbol(void *handle, const char *name, T *out) {
+    *out = reinterpret_cast<T>(dlsym(handle, name));
+
+    if (*out == nullptr)
+      throw std::runtime_error(std::string("Unable to find ") + name
+                               + " in libEGL");
+}
+
+static void load_egl(EGLFunctions *egl) {
+    void *handle = dlopen("libEGL.so.1", RTLD_NOW | RTLD_GLOBAL);
+
+    if (handle == nullptr)
+      throw std::runtime_error(std::string("Unable to load libEGL: ")
+                               + dlerror());
+
+#define LOAD(name) load_egl_symbol(handle, "egl" #name, &egl->name)
+    LOAD(BindAPI);
+    LOAD(ChooseConfig);
+    LOAD(CreateContext);
+    LOAD(CreatePbufferSurface);
+    LOAD(CreateWindowSurface);
+    LOAD(DestroyContext);
+    LOAD(DestroySurface);
+    LOAD(GetConfigAttrib);
+    LOAD(GetDisplay);
+    LOAD(GetProcAddress);
+    LOAD(Initialize);
+    LOAD(MakeCurrent);
+    LOAD(QueryString);
+    LOAD(SwapBuffers);
+    LOAD(Terminate);
+#undef LOAD
+}
+
+/* Output a string as a JSON string literal */
+static void print_json_string(std::ostream& stream, const char *str) {
+    stream << '"';
+
+    for (; str != nullptr && *str != '\0'; str++) {
+        unsigned char c = *str;
+
+        switch (c) {
+          case '"':
+            stream << "\\\"";
+            break;
+
+          case '\\':
+            stream << "\\\\";
+            break;
+
+          case '\n':
+            stream << "\\n";
+            break;
+
+          default:
+            if (c < 0x20) {
+              char buf[8];
+
+              snprintf(buf, sizeof(buf), "\\u%04x", c);
+              stream << buf;
+            } else {
+              stream << c;
+            }
+            break;
+        }
+    }
+
+    stream << '"';
+}
+
 class HelloTriangleGLApplication {
 public:
-    HelloTriangleGLApplication(bool visible)
+    HelloTriangleGLApplication(bool visible, bool info, Platform platform)
       : m_visible(visible),
+        m_info(info),
+        m_platform(platform),
         m_display(nullptr),
         m_window(0),
-        m_context(0)
+        m_context(0),
+        m_egl_display(EGL_NO_DISPLAY),
+        m_egl_surface(EGL_NO_SURFACE),
+        m_egl_context(EGL_NO_CONTEXT),
+        m_egl()
     {
     }
 
     void run() {
         initGL();
+
+        /* Report what we loaded before trying to draw, so that the
+         * caller can distinguish between being unable to load the
+         * driver and being unable to draw with it */
+        if (m_info)
+          printInfo();
+
         mainLoop();
+        checkPixels();
         cleanup();
     }
 
 private:
     bool m_visible;
+    bool m_info;
+    Platform m_platform;
     Display *m_display;
     Window m_window;
     GLXContext m_context;
+    EGLDisplay m_egl_display;
+    EGLSurface m_egl_surface;
+    EGLContext m_egl_context;
+    EGLFunctions m_egl;
+
+    bool isEGL() const {
+        return m_platform != Platform::GLX;
+    }
 
     void initGL() {
+        if (m_platform == Platform::SURFACELESS) {
+            initSurfacelessEGL();
+            return;
+        }
+
         m_display = XOpenDisplay(nullptr);
         if (!m_display)
           {
             throw std::runtime_error("Unable to open display");
           }
 
-        makeWindow();
+        if (m_platform == Platform::EGL_X11)
+          initX11EGL();
+        else
+          makeWindow();
 
         if (m_visible)
           XMapWindow(m_display, m_window);
 
-        glXMakeCurrent(m_display, m_window, m_context);
+        if (m_platform == Platform::GLX)
+          glXMakeCurrent(m_display, m_window, m_context);
+    }
+
+    void initEGLDisplay(EGLDisplay display) {
+        EGLint major, minor;
+
+        if (display == EGL_NO_DISPLAY)
+          throw std::runtime_error("Unable to get an EGL display");
+
+        m_egl_display = display;
+
+        if (!m_egl.Initialize(m_egl_display, &major, &minor))
+          throw std::runtime_error("Error: eglInitialize failed");
+
+        if (!m_egl.BindAPI(EGL_OPENGL_API))
+          throw std::runtime_error("Error: eglBindAPI(EGL_OPENGL_API) failed");
+    }
+
+    void makeEGLCurrent(EGLConfig config) {
+        m_egl_context = m_egl.CreateContext(m_egl_display, config,
+                                            EGL_NO_CONTEXT, nullptr);
+
+        if (m_egl_context == EGL_NO_CONTEXT)
+          throw std::runtime_error("Error: eglCreateContext failed");
+
+        if (!m_egl.MakeCurrent(m_egl_display, m_egl_surface, m_egl_surface,
+                               m_egl_context))
+          throw std::runtime_error("Error: eglMakeCurrent failed");
+    }
+
+    /* Draw into an X11 window, like waffle's x11_egl platform */
+    void initX11EGL() {
+        const char *client_extensions;
+        EGLDisplay display = EGL_NO_DISPLAY;
+        EGLConfig config;
+        EGLint n_configs = 0;
+        EGLint visual_id = 0;
+        XVisualInfo visual_template;
+        XVisualInfo *visinfo;
+        int n_visuals = 0;
+        static const EGLint config_attribs[] = {
+            EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 1,
+            EGL_GREEN_SIZE, 1,
+            EGL_BLUE_SIZE, 1,
+            EGL_NONE
+        };
+
+        load_egl(&m_egl);
+        client_extensions = m_egl.QueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+        if (client_extensions != nullptr
+            && strstr(client_extensions, "EGL_EXT_platform_x11") != nullptr) {
+            auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+                m_egl.GetProcAddress("eglGetPlatformDisplayEXT"));
+
+            if (get_platform_display != nullptr)
+              display = get_platform_display(EGL_PLATFORM_X11_EXT, m_display,
+                                             nullptr);
+        }
+
+        if (display == EGL_NO_DISPLAY)
+          display = m_egl.GetDisplay((EGLNativeDisplayType) m_display);
+
+        initEGLDisplay(display);
+
+        if (!m_egl.ChooseConfig(m_egl_display, config_attribs, &config, 1,
+                                &n_configs)
+            || n_configs < 1)
+          throw std::runtime_error("Error: couldn't get an RGB window config");
+
+        if (!m_egl.GetConfigAttrib(m_egl_display, config,
+                                   EGL_NATIVE_VISUAL_ID, &visual_id))
+          throw std::runtime_error("Error: eglGetConfigAttrib failed");
+
+        memset(&visual_template, 0, sizeof(visual_template));
+        visual_template.visualid = visual_id;
+        visinfo = XGetVisualInfo(m_display, VisualIDMask, &visual_template,
+                                 &n_visuals);
+
+        if (!visinfo || n_visuals < 1)
+          throw std::runtime_error("Error: couldn't get a visual for the EGL config");
+
+        createWindow(visinfo);
+        XFree(visinfo);
+
+        m_egl_surface = m_egl.CreateWindowSurface(m_egl_display, config,
+                                                  (EGLNativeWindowType) m_window,
+                                                  nullptr);
+
+        if (m_egl_surface == EGL_NO_SURFACE)
+          throw std::runtime_error("Error: eglCreateWindowSurface failed");
+
+        makeEGLCurrent(config);
+    }
+
+    /* Draw into a pbuffer on Mesa's surfaceless platform, which does
+     * not need a window system at all. This is only used when explicitly
+     * requested, for example to test llvmpipe on a headless machine. */
+    void initSurfacelessEGL() {
+        const char *client_extensions;
+        EGLDisplay display = EGL_NO_DISPLAY;
+        EGLConfig config;
+        EGLint n_configs = 0;
+        static const EGLint config_attribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 1,
+            EGL_GREEN_SIZE, 1,
+            EGL_BLUE_SIZE, 1,
+            EGL_NONE
+        };
+        static const EGLint pbuffer_attribs[] = {
+            EGL_WIDTH, WIDTH,
+            EGL_HEIGHT, HEIGHT,
+            EGL_NONE
+        };
+
+        load_egl(&m_egl);
+        client_extensions = m_egl.QueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+        if (client_extensions == nullptr
+            || strstr(client_extensions, "EGL_MESA_platform_surfaceless") == nullptr)
+          throw std::runtime_error("Error: EGL_MESA_platform_surfaceless not supported");
+
+        auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            m_egl.GetProcAddress("eglGetPlatformDisplayEXT"));
+
+        if (get_platform_display != nullptr)
+          display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                         EGL_DEFAULT_DISPLAY, nullptr);
+
+        initEGLDisplay(display);
+
+        if (!m_egl.ChooseConfig(m_egl_display, config_attribs, &config, 1,
+                                &n_configs)
+            || n_configs < 1)
+          throw std::runtime_error("Error: couldn't get an RGB pbuffer config");
+
+        m_egl_surface = m_egl.CreatePbufferSurface(m_egl_display, config,
+                                                   pbuffer_attribs);
+
+        if (m_egl_surface == EGL_NO_SURFACE)
+          throw std::runtime_error("Error: eglCreatePbufferSurface failed");
+
+        makeEGLCurrent(config);
+    }
+
+    const char *platformName() const {
+        /* Use the same names as waffle */
+        switch (m_platform) {
+          case Platform::EGL_X11:
+            return "x11_egl";
+          case Platform::SURFACELESS:
+            return "surfaceless_egl";
+          case Platform::GLX:
+          default:
+            return "glx";
+        }
+    }
+
+    /* Output the same information as `wflinfo --format=json`, in the
+     * same format, so that it can be parsed in the same way */
+    void printInfo() {
+        const char *vendor = reinterpret_cast<const char *>(glGetString(GL_VENDOR));
+        const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+        const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+        const char *glsl = reinterpret_cast<const char *>(glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+        if (renderer == nullptr || version == nullptr)
+          throw std::runtime_error("Error: unable to query GL renderer and version");
+
+        std::cout << "{" << std::endl
+                  << "\t\"waffle\": {" << std::endl
+                  << "\t\t\"platform\": \""
+                  << platformName()
+                  << "\"," << std::endl
+                  << "\t\t\"api\": \"gl\"" << std::endl
+                  << "\t}," << std::endl
+                  << "\t\"OpenGL\": {" << std::endl
+                  << "\t\t\"vendor string\": ";
+        print_json_string(std::cout, vendor);
+        std::cout << "," << std::endl
+                  << "\t\t\"renderer string\": ";
+        print_json_string(std::cout, renderer);
+        std::cout << "," << std::endl
+                  << "\t\t\"version string\": ";
+        print_json_string(std::cout, version);
+        std::cout << "," << std::endl
+                  << "\t\t\"shading language version string\": ";
+        print_json_string(std::cout, glsl);
+        std::cout << std::endl
+                  << "\t}" << std::endl
+                  << "}" << std::endl;
+        std::cout.flush();
+    }
+
+    /* With a pbuffer we can check that something was really drawn;
+     * with a window, it might not be mapped, so we can't */
+    void checkPixels() {
+        GLubyte pixel[4] = { 0, 0, 0, 0 };
+
+        if (m_platform != Platform::SURFACELESS)
+          return;
+
+        glFinish();
+        glReadPixels(WIDTH / 2, HEIGHT / 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                     pixel);
+
+        if (pixel[0] < 128 || pixel[1] >= 128 || pixel[2] >= 128)
+          throw std::runtime_error("Error: triangle was not drawn");
     }
 
     void drawTriangle()
@@ -102,9 +448,6 @@ private:
        int i = 0;
 
        int scrnum;
-       XSetWindowAttributes attr;
-       unsigned long mask;
-       Window root;
        XVisualInfo *visinfo;
 
        /* Singleton attributes. */
@@ -124,7 +467,6 @@ private:
        attribs[i++] = None;
 
        scrnum = DefaultScreen(m_display);
-       root = RootWindow(m_display, scrnum);
 
        visinfo = glXChooseVisual(m_display, scrnum, attribs);
        if (!visinfo)
@@ -133,6 +475,23 @@ private:
           exit(1);
         }
 
+       createWindow(visinfo);
+
+       m_context = glXCreateContext(m_display, visinfo, NULL, True );
+       if (!m_context)
+        {
+          throw std::runtime_error("Error: glXCreateContext failed");
+        }
+
+       XFree(visinfo);
+    }
+
+    void createWindow(XVisualInfo *visinfo)
+    {
+       XSetWindowAttributes attr;
+       unsigned long mask;
+       Window root = RootWindow(m_display, DefaultScreen(m_display));
+
        /* window attributes */
        attr.background_pixel = 0;
        attr.border_pixel = 0;
@@ -156,14 +515,6 @@ private:
             XSetStandardProperties(m_display, m_window, "check-gl", "check-gl",
                                     None, (char **)NULL, 0, &sizehints);
          }
-
-       m_context = glXCreateContext(m_display, visinfo, NULL, True );
-       if (!m_context)
-        {
-          throw std::runtime_error("Error: glXCreateContext failed");
-        }
-
-       XFree(visinfo);
     }
 
     void mainLoop() {
@@ -173,8 +524,19 @@ private:
     }
 
     void cleanup() {
+        if (m_egl_display != EGL_NO_DISPLAY) {
+          m_egl.MakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                            EGL_NO_CONTEXT);
+          if (m_egl_context != EGL_NO_CONTEXT)
+              m_egl.DestroyContext(m_egl_display, m_egl_context);
+          if (m_egl_surface != EGL_NO_SURFACE)
+              m_egl.DestroySurface(m_egl_display, m_egl_surface);
+          m_egl.Terminate(m_egl_display);
+        }
+
         if (m_display) {
-          glXMakeCurrent(m_display, None, nullptr);
+          if (m_context)
+              glXMakeCurrent(m_display, None, nullptr);
           if (m_context) {
               glXDestroyContext(m_display, m_context);
           }
@@ -188,19 +550,26 @@ private:
     void drawFrame() {
         drawTriangle();
 
-        glXSwapBuffers(m_display, m_window);
+        if (isEGL())
+          m_egl.SwapBuffers(m_egl_display, m_egl_surface);
+        else
+          glXSwapBuffers(m_display, m_window);
     }
 
 };
 
 enum {
     OPTION_HELP = 1,
+    OPTION_INFO,
+    OPTION_PLATFORM,
     OPTION_VERSION,
     OPTION_VISIBLE,
 };
 
 static struct option long_options[] = {
     { "help", no_argument, NULL, OPTION_HELP },
+    { "info", no_argument, NULL, OPTION_INFO },
+    { "platform", required_argument, NULL, OPTION_PLATFORM },
     { "version", no_argument, NULL, OPTION_VERSION },
     { "visible", no_argument, NULL, OPTION_VISIBLE },
     { NULL, 0, NULL, 0 }
@@ -213,6 +582,8 @@ static void usage(int code) {
     stream << "Usage: " << argv0 << " [OPTIONS]" << std::endl;
     stream << "Options:" << std::endl;
     stream << "--help\t\tShow this help and exit" << std::endl;
+    stream << "--info\t\tOutput renderer and version like wflinfo --format=json" << std::endl;
+    stream << "--platform=glx|egl|surfaceless\tDraw in an X11 window with GLX or EGL, or in an EGL pbuffer without a window system [glx]" << std::endl;
     stream << "--visible\tMake test window visible" << std::endl;
     stream << "--version\tShow version and exit" << std::endl;
     std::exit(code);
@@ -220,7 +591,9 @@ static void usage(int code) {
 
 int main(int argc, char** argv) {
     int opt;
+    bool info = false;
     bool visible = false;
+    Platform platform = Platform::GLX;
 
     argv0 = argv[0];
 
@@ -230,6 +603,23 @@ int main(int argc, char** argv) {
           usage(0);
           break;  // not reached
 
+        case OPTION_INFO:
+          info = true;
+          break;
+
+        case OPTION_PLATFORM:
+          if (strcmp(optarg, "glx") == 0) {
+            platform = Platform::GLX;
+          } else if (strcmp(optarg, "egl") == 0) {
+            platform = Platform::EGL_X11;
+          } else if (strcmp(optarg, "surfaceless") == 0) {
+            platform = Platform::SURFACELESS;
+          } else {
+            std::cerr << "Unknown platform: " << optarg << std::endl;
+            usage(2);
+          }
+          break;
+
         case OPTION_VERSION:
           /* Output version number as YAML for machine-readability,
            * inspired by `ostree --version` and `docker version` */
@@ -249,7 +639,7 @@ int main(int argc, char** argv) {
       }
     }
 
-    HelloTriangleGLApplication app(visible);
+    HelloTriangleGLApplication app(visible, info, platform);
 
     try {
         app.run();
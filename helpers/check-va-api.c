@@ -26,20 +26,32 @@
  */
 
 #include <assert.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include <va/va.h>
+#include <va/va_drm.h>
 #include <va/va_x11.h>
 
 enum
 {
   OPTION_HELP = 1,
+  OPTION_TIMEOUT,
+  OPTION_TOTAL_TIMEOUT,
   OPTION_VERBOSE,
   OPTION_VERSION,
 };
@@ -47,11 +59,16 @@ enum
 struct option long_options[] =
 {
   { "help", no_argument, NULL, OPTION_HELP },
+  { "timeout", required_argument, NULL, OPTION_TIMEOUT },
+  { "total-timeout", required_argument, NULL, OPTION_TOTAL_TIMEOUT },
   { "verbose", no_argument, NULL, OPTION_VERBOSE },
   { "version", no_argument, NULL, OPTION_VERSION },
   { NULL, 0, NULL, 0 }
 };
 
+/* The render node currently being tested, or NULL when using X11 */
+static const char *current_device = NULL;
+
 /* Pseudo-randomly generated MPEG2 video clip with one I-frame */
 static unsigned char clip_mpeg2[] =
 {
@@ -157,41 +174,154 @@ usage (int code)
 
   fprintf (fp, "Usage: %s [OPTIONS]\n",
            program_invocation_short_name);
+  fprintf (fp, "\n");
+  fprintf (fp, "Test each DRM render node in /dev/dri, or the X11 display\n"
+               "if no render node can be opened.\n");
+  fprintf (fp, "\n");
+  fprintf (fp, "  --timeout=SECONDS  Give up on a render node after this many\n"
+               "                     seconds [default: 3]\n");
+  fprintf (fp, "  --total-timeout=SECONDS\n"
+               "                     Give up on all remaining devices after\n"
+               "                     this many seconds [default: 8]\n");
+  fprintf (fp, "  --verbose          Print a JSON object on a line by itself\n"
+               "                     for each device tested\n");
   exit (code);
 }
 
+/*
+ * Print an error message to stderr, prefixed with the render node
+ * being tested, if any.
+ */
+static void __attribute__((__format__ (__printf__, 1, 2)))
+print_error (const char *format,
+             ...)
+{
+  va_list ap;
+
+  if (current_device != NULL)
+    fprintf (stderr, "%s: ", current_device);
+
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+}
+
+/*
+ * Print @str as a JSON string literal, or null if @str is %NULL.
+ */
+static void
+print_json_string (const char *str)
+{
+  if (str == NULL)
+    {
+      fputs ("null", stdout);
+      return;
+    }
+
+  putchar ('"');
+
+  for (; *str != '\0'; str++)
+    {
+      unsigned char c = *str;
+
+      if (c == '"' || c == '\\')
+        printf ("\\%c", c);
+      else if (c < 0x20)
+        printf ("\\u%04x", c);
+      else
+        putchar (c);
+    }
+
+  putchar ('"');
+}
+
+/*
+ * Print the result of testing @device (or the X11 display if %NULL)
+ * as a JSON object on a line by itself, so that a caller can see the
+ * result for each device even if it has to kill us part way through.
+ */
+static void
+print_record (const char *device,
+              const char *vendor,
+              const char *error)
+{
+  fputs ("{\"device\": ", stdout);
+  print_json_string (device);
+  printf (", \"can-draw\": %s", vendor != NULL ? "true" : "false");
+
+  if (vendor != NULL)
+    {
+      fputs (", \"vendor\": ", stdout);
+      print_json_string (vendor);
+    }
+
+  if (error != NULL)
+    {
+      fputs (", \"error\": ", stdout);
+      print_json_string (error);
+    }
+
+  fputs ("}\n", stdout);
+  fflush (stdout);
+}
+
+/*
+ * Returns: The number of whole seconds until @deadline, or 0 if it
+ *  has passed
+ */
+static unsigned int
+seconds_until (const struct timespec *deadline)
+{
+  struct timespec now;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &now) != 0
+      || now.tv_sec >= deadline->tv_sec)
+    return 0;
+
+  if (now.tv_nsec > deadline->tv_nsec)
+    return deadline->tv_sec - now.tv_sec - 1;
+
+  return deadline->tv_sec - now.tv_sec;
+}
+
 static bool
 _do_vaapi (const char *description,
            VAStatus va_status)
 {
   if (va_status != VA_STATUS_SUCCESS)
     {
-      fprintf (stderr, "%s failed: %s (%d)\n", description, vaErrorStr (va_status), va_status);
+      print_error ("%s failed: %s (%d)\n", description, vaErrorStr (va_status), va_status);
       return False;
     }
   return True;
 }
 
-int
-main (int argc,
-      char **argv)
+/*
+ * Exercise @va_display by creating surfaces and an image, then trying
+ * to decode a tiny clip or, failing that, to post-process a surface.
+ * On success, set @vendor_out to a copy of the vendor string.
+ *
+ * Returns: 0 on success, 1 on failure
+ */
+static int
+test_va_display (VADisplay va_display,
+                 char **vendor_out)
 {
 
 #define do_vaapi_or_exit(expr) if (! _do_vaapi (#expr, expr)) goto out;
 
-  bool verbose = false;
   bool decode_available = false;
-  int opt;
+  const char *vendor;
   int surfaces_count = 2;
   int ret = 1;
   int max_profiles;
   int num_profiles;
   int major_version;
   int minor_version;
-  unsigned int width = 1280;
-  unsigned int height = 720;
-  Display *display = NULL;
-  VADisplay va_display = NULL;
+  /* The surfaces are only used to check that the driver works, so
+   * keep them small: the decode test clips are smaller still */
+  unsigned int width = 256;
+  unsigned int height = 256;
   VASurfaceAttrib attr;
   VAImage img;
   VASurfaceID *surfaces = NULL;
@@ -211,35 +341,6 @@ main (int argc,
   VARectangle input_region;
   VARectangle output_region;
 
-  while ((opt = getopt_long (argc, argv, "", long_options, NULL)) != -1)
-    {
-      switch (opt)
-        {
-          case OPTION_HELP:
-            usage (0);
-            break;
-
-          case OPTION_VERBOSE:
-            verbose = true;
-            break;
-
-          case OPTION_VERSION:
-            /* Output version number as YAML for machine-readability,
-             * inspired by `ostree --version` and `docker version` */
-            printf (
-                "%s:\n"
-                " Package: steam-runtime-tools\n"
-                " Version: %s\n",
-                argv[0], VERSION);
-            return 0;
-
-          case '?':
-          default:
-            usage (1);
-            break;  /* not reached */
-        }
-    }
-
   img.image_id = VA_INVALID_ID;
 
   attr.type = VASurfaceAttribPixelFormat;
@@ -264,48 +365,29 @@ main (int argc,
   output_region.width = width - 30;
   output_region.height = height - 30;
 
-  display = XOpenDisplay (NULL);
-  if (!display)
-    {
-      fprintf (stderr, "An error occurred trying to open a connection to the X server\n");
-      return 1;
-    }
-
-  va_display = vaGetDisplay (display);
-  if (!va_display)
-    {
-      fprintf (stderr, "An error occurred trying to get a suitable VADisplay for VA-API\n");
-      goto out;
-    }
-
   do_vaapi_or_exit (vaInitialize (va_display, &major_version, &minor_version));
 
-  if (verbose)
-    printf ("%s\n", vaQueryVendorString (va_display));
-
   /* Test the ability to get the supported profiles and that they are not more than
    * the maximum number from the implementation */
   max_profiles = vaMaxNumProfiles (va_display);
   if (max_profiles < 1)
     {
-      fprintf (stderr,
-               "vaMaxNumProfiles failed: unexpected number of maximum profiles (%i)\n", max_profiles);
+      print_error ("vaMaxNumProfiles failed: unexpected number of maximum profiles (%i)\n", max_profiles);
       goto out;
     }
   profiles = calloc (max_profiles, sizeof (VAProfile));
 
   if (profiles == NULL)
     {
-      fprintf (stderr, "Out of memory\n");
+      print_error ("Out of memory\n");
       goto out;
     }
 
   do_vaapi_or_exit (vaQueryConfigProfiles (va_display, profiles, &num_profiles));
   if (num_profiles > max_profiles)
     {
-      fprintf (stderr,
-               "vaQueryConfigProfiles failed: the number of profiles (%i) exceed the maximum (%i)\n",
-               num_profiles, max_profiles);
+      print_error ("vaQueryConfigProfiles failed: the number of profiles (%i) exceed the maximum (%i)\n",
+                   num_profiles, max_profiles);
       goto out;
     }
 
@@ -313,7 +395,7 @@ main (int argc,
 
   if (surfaces == NULL)
     {
-      fprintf (stderr, "Out of memory\n");
+      print_error ("Out of memory\n");
       goto out;
     }
 
@@ -460,6 +542,12 @@ main (int argc,
       do_vaapi_or_exit (vaSyncSurface (va_display, surfaces[1]));
     }
 
+  vendor = vaQueryVendorString (va_display);
+  *vendor_out = strdup (vendor != NULL ? vendor : "");
+
+  if (*vendor_out == NULL)
+    goto out;
+
   ret = 0;
 
 out:
@@ -488,11 +576,319 @@ out:
 
       vaTerminate (va_display);
     }
-  if (display)
-    XCloseDisplay (display);
 
   free (profiles);
   free (surfaces);
 
   return ret;
 }
+
+/*
+ * Test the render node @path in a subprocess, so that a driver that
+ * hangs or crashes only costs us that node. Give up after @timeout
+ * seconds.
+ *
+ * Returns: 0 if the node works, 1 if it does not, or -1 if it could
+ *  not be opened at all
+ */
+static int
+test_render_node (const char *path,
+                  unsigned int timeout,
+                  bool verbose)
+{
+  char error[256];
+  int fd;
+  int wait_status;
+  pid_t pid;
+
+  fd = open (path, O_RDWR | O_CLOEXEC);
+
+  if (fd < 0)
+    {
+      snprintf (error, sizeof (error), "Unable to open: %s", strerror (errno));
+      fprintf (stderr, "%s: %s\n", path, error);
+
+      if (verbose)
+        print_record (path, NULL, error);
+
+      return -1;
+    }
+
+  /* Don't let the child repeat anything that is still buffered */
+  fflush (stdout);
+  fflush (stderr);
+
+  pid = fork ();
+
+  if (pid < 0)
+    {
+      snprintf (error, sizeof (error), "Unable to fork: %s", strerror (errno));
+      fprintf (stderr, "%s: %s\n", path, error);
+      close (fd);
+
+      if (verbose)
+        print_record (path, NULL, error);
+
+      return 1;
+    }
+
+  if (pid == 0)
+    {
+      VADisplay va_display;
+      char *vendor = NULL;
+      int ret;
+
+      /* The default action for SIGALRM terminates the process */
+      alarm (timeout);
+      current_device = path;
+      va_display = vaGetDisplayDRM (fd);
+
+      if (!va_display)
+        {
+          print_error ("An error occurred trying to get a suitable VADisplay for VA-API\n");
+          exit (1);
+        }
+
+      ret = test_va_display (va_display, &vendor);
+
+      /* If it worked, the child reports it; otherwise the parent does,
+       * so that there is exactly one record per node */
+      if (ret == 0 && verbose)
+        print_record (path, vendor, NULL);
+
+      free (vendor);
+      exit (ret);
+    }
+
+  close (fd);
+
+  while (waitpid (pid, &wait_status, 0) < 0)
+    {
+      if (errno != EINTR)
+        {
+          snprintf (error, sizeof (error),
+                    "Unable to wait for subprocess: %s", strerror (errno));
+          fprintf (stderr, "%s: %s\n", path, error);
+
+          if (verbose)
+            print_record (path, NULL, error);
+
+          return 1;
+        }
+    }
+
+  if (WIFEXITED (wait_status) && WEXITSTATUS (wait_status) == 0)
+    return 0;
+
+  if (WIFEXITED (wait_status))
+    {
+      snprintf (error, sizeof (error), "Failed with exit status %d",
+                WEXITSTATUS (wait_status));
+    }
+  else if (WIFSIGNALED (wait_status) && WTERMSIG (wait_status) == SIGALRM)
+    {
+      snprintf (error, sizeof (error), "Timed out after %u seconds", timeout);
+      fprintf (stderr, "%s: %s\n", path, error);
+    }
+  else if (WIFSIGNALED (wait_status))
+    {
+      snprintf (error, sizeof (error), "Killed by signal %d (%s)",
+                WTERMSIG (wait_status), strsignal (WTERMSIG (wait_status)));
+      fprintf (stderr, "%s: %s\n", path, error);
+    }
+  else
+    {
+      snprintf (error, sizeof (error), "Unknown wait status 0x%x",
+                wait_status);
+    }
+
+  if (verbose)
+    print_record (path, NULL, error);
+
+  return 1;
+}
+
+static int
+test_x11 (unsigned int timeout,
+          bool verbose)
+{
+  Display *display = NULL;
+  VADisplay va_display = NULL;
+  char *vendor = NULL;
+  const char *error = NULL;
+  int ret = 1;
+
+  /* This is not in a subprocess, so if it takes too long, the whole
+   * process is terminated by SIGALRM */
+  alarm (timeout);
+
+  display = XOpenDisplay (NULL);
+  if (!display)
+    {
+      error = "An error occurred trying to open a connection to the X server";
+      fprintf (stderr, "%s\n", error);
+      goto out;
+    }
+
+  va_display = vaGetDisplay (display);
+  if (!va_display)
+    {
+      error = "An error occurred trying to get a suitable VADisplay for VA-API";
+      fprintf (stderr, "%s\n", error);
+      goto out;
+    }
+
+  ret = test_va_display (va_display, &vendor);
+
+  if (ret != 0)
+    error = "Failed";
+
+out:
+  if (verbose)
+    print_record (NULL, vendor, error);
+
+  if (display != NULL)
+    XCloseDisplay (display);
+
+  free (vendor);
+  return ret;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  bool verbose = false;
+  bool have_node = false;
+  bool have_success = false;
+  char *endptr;
+  glob_t nodes = {};
+  int opt;
+  size_t i;
+  struct timespec deadline;
+  unsigned int remaining;
+  unsigned long timeout = 3;
+  unsigned long total_timeout = 8;
+
+  while ((opt = getopt_long (argc, argv, "", long_options, NULL)) != -1)
+    {
+      switch (opt)
+        {
+          case OPTION_HELP:
+            usage (0);
+            break;
+
+          case OPTION_TIMEOUT:
+            errno = 0;
+            timeout = strtoul (optarg, &endptr, 10);
+
+            if (errno != 0 || endptr == optarg || *endptr != '\0'
+                || timeout == 0 || timeout > 3600)
+              {
+                fprintf (stderr, "Invalid --timeout: %s\n", optarg);
+                usage (1);
+              }
+            break;
+
+          case OPTION_TOTAL_TIMEOUT:
+            errno = 0;
+            total_timeout = strtoul (optarg, &endptr, 10);
+
+            if (errno != 0 || endptr == optarg || *endptr != '\0'
+                || total_timeout == 0 || total_timeout > 3600)
+              {
+                fprintf (stderr, "Invalid --total-timeout: %s\n", optarg);
+                usage (1);
+              }
+            break;
+
+          case OPTION_VERBOSE:
+            verbose = true;
+            break;
+
+          case OPTION_VERSION:
+            /* Output version number as YAML for machine-readability,
+             * inspired by `ostree --version` and `docker version` */
+            printf (
+                "%s:\n"
+                " Package: steam-runtime-tools\n"
+                " Version: %s\n",
+                argv[0], VERSION);
+            return 0;
+
+          case '?':
+          default:
+            usage (1);
+            break;  /* not reached */
+        }
+    }
+
+  /* steam-runtime-tools gives up on us after 10 seconds, so by default
+   * stop testing new devices before then, and make sure the last one
+   * cannot take us past that point, so that we can still report the
+   * devices that we did test */
+  if (clock_gettime (CLOCK_MONOTONIC, &deadline) != 0)
+    {
+      fprintf (stderr, "Unable to read monotonic clock: %s\n",
+               strerror (errno));
+      return 1;
+    }
+
+  deadline.tv_sec += total_timeout;
+
+  /* Each render node represents one GPU, and can be used without a
+   * display server, so prefer those */
+  if (glob ("/dev/dri/renderD*", 0, NULL, &nodes) == 0)
+    {
+      for (i = 0; i < nodes.gl_pathc; i++)
+        {
+          int result;
+
+          remaining = seconds_until (&deadline);
+
+          if (remaining == 0)
+            {
+              fprintf (stderr, "%s: Not tested: ran out of time\n",
+                       nodes.gl_pathv[i]);
+
+              if (verbose)
+                print_record (nodes.gl_pathv[i], NULL,
+                              "Not tested: ran out of time");
+
+              have_node = true;
+              continue;
+            }
+
+          result = test_render_node (nodes.gl_pathv[i],
+                                     MIN (timeout, remaining),
+                                     verbose);
+
+          if (result >= 0)
+            have_node = true;
+
+          if (result == 0)
+            have_success = true;
+        }
+    }
+
+  globfree (&nodes);
+
+  if (have_node)
+    return have_success ? 0 : 1;
+
+  remaining = seconds_until (&deadline);
+
+  if (remaining == 0)
+    {
+      fprintf (stderr, "X11 not tested: ran out of time\n");
+
+      if (verbose)
+        print_record (NULL, NULL, "Not tested: ran out of time");
+
+      return 1;
+    }
+
+  /* No usable render node (perhaps /dev/dri is not shared with us),
+   * so fall back to going via the X server */
+  return test_x11 (MIN (timeout, remaining), verbose);
+}
@@ -36,19 +36,119 @@
 #include <steam-runtime-tools/json-glib-backports-internal.h>
 #include <steam-runtime-tools/utils-internal.h>
 
-#if !GLIB_CHECK_VERSION(2, 43, 4)
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(GDBusProxy, g_object_unref)
-#endif
-
 static gboolean opt_print_version = FALSE;
+static gdouble opt_timeout = 5.0;
 
 static const GOptionEntry option_entries[] =
 {
+  { "timeout", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE, &opt_timeout,
+    "Stop waiting for replies after this many seconds [default: 5]",
+    "SECONDS" },
   { "version", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_print_version,
     "Print version number and exit", NULL },
   { NULL }
 };
 
+static const gchar * const portal_interface_name[] = {
+  "org.freedesktop.portal.OpenURI",
+  "org.freedesktop.portal.Email",
+  NULL,
+};
+
+static const gchar * const portal_impl_name[] = {
+  "org.freedesktop.impl.portal.desktop.gtk",
+  "org.freedesktop.impl.portal.desktop.kde",
+  NULL,
+};
+
+typedef struct _QueryContext QueryContext;
+
+/*
+ * PortalQuery:
+ * @name: The portal interface, or the bus name of the backend
+ * @context: The context that is waiting for this query
+ * @available: %TRUE if the query succeeded
+ * @version: The interface version, if @name is a portal interface
+ * @error: The reason why the query failed
+ */
+typedef struct
+{
+  const gchar *name;
+  QueryContext *context;
+  gboolean available;
+  guint32 version;
+  GError *error;
+} PortalQuery;
+
+/*
+ * QueryContext:
+ * @cancellable: Cancelled when the deadline is reached
+ * @pending: Number of queries that have not completed yet
+ * @timed_out: %TRUE if the deadline was reached
+ */
+struct _QueryContext
+{
+  GCancellable *cancellable;
+  guint pending;
+  gboolean timed_out;
+};
+
+static gboolean
+deadline_cb (gpointer user_data)
+{
+  QueryContext *context = user_data;
+
+  context->timed_out = TRUE;
+  g_cancellable_cancel (context->cancellable);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+interface_version_cb (GObject *source_object,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+  PortalQuery *query = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GVariant) variant_version = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                         result, &query->error);
+
+  if (reply != NULL)
+    {
+      g_variant_get (reply, "(v)", &variant_version);
+
+      if (g_variant_classify (variant_version) == G_VARIANT_CLASS_UINT32)
+        {
+          query->available = TRUE;
+          query->version = g_variant_get_uint32 (variant_version);
+        }
+      else
+        {
+          g_set_error (&query->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "The 'version' property has unexpected type '%s'",
+                       g_variant_get_type_string (variant_version));
+        }
+    }
+
+  query->context->pending--;
+}
+
+static void
+backend_ping_cb (GObject *source_object,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+  PortalQuery *query = user_data;
+  g_autoptr(GVariant) reply = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                         result, &query->error);
+  query->available = (reply != NULL);
+  query->context->pending--;
+}
+
 int
 main (int argc,
       char **argv)
@@ -59,27 +159,18 @@ main (int argc,
   g_autoptr(JsonBuilder) builder = NULL;
   g_autoptr(JsonGenerator) generator = NULL;
   g_autoptr(GDBusConnection) connection = NULL;
-  g_autoptr(GVariant) variant_version = NULL;
   g_autoptr(GError) local_error = NULL;
   g_autoptr(GOptionContext) option_context = NULL;
-  guint32 version;
+  PortalQuery interface_queries[G_N_ELEMENTS (portal_interface_name)] = {};
+  PortalQuery impl_queries[G_N_ELEMENTS (portal_impl_name)] = {};
+  QueryContext context = {};
   GError **error = &local_error;
+  gboolean check_backends;
   gboolean impl_available = FALSE;
+  guint deadline_id;
   int ret = EXIT_SUCCESS;
   gsize i;
 
-  static const gchar * const portal_interface_name[] = {
-    "org.freedesktop.portal.OpenURI",
-    "org.freedesktop.portal.Email",
-    NULL,
-  };
-
-  static const gchar * const portal_impl_name[] = {
-    "org.freedesktop.impl.portal.desktop.gtk",
-    "org.freedesktop.impl.portal.desktop.kde",
-    NULL,
-  };
-
   option_context = g_option_context_new ("");
   g_option_context_add_main_entries (option_context, option_entries, NULL);
 
@@ -108,9 +199,6 @@ main (int argc,
       return EXIT_FAILURE;
     }
 
-  builder = json_builder_new ();
-  json_builder_begin_object (builder);
-
   connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
   if (connection == NULL)
     {
@@ -118,114 +206,132 @@ main (int argc,
       return EXIT_FAILURE;
     }
 
+  /* If we are in a Flatpak container we are not allowed to contact the
+   * portals implementations. So we just skip this test */
+  check_backends = !g_file_test ("/.flatpak-info", G_FILE_TEST_IS_REGULAR);
+
+  /* Send all the queries before waiting for any replies, so that a
+   * portal or backend that is slow to be activated does not hold up
+   * the others */
+  context.cancellable = g_cancellable_new ();
+
+  for (i = 0; portal_interface_name[i] != NULL; i++)
+    {
+      PortalQuery *query = &interface_queries[i];
+
+      query->name = portal_interface_name[i];
+      query->context = &context;
+      context.pending++;
+      g_dbus_connection_call (connection,
+                              "org.freedesktop.portal.Desktop",
+                              "/org/freedesktop/portal/desktop",
+                              "org.freedesktop.DBus.Properties",
+                              "Get",
+                              g_variant_new ("(ss)", query->name, "version"),
+                              G_VARIANT_TYPE ("(v)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,
+                              context.cancellable,
+                              interface_version_cb,
+                              query);
+    }
+
+  /* Only check whether each backend is already running: activating it
+   * as a side-effect of the check would be slow, and would change what
+   * we are measuring */
+  for (i = 0; check_backends && portal_impl_name[i] != NULL; i++)
+    {
+      PortalQuery *query = &impl_queries[i];
+
+      query->name = portal_impl_name[i];
+      query->context = &context;
+      context.pending++;
+      g_dbus_connection_call (connection,
+                              query->name,
+                              "/org/freedesktop/portal/desktop",
+                              "org.freedesktop.DBus.Peer",
+                              "Ping",
+                              NULL,
+                              G_VARIANT_TYPE_UNIT,
+                              G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                              -1,
+                              context.cancellable,
+                              backend_ping_cb,
+                              query);
+    }
+
+  deadline_id = g_timeout_add ((guint) (MAX (opt_timeout, 0.0) * 1000),
+                               deadline_cb,
+                               &context);
+
+  while (context.pending > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!context.timed_out)
+    g_source_remove (deadline_id);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
   json_builder_set_member_name (builder, "interfaces");
   json_builder_begin_object (builder);
   for (i = 0; portal_interface_name[i] != NULL; i++)
     {
-      g_autoptr(GDBusProxy) portal_proxy = NULL;
-      g_autofree gchar *name_owner = NULL;
-      portal_proxy = g_dbus_proxy_new_sync (connection,
-                                            G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
-                                            NULL,
-                                            "org.freedesktop.portal.Desktop",
-                                            "/org/freedesktop/portal/desktop",
-                                            portal_interface_name[i],
-                                            NULL,
-                                            error);
-
-      json_builder_set_member_name (builder, portal_interface_name[i]);
+      PortalQuery *query = &interface_queries[i];
+
+      json_builder_set_member_name (builder, query->name);
       json_builder_begin_object (builder);
       json_builder_set_member_name (builder, "available");
 
-      if (portal_proxy == NULL)
-        {
-          g_printerr ("Failed to contact 'org.freedesktop.portal.Desktop': %s\n",
-                      local_error->message);
-          json_builder_add_boolean_value (builder, FALSE);
-          json_builder_end_object (builder);
-          ret = EXIT_FAILURE;
-          continue;
-        }
-
-      name_owner = g_dbus_proxy_get_name_owner (portal_proxy);
-      if (name_owner == NULL)
+      if (query->available)
         {
-          g_printerr ("Failed to connect to 'org.freedesktop.portal.Desktop'\n");
-          json_builder_add_boolean_value (builder, FALSE);
-          json_builder_end_object (builder);
-          ret = EXIT_FAILURE;
-          continue;
+          json_builder_add_boolean_value (builder, TRUE);
+          json_builder_set_member_name (builder, "version");
+          json_builder_add_int_value (builder, query->version);
         }
-
-      variant_version = g_dbus_proxy_get_cached_property (portal_proxy, "version");
-
-      if (variant_version == NULL
-          || g_variant_classify (variant_version) != G_VARIANT_CLASS_UINT32)
+      else
         {
-          g_printerr ("The 'version' property is not available for '%s', "
-                      "either there isn't a working xdg-desktop-portal or "
-                      "it is a very old version\n", portal_interface_name[i]);
+          if (context.timed_out
+              && g_error_matches (query->error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr ("Timed out waiting for the 'version' property of "
+                        "'%s'\n", query->name);
+          else
+            g_printerr ("The 'version' property is not available for '%s', "
+                        "either there isn't a working xdg-desktop-portal or "
+                        "it is a very old version: %s\n", query->name,
+                        query->error->message);
 
           json_builder_add_boolean_value (builder, FALSE);
           ret = EXIT_FAILURE;
         }
-      else
-        {
-          json_builder_add_boolean_value (builder, TRUE);
-          json_builder_set_member_name (builder, "version");
-          version = g_variant_get_uint32 (variant_version);
-          json_builder_add_int_value (builder, version);
-        }
+
       json_builder_end_object (builder);
     }
   json_builder_end_object (builder);
 
-  /* If we are in a Flatpak container we are not allowed to contact the
-   * portals implementations. So we just skip this test */
-  if (!g_file_test ("/.flatpak-info", G_FILE_TEST_IS_REGULAR))
+  if (check_backends)
     {
       json_builder_set_member_name (builder, "backends");
       json_builder_begin_object (builder);
       for (i = 0; portal_impl_name[i] != NULL; i++)
         {
-          g_autoptr(GDBusProxy) portal_impl_proxy = NULL;
-          g_autofree gchar *impl_name_owner = NULL;
-          portal_impl_proxy = g_dbus_proxy_new_sync (connection,
-                                                     (G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-                                                      G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS),
-                                                     NULL,
-                                                     portal_impl_name[i],
-                                                     "/org/freedesktop/portal/desktop",
-                                                     "org.freedesktop.DBus.Peer",
-                                                     NULL,
-                                                     error);
-
-          json_builder_set_member_name (builder, portal_impl_name[i]);
+          PortalQuery *query = &impl_queries[i];
+
+          json_builder_set_member_name (builder, query->name);
           json_builder_begin_object (builder);
           json_builder_set_member_name (builder, "available");
 
-          if (portal_impl_proxy == NULL)
+          if (query->available)
             {
-              g_debug ("Failed to contact '%s': %s\n",
-                       portal_impl_name[i], local_error->message);
-              g_clear_error (error);
-              json_builder_add_boolean_value (builder, FALSE);
-              json_builder_end_object (builder);
-              continue;
-            }
-
-          impl_name_owner = g_dbus_proxy_get_name_owner (portal_impl_proxy);
-          if (impl_name_owner == NULL)
-            {
-              g_debug ("Failed to connect to '%s'\n", portal_impl_name[i]);
-              json_builder_add_boolean_value (builder, FALSE);
+              impl_available = TRUE;
             }
           else
             {
-              impl_available = TRUE;
-              json_builder_add_boolean_value (builder, TRUE);
+              g_debug ("Failed to contact '%s': %s",
+                       query->name, query->error->message);
             }
 
+          json_builder_add_boolean_value (builder, query->available);
           json_builder_end_object (builder);
         }
       json_builder_end_object (builder);
@@ -251,5 +357,12 @@ main (int argc,
   if (fputs ("\n", original_stdout) < 0)
     g_warning ("Unable to write final newline: %s", g_strerror (errno));
 
+  for (i = 0; i < G_N_ELEMENTS (interface_queries); i++)
+    g_clear_error (&interface_queries[i].error);
+
+  for (i = 0; i < G_N_ELEMENTS (impl_queries); i++)
+    g_clear_error (&impl_queries[i].error);
+
+  g_clear_object (&context.cancellable);
   return ret;
 }
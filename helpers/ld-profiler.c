@@ -0,0 +1,356 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * An LD_AUDIT module that records how the dynamic linker finds and
+ * loads each library, for diagnosing slow startup.
+ *
+ * If $PRESSURE_VESSEL_LD_PROFILE_DIR is set to a directory, each process
+ * writes a trace to a new file in it, with a name that starts with
+ * "ld-profile.". Otherwise this module does nothing.
+ * See pressure-vessel-ld-profile-report(1) for how to summarize the traces.
+ *
+ * Audit modules are loaded into their own link-map namespace early
+ * during startup, so this only uses libc.
+ *
+ * The trace is text, one event per line, with tab-separated fields.
+ * Times are in microseconds since the module was initialized.
+ *
+ *    V <version>                 Format version, always first
+ *    P <pid> <ppid> <executable> The process being traced
+ *    A <time>                    The dynamic linker starts adding objects
+ *                                (at startup or during dlopen())
+ *    Q <time> <name>             Start searching for <name>
+ *    C <time> <source> <path>    Try <path>, found via <source>
+ *    O <time> <lmid> <path>      Loaded <path>
+ *    Z <time>                    The dynamic linker has finished adding
+ *                                objects
+ *
+ * <source> is one of runpath (DT_RPATH or DT_RUNPATH), libpath
+ * (LD_LIBRARY_PATH), config (ld.so.cache), default or secure.
+ * A search that is not followed by an O line before the next Q or Z
+ * line, or the end of the trace, did not find anything. For dlopen(),
+ * the Q line for the requested library comes before the A line.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_FORMAT_VERSION 1
+#define BUFFER_SIZE (16 * 1024)
+
+static int trace_fd = -1;
+static pid_t trace_pid = 0;
+static uint64_t start_time = 0;
+static char buffer[BUFFER_SIZE];
+static size_t buffer_len = 0;
+/* Nonzero between LA_ACT_ADD and the next LA_ACT_CONSISTENT */
+static int adding = 0;
+
+static uint64_t
+now_usec (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+
+  return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+flush_trace (void)
+{
+  size_t done = 0;
+
+  while (trace_fd >= 0 && done < buffer_len)
+    {
+      ssize_t res = write (trace_fd, buffer + done, buffer_len - done);
+
+      if (res < 0 && errno == EINTR)
+        continue;
+
+      if (res <= 0)
+        {
+          /* Give up on tracing rather than affecting the program */
+          close (trace_fd);
+          trace_fd = -1;
+          break;
+        }
+
+      done += res;
+    }
+
+  buffer_len = 0;
+}
+
+static void
+append_trace (const char *format,
+              ...) __attribute__((format(printf, 1, 2)));
+
+static void
+append_trace (const char *format,
+              ...)
+{
+  va_list ap;
+  int len;
+
+  if (trace_fd < 0)
+    return;
+
+  va_start (ap, format);
+  len = vsnprintf (buffer + buffer_len, sizeof (buffer) - buffer_len,
+                   format, ap);
+  va_end (ap);
+
+  if (len < 0)
+    return;
+
+  if ((size_t) len >= sizeof (buffer) - buffer_len)
+    {
+      /* Didn't fit: flush what we had and try again */
+      flush_trace ();
+
+      va_start (ap, format);
+      len = vsnprintf (buffer, sizeof (buffer), format, ap);
+      va_end (ap);
+
+      /* Anything that still doesn't fit is dropped */
+      if (len < 0 || (size_t) len >= sizeof (buffer))
+        return;
+    }
+
+  buffer_len += len;
+}
+
+static int
+open_trace (void)
+{
+  const char *dir = getenv ("PRESSURE_VESSEL_LD_PROFILE_DIR");
+  char exe[PATH_MAX];
+  char path[PATH_MAX];
+  ssize_t exe_len;
+  unsigned int i;
+
+  if (dir == NULL || dir[0] != '/')
+    return -1;
+
+  trace_pid = getpid ();
+
+  /* The same process ID can be traced more than once if it calls
+   * execve(), so don't overwrite an earlier trace */
+  for (i = 0; i < 1000; i++)
+    {
+      int fd;
+
+      if (i == 0)
+        snprintf (path, sizeof (path), "%s/ld-profile.%ld.txt",
+                  dir, (long) trace_pid);
+      else
+        snprintf (path, sizeof (path), "%s/ld-profile.%ld.%u.txt",
+                  dir, (long) trace_pid, i);
+
+      fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_NOCTTY,
+                 0644);
+
+      if (fd >= 0)
+        {
+          trace_fd = fd;
+          break;
+        }
+
+      if (errno != EEXIST)
+        return -1;
+    }
+
+  if (trace_fd < 0)
+    return -1;
+
+  exe_len = readlink ("/proc/self/exe", exe, sizeof (exe) - 1);
+
+  if (exe_len < 0)
+    exe_len = 0;
+
+  exe[exe_len] = '\0';
+
+  buffer_len = 0;
+  start_time = now_usec ();
+  append_trace ("V\t%d\n", TRACE_FORMAT_VERSION);
+  append_trace ("P\t%ld\t%ld\t%s\n",
+                (long) trace_pid, (long) getppid (), exe);
+  return trace_fd;
+}
+
+/*
+ * After fork(), the child must not write to the parent's trace,
+ * and must not write out events that the parent had buffered.
+ * If @reopen is false, only start a new trace for the child when it
+ * does something more interesting: most children call execve()
+ * without loading anything first, and the new program image will
+ * start its own trace.
+ */
+static void
+check_fork (int reopen)
+{
+  if (trace_pid == 0 || getpid () == trace_pid)
+    return;
+
+  if (trace_fd >= 0)
+    {
+      close (trace_fd);
+      trace_fd = -1;
+    }
+
+  buffer_len = 0;
+  adding = 0;
+
+  if (reopen)
+    open_trace ();
+}
+
+static unsigned long long
+elapsed (void)
+{
+  return (unsigned long long) (now_usec () - start_time);
+}
+
+__attribute__((visibility("default"))) unsigned int
+la_version (unsigned int version)
+{
+  if (open_trace () < 0)
+    return 0;
+
+  if (version < LAV_CURRENT)
+    return version;
+
+  return LAV_CURRENT;
+}
+
+__attribute__((visibility("default"))) void
+la_activity (uintptr_t *cookie,
+             unsigned int flag)
+{
+  check_fork (flag == LA_ACT_ADD);
+
+  switch (flag)
+    {
+      case LA_ACT_ADD:
+        append_trace ("A\t%llu\n", elapsed ());
+        adding = 1;
+        break;
+
+      case LA_ACT_CONSISTENT:
+        /* Ignore the end of dlclose() */
+        if (adding)
+          {
+            append_trace ("Z\t%llu\n", elapsed ());
+            adding = 0;
+          }
+
+        /* Write out each batch as it completes, in case the process
+         * calls execve() or crashes */
+        flush_trace ();
+        break;
+
+      case LA_ACT_DELETE:
+      default:
+        break;
+    }
+}
+
+__attribute__((visibility("default"))) char *
+la_objsearch (const char *name,
+              uintptr_t *cookie,
+              unsigned int flag)
+{
+  const char *source;
+
+  check_fork (1);
+
+  switch (flag)
+    {
+      case LA_SER_ORIG:
+        append_trace ("Q\t%llu\t%s\n", elapsed (), name);
+        return (char *) name;
+
+      case LA_SER_RUNPATH:
+        source = "runpath";
+        break;
+
+      case LA_SER_LIBPATH:
+        source = "libpath";
+        break;
+
+      case LA_SER_CONFIG:
+        source = "config";
+        break;
+
+      case LA_SER_DEFAULT:
+        source = "default";
+        break;
+
+      case LA_SER_SECURE:
+        source = "secure";
+        break;
+
+      default:
+        source = "unknown";
+        break;
+    }
+
+  append_trace ("C\t%llu\t%s\t%s\n", elapsed (), source, name);
+  return (char *) name;
+}
+
+__attribute__((visibility("default"))) unsigned int
+la_objopen (struct link_map *map,
+            Lmid_t lmid,
+            uintptr_t *cookie)
+{
+  check_fork (1);
+
+  /* The main program has an empty name */
+  if (map->l_name != NULL && map->l_name[0] != '\0')
+    append_trace ("O\t%llu\t%ld\t%s\n", elapsed (), (long) lmid, map->l_name);
+
+  /* We don't need la_symbind*() */
+  return 0;
+}
+
+__attribute__((destructor)) static void
+ld_profiler_finish (void)
+{
+  check_fork (0);
+  flush_trace ();
+}
@@ -26,10 +26,16 @@
 
 #include <fcntl.h>
 #include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sysexits.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -52,10 +58,12 @@ static const char * const *global_original_environ = NULL;
 static GPtrArray *global_locks = NULL;
 static GPtrArray *global_ld_so_conf_entries = NULL;
 static GArray *global_pass_fds = NULL;
+static gboolean opt_background_cleanup = FALSE;
 static gboolean opt_batch = FALSE;
 static gboolean opt_create = FALSE;
 static gboolean opt_exit_with_parent = FALSE;
 static gboolean opt_generate_locales = FALSE;
+static int opt_record_mapped_files_fd = -1;
 static gchar *opt_regenerate_ld_so_cache = NULL;
 static gchar *opt_set_ld_library_path = NULL;
 static PvShell opt_shell = PV_SHELL_NONE;
@@ -149,6 +157,82 @@ lib_temp_dirs_free (LibTempDirs *lib_temp_dirs)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (LibTempDirs, lib_temp_dirs_free)
 
+/* From linux/ioprio.h, which is not always available */
+#define ADVERB_IOPRIO_WHO_PROCESS 1
+#define ADVERB_IOPRIO_CLASS_IDLE 3
+#define ADVERB_IOPRIO_CLASS_SHIFT 13
+
+/* Runs in the child process after fork(), so this must only call
+ * async-signal-safe functions */
+static void
+background_cleanup_child_setup_cb (gpointer user_data)
+{
+  setsid ();
+  setpriority (PRIO_PROCESS, 0, 19);
+  syscall (SYS_ioprio_set, ADVERB_IOPRIO_WHO_PROCESS, 0,
+           ADVERB_IOPRIO_CLASS_IDLE << ADVERB_IOPRIO_CLASS_SHIFT);
+
+  /* Don't hold any locks or other fds open: stdin, stdout and stderr
+   * are already /dev/null */
+  flatpak_close_fds_workaround (3);
+}
+
+/*
+ * remove_temp_dirs:
+ * @paths: (element-type filename): Temporary directories to delete
+ *
+ * Delete @paths. With --background-cleanup, do this in a detached,
+ * low-priority process, so that our caller does not have to wait for
+ * it before it sees our exit status.
+ */
+static void
+remove_temp_dirs (GPtrArray *paths)
+{
+  gsize i;
+
+  if (paths->len == 0)
+    return;
+
+  if (opt_background_cleanup)
+    {
+      g_autoptr(GPtrArray) argv = g_ptr_array_new ();
+      g_autoptr(GError) local_error = NULL;
+
+      g_ptr_array_add (argv, (char *) "/bin/sh");
+      g_ptr_array_add (argv, (char *) "-c");
+      g_ptr_array_add (argv, (char *) "exec rm -fr -- \"$@\"");
+      g_ptr_array_add (argv, (char *) "sh");
+
+      for (i = 0; i < paths->len; i++)
+        g_ptr_array_add (argv, g_ptr_array_index (paths, i));
+
+      g_ptr_array_add (argv, NULL);
+
+      /* Without G_SPAWN_DO_NOT_REAP_CHILD, GLib uses an intermediate
+       * process, so the shell is not our child and will not be waited
+       * for. We use LEAVE_DESCRIPTORS_OPEN to work around a deadlock in
+       * older GLib, see flatpak_close_fds_workaround */
+      if (g_spawn_async (NULL,
+                         (gchar **) argv->pdata,
+                         NULL,
+                         (G_SPAWN_LEAVE_DESCRIPTORS_OPEN |
+                          G_SPAWN_STDOUT_TO_DEV_NULL |
+                          G_SPAWN_STDERR_TO_DEV_NULL),
+                         background_cleanup_child_setup_cb,
+                         NULL,
+                         NULL,
+                         &local_error))
+        return;
+
+      g_debug ("Unable to start background cleanup: %s",
+               local_error->message);
+      /* fall through to cleaning up synchronously */
+    }
+
+  for (i = 0; i < paths->len; i++)
+    _srt_rm_rf (g_ptr_array_index (paths, i));
+}
+
 static void
 child_setup_cb (gpointer user_data)
 {
@@ -389,6 +473,49 @@ opt_pass_fd_cb (const char *name,
   return TRUE;
 }
 
+static gboolean
+opt_record_mapped_files_cb (const char *name,
+                            const char *value,
+                            gpointer data,
+                            GError **error)
+{
+  char *endptr;
+  gint64 i64 = g_ascii_strtoll (value, &endptr, 10);
+  int fd;
+  int fd_flags;
+
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (i64 < 0 || i64 > G_MAXINT || endptr == value || *endptr != '\0')
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Integer out of range or invalid: %s", value);
+      return FALSE;
+    }
+
+  fd = (int) i64;
+
+  fd_flags = fcntl (fd, F_GETFD);
+
+  if (fd_flags < 0)
+    return glnx_throw_errno_prefix (error,
+                                    "Unable to receive --record-mapped-files %d",
+                                    fd);
+
+  /* The command does not need to inherit this */
+  if ((fd_flags & FD_CLOEXEC) == 0
+      && fcntl (fd, F_SETFD, fd_flags | FD_CLOEXEC) != 0)
+    return glnx_throw_errno_prefix (error,
+                                    "Unable to configure --record-mapped-files "
+                                    "%d for close-on-exec",
+                                    fd);
+
+  glnx_close_fd (&opt_record_mapped_files_fd);
+  opt_record_mapped_files_fd = fd;
+  return TRUE;
+}
+
 static gboolean
 opt_shell_cb (const gchar *option_name,
               const gchar *value,
@@ -851,6 +978,272 @@ out:
   return ret;
 }
 
+/* Sanity limit on the number of distinct files to record */
+#define MAX_MAPPED_FILES 8192
+
+typedef struct
+{
+  GMutex mutex;
+  GCond cond;
+  GThread *thread;
+  /* Only accessed by the thread until it has been joined */
+  GHashTable *paths;
+  pid_t ancestor;
+  /* Protected by mutex */
+  gboolean stopping;
+} MappedFilesRecorder;
+
+/*
+ * Returns: The parent of @pid, or -1 if it cannot be determined
+ */
+static pid_t
+get_parent_pid (pid_t pid)
+{
+  g_autofree gchar *path = g_strdup_printf ("/proc/%d/stat", pid);
+  g_autofree gchar *contents = NULL;
+  const char *after_comm;
+  int ppid;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return -1;
+
+  /* The second field is the executable name in parentheses, which
+   * can itself contain parentheses, so look for the last one */
+  after_comm = strrchr (contents, ')');
+
+  if (after_comm == NULL
+      || sscanf (after_comm + 1, " %*c %d", &ppid) != 1)
+    return -1;
+
+  return ppid;
+}
+
+static gboolean
+pid_is_descendant (GHashTable *parents,
+                   pid_t pid,
+                   pid_t ancestor)
+{
+  gpointer ppid;
+  gsize depth;
+
+  /* The limit guards against loops caused by pid reuse between
+   * reading one /proc/PID/stat and the next */
+  for (depth = 0; depth < 1024; depth++)
+    {
+      if (!g_hash_table_lookup_extended (parents, GINT_TO_POINTER (pid),
+                                         NULL, &ppid))
+        return FALSE;
+
+      pid = GPOINTER_TO_INT (ppid);
+
+      if (pid == ancestor)
+        return TRUE;
+
+      if (pid <= 1)
+        return FALSE;
+    }
+
+  return FALSE;
+}
+
+/* Called in recorder thread */
+static void
+mapped_files_recorder_add_maps (MappedFilesRecorder *self,
+                                pid_t pid)
+{
+  g_autofree gchar *path = g_strdup_printf ("/proc/%d/maps", pid);
+  g_autofree gchar *contents = NULL;
+  g_auto(GStrv) lines = NULL;
+  gsize i;
+
+  /* This can fail if the process has already exited */
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      const char *p = lines[i];
+      gsize field;
+
+      /* Skip address range, permissions, offset, device and inode */
+      for (field = 0; field < 5 && p != NULL; field++)
+        {
+          p = strchr (p, ' ');
+
+          if (p != NULL)
+            p += strspn (p, " ");
+        }
+
+      if (p == NULL
+          || p[0] != '/'
+          || g_str_has_suffix (p, " (deleted)")
+          || g_hash_table_contains (self->paths, p))
+        continue;
+
+      if (g_hash_table_size (self->paths) >= MAX_MAPPED_FILES)
+        return;
+
+      g_hash_table_add (self->paths, g_strdup (p));
+    }
+}
+
+/* Called in recorder thread */
+static void
+mapped_files_recorder_sample (MappedFilesRecorder *self)
+{
+  g_autoptr(GHashTable) parents = g_hash_table_new (NULL, NULL);
+  g_autoptr(GArray) pids = g_array_new (FALSE, FALSE, sizeof (pid_t));
+  g_autoptr(GDir) dir = NULL;
+  const char *member;
+  gsize i;
+
+  dir = g_dir_open ("/proc", 0, NULL);
+
+  if (dir == NULL)
+    return;
+
+  while ((member = g_dir_read_name (dir)) != NULL)
+    {
+      char *endptr;
+      gint64 i64 = g_ascii_strtoll (member, &endptr, 10);
+      pid_t pid;
+      pid_t ppid;
+
+      if (i64 <= 0 || i64 > G_MAXINT || endptr == member || *endptr != '\0')
+        continue;
+
+      pid = (pid_t) i64;
+      ppid = get_parent_pid (pid);
+
+      if (ppid < 0)
+        continue;
+
+      g_hash_table_replace (parents, GINT_TO_POINTER (pid),
+                            GINT_TO_POINTER (ppid));
+      g_array_append_val (pids, pid);
+    }
+
+  for (i = 0; i < pids->len; i++)
+    {
+      pid_t pid = g_array_index (pids, pid_t, i);
+
+      if (pid_is_descendant (parents, pid, self->ancestor))
+        mapped_files_recorder_add_maps (self, pid);
+    }
+}
+
+static gpointer
+mapped_files_recorder_thread (gpointer data)
+{
+  MappedFilesRecorder *self = data;
+  /* Most libraries are loaded during startup, so sample often at
+   * first, and then back off */
+  gint64 interval = G_TIME_SPAN_SECOND;
+
+  g_mutex_lock (&self->mutex);
+
+  while (!self->stopping)
+    {
+      gint64 end_time = g_get_monotonic_time () + interval;
+
+      while (!self->stopping
+             && g_cond_wait_until (&self->cond, &self->mutex, end_time))
+        continue;
+
+      if (self->stopping)
+        break;
+
+      g_mutex_unlock (&self->mutex);
+      mapped_files_recorder_sample (self);
+      g_mutex_lock (&self->mutex);
+
+      interval = MIN (interval * 2, 30 * G_TIME_SPAN_SECOND);
+    }
+
+  g_mutex_unlock (&self->mutex);
+  return NULL;
+}
+
+/*
+ * Start sampling the files mapped by our descendant processes.
+ * Must be called after blocking SIGCHLD.
+ */
+static MappedFilesRecorder *
+mapped_files_recorder_start (void)
+{
+  MappedFilesRecorder *self = g_new0 (MappedFilesRecorder, 1);
+
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->ancestor = getpid ();
+  self->thread = g_thread_new ("record-mapped-files",
+                               mapped_files_recorder_thread, self);
+  return self;
+}
+
+/*
+ * Stop sampling, replace the contents of @fd with the list of files
+ * that were recorded, and free @self.
+ */
+static gboolean
+mapped_files_recorder_finish (MappedFilesRecorder *self,
+                              int fd,
+                              GError **error)
+{
+  g_autoptr(GString) buffer = g_string_new ("");
+  g_autofree gpointer *paths = NULL;
+  gboolean ret = FALSE;
+  guint n = 0;
+  guint i;
+
+  g_mutex_lock (&self->mutex);
+  self->stopping = TRUE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->mutex);
+  g_thread_join (g_steal_pointer (&self->thread));
+
+  if (g_hash_table_size (self->paths) == 0)
+    {
+      /* Perhaps the command failed immediately: don't throw away
+       * a list from a more successful run */
+      g_debug ("No mapped files recorded, keeping previous list");
+      ret = TRUE;
+      goto out;
+    }
+
+  paths = g_hash_table_get_keys_as_array (self->paths, &n);
+  qsort (paths, n, sizeof (gpointer), _srt_indirect_strcmp0);
+
+  for (i = 0; i < n; i++)
+    g_string_append_printf (buffer, "%s\n", (const char *) paths[i]);
+
+  g_debug ("Recorded %u mapped files", n);
+
+  if (ftruncate (fd, 0) != 0 || lseek (fd, 0, SEEK_SET) != 0)
+    {
+      glnx_throw_errno_prefix (error, "Unable to truncate mapped files list");
+      goto out;
+    }
+
+  if (glnx_loop_write (fd, buffer->str, buffer->len) < 0)
+    {
+      glnx_throw_errno_prefix (error, "Unable to write mapped files list");
+      goto out;
+    }
+
+  ret = TRUE;
+
+out:
+  g_hash_table_unref (self->paths);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->mutex);
+  g_free (self);
+  return ret;
+}
+
 /* Only do async-signal-safe things here: see signal-safety(7) */
 static void
 terminate_child_cb (int signum)
@@ -913,6 +1306,14 @@ static GOptionEntry options[] =
     G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_generate_locales,
     "Don't generate any missing locales [default].", NULL },
 
+  { "background-cleanup", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_background_cleanup,
+    "Delete temporary files in a detached low-priority process, "
+    "without waiting for it to finish.", NULL },
+  { "no-background-cleanup", '\0',
+    G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_background_cleanup,
+    "Delete temporary files before exiting [default].", NULL },
+
   { "regenerate-ld.so-cache", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_regenerate_ld_so_cache,
     "Regenerate ld.so.cache in the given directory, incorporating "
@@ -927,7 +1328,8 @@ static GOptionEntry options[] =
   { "set-ld-library-path", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_set_ld_library_path,
     "Set the environment variable LD_LIBRARY_PATH to VALUE before "
-    "executing COMMAND.",
+    "executing COMMAND. If VALUE is empty and the ld.so.cache was "
+    "regenerated, unset it instead.",
     "VALUE" },
 
   { "write", '\0',
@@ -970,6 +1372,12 @@ static GOptionEntry options[] =
     "Let the launched process inherit the given fd.",
     NULL },
 
+  { "record-mapped-files", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_CALLBACK, opt_record_mapped_files_cb,
+    "Record the files mapped by COMMAND and its descendants, and "
+    "write them to the given fd when it exits.",
+    "FD" },
+
   { "shell", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_CALLBACK, opt_shell_cb,
     "Run an interactive shell: never, after COMMAND, "
@@ -1038,6 +1446,8 @@ main (int argc,
   struct sigaction terminate_child_action = {};
   g_autoptr(FlatpakBwrap) wrapped_command = NULL;
   g_autoptr(LibTempDirs) lib_temp_dirs = g_new0 (LibTempDirs, 1);
+  MappedFilesRecorder *recorder = NULL;
+  g_autoptr(GPtrArray) temp_dirs = NULL;
   gboolean all_abi_paths_created = TRUE;
   gsize i;
 
@@ -1330,9 +1740,21 @@ main (int argc,
                                   error))
         {
           g_debug ("Generated ld.so.cache in %s", opt_regenerate_ld_so_cache);
-          g_debug ("Setting LD_LIBARY_PATH to \"%s\"", opt_set_ld_library_path);
-          flatpak_bwrap_set_env (wrapped_command, "LD_LIBRARY_PATH",
-                                 opt_set_ld_library_path, TRUE);
+
+          if (opt_set_ld_library_path != NULL
+              && opt_set_ld_library_path[0] == '\0')
+            {
+              /* Everything can be found via the ld.so.cache */
+              g_debug ("Unsetting LD_LIBRARY_PATH");
+              flatpak_bwrap_unset_env (wrapped_command, "LD_LIBRARY_PATH");
+            }
+          else
+            {
+              g_debug ("Setting LD_LIBARY_PATH to \"%s\"",
+                       opt_set_ld_library_path);
+              flatpak_bwrap_set_env (wrapped_command, "LD_LIBRARY_PATH",
+                                     opt_set_ld_library_path, TRUE);
+            }
         }
       else
         {
@@ -1458,6 +1880,9 @@ main (int argc,
 
   g_free (child_setup_data.pass_fds);
 
+  if (opt_record_mapped_files_fd >= 0)
+    recorder = mapped_files_recorder_start ();
+
   /* If the child writes to stdout and closes it, don't interfere */
   g_clear_pointer (&original_stdout, fclose);
 
@@ -1505,13 +1930,31 @@ main (int argc,
     }
 
 out:
+  if (recorder != NULL)
+    {
+      g_autoptr(GError) record_error = NULL;
+
+      if (!mapped_files_recorder_finish (g_steal_pointer (&recorder),
+                                         opt_record_mapped_files_fd,
+                                         &record_error))
+        g_warning ("%s", record_error->message);
+    }
+
+  glnx_close_fd (&opt_record_mapped_files_fd);
   global_ld_so_conf_entries = NULL;
   global_locks = NULL;
   g_clear_pointer (&global_pass_fds, g_array_unref);
   g_clear_pointer (&opt_regenerate_ld_so_cache, g_free);
 
+  temp_dirs = g_ptr_array_new_with_free_func (g_free);
+
   if (locales_temp_dir != NULL)
-    _srt_rm_rf (locales_temp_dir);
+    g_ptr_array_add (temp_dirs, g_steal_pointer (&locales_temp_dir));
+
+  if (lib_temp_dirs->root_path != NULL)
+    g_ptr_array_add (temp_dirs, g_steal_pointer (&lib_temp_dirs->root_path));
+
+  remove_temp_dirs (temp_dirs);
 
   g_clear_pointer (&opt_preload_modules, g_array_unref);
 
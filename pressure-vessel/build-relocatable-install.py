@@ -108,6 +108,7 @@ DIFFERENT_COPYRIGHT_FILES = [
     'util-linux',
 ]
 SCRIPTS = [
+    'pressure-vessel-ld-profile-report',
     'pressure-vessel-locale-gen',
     'pressure-vessel-test-ui',
     'pressure-vessel-unruntime',
@@ -119,3 +119,39 @@ pv_environ_getenv (PvEnviron *self,
 
   return g_hash_table_lookup (self->values, var);
 }
+
+/*
+ * pv_environ_apply:
+ * @self: The environment changes
+ * @envp: (array zero-terminated=1): The execution environment of bwrap(1)
+ *
+ * Returns: (transfer full): The environment that a process started with
+ *  the changes in @self would see, if it inherited @envp
+ */
+GStrv
+pv_environ_apply (PvEnviron *self,
+                  const char * const *envp)
+{
+  GStrv ret;
+  GHashTableIter iter;
+  gpointer k, v;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  ret = g_strdupv ((gchar **) envp);
+
+  if (ret == NULL)
+    ret = g_new0 (gchar *, 1);
+
+  g_hash_table_iter_init (&iter, self->values);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+      if (v == NULL)
+        ret = g_environ_unsetenv (ret, k);
+      else
+        ret = g_environ_setenv (ret, k, v, TRUE);
+    }
+
+  return ret;
+}
@@ -37,5 +37,7 @@ void pv_environ_inherit_env (PvEnviron *self,
 GList *pv_environ_get_vars (PvEnviron *self);
 const char *pv_environ_getenv (PvEnviron *self,
                                const char *var);
+GStrv pv_environ_apply (PvEnviron *self,
+                        const char * const *envp);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (PvEnviron, pv_environ_free)
@@ -39,9 +39,11 @@
 #include "steam-runtime-tools/glib-backports-internal.h"
 
 /* modified for pressure-vessel */
-gboolean flatpak_run_in_transient_unit (const char *owner,
+gboolean flatpak_run_in_transient_unit (GDBusConnection *connection,
+                                        const char *owner,
                                         const char *prefix,
                                         const char *appid,
+                                        GVariant   *extra_properties,
                                         GError    **error);
 
 /* See flatpak-metadata(5) */
@@ -1714,11 +1714,18 @@ systemd_unit_name_escape (const gchar *in)
  * Modified from Flatpak's version. For simplicity we assume that @owner
  * and @prefix are in a form that don't need escaping to be a valid systemd
  * scope name.
+ *
+ * @connection: (nullable): A connection to the systemd user manager,
+ *  or %NULL to connect to its private socket
+ * @extra_properties: (nullable): Additional properties of type `a(sv)`
+ *  for the new scope, for example resource-control properties
  */
 gboolean
-flatpak_run_in_transient_unit (const char *owner,
+flatpak_run_in_transient_unit (GDBusConnection *connection,
+                               const char *owner,
                                const char *prefix,
                                const char *appid,
+                               GVariant *extra_properties,
                                GError **error)
 {
   g_autoptr(GDBusConnection) conn = NULL;
@@ -1737,23 +1744,38 @@ flatpak_run_in_transient_unit (const char *owner,
   gboolean res = FALSE;
   g_autoptr(GMainContextPopDefault) main_context = NULL;
 
-  path = g_strdup_printf ("/run/user/%d/systemd/private", getuid ());
+  g_return_val_if_fail (extra_properties == NULL
+                        || g_variant_is_of_type (extra_properties,
+                                                 G_VARIANT_TYPE ("a(sv)")),
+                        FALSE);
 
-  if (!g_file_test (path, G_FILE_TEST_EXISTS))
-    return flatpak_fail_error (error, FLATPAK_ERROR_SETUP_FAILED,
-                               _("No systemd user session available, cgroups not available"));
+  if (connection != NULL)
+    {
+      conn = g_object_ref (connection);
+    }
+  else
+    {
+      path = g_strdup_printf ("/run/user/%d/systemd/private", getuid ());
+
+      if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        return flatpak_fail_error (error, FLATPAK_ERROR_SETUP_FAILED,
+                                   _("No systemd user session available, cgroups not available"));
+    }
 
   main_context = flatpak_main_context_new_default ();
   main_loop = g_main_loop_new (main_context, FALSE);
 
-  address = g_strconcat ("unix:path=", path, NULL);
-
-  conn = g_dbus_connection_new_for_address_sync (address,
-                                                 G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
-                                                 NULL,
-                                                 NULL, error);
-  if (!conn)
-    goto out;
+  if (conn == NULL)
+    {
+      address = g_strconcat ("unix:path=", path, NULL);
+
+      conn = g_dbus_connection_new_for_address_sync (address,
+                                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                     NULL,
+                                                     NULL, error);
+      if (!conn)
+        goto out;
+    }
 
   manager = systemd_manager_proxy_new_sync (conn,
                                             G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
@@ -1776,6 +1798,20 @@ flatpak_run_in_transient_unit (const char *owner,
                                                     &pid, 1, sizeof (guint32))
                         );
 
+  if (extra_properties != NULL)
+    {
+      GVariantIter iter;
+      GVariant *child;
+
+      g_variant_iter_init (&iter, extra_properties);
+
+      while ((child = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          g_variant_builder_add_value (&builder, child);
+          g_variant_unref (child);
+        }
+    }
+
   properties = g_variant_builder_end (&builder);
 
   aux = g_variant_new_array (G_VARIANT_TYPE ("(sa(sv))"), NULL, 0);
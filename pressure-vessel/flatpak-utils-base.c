@@ -26,6 +26,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 
 #include <gio/gio.h>
 #include "libglnx/libglnx.h"
@@ -111,12 +112,30 @@ flatpak_canonicalize_filename (const char *path)
  * the G_SPAWN_LEAVE_DESCRIPTORS_OPEN/G_SUBPROCESS_FLAGS_INHERIT_FDS flag
  * and setting CLOEXEC ourselves.
  */
+#ifndef __NR_close_range
+/* The same on all architectures, like other syscalls added after 5.1 */
+#define __NR_close_range 436
+#endif
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
 void
 flatpak_close_fds_workaround (int start_fd)
 {
-  int max_open_fds = sysconf (_SC_OPEN_MAX);
+  int max_open_fds;
   int fd;
 
+  /* Not in Flatpak 1.6.1: on Linux 5.11+, do this in one syscall,
+   * instead of taking time proportional to RLIMIT_NOFILE, which can be
+   * very large. This is async-signal-safe, like the fallback. */
+  if (syscall (__NR_close_range, (unsigned) start_fd, ~0U,
+               CLOSE_RANGE_CLOEXEC) == 0)
+    return;
+
+  max_open_fds = sysconf (_SC_OPEN_MAX);
+
   for (fd = start_fd; fd < max_open_fds; fd++)
     fcntl (fd, F_SETFD, FD_CLOEXEC);
 }
@@ -0,0 +1,323 @@
+/*
+ * Lightweight binary protocol for pressure-vessel-launcher
+ *
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "subprojects/libglnx/config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "launch-channel.h"
+
+static void
+close_fd_in_array (gpointer p)
+{
+  int *fd_p = p;
+
+  glnx_close_fd (fd_p);
+}
+
+/*
+ * pv_launch_channel_frame_new:
+ * @type: The type of frame
+ *
+ * Returns: (transfer full): A new frame with an empty payload
+ */
+PvLaunchChannelFrame *
+pv_launch_channel_frame_new (PvLaunchChannelFrameType type)
+{
+  PvLaunchChannelFrame *self = g_new0 (PvLaunchChannelFrame, 1);
+
+  self->type = type;
+  self->payload = g_byte_array_new ();
+  self->fds = g_array_new (FALSE, FALSE, sizeof (int));
+  g_array_set_clear_func (self->fds, close_fd_in_array);
+  return self;
+}
+
+void
+pv_launch_channel_frame_free (PvLaunchChannelFrame *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_byte_array_unref (self->payload);
+  g_array_unref (self->fds);
+  g_free (self);
+}
+
+void
+pv_launch_channel_frame_add_uint32 (PvLaunchChannelFrame *self,
+                                    guint32 value)
+{
+  g_byte_array_append (self->payload, (const guint8 *) &value,
+                       sizeof (value));
+}
+
+void
+pv_launch_channel_frame_add_string (PvLaunchChannelFrame *self,
+                                    const char *value)
+{
+  g_byte_array_append (self->payload, (const guint8 *) value,
+                       strlen (value) + 1);
+}
+
+/*
+ * pv_launch_channel_frame_add_fd:
+ * @self: A frame
+ * @fd: A file descriptor, which is duplicated and not taken
+ *
+ * Attach a copy of @fd to @self.
+ */
+gboolean
+pv_launch_channel_frame_add_fd (PvLaunchChannelFrame *self,
+                                int fd,
+                                GError **error)
+{
+  int copy;
+
+  if (self->fds->len >= PV_LAUNCH_CHANNEL_MAX_FDS)
+    return glnx_throw (error, "Too many file descriptors (maximum %d)",
+                       PV_LAUNCH_CHANNEL_MAX_FDS);
+
+  copy = fcntl (fd, F_DUPFD_CLOEXEC, 3);
+
+  if (copy < 0)
+    return glnx_throw_errno_prefix (error, "Unable to duplicate fd %d", fd);
+
+  g_array_append_val (self->fds, copy);
+  return TRUE;
+}
+
+gboolean
+pv_launch_channel_frame_get_uint32 (PvLaunchChannelFrame *self,
+                                    guint32 *value,
+                                    GError **error)
+{
+  g_return_val_if_fail (self->read_pos <= self->payload->len, FALSE);
+
+  if (self->payload->len - self->read_pos < sizeof (guint32))
+    return glnx_throw (error, "Truncated frame: expected an integer");
+
+  memcpy (value, self->payload->data + self->read_pos, sizeof (guint32));
+  self->read_pos += sizeof (guint32);
+  return TRUE;
+}
+
+/*
+ * Returns: (transfer none): A string owned by @self, or %NULL on error
+ */
+const char *
+pv_launch_channel_frame_get_string (PvLaunchChannelFrame *self,
+                                    GError **error)
+{
+  const char *start;
+  const char *end;
+
+  g_return_val_if_fail (self->read_pos <= self->payload->len, NULL);
+
+  start = (const char *) self->payload->data + self->read_pos;
+  end = memchr (start, '\0', self->payload->len - self->read_pos);
+
+  if (end == NULL)
+    {
+      glnx_throw (error, "Truncated frame: expected a string");
+      return NULL;
+    }
+
+  self->read_pos += (end - start) + 1;
+  return start;
+}
+
+gboolean
+pv_launch_channel_frame_at_end (PvLaunchChannelFrame *self)
+{
+  return self->read_pos >= self->payload->len;
+}
+
+/*
+ * pv_launch_channel_send:
+ * @socket_fd: A `SOCK_SEQPACKET` socket
+ * @frame: The frame to send, together with its attached fds
+ *
+ * Send @frame as a single message.
+ */
+gboolean
+pv_launch_channel_send (int socket_fd,
+                        PvLaunchChannelFrame *frame,
+                        GError **error)
+{
+  union
+  {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE (sizeof (int) * PV_LAUNCH_CHANNEL_MAX_FDS)];
+  } control = {};
+  PvLaunchChannelHeader header = {};
+  struct iovec iov[2] = {};
+  struct msghdr msg = {};
+  ssize_t sent;
+
+  g_return_val_if_fail (socket_fd >= 0, FALSE);
+  g_return_val_if_fail (frame != NULL, FALSE);
+  g_return_val_if_fail (frame->fds->len <= PV_LAUNCH_CHANNEL_MAX_FDS, FALSE);
+
+  if (frame->payload->len > PV_LAUNCH_CHANNEL_MAX_PAYLOAD)
+    return glnx_throw (error, "Frame too large (%u bytes, maximum %d)",
+                       frame->payload->len, PV_LAUNCH_CHANNEL_MAX_PAYLOAD);
+
+  header.type = frame->type;
+  header.length = frame->payload->len;
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof (header);
+  iov[1].iov_base = frame->payload->data;
+  iov[1].iov_len = frame->payload->len;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = G_N_ELEMENTS (iov);
+
+  if (frame->fds->len > 0)
+    {
+      struct cmsghdr *cmsg;
+      gsize fds_size = sizeof (int) * frame->fds->len;
+
+      msg.msg_control = control.buf;
+      msg.msg_controllen = CMSG_SPACE (fds_size);
+      cmsg = CMSG_FIRSTHDR (&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN (fds_size);
+      memcpy (CMSG_DATA (cmsg), frame->fds->data, fds_size);
+    }
+
+  do
+    sent = sendmsg (socket_fd, &msg, MSG_NOSIGNAL);
+  while (sent < 0 && errno == EINTR);
+
+  if (sent < 0)
+    return glnx_throw_errno_prefix (error, "Unable to send frame");
+
+  if ((gsize) sent != sizeof (header) + frame->payload->len)
+    return glnx_throw (error, "Frame only partially sent");
+
+  return TRUE;
+}
+
+/*
+ * pv_launch_channel_receive:
+ * @socket_fd: A `SOCK_SEQPACKET` socket
+ *
+ * Receive a single frame. This blocks if @socket_fd is in blocking mode
+ * and no frame is available.
+ *
+ * Returns: (transfer full): The frame, or %NULL with
+ *  %G_IO_ERROR_CONNECTION_CLOSED if the peer closed the socket,
+ *  or %NULL with some other error on failure
+ */
+PvLaunchChannelFrame *
+pv_launch_channel_receive (int socket_fd,
+                           GError **error)
+{
+  union
+  {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE (sizeof (int) * PV_LAUNCH_CHANNEL_MAX_FDS)];
+  } control = {};
+  g_autoptr(PvLaunchChannelFrame) frame = NULL;
+  g_autofree guint8 *buf = NULL;
+  PvLaunchChannelHeader header;
+  struct cmsghdr *cmsg;
+  struct iovec iov = {};
+  struct msghdr msg = {};
+  ssize_t received;
+
+  g_return_val_if_fail (socket_fd >= 0, NULL);
+
+  buf = g_malloc (sizeof (header) + PV_LAUNCH_CHANNEL_MAX_PAYLOAD);
+  iov.iov_base = buf;
+  iov.iov_len = sizeof (header) + PV_LAUNCH_CHANNEL_MAX_PAYLOAD;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  do
+    received = recvmsg (socket_fd, &msg, MSG_CMSG_CLOEXEC);
+  while (received < 0 && errno == EINTR);
+
+  if (received < 0)
+    {
+      glnx_throw_errno_prefix (error, "Unable to receive frame");
+      return NULL;
+    }
+
+  if (received == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                           "Connection closed by peer");
+      return NULL;
+    }
+
+  /* Take ownership of any fds first, so that they will be closed
+   * if the frame turns out to be invalid */
+  frame = pv_launch_channel_frame_new (0);
+
+  for (cmsg = CMSG_FIRSTHDR (&msg);
+       cmsg != NULL;
+       cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+          gsize n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+
+          g_array_append_vals (frame->fds, CMSG_DATA (cmsg), n);
+        }
+    }
+
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    {
+      glnx_throw (error, "Frame too large");
+      return NULL;
+    }
+
+  if ((gsize) received < sizeof (header))
+    {
+      glnx_throw (error, "Frame too short");
+      return NULL;
+    }
+
+  memcpy (&header, buf, sizeof (header));
+
+  if (header.length != received - sizeof (header))
+    {
+      glnx_throw (error,
+                  "Frame length %u does not match %" G_GSIZE_FORMAT
+                  " bytes received",
+                  header.length, (gsize) received - sizeof (header));
+      return NULL;
+    }
+
+  frame->type = header.type;
+  g_byte_array_append (frame->payload, buf + sizeof (header), header.length);
+  return g_steal_pointer (&frame);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "steam-runtime-tools/glib-backports-internal.h"
+#include "libglnx/libglnx.h"
+
+/*
+ * The version of the fast-channel protocol implemented here, as returned
+ * by com.steampowered.PressureVessel.Launcher1.OpenFastChannel().
+ */
+#define PV_LAUNCH_CHANNEL_PROTOCOL_VERSION 1
+
+/*
+ * Frames are sent over a SOCK_SEQPACKET socket, so each frame is one
+ * message. Requests that do not fit in these limits must be sent via
+ * the D-Bus Launch() method instead.
+ */
+#define PV_LAUNCH_CHANNEL_MAX_PAYLOAD (64 * 1024)
+#define PV_LAUNCH_CHANNEL_MAX_FDS 64
+
+/**
+ * PvLaunchChannelFrameType:
+ * @PV_LAUNCH_CHANNEL_FRAME_SET_ENV: Client to server: register an
+ *  environment delta. Payload: u32 nonzero delta ID, then zero or
+ *  more environment entries.
+ * @PV_LAUNCH_CHANNEL_FRAME_LAUNCH: Client to server: start a process.
+ *  Payload: u32 delta ID or 0, u32 #PvLaunchFlags, u32 terminate-after
+ *  boolean, u32 number of fds, one u32 target fd number per fd attached
+ *  to the frame, u32 number of arguments, working directory string
+ *  (empty to use the launcher's), the arguments, then zero or more
+ *  environment entries applied after the registered delta.
+ *  Answered by @PV_LAUNCH_CHANNEL_FRAME_STARTED or
+ *  @PV_LAUNCH_CHANNEL_FRAME_FAILED.
+ * @PV_LAUNCH_CHANNEL_FRAME_SEND_SIGNAL: Client to server: send a signal
+ *  to a process started via this channel. Payload: u32 pid, u32 signal
+ *  number, u32 to-process-group boolean. Not answered.
+ * @PV_LAUNCH_CHANNEL_FRAME_STARTED: Server to client: payload is the
+ *  u32 pid of the new process.
+ * @PV_LAUNCH_CHANNEL_FRAME_FAILED: Server to client: payload is an
+ *  error message string.
+ * @PV_LAUNCH_CHANNEL_FRAME_EXITED: Server to client: payload is the
+ *  u32 pid and u32 wait status of a process that has exited.
+ *
+ * Environment entries are strings: `VAR=VALUE` sets a variable and
+ * `VAR` without `=` unsets it. Integers are in host byte order, and
+ * strings are nul-terminated.
+ */
+typedef enum
+{
+  PV_LAUNCH_CHANNEL_FRAME_SET_ENV = 1,
+  PV_LAUNCH_CHANNEL_FRAME_LAUNCH,
+  PV_LAUNCH_CHANNEL_FRAME_SEND_SIGNAL,
+  PV_LAUNCH_CHANNEL_FRAME_STARTED,
+  PV_LAUNCH_CHANNEL_FRAME_FAILED,
+  PV_LAUNCH_CHANNEL_FRAME_EXITED,
+} PvLaunchChannelFrameType;
+
+typedef struct
+{
+  guint32 type;
+  guint32 length;
+} PvLaunchChannelHeader;
+
+/**
+ * PvLaunchChannelFrame:
+ * @type: The frame type
+ * @payload: The payload, not including the header
+ * @fds: (element-type int): File descriptors attached to the frame,
+ *  owned by the frame
+ * @read_pos: Offset of the next item to be read from @payload
+ */
+typedef struct
+{
+  PvLaunchChannelFrameType type;
+  GByteArray *payload;
+  GArray *fds;
+  gsize read_pos;
+} PvLaunchChannelFrame;
+
+PvLaunchChannelFrame *pv_launch_channel_frame_new (PvLaunchChannelFrameType type);
+void pv_launch_channel_frame_free (PvLaunchChannelFrame *self);
+
+void pv_launch_channel_frame_add_uint32 (PvLaunchChannelFrame *self,
+                                         guint32 value);
+void pv_launch_channel_frame_add_string (PvLaunchChannelFrame *self,
+                                         const char *value);
+gboolean pv_launch_channel_frame_add_fd (PvLaunchChannelFrame *self,
+                                         int fd,
+                                         GError **error);
+
+gboolean pv_launch_channel_frame_get_uint32 (PvLaunchChannelFrame *self,
+                                             guint32 *value,
+                                             GError **error);
+const char *pv_launch_channel_frame_get_string (PvLaunchChannelFrame *self,
+                                                GError **error);
+gboolean pv_launch_channel_frame_at_end (PvLaunchChannelFrame *self);
+
+gboolean pv_launch_channel_send (int socket_fd,
+                                 PvLaunchChannelFrame *frame,
+                                 GError **error);
+PvLaunchChannelFrame *pv_launch_channel_receive (int socket_fd,
+                                                 GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PvLaunchChannelFrame,
+                               pv_launch_channel_frame_free)
@@ -32,6 +32,7 @@
 #include <locale.h>
 #include <sysexits.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -43,6 +44,7 @@
 #include "steam-runtime-tools/utils-internal.h"
 #include "libglnx/libglnx.h"
 
+#include "launch-channel.h"
 #include "launcher.h"
 #include "utils.h"
 
@@ -140,26 +142,15 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(AutoUnixFDList, g_object_unref)
 
 static const char * const *global_original_environ = NULL;
 static GDBusConnection *bus_or_peer_connection = NULL;
+static int fast_channel_fd = -1;
 static guint child_pid = 0;
 static int launch_exit_status = LAUNCH_EX_USAGE;
 
 static void
-process_exited_cb (G_GNUC_UNUSED GDBusConnection *connection,
-                   G_GNUC_UNUSED const gchar     *sender_name,
-                   G_GNUC_UNUSED const gchar     *object_path,
-                   G_GNUC_UNUSED const gchar     *interface_name,
-                   G_GNUC_UNUSED const gchar     *signal_name,
-                   GVariant                      *parameters,
-                   gpointer                       user_data)
+child_exited (GMainLoop *loop,
+              guint32 client_pid,
+              guint32 wait_status)
 {
-  GMainLoop *loop = user_data;
-  guint32 client_pid = 0;
-  guint32 wait_status = 0;
-
-  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(uu)")))
-    return;
-
-  g_variant_get (parameters, "(uu)", &client_pid, &wait_status);
   g_debug ("child %d exited: wait status %d", client_pid, wait_status);
 
   if (child_pid == client_pid)
@@ -197,6 +188,26 @@ process_exited_cb (G_GNUC_UNUSED GDBusConnection *connection,
     }
 }
 
+static void
+process_exited_cb (G_GNUC_UNUSED GDBusConnection *connection,
+                   G_GNUC_UNUSED const gchar     *sender_name,
+                   G_GNUC_UNUSED const gchar     *object_path,
+                   G_GNUC_UNUSED const gchar     *interface_name,
+                   G_GNUC_UNUSED const gchar     *signal_name,
+                   GVariant                      *parameters,
+                   gpointer                       user_data)
+{
+  GMainLoop *loop = user_data;
+  guint32 client_pid = 0;
+  guint32 wait_status = 0;
+
+  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(uu)")))
+    return;
+
+  g_variant_get (parameters, "(uu)", &client_pid, &wait_status);
+  child_exited (loop, client_pid, wait_status);
+}
+
 static void
 forward_signal (int sig)
 {
@@ -241,17 +252,30 @@ forward_signal (int sig)
   if (sig == SIGINT || sig == SIGSTOP || sig == SIGCONT)
     to_process_group = TRUE;
 
-  reply = g_dbus_connection_call_sync (bus_or_peer_connection,
-                                       api->service_bus_name,   /* NULL if p2p */
-                                       api->service_obj_path,
-                                       api->service_iface,
-                                       api->send_signal_method,
-                                       g_variant_new ("(uub)",
-                                                      child_pid, sig,
-                                                      to_process_group),
-                                       G_VARIANT_TYPE ("()"),
-                                       G_DBUS_CALL_FLAGS_NONE,
-                                       -1, NULL, &error);
+  if (fast_channel_fd >= 0)
+    {
+      g_autoptr(PvLaunchChannelFrame) frame = NULL;
+
+      frame = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_SEND_SIGNAL);
+      pv_launch_channel_frame_add_uint32 (frame, child_pid);
+      pv_launch_channel_frame_add_uint32 (frame, sig);
+      pv_launch_channel_frame_add_uint32 (frame, to_process_group);
+      pv_launch_channel_send (fast_channel_fd, frame, &error);
+    }
+  else
+    {
+      reply = g_dbus_connection_call_sync (bus_or_peer_connection,
+                                           api->service_bus_name,   /* NULL if p2p */
+                                           api->service_obj_path,
+                                           api->service_iface,
+                                           api->send_signal_method,
+                                           g_variant_new ("(uub)",
+                                                          child_pid, sig,
+                                                          to_process_group),
+                                           G_VARIANT_TYPE ("()"),
+                                           G_DBUS_CALL_FLAGS_NONE,
+                                           -1, NULL, &error);
+    }
 
   if (error)
     g_info ("Failed to forward signal: %s", error->message);
@@ -579,6 +603,7 @@ static gchar *opt_app_path = NULL;
 static gboolean opt_clear_env = FALSE;
 static gchar *opt_dbus_address = NULL;
 static gchar *opt_directory = NULL;
+static gboolean opt_fast_channel = FALSE;
 static gchar *opt_socket = NULL;
 static GHashTable *opt_env = NULL;
 static GHashTable *opt_unsetenv = NULL;
@@ -675,6 +700,237 @@ opt_env_cb (const char *option_name,
   g_return_val_if_reached (FALSE);
 }
 
+/*
+ * Ask pressure-vessel-launcher to accept requests on a new fast channel.
+ *
+ * Returns: The client end of the channel, or -1 on error. If the
+ *  launcher does not support a compatible fast channel, return -1
+ *  without setting @error.
+ */
+static int
+open_fast_channel (GError **error)
+{
+  g_autoptr(AutoUnixFDList) fd_list = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  glnx_autofd int client_fd = -1;
+  glnx_autofd int server_fd = -1;
+  guint32 version = 0;
+  gint handle;
+  int sv[2];
+
+  g_return_val_if_fail (api == &launcher_api, -1);
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+      glnx_throw_errno_prefix (error, "Unable to create socket pair");
+      return -1;
+    }
+
+  client_fd = sv[0];
+  server_fd = sv[1];
+  fd_list = g_unix_fd_list_new ();
+  handle = g_unix_fd_list_append (fd_list, server_fd, error);
+
+  if (handle < 0)
+    return -1;
+
+  /* The GUnixFdList keeps a duplicate, so we should release the original */
+  glnx_close_fd (&server_fd);
+
+  reply = g_dbus_connection_call_with_unix_fd_list_sync (bus_or_peer_connection,
+                                                         api->service_bus_name,
+                                                         api->service_obj_path,
+                                                         api->service_iface,
+                                                         "OpenFastChannel",
+                                                         g_variant_new ("(h)", handle),
+                                                         G_VARIANT_TYPE ("(u)"),
+                                                         G_DBUS_CALL_FLAGS_NONE,
+                                                         -1,
+                                                         fd_list,
+                                                         NULL,
+                                                         NULL,
+                                                         &local_error);
+
+  if (reply == NULL)
+    {
+      if (g_error_matches (local_error, G_DBUS_ERROR,
+                           G_DBUS_ERROR_UNKNOWN_METHOD))
+        {
+          g_debug ("Launcher does not support fast channels: %s",
+                   local_error->message);
+          return -1;
+        }
+
+      g_dbus_error_strip_remote_error (local_error);
+      g_propagate_error (error, g_steal_pointer (&local_error));
+      return -1;
+    }
+
+  g_variant_get (reply, "(u)", &version);
+
+  if (version != PV_LAUNCH_CHANNEL_PROTOCOL_VERSION)
+    {
+      g_debug ("Unsupported fast channel protocol version %u", version);
+      return -1;
+    }
+
+  return glnx_steal_fd (&client_fd);
+}
+
+/*
+ * Start @argv via the fast channel, and wait for its process ID.
+ *
+ * If the request cannot be represented as a fast-channel frame,
+ * fail with %G_IO_ERROR_NOT_SUPPORTED: the caller should fall back to
+ * using D-Bus.
+ */
+static gboolean
+fast_channel_launch (GUnixFDList *fd_list,
+                     GVariant *fds,
+                     const char *cwd,
+                     const char * const *argv,
+                     guint flags,
+                     GError **error)
+{
+  g_autoptr(PvLaunchChannelFrame) frame = NULL;
+  g_autoptr(PvLaunchChannelFrame) reply = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+  const gint *fd_array;
+  gint fds_len = 0;
+  gsize i, n_fds;
+  guint32 pid;
+
+  fd_array = g_unix_fd_list_peek_fds (fd_list, &fds_len);
+  n_fds = g_variant_n_children (fds);
+
+  if (n_fds > PV_LAUNCH_CHANNEL_MAX_FDS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Too many fds for fast channel");
+      return FALSE;
+    }
+
+  frame = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_LAUNCH);
+  pv_launch_channel_frame_add_uint32 (frame, 0);  /* no environment delta */
+  pv_launch_channel_frame_add_uint32 (frame, flags);
+  pv_launch_channel_frame_add_uint32 (frame, opt_terminate);
+  pv_launch_channel_frame_add_uint32 (frame, n_fds);
+
+  for (i = 0; i < n_fds; i++)
+    {
+      guint32 dest_fd;
+      gint32 handle;
+
+      g_variant_get_child (fds, i, "{uh}", &dest_fd, &handle);
+      g_return_val_if_fail (handle >= 0 && handle < fds_len, FALSE);
+      pv_launch_channel_frame_add_uint32 (frame, dest_fd);
+
+      if (!pv_launch_channel_frame_add_fd (frame, fd_array[handle], error))
+        return FALSE;
+    }
+
+  pv_launch_channel_frame_add_uint32 (frame, g_strv_length ((gchar **) argv));
+  pv_launch_channel_frame_add_string (frame, cwd);
+
+  for (i = 0; argv[i] != NULL; i++)
+    pv_launch_channel_frame_add_string (frame, argv[i]);
+
+  g_hash_table_iter_init (&iter, opt_env);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_autofree gchar *entry = g_strdup_printf ("%s=%s",
+                                                 (const char *) key,
+                                                 (const char *) value);
+
+      pv_launch_channel_frame_add_string (frame, entry);
+    }
+
+  g_hash_table_iter_init (&iter, opt_unsetenv);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    pv_launch_channel_frame_add_string (frame, key);
+
+  if (frame->payload->len > PV_LAUNCH_CHANNEL_MAX_PAYLOAD)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Command too long for fast channel");
+      return FALSE;
+    }
+
+  if (!pv_launch_channel_send (fast_channel_fd, frame, error))
+    return FALSE;
+
+  reply = pv_launch_channel_receive (fast_channel_fd, error);
+
+  if (reply == NULL)
+    return FALSE;
+
+  switch (reply->type)
+    {
+      case PV_LAUNCH_CHANNEL_FRAME_STARTED:
+        if (!pv_launch_channel_frame_get_uint32 (reply, &pid, error))
+          return FALSE;
+
+        child_pid = pid;
+        return TRUE;
+
+      case PV_LAUNCH_CHANNEL_FRAME_FAILED:
+        {
+          const char *message = pv_launch_channel_frame_get_string (reply,
+                                                                    error);
+
+          if (message == NULL)
+            return FALSE;
+
+          return glnx_throw (error, "%s", message);
+        }
+
+      case PV_LAUNCH_CHANNEL_FRAME_SET_ENV:
+      case PV_LAUNCH_CHANNEL_FRAME_LAUNCH:
+      case PV_LAUNCH_CHANNEL_FRAME_SEND_SIGNAL:
+      case PV_LAUNCH_CHANNEL_FRAME_EXITED:
+      default:
+        return glnx_throw (error, "Unexpected frame type %u", reply->type);
+    }
+}
+
+static gboolean
+fast_channel_readable_cb (int fd,
+                          G_GNUC_UNUSED GIOCondition condition,
+                          gpointer user_data)
+{
+  GMainLoop *loop = user_data;
+  g_autoptr(PvLaunchChannelFrame) frame = NULL;
+  g_autoptr(GError) error = NULL;
+  guint32 client_pid = 0;
+  guint32 wait_status = 0;
+
+  frame = pv_launch_channel_receive (fd, &error);
+
+  if (frame != NULL
+      && frame->type == PV_LAUNCH_CHANNEL_FRAME_EXITED
+      && pv_launch_channel_frame_get_uint32 (frame, &client_pid, &error)
+      && pv_launch_channel_frame_get_uint32 (frame, &wait_status, &error))
+    {
+      child_exited (loop, client_pid, wait_status);
+      return G_SOURCE_CONTINUE;
+    }
+
+  if (frame != NULL && error == NULL)
+    {
+      g_debug ("Ignoring unexpected frame type %u", frame->type);
+      return G_SOURCE_CONTINUE;
+    }
+
+  g_debug ("Fast channel closed, quitting: %s", error->message);
+  launch_exit_status = LAUNCH_EX_CANNOT_REPORT;
+  g_main_loop_quit (loop);
+  return G_SOURCE_REMOVE;
+}
+
 static const GOptionEntry options[] =
 {
   { "app-path", '\0',
@@ -699,6 +955,10 @@ static const GOptionEntry options[] =
   { "env", '\0',
     G_OPTION_FLAG_FILENAME, G_OPTION_ARG_CALLBACK, opt_env_cb,
     "Set environment variable.", "VAR=VALUE" },
+  { "fast-channel", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_fast_channel,
+    "Send the command to pressure-vessel-launcher via a lightweight "
+    "binary protocol instead of D-Bus, if supported.", NULL },
   { "forward-fd", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY, &forward_fds,
     "Connect a file descriptor to the launched process. "
@@ -858,6 +1118,13 @@ main (int argc,
       goto out;
     }
 
+  if (api != &launcher_api && opt_fast_channel)
+    {
+      glnx_throw (error,
+                  "--fast-channel cannot be used with Flatpak services");
+      goto out;
+    }
+
   if (api != &subsandbox_api && opt_app_path != NULL)
     {
       glnx_throw (error,
@@ -1214,6 +1481,14 @@ main (int argc,
                                         g_main_loop_ref (loop),
                                         (GDestroyNotify) g_main_loop_unref);
 
+  if (opt_fast_channel)
+    {
+      fast_channel_fd = open_fast_channel (error);
+
+      if (fast_channel_fd < 0 && local_error != NULL)
+        goto out;
+    }
+
   {
     g_autoptr(GVariant) fds = NULL;
     g_autoptr(GVariant) env = NULL;
@@ -1229,59 +1504,80 @@ main (int argc,
     env = g_variant_ref_sink (g_variant_builder_end (&env_builder));
     opts = g_variant_ref_sink (g_variant_builder_end (&options_builder));
 
-    if (api == &host_api)
-      {
-        /* o.fd.Flatpak.Development doesn't take arbitrary options a{sv} */
-        arguments = g_variant_new ("(^ay^aay@a{uh}@a{ss}u)",
-                                   opt_directory,
-                                   (const char * const *) command_and_args,
-                                   fds,
-                                   env,
-                                   spawn_flags);
-      }
-    else
+    if (fast_channel_fd >= 0
+        && !fast_channel_launch (fd_list, fds, opt_directory,
+                                 (const char * const *) command_and_args,
+                                 spawn_flags, error))
       {
-        arguments = g_variant_new ("(^ay^aay@a{uh}@a{ss}u@a{sv})",
-                                   opt_directory,
-                                   (const char * const *) command_and_args,
-                                   fds,
-                                   env,
-                                   spawn_flags,
-                                   opts);
+        if (!g_error_matches (local_error, G_IO_ERROR,
+                              G_IO_ERROR_NOT_SUPPORTED))
+          goto out;
+
+        g_debug ("Falling back to D-Bus: %s", local_error->message);
+        g_clear_error (&local_error);
+        glnx_close_fd (&fast_channel_fd);
       }
 
-    reply = g_dbus_connection_call_with_unix_fd_list_sync (bus_or_peer_connection,
-                                                           api->service_bus_name,
-                                                           api->service_obj_path,
-                                                           api->service_iface,
-                                                           api->launch_method,
-                                                           /* sinks floating reference */
-                                                           g_steal_pointer (&arguments),
-                                                           G_VARIANT_TYPE ("(u)"),
-                                                           G_DBUS_CALL_FLAGS_NONE,
-                                                           -1,
-                                                           fd_list,
-                                                           NULL,
-                                                           NULL, error);
-
-    if (reply == NULL)
+    if (fast_channel_fd < 0)
       {
-        g_dbus_error_strip_remote_error (local_error);
-        goto out;
-      }
+        if (api == &host_api)
+          {
+            /* o.fd.Flatpak.Development doesn't take arbitrary options a{sv} */
+            arguments = g_variant_new ("(^ay^aay@a{uh}@a{ss}u)",
+                                       opt_directory,
+                                       (const char * const *) command_and_args,
+                                       fds,
+                                       env,
+                                       spawn_flags);
+          }
+        else
+          {
+            arguments = g_variant_new ("(^ay^aay@a{uh}@a{ss}u@a{sv})",
+                                       opt_directory,
+                                       (const char * const *) command_and_args,
+                                       fds,
+                                       env,
+                                       spawn_flags,
+                                       opts);
+          }
+
+        reply = g_dbus_connection_call_with_unix_fd_list_sync (bus_or_peer_connection,
+                                                               api->service_bus_name,
+                                                               api->service_obj_path,
+                                                               api->service_iface,
+                                                               api->launch_method,
+                                                               /* sinks floating reference */
+                                                               g_steal_pointer (&arguments),
+                                                               G_VARIANT_TYPE ("(u)"),
+                                                               G_DBUS_CALL_FLAGS_NONE,
+                                                               -1,
+                                                               fd_list,
+                                                               NULL,
+                                                               NULL, error);
+
+        if (reply == NULL)
+          {
+            g_dbus_error_strip_remote_error (local_error);
+            goto out;
+          }
 
-    g_variant_get (reply, "(u)", &child_pid);
+        g_variant_get (reply, "(u)", &child_pid);
+      }
   }
 
   g_debug ("child_pid: %d", child_pid);
 
   /* Release our reference to the fds, so that only the copy we sent over
-   * D-Bus remains open */
+   * D-Bus or the fast channel remains open */
   g_clear_object (&fd_list);
 
   g_signal_connect (bus_or_peer_connection, "closed",
                     G_CALLBACK (connection_closed_cb), loop);
 
+  if (fast_channel_fd >= 0)
+    g_unix_fd_add (fast_channel_fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                   fast_channel_readable_cb, loop);
+
   g_main_loop_run (loop);
 
 out:
@@ -1291,6 +1587,8 @@ out:
   if (signal_source > 0)
     g_source_remove (signal_source);
 
+  glnx_close_fd (&fast_channel_fd);
+
   g_strfreev (forward_fds);
   g_free (opt_app_path);
   g_free (opt_directory);
@@ -46,6 +46,7 @@
 #include "libglnx/libglnx.h"
 
 #include "flatpak-utils-base-private.h"
+#include "launch-channel.h"
 #include "launcher.h"
 #include "portal-listener.h"
 #include "utils.h"
@@ -83,9 +84,48 @@ unref_skeleton_in_timeout (void)
   g_timeout_add (500, unref_skeleton_in_timeout_cb, NULL);
 }
 
+/*
+ * FastChannel:
+ * @fd: One end of a socket pair set up by OpenFastChannel(), or -1
+ *  if the client has disconnected
+ * @watch: Main-loop source watching @fd
+ * @env_deltas: Map from nonzero delta ID to (transfer full) #GStrv
+ *  of environment entries, as registered by
+ *  %PV_LAUNCH_CHANNEL_FRAME_SET_ENV
+ */
+typedef struct
+{
+  gsize refcount;
+  int fd;
+  guint watch;
+  GHashTable *env_deltas;
+} FastChannel;
+
+static FastChannel *
+fast_channel_ref (FastChannel *channel)
+{
+  channel->refcount++;
+  return channel;
+}
+
+static void
+fast_channel_unref (FastChannel *channel)
+{
+  g_return_if_fail (channel->refcount > 0);
+
+  if (--channel->refcount > 0)
+    return;
+
+  g_assert (channel->watch == 0);
+  glnx_close_fd (&channel->fd);
+  g_hash_table_unref (channel->env_deltas);
+  g_free (channel);
+}
+
 typedef struct
 {
   GDBusConnection *connection;
+  FastChannel *channel;
   GPid pid;
   gchar *client;
   guint child_watch;
@@ -96,6 +136,7 @@ static void
 pid_data_free (PidData *data)
 {
   g_clear_object (&data->connection);
+  g_clear_pointer (&data->channel, fast_channel_unref);
   g_free (data->client);
   g_free (data);
 }
@@ -129,14 +170,33 @@ child_watch_died (GPid     pid,
 
   g_debug ("Child %d died: wait status %d", pid_data->pid, status);
 
-  signal_variant = g_variant_ref_sink (g_variant_new ("(uu)", pid, status));
-  g_dbus_connection_emit_signal (pid_data->connection,
-                                 pid_data->client,
-                                 LAUNCHER_PATH,
-                                 LAUNCHER_IFACE,
-                                 "ProcessExited",
-                                 signal_variant,
-                                 NULL);
+  if (pid_data->channel != NULL)
+    {
+      if (pid_data->channel->fd >= 0)
+        {
+          g_autoptr(PvLaunchChannelFrame) frame = NULL;
+          g_autoptr(GError) error = NULL;
+
+          frame = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_EXITED);
+          pv_launch_channel_frame_add_uint32 (frame, pid);
+          pv_launch_channel_frame_add_uint32 (frame, status);
+
+          if (!pv_launch_channel_send (pid_data->channel->fd, frame, &error))
+            g_debug ("Unable to report exit of %d: %s",
+                     pid, error->message);
+        }
+    }
+  else
+    {
+      signal_variant = g_variant_ref_sink (g_variant_new ("(uu)", pid, status));
+      g_dbus_connection_emit_signal (pid_data->connection,
+                                     pid_data->client,
+                                     LAUNCHER_PATH,
+                                     LAUNCHER_IFACE,
+                                     "ProcessExited",
+                                     signal_variant,
+                                     NULL);
+    }
 
   /* This frees the pid_data, so be careful */
   g_hash_table_remove (client_pid_data_hash, GUINT_TO_POINTER (pid_data->pid));
@@ -219,6 +279,132 @@ child_setup_func (gpointer user_data)
   setpgid (0, 0);
 }
 
+/*
+ * If any "to" fd in @fd_map is the same as a "from" fd that will be
+ * used later, move it to an unused fd number temporarily. The second
+ * pass in child_setup_func() will move it to its final number.
+ */
+static void
+fd_map_avoid_conflicts (FdMapEntry *fd_map,
+                        gsize n_fds)
+{
+  gint32 max_fd = -1;
+  gsize i, j;
+
+  for (i = 0; i < n_fds; i++)
+    {
+      max_fd = MAX (max_fd, fd_map[i].to);
+      max_fd = MAX (max_fd, fd_map[i].from);
+    }
+
+  /* We make a second pass over the fds to find if any "to" fd index
+     overlaps an already in use fd (i.e. one in the "from" category
+     that are allocated randomly). If a fd overlaps "to" fd then its
+     a caller issue and not our fault, so we ignore that. */
+  for (i = 0; i < n_fds; i++)
+    {
+      int to_fd = fd_map[i].to;
+      gboolean conflict = FALSE;
+
+      /* At this point we're fine with using "from" values for this
+         value (because we handle to==from in the code), or values
+         that are before "i" in the fd_map (because those will be
+         closed at this point when dup:ing). However, we can't
+         reuse a fd that is in "from" for j > i. */
+      for (j = i + 1; j < n_fds; j++)
+        {
+          int from_fd = fd_map[j].from;
+          if (from_fd == to_fd)
+            {
+              conflict = TRUE;
+              break;
+            }
+        }
+
+      if (conflict)
+        fd_map[i].to = ++max_fd;
+    }
+}
+
+static GStrv
+launch_environ_new (gboolean clear_env)
+{
+  if (clear_env)
+    {
+      char *empty[] = { NULL };
+
+      return g_strdupv (empty);
+    }
+
+  return g_strdupv (global_listener->original_environ);
+}
+
+/*
+ * Start @argv in @cwd_path with environment @env, which is not modified.
+ * PWD in @env is replaced with the actual working directory.
+ */
+static gboolean
+spawn_child (const gchar *cwd_path,
+             const gchar * const *argv,
+             gchar **env,
+             FdMapEntry *fd_map,
+             gsize n_fds,
+             GPid *pid_out,
+             GError **error)
+{
+  ChildSetupData child_setup_data = { NULL };
+  g_auto(GStrv) child_env = g_strdupv (env);
+
+  child_setup_data.fd_map = fd_map;
+  child_setup_data.fd_map_len = n_fds;
+
+  if (cwd_path == NULL)
+    child_env = g_environ_setenv (child_env, "PWD",
+                                  global_listener->original_cwd_l, TRUE);
+  else
+    child_env = g_environ_setenv (child_env, "PWD", cwd_path, TRUE);
+
+  /* We use LEAVE_DESCRIPTORS_OPEN to work around dead-lock, see flatpak_close_fds_workaround */
+  return g_spawn_async_with_pipes (cwd_path,
+                                   (gchar **) argv,
+                                   child_env,
+                                   G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_LEAVE_DESCRIPTORS_OPEN,
+                                   child_setup_func, &child_setup_data,
+                                   pid_out,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   error);
+}
+
+/*
+ * Start watching @pid. The caller is responsible for recording how
+ * its exit should be reported.
+ *
+ * Returns: (transfer none): The new PidData, owned by client_pid_data_hash
+ */
+static PidData *
+track_child (GPid pid,
+             gboolean terminate_after)
+{
+  PidData *pid_data;
+
+  pid_data = g_new0 (PidData, 1);
+  pid_data->pid = pid;
+  pid_data->terminate_after = terminate_after;
+  pid_data->child_watch = g_child_watch_add_full (G_PRIORITY_DEFAULT,
+                                                  pid,
+                                                  child_watch_died,
+                                                  pid_data,
+                                                  NULL);
+
+  g_debug ("Client Pid is %d", pid_data->pid);
+
+  g_hash_table_replace (client_pid_data_hash, GUINT_TO_POINTER (pid_data->pid),
+                        pid_data);
+  return pid_data;
+}
+
 static gboolean
 handle_launch (PvLauncher1           *object,
                GDBusMethodInvocation *invocation,
@@ -231,16 +417,14 @@ handle_launch (PvLauncher1           *object,
                GVariant              *arg_options)
 {
   g_autoptr(GError) error = NULL;
-  ChildSetupData child_setup_data = { NULL };
   GPid pid;
   PidData *pid_data;
-  gsize i, j, n_fds, n_envs;
+  gsize i, n_fds, n_envs;
   const gint *fds = NULL;
   gint fds_len = 0;
   g_autofree FdMapEntry *fd_map = NULL;
   g_auto(GStrv) env = NULL;
   g_auto(GStrv) unset_env = NULL;
-  gint32 max_fd;
   gboolean terminate_after = FALSE;
 
   if (fd_list != NULL)
@@ -273,10 +457,6 @@ handle_launch (PvLauncher1           *object,
     n_fds = g_variant_n_children (arg_fds);
   fd_map = g_new0 (FdMapEntry, n_fds);
 
-  child_setup_data.fd_map = fd_map;
-  child_setup_data.fd_map_len = n_fds;
-
-  max_fd = -1;
   for (i = 0; i < n_fds; i++)
     {
       gint32 handle, dest_fd;
@@ -290,49 +470,11 @@ handle_launch (PvLauncher1           *object,
       fd_map[i].to = dest_fd;
       fd_map[i].from = handle_fd;
       fd_map[i].final = fd_map[i].to;
-
-      max_fd = MAX (max_fd, fd_map[i].to);
-      max_fd = MAX (max_fd, fd_map[i].from);
-    }
-
-  /* We make a second pass over the fds to find if any "to" fd index
-     overlaps an already in use fd (i.e. one in the "from" category
-     that are allocated randomly). If a fd overlaps "to" fd then its
-     a caller issue and not our fault, so we ignore that. */
-  for (i = 0; i < n_fds; i++)
-    {
-      int to_fd = fd_map[i].to;
-      gboolean conflict = FALSE;
-
-      /* At this point we're fine with using "from" values for this
-         value (because we handle to==from in the code), or values
-         that are before "i" in the fd_map (because those will be
-         closed at this point when dup:ing). However, we can't
-         reuse a fd that is in "from" for j > i. */
-      for (j = i + 1; j < n_fds; j++)
-        {
-          int from_fd = fd_map[j].from;
-          if (from_fd == to_fd)
-            {
-              conflict = TRUE;
-              break;
-            }
-        }
-
-      if (conflict)
-        fd_map[i].to = ++max_fd;
     }
 
-  if (arg_flags & PV_LAUNCH_FLAGS_CLEAR_ENV)
-    {
-      char *empty[] = { NULL };
+  fd_map_avoid_conflicts (fd_map, n_fds);
 
-      env = g_strdupv (empty);
-    }
-  else
-    {
-      env = g_strdupv (global_listener->original_environ);
-    }
+  env = launch_environ_new (arg_flags & PV_LAUNCH_FLAGS_CLEAR_ENV);
 
   n_envs = g_variant_n_children (arg_envs);
   for (i = 0; i < n_envs; i++)
@@ -360,23 +502,7 @@ handle_launch (PvLauncher1           *object,
       env = g_environ_unsetenv (env, unset_env[i]);
     }
 
-  if (arg_cwd_path == NULL)
-    env = g_environ_setenv (env, "PWD", global_listener->original_cwd_l,
-                            TRUE);
-  else
-    env = g_environ_setenv (env, "PWD", arg_cwd_path, TRUE);
-
-  /* We use LEAVE_DESCRIPTORS_OPEN to work around dead-lock, see flatpak_close_fds_workaround */
-  if (!g_spawn_async_with_pipes (arg_cwd_path,
-                                 (gchar **) arg_argv,
-                                 env,
-                                 G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_LEAVE_DESCRIPTORS_OPEN,
-                                 child_setup_func, &child_setup_data,
-                                 &pid,
-                                 NULL,
-                                 NULL,
-                                 NULL,
-                                 &error))
+  if (!spawn_child (arg_cwd_path, arg_argv, env, fd_map, n_fds, &pid, &error))
     {
       gint code = G_DBUS_ERROR_FAILED;
 
@@ -391,21 +517,9 @@ handle_launch (PvLauncher1           *object,
       return G_DBUS_METHOD_INVOCATION_HANDLED;
     }
 
-  pid_data = g_new0 (PidData, 1);
+  pid_data = track_child (pid, terminate_after);
   pid_data->connection = g_object_ref (g_dbus_method_invocation_get_connection (invocation));
-  pid_data->pid = pid;
   pid_data->client = g_strdup (g_dbus_method_invocation_get_sender (invocation));
-  pid_data->terminate_after = terminate_after;
-  pid_data->child_watch = g_child_watch_add_full (G_PRIORITY_DEFAULT,
-                                                  pid,
-                                                  child_watch_died,
-                                                  pid_data,
-                                                  NULL);
-
-  g_debug ("Client Pid is %d", pid_data->pid);
-
-  g_hash_table_replace (client_pid_data_hash, GUINT_TO_POINTER (pid_data->pid),
-                        pid_data);
 
   pv_launcher1_complete_launch (object, invocation, NULL, pid);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
@@ -455,6 +569,374 @@ handle_terminate (PvLauncher1           *object,
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
+/*
+ * Apply a fast-channel environment entry to @env, which is consumed.
+ * PWD is ignored, because we special-case it in spawn_child().
+ */
+static GStrv
+environ_apply_entry (GStrv env,
+                     const char *entry)
+{
+  const char *equals = strchr (entry, '=');
+
+  if (equals == NULL)
+    {
+      if (strcmp (entry, "PWD") != 0)
+        env = g_environ_unsetenv (env, entry);
+    }
+  else
+    {
+      g_autofree gchar *var = g_strndup (entry, equals - entry);
+
+      if (strcmp (var, "PWD") != 0)
+        env = g_environ_setenv (env, var, equals + 1, TRUE);
+    }
+
+  return env;
+}
+
+static gboolean
+fast_channel_handle_set_env (FastChannel *channel,
+                             PvLaunchChannelFrame *frame,
+                             GError **error)
+{
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func (g_free);
+  guint32 id;
+
+  if (!pv_launch_channel_frame_get_uint32 (frame, &id, error))
+    return FALSE;
+
+  if (id == 0)
+    return glnx_throw (error, "Environment delta ID 0 is reserved");
+
+  while (!pv_launch_channel_frame_at_end (frame))
+    {
+      const char *entry = pv_launch_channel_frame_get_string (frame, error);
+
+      if (entry == NULL)
+        return FALSE;
+
+      g_ptr_array_add (entries, g_strdup (entry));
+    }
+
+  g_ptr_array_add (entries, NULL);
+  g_hash_table_replace (channel->env_deltas, GUINT_TO_POINTER (id),
+                        g_ptr_array_free (g_steal_pointer (&entries), FALSE));
+  return TRUE;
+}
+
+/*
+ * Returns: %FALSE if the frame was malformed, in which case the
+ *  channel should be closed. Failing to start the command is reported
+ *  to the client and is not an error here.
+ */
+static gboolean
+fast_channel_handle_launch (FastChannel *channel,
+                            PvLaunchChannelFrame *frame,
+                            GError **error)
+{
+  g_autoptr(PvLaunchChannelFrame) reply = NULL;
+  g_autoptr(GPtrArray) argv = NULL;
+  g_autoptr(GError) spawn_error = NULL;
+  g_autofree FdMapEntry *fd_map = NULL;
+  g_auto(GStrv) env = NULL;
+  const char *cwd_path;
+  PidData *pid_data;
+  GPid pid;
+  guint32 env_id;
+  guint32 flags;
+  guint32 terminate_after;
+  guint32 n_fds;
+  guint32 n_args;
+  guint32 i;
+
+  if (!pv_launch_channel_frame_get_uint32 (frame, &env_id, error)
+      || !pv_launch_channel_frame_get_uint32 (frame, &flags, error)
+      || !pv_launch_channel_frame_get_uint32 (frame, &terminate_after, error)
+      || !pv_launch_channel_frame_get_uint32 (frame, &n_fds, error))
+    return FALSE;
+
+  if (n_fds != frame->fds->len)
+    return glnx_throw (error, "Expected %u fds, received %u",
+                       n_fds, frame->fds->len);
+
+  fd_map = g_new0 (FdMapEntry, n_fds);
+
+  for (i = 0; i < n_fds; i++)
+    {
+      guint32 dest_fd;
+
+      if (!pv_launch_channel_frame_get_uint32 (frame, &dest_fd, error))
+        return FALSE;
+
+      fd_map[i].to = dest_fd;
+      fd_map[i].from = g_array_index (frame->fds, int, i);
+      fd_map[i].final = fd_map[i].to;
+    }
+
+  fd_map_avoid_conflicts (fd_map, n_fds);
+
+  if (!pv_launch_channel_frame_get_uint32 (frame, &n_args, error))
+    return FALSE;
+
+  cwd_path = pv_launch_channel_frame_get_string (frame, error);
+
+  if (cwd_path == NULL)
+    return FALSE;
+
+  if (*cwd_path == '\0')
+    cwd_path = NULL;
+
+  argv = g_ptr_array_new ();
+
+  for (i = 0; i < n_args; i++)
+    {
+      const char *arg = pv_launch_channel_frame_get_string (frame, error);
+
+      if (arg == NULL)
+        return FALSE;
+
+      g_ptr_array_add (argv, (char *) arg);
+    }
+
+  g_ptr_array_add (argv, NULL);
+
+  env = launch_environ_new (flags & PV_LAUNCH_FLAGS_CLEAR_ENV);
+
+  if (env_id != 0)
+    {
+      const char * const *delta = g_hash_table_lookup (channel->env_deltas,
+                                                       GUINT_TO_POINTER (env_id));
+
+      if (delta == NULL)
+        return glnx_throw (error, "Unknown environment delta %u", env_id);
+
+      for (i = 0; delta[i] != NULL; i++)
+        env = environ_apply_entry (env, delta[i]);
+    }
+
+  while (!pv_launch_channel_frame_at_end (frame))
+    {
+      const char *entry = pv_launch_channel_frame_get_string (frame, error);
+
+      if (entry == NULL)
+        return FALSE;
+
+      env = environ_apply_entry (env, entry);
+    }
+
+  if (n_args == 0)
+    {
+      reply = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_FAILED);
+      pv_launch_channel_frame_add_string (reply, "No command given");
+    }
+  else if ((flags & ~PV_LAUNCH_FLAGS_MASK) != 0)
+    {
+      g_autofree gchar *message = NULL;
+
+      message = g_strdup_printf ("Unsupported flags enabled: 0x%x",
+                                 flags & ~PV_LAUNCH_FLAGS_MASK);
+      reply = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_FAILED);
+      pv_launch_channel_frame_add_string (reply, message);
+    }
+  else if (!spawn_child (cwd_path, (const char * const *) argv->pdata, env,
+                         fd_map, n_fds, &pid, &spawn_error))
+    {
+      g_autofree gchar *message = NULL;
+
+      message = g_strdup_printf ("Failed to start command: %s",
+                                 spawn_error->message);
+      reply = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_FAILED);
+      pv_launch_channel_frame_add_string (reply, message);
+    }
+  else
+    {
+      g_info ("Running spawn command %s", (const char *) argv->pdata[0]);
+      pid_data = track_child (pid, terminate_after);
+      pid_data->channel = fast_channel_ref (channel);
+
+      reply = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_STARTED);
+      pv_launch_channel_frame_add_uint32 (reply, pid);
+    }
+
+  return pv_launch_channel_send (channel->fd, reply, error);
+}
+
+static gboolean
+fast_channel_handle_send_signal (FastChannel *channel,
+                                 PvLaunchChannelFrame *frame,
+                                 GError **error)
+{
+  PidData *pid_data = NULL;
+  guint32 pid;
+  guint32 sig;
+  guint32 to_process_group;
+
+  if (!pv_launch_channel_frame_get_uint32 (frame, &pid, error)
+      || !pv_launch_channel_frame_get_uint32 (frame, &sig, error)
+      || !pv_launch_channel_frame_get_uint32 (frame, &to_process_group, error))
+    return FALSE;
+
+  pid_data = g_hash_table_lookup (client_pid_data_hash, GUINT_TO_POINTER (pid));
+
+  /* Silently ignore processes that have already exited or belong to
+   * another client, in the same way as a signal racing with exit */
+  if (pid_data == NULL || pid_data->channel != channel)
+    {
+      g_debug ("Not sending signal %u to unknown pid %u", sig, pid);
+      return TRUE;
+    }
+
+  g_debug ("Sending signal %u to client pid %u", sig, pid);
+
+  if (to_process_group)
+    killpg (pid_data->pid, sig);
+  else
+    kill (pid_data->pid, sig);
+
+  return TRUE;
+}
+
+static void
+fast_channel_close (FastChannel *channel)
+{
+  GHashTableIter iter;
+  gpointer value = NULL;
+
+  g_hash_table_iter_init (&iter, client_pid_data_hash);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      PidData *pid_data = value;
+
+      if (pid_data->channel == channel)
+        {
+          g_debug ("Fast channel closed, killing %d", pid_data->pid);
+          killpg (pid_data->pid, SIGINT);
+        }
+    }
+
+  glnx_close_fd (&channel->fd);
+}
+
+static gboolean
+fast_channel_readable_cb (int fd,
+                          G_GNUC_UNUSED GIOCondition condition,
+                          gpointer user_data)
+{
+  FastChannel *channel = user_data;
+  g_autoptr(PvLaunchChannelFrame) frame = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean ok;
+
+  frame = pv_launch_channel_receive (fd, &error);
+
+  if (frame == NULL)
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED))
+        g_debug ("Fast channel closed by client");
+      else
+        g_warning ("Closing fast channel: %s", error->message);
+
+      channel->watch = 0;
+      fast_channel_close (channel);
+      return G_SOURCE_REMOVE;
+    }
+
+  switch (frame->type)
+    {
+      case PV_LAUNCH_CHANNEL_FRAME_SET_ENV:
+        ok = fast_channel_handle_set_env (channel, frame, &error);
+        break;
+
+      case PV_LAUNCH_CHANNEL_FRAME_LAUNCH:
+        ok = fast_channel_handle_launch (channel, frame, &error);
+        break;
+
+      case PV_LAUNCH_CHANNEL_FRAME_SEND_SIGNAL:
+        ok = fast_channel_handle_send_signal (channel, frame, &error);
+        break;
+
+      case PV_LAUNCH_CHANNEL_FRAME_STARTED:
+      case PV_LAUNCH_CHANNEL_FRAME_FAILED:
+      case PV_LAUNCH_CHANNEL_FRAME_EXITED:
+      default:
+        ok = glnx_throw (&error, "Unexpected frame type %u", frame->type);
+        break;
+    }
+
+  if (!ok)
+    {
+      g_warning ("Closing fast channel: %s", error->message);
+      channel->watch = 0;
+      fast_channel_close (channel);
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+handle_open_fast_channel (PvLauncher1           *object,
+                          GDBusMethodInvocation *invocation,
+                          GUnixFDList           *fd_list,
+                          gint                   arg_socket)
+{
+  g_autoptr(GError) error = NULL;
+  glnx_autofd int fd = -1;
+  FastChannel *channel;
+  int type = 0;
+  socklen_t len = sizeof (type);
+
+  if (fd_list == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_INVALID_ARGS,
+                                             "No fds attached to message");
+      return G_DBUS_METHOD_INVOCATION_HANDLED;
+    }
+
+  fd = g_unix_fd_list_get (fd_list, arg_socket, &error);
+
+  if (fd < 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_INVALID_ARGS,
+                                             "Invalid socket: %s",
+                                             error->message);
+      return G_DBUS_METHOD_INVOCATION_HANDLED;
+    }
+
+  if (getsockopt (fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0
+      || type != SOCK_SEQPACKET)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_INVALID_ARGS,
+                                             "Fast channel must be a "
+                                             "SOCK_SEQPACKET socket");
+      return G_DBUS_METHOD_INVOCATION_HANDLED;
+    }
+
+  g_debug ("Opening fast channel on fd %d", fd);
+
+  channel = g_new0 (FastChannel, 1);
+  channel->refcount = 1;
+  channel->fd = glnx_steal_fd (&fd);
+  channel->env_deltas = g_hash_table_new_full (NULL, NULL, NULL,
+                                               (GDestroyNotify) g_strfreev);
+  /* The watch owns the initial reference */
+  channel->watch = g_unix_fd_add_full (G_PRIORITY_DEFAULT,
+                                       channel->fd,
+                                       G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                       fast_channel_readable_cb,
+                                       channel,
+                                       (GDestroyNotify) fast_channel_unref);
+
+  pv_launcher1_complete_open_fast_channel (object, invocation, NULL,
+                                           PV_LAUNCH_CHANNEL_PROTOCOL_VERSION);
+  return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
 static void
 name_owner_changed (GDBusConnection *connection,
                     const gchar     *sender_name,
@@ -482,7 +964,7 @@ name_owner_changed (GDBusConnection *connection,
         {
           pid_data = value;
 
-          if (g_str_equal (pid_data->client, name))
+          if (g_strcmp0 (pid_data->client, name) == 0)
             list = g_list_prepend (list, pid_data);
         }
 
@@ -509,7 +991,7 @@ export_launcher (GDBusConnection *connection,
                               launcher,   /* an arbitrary non-NULL pointer */
                               skeleton_died_cb);
 
-      pv_launcher1_set_version (PV_LAUNCHER1 (launcher), 0);
+      pv_launcher1_set_version (PV_LAUNCHER1 (launcher), 1);
       pv_launcher1_set_supported_launch_flags (PV_LAUNCHER1 (launcher),
                                                PV_LAUNCH_FLAGS_MASK);
 
@@ -519,6 +1001,8 @@ export_launcher (GDBusConnection *connection,
                         G_CALLBACK (handle_send_signal), NULL);
       g_signal_connect (launcher, "handle-terminate",
                         G_CALLBACK (handle_terminate), NULL);
+      g_signal_connect (launcher, "handle-open-fast-channel",
+                        G_CALLBACK (handle_open_fast_channel), NULL);
     }
 
   if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (launcher),
@@ -42,6 +42,7 @@
 #include "enumtypes.h"
 #include "exports.h"
 #include "flatpak-run-private.h"
+#include "flatpak-utils-base-private.h"
 #include "mtree.h"
 #include "supported-architectures.h"
 #include "tree-copy.h"
@@ -73,6 +74,9 @@ struct _PvRuntime
   const gchar *helpers_path;
   PvBwrapLock *runtime_lock;
   GStrv original_environ;
+  GStrv vulkan_layers_allow;
+  GStrv vulkan_layers_deny;
+  gchar *vulkan_icd_selector;
 
   gchar *libcapsule_knowledge;
   gchar *runtime_abi_json;
@@ -92,10 +96,13 @@ struct _PvRuntime
   const gchar *host_in_current_namespace;
   EnumerationThread indep_thread;
   EnumerationThread *arch_threads;
+  GThread *prewarm_thread;
 
   PvRuntimeFlags flags;
   int variable_dir_fd;
   int mutable_sysroot_fd;
+  int tmpdir_sync_fd;
+  int prewarm_fd;
   gboolean any_libc_from_provider;
   gboolean all_libc_from_provider;
   gboolean runtime_is_just_usr;
@@ -303,6 +310,8 @@ pv_runtime_init (PvRuntime *self)
   self->all_libc_from_provider = FALSE;
   self->variable_dir_fd = -1;
   self->mutable_sysroot_fd = -1;
+  self->tmpdir_sync_fd = -1;
+  self->prewarm_fd = -1;
   self->is_flatpak_env = g_file_test ("/.flatpak-info",
                                       G_FILE_TEST_IS_REGULAR);
 }
@@ -1686,6 +1695,69 @@ pv_runtime_initable_init (GInitable *initable,
   return TRUE;
 }
 
+/* Runs in the child process after fork(), so this must only call
+ * async-signal-safe functions */
+static void
+delete_tmpdir_child_setup_cb (gpointer user_data)
+{
+  int sync_fd = GPOINTER_TO_INT (user_data);
+
+  setsid ();
+
+  /* Read the sync pipe on stdin, so that `cat` will wait for EOF.
+   * dup2() clears FD_CLOEXEC on the new fd. */
+  if (dup2 (sync_fd, STDIN_FILENO) < 0)
+    _exit (1);
+
+  /* We must not hold a copy of the write end of the sync pipe,
+   * or it would never reach EOF */
+  flatpak_close_fds_workaround (3);
+}
+
+/*
+ * Delete self->tmpdir in a detached process, after every copy of
+ * the write end of self->tmpdir_sync_fd has been closed. bwrap keeps
+ * its copy open for as long as the container is running, and if we
+ * fail before running bwrap, our copy is closed when we exit.
+ *
+ * We might have other threads at this point, so the child process
+ * execs a shell instead of doing the deletion itself.
+ */
+static void
+pv_runtime_delete_tmpdir_later (PvRuntime *self)
+{
+  g_autoptr(GError) local_error = NULL;
+  const char * const argv[] =
+  {
+    "/bin/sh",
+    "-c",
+    "cat > /dev/null; exec rm -fr -- \"$1\"",
+    "sh",
+    self->tmpdir,
+    NULL
+  };
+
+  g_return_if_fail (self->tmpdir != NULL);
+  g_return_if_fail (self->tmpdir_sync_fd >= 0);
+
+  /* Without G_SPAWN_DO_NOT_REAP_CHILD, GLib uses an intermediate process,
+   * so the shell is not our child and will not be waited for.
+   * We use LEAVE_DESCRIPTORS_OPEN to work around a deadlock in older GLib,
+   * see flatpak_close_fds_workaround */
+  if (!g_spawn_async (NULL,
+                      (gchar **) argv,
+                      NULL,
+                      (G_SPAWN_LEAVE_DESCRIPTORS_OPEN |
+                       G_SPAWN_STDOUT_TO_DEV_NULL |
+                       G_SPAWN_STDERR_TO_DEV_NULL),
+                      delete_tmpdir_child_setup_cb,
+                      GINT_TO_POINTER (self->tmpdir_sync_fd),
+                      NULL,
+                      &local_error))
+    g_warning ("Unable to delete temporary directory \"%s\" later: %s",
+               self->tmpdir, local_error->message);
+}
+
 void
 pv_runtime_cleanup (PvRuntime *self)
 {
@@ -1693,13 +1765,27 @@ pv_runtime_cleanup (PvRuntime *self)
 
   g_return_if_fail (PV_IS_RUNTIME (self));
 
-  if (self->tmpdir != NULL &&
-      !glnx_shutil_rm_rf_at (-1, self->tmpdir, NULL, &local_error))
+  /* The prewarm thread might be reading files from the overrides,
+   * which are in self->tmpdir */
+  if (self->prewarm_thread != NULL)
+    g_thread_join (g_steal_pointer (&self->prewarm_thread));
+
+  if (self->tmpdir != NULL && self->tmpdir_sync_fd >= 0)
+    {
+      /* The container's view of the overrides is a bind-mount of part
+       * of self->tmpdir, so it needs to stay there until the container
+       * exits */
+      pv_runtime_delete_tmpdir_later (self);
+    }
+  else if (self->tmpdir != NULL &&
+           !glnx_shutil_rm_rf_at (-1, self->tmpdir, NULL, &local_error))
     {
       g_warning ("Unable to delete temporary directory: %s",
                  local_error->message);
     }
 
+  glnx_close_fd (&self->tmpdir_sync_fd);
+
   g_clear_pointer (&self->overrides, g_free);
   g_clear_pointer (&self->container_access, g_free);
   g_clear_pointer (&self->container_access_adverb, flatpak_bwrap_free);
@@ -1727,12 +1813,16 @@ pv_runtime_finalize (GObject *object)
   pv_runtime_cleanup (self);
   g_free (self->bubblewrap);
   g_strfreev (self->original_environ);
+  g_strfreev (self->vulkan_layers_allow);
+  g_strfreev (self->vulkan_layers_deny);
+  g_free (self->vulkan_icd_selector);
   g_free (self->libcapsule_knowledge);
   g_free (self->runtime_abi_json);
   glnx_close_fd (&self->variable_dir_fd);
   g_free (self->variable_dir);
   glnx_close_fd (&self->mutable_sysroot_fd);
   g_free (self->mutable_sysroot);
+  glnx_close_fd (&self->prewarm_fd);
   g_free (self->runtime_files_on_host);
   g_free (self->runtime_app);
   g_free (self->runtime_usr);
@@ -1837,6 +1927,31 @@ pv_runtime_new (const char *source,
                          NULL);
 }
 
+/*
+ * Returns: %TRUE if the overrides for @multiarch_tuple include library
+ *  aliases, which are not SONAMEs and so cannot be found via ld.so.cache
+ */
+static gboolean
+pv_runtime_has_library_aliases (PvRuntime *self,
+                                const char *multiarch_tuple)
+{
+  g_auto(GLnxDirFdIterator) iter = { FALSE };
+  g_autofree gchar *path = NULL;
+  struct dirent *dent;
+
+  path = g_build_filename (self->overrides, "lib", multiarch_tuple,
+                           "aliases", NULL);
+
+  if (!glnx_dirfd_iterator_init_at (AT_FDCWD, path, FALSE, &iter, NULL))
+    return FALSE;
+
+  /* If in doubt, assume there are aliases */
+  if (!glnx_dirfd_iterator_next_dent (&iter, &dent, NULL, NULL))
+    return TRUE;
+
+  return dent != NULL;
+}
+
 static void
 pv_runtime_adverb_regenerate_ld_so_cache (PvRuntime *self,
                                           FlatpakBwrap *adverb_argv)
@@ -1893,11 +2008,18 @@ pv_runtime_adverb_regenerate_ld_so_cache (PvRuntime *self,
        * the runtime's older version. Work around this by adding the
        * provider's version to LD_LIBRARY_PATH *as well as* regenerating
        * the ld.so.cache - this will not work for games that incorrectly
-       * reset the LD_LIBRARY_PATH, but is better than nothing! */
-      if (self->mutable_sysroot == NULL)
+       * reset the LD_LIBRARY_PATH, but is better than nothing!
+       * In ld.so.cache-only mode the user has opted out of this. */
+      if (self->mutable_sysroot == NULL
+          && !(self->flags & PV_RUNTIME_FLAGS_LD_SO_CACHE_ONLY))
         pv_search_path_append (ldlp_after_regen, ld_path);
 
-      pv_search_path_append (ldlp_after_regen, aliases);
+      /* Every directory in the LD_LIBRARY_PATH costs a failed lookup
+       * for each library that is not in it, so in ld.so.cache-only mode
+       * we only keep the aliases directories that are non-empty. */
+      if (!(self->flags & PV_RUNTIME_FLAGS_LD_SO_CACHE_ONLY)
+          || pv_runtime_has_library_aliases (self, pv_multiarch_tuples[i]))
+        pv_search_path_append (ldlp_after_regen, aliases);
     }
 
   flatpak_bwrap_add_args (adverb_argv,
@@ -1963,6 +2085,15 @@ pv_runtime_get_adverb (PvRuntime *self,
                               NULL);
     }
 
+  if (self->prewarm_fd >= 0)
+    {
+      int fd = glnx_steal_fd (&self->prewarm_fd);
+
+      g_debug ("Passing file access list fd %d down to adverb", fd);
+      flatpak_bwrap_add_fd (bwrap, fd);
+      flatpak_bwrap_add_arg_printf (bwrap, "--record-mapped-files=%d", fd);
+    }
+
   pv_runtime_adverb_regenerate_ld_so_cache (self, bwrap);
 
   return TRUE;
@@ -1971,8 +2102,8 @@ pv_runtime_get_adverb (PvRuntime *self,
 /*
  * Set self->container_access_adverb to a (possibly empty) command prefix
  * that will result in the container being available at
- * self->container_access, with write access to self->overrides, and
- * read-only access to everything else.
+ * self->container_access, with write access to self->overrides.
+ * The tools run with this prefix must not write to the container.
  */
 static gboolean
 pv_runtime_provide_container_access (PvRuntime *self,
@@ -2029,16 +2160,14 @@ pv_runtime_provide_container_access (PvRuntime *self,
     }
   else
     {
-      g_autofree gchar *etc = NULL;
-      g_autofree gchar *etc_dest = NULL;
-
-      if (self->bubblewrap == NULL)
-        return glnx_throw (error,
-                           "Cannot run bubblewrap to set up runtime");
-
-      /* Otherwise, will we need to use bwrap to build a directory hierarchy
-       * that is the same shape as the final system. */
-      g_info ("%s: Using bwrap to set up runtime that is just /usr",
+      /* Otherwise, we need a directory hierarchy that is the same shape
+       * as the final system. We used to run every capsule-capture-libs
+       * call in a bwrap subsandbox that bind-mounted the runtime into
+       * place, but that costs a user and mount namespace per call.
+       * capsule-capture-libs only reads from the container, and resolves
+       * symbolic links itself when it needs to stay inside it, so a tree
+       * of symbolic links set up once is equivalent. */
+      g_info ("%s: Using symlinks to set up runtime that is just /usr",
               G_STRFUNC);
 
       /* By design, writeable copies of the runtime never need this:
@@ -2047,31 +2176,13 @@ pv_runtime_provide_container_access (PvRuntime *self,
       g_assert (self->tmpdir != NULL);
 
       self->container_access = g_build_filename (self->tmpdir, "mnt", NULL);
-      g_mkdir (self->container_access, 0700);
-
-      self->container_access_adverb = flatpak_bwrap_new (NULL);
-      flatpak_bwrap_add_args (self->container_access_adverb,
-                              self->bubblewrap,
-                              "--ro-bind", "/", "/",
-                              "--bind", self->overrides, self->overrides,
-                              "--tmpfs", self->container_access,
-                              NULL);
 
-      if (!pv_bwrap_bind_usr (self->container_access_adverb,
-                              self->runtime_files_on_host,
-                              self->runtime_files,
-                              self->container_access,
-                              error))
+      if (!pv_symlink_usr_into_sysroot (self->runtime_files,
+                                        self->container_access,
+                                        error))
         return FALSE;
 
-      /* For simplicity we bind all of /etc here */
-      etc = g_build_filename (self->runtime_files_on_host,
-                              "etc", NULL);
-      etc_dest = g_build_filename (self->container_access,
-                                   "etc", NULL);
-      flatpak_bwrap_add_args (self->container_access_adverb,
-                              "--ro-bind", etc, etc_dest,
-                              NULL);
+      self->container_access_adverb = flatpak_bwrap_new (NULL);
     }
 
   return TRUE;
@@ -2183,7 +2294,10 @@ typedef struct
    * or (type SrtVaApiDriver) or (type SrtVulkanLayer) or
    * (type SrtDriDriver) */
   gpointer icd;
-  gchar *resolved_library;
+  /* Last entry is always NULL; keyed by the index of a multiarch
+   * tuple in multiarch_tuples, because Vulkan layers can resolve
+   * to a different library for each architecture */
+  gchar *resolved_libraries[PV_N_SUPPORTED_ARCHITECTURES + 1];
   /* Last entry is always NONEXISTENT; keyed by the index of a multiarch
    * tuple in multiarch_tuples. */
   IcdKind kinds[PV_N_SUPPORTED_ARCHITECTURES + 1];
@@ -2208,10 +2322,10 @@ icd_details_new (gpointer icd)
 
   self = g_slice_new0 (IcdDetails);
   self->icd = g_object_ref (icd);
-  self->resolved_library = NULL;
 
   for (i = 0; i < PV_N_SUPPORTED_ARCHITECTURES + 1; i++)
     {
+      self->resolved_libraries[i] = NULL;
       self->kinds[i] = ICD_KIND_NONEXISTENT;
       self->paths_in_container[i] = NULL;
     }
@@ -2225,10 +2339,12 @@ icd_details_free (IcdDetails *self)
   gsize i;
 
   g_object_unref (self->icd);
-  g_free (self->resolved_library);
 
   for (i = 0; i < PV_N_SUPPORTED_ARCHITECTURES + 1; i++)
-    g_free (self->paths_in_container[i]);
+    {
+      g_free (self->resolved_libraries[i]);
+      g_free (self->paths_in_container[i]);
+    }
 
   g_slice_free (IcdDetails, self);
 }
@@ -2317,13 +2433,15 @@ bind_icd (PvRuntime *self,
   gsize dir_elements_before = 0;
   gsize dir_elements_after = 0;
   const gchar *subdir = requested_subdir;
+  const gchar *resolved_library;
 
   g_return_val_if_fail (self->provider != NULL, FALSE);
   g_return_val_if_fail (runtime_architecture_check_valid (arch), FALSE);
   g_return_val_if_fail (subdir != NULL, FALSE);
   g_return_val_if_fail (details != NULL, FALSE);
-  g_return_val_if_fail (details->resolved_library != NULL, FALSE);
   multiarch_index = arch->multiarch_index;
+  resolved_library = details->resolved_libraries[multiarch_index];
+  g_return_val_if_fail (resolved_library != NULL, FALSE);
   g_return_val_if_fail (details->kinds[multiarch_index] == ICD_KIND_NONEXISTENT,
                         FALSE);
   g_return_val_if_fail (details->paths_in_container[multiarch_index] == NULL,
@@ -2332,9 +2450,9 @@ bind_icd (PvRuntime *self,
   g_return_val_if_fail (dependency_patterns != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  g_info ("Capturing loadable module: %s", details->resolved_library);
+  g_info ("Capturing loadable module: %s", resolved_library);
 
-  if (g_path_is_absolute (details->resolved_library))
+  if (g_path_is_absolute (resolved_library))
     {
       details->kinds[multiarch_index] = ICD_KIND_ABSOLUTE;
       mode = "path";
@@ -2354,7 +2472,7 @@ bind_icd (PvRuntime *self,
     return glnx_throw_errno_prefix (error, "Unable to create %s",
                                     in_current_namespace);
 
-  base = glnx_basename (details->resolved_library);
+  base = glnx_basename (resolved_library);
 
   /* Check whether we can get away with avoiding the sequence number.
    * Depending on the type of ICD, we might want to use the sequence
@@ -2401,9 +2519,9 @@ bind_icd (PvRuntime *self,
     dir_elements_before++;
 
   pattern = g_strdup_printf ("no-dependencies:even-if-older:%s:%s:%s",
-                             options, mode, details->resolved_library);
+                             options, mode, resolved_library);
   dependency_pattern = g_strdup_printf ("only-dependencies:%s:%s:%s",
-                                        options, mode, details->resolved_library);
+                                        options, mode, resolved_library);
 
   if (!pv_runtime_provide_container_access (self, error))
     return FALSE;
@@ -2456,7 +2574,7 @@ bind_icd (PvRuntime *self,
       details->paths_in_container[multiarch_index] = g_build_filename (arch->libdir_in_container,
                                                                        subdir,
                                                                        seq_str ? seq_str : "",
-                                                                       glnx_basename (details->resolved_library),
+                                                                       glnx_basename (resolved_library),
                                                                        NULL);
     }
 
@@ -2929,12 +3047,34 @@ bind_runtime_finish (PvRuntime *self,
 
   if (self->mutable_sysroot == NULL)
     {
-      /* self->overrides is in a temporary directory that will be
-       * cleaned up before we enter the container, so we need to convert
-       * it into a series of --dir and --symlink instructions.
+      int sync_fds[2];
+
+      /* self->overrides is in a temporary directory. Mount it into the
+       * container as a single tree, and keep the temporary directory
+       * until bwrap closes the --sync-fd when the container exits.
+       * This costs the same however many graphics driver files we have.
        *
        * We have to do this late, because it adds data fds. */
-      pv_bwrap_copy_tree (bwrap, self->overrides, self->overrides_in_container);
+      if (pipe2 (sync_fds, O_CLOEXEC) == 0)
+        {
+          glnx_close_fd (&self->tmpdir_sync_fd);
+          self->tmpdir_sync_fd = sync_fds[0];
+          flatpak_bwrap_add_args (bwrap,
+                                  "--ro-bind", self->overrides,
+                                  self->overrides_in_container,
+                                  NULL);
+          flatpak_bwrap_add_args_data_fd (bwrap, "--sync-fd", sync_fds[1],
+                                          NULL);
+        }
+      else
+        {
+          /* The temporary directory will be cleaned up before we
+           * enter the container, so we need to convert it into a
+           * series of --dir and --symlink instructions. */
+          g_debug ("Unable to create sync pipe: %s", g_strerror (errno));
+          pv_bwrap_copy_tree (bwrap, self->overrides,
+                              self->overrides_in_container);
+        }
     }
 
   /* /etc/localtime and /etc/resolv.conf can not exist (or be symlinks to
@@ -3821,6 +3961,7 @@ collect_vulkan_layers (PvRuntime *self,
   for (j = 0; j < layer_details->len; j++)
     {
       g_autoptr(SrtLibrary) library = NULL;
+      g_autofree gchar *resolved_library = NULL;
       SrtLibraryIssues issues;
       IcdDetails *details = g_ptr_array_index (layer_details, j);
       SrtVulkanLayer *layer = SRT_VULKAN_LAYER (details->icd);
@@ -3845,16 +3986,16 @@ collect_vulkan_layers (PvRuntime *self,
       /* If the library_path is relative to the JSON file, turn it into an
        * absolute path. If it's already absolute, or if it's a basename to be
        * looked up in the system library search path, use it as-is. */
-      details->resolved_library = srt_vulkan_layer_resolve_library_path (layer);
-      g_assert (details->resolved_library != NULL);
-
-      if (strchr (details->resolved_library, '/') != NULL &&
-          (strstr (details->resolved_library, "$ORIGIN/") != NULL ||
-           strstr (details->resolved_library, "${ORIGIN}") != NULL ||
-           strstr (details->resolved_library, "$LIB/") != NULL ||
-           strstr (details->resolved_library, "${LIB}") != NULL ||
-           strstr (details->resolved_library, "$PLATFORM/") != NULL ||
-           strstr (details->resolved_library, "${PLATFORM}") != NULL))
+      resolved_library = srt_vulkan_layer_resolve_library_path (layer);
+      g_assert (resolved_library != NULL);
+
+      if (strchr (resolved_library, '/') != NULL &&
+          (strstr (resolved_library, "$ORIGIN/") != NULL ||
+           strstr (resolved_library, "${ORIGIN}") != NULL ||
+           strstr (resolved_library, "$LIB/") != NULL ||
+           strstr (resolved_library, "${LIB}") != NULL ||
+           strstr (resolved_library, "$PLATFORM/") != NULL ||
+           strstr (resolved_library, "${PLATFORM}") != NULL))
         {
           /* When loading a library by its absolute or relative path
            * (but not when searching the library path for its basename),
@@ -3867,7 +4008,7 @@ collect_vulkan_layers (PvRuntime *self,
           if (g_strcmp0 (self->provider->path_in_current_ns, "/") == 0)
             {
               /* It's in our current namespace, so we can dlopen it. */
-              issues = srt_check_library_presence (details->resolved_library,
+              issues = srt_check_library_presence (resolved_library,
                                                    arch->details->tuple, NULL,
                                                    SRT_LIBRARY_SYMBOLS_FORMAT_PLAIN,
                                                    &library);
@@ -3875,12 +4016,12 @@ collect_vulkan_layers (PvRuntime *self,
                             SRT_LIBRARY_ISSUES_UNKNOWN |
                             SRT_LIBRARY_ISSUES_TIMEOUT))
                 {
-                  g_info ("Unable to load library %s: %s", details->resolved_library,
+                  g_info ("Unable to load library %s: %s", resolved_library,
                           srt_library_get_messages (library));
                   continue;
                 }
-              g_free (details->resolved_library);
-              details->resolved_library = g_strdup (srt_library_get_absolute_path (library));
+              g_free (resolved_library);
+              resolved_library = g_strdup (srt_library_get_absolute_path (library));
             }
           else
             {
@@ -3891,6 +4032,9 @@ collect_vulkan_layers (PvRuntime *self,
             }
         }
 
+      details->resolved_libraries[arch->multiarch_index] =
+        g_steal_pointer (&resolved_library);
+
       if (!bind_icd (self, arch, j, dir_name, details, &use_numbered_subdirs,
                      use_subdir_for_kind_soname, dependency_patterns, NULL, error))
         return FALSE;
@@ -4214,6 +4358,95 @@ typedef enum
   PV_RUNTIME_DATA_FLAGS_NONE = 0
 } PvRuntimeDataFlags;
 
+/*
+ * Look for the data directory @dir_basename belonging to a library
+ * in @prefix, in the provider. This is the part of
+ * pv_runtime_collect_lib_data() that needs to stat the provider.
+ *
+ * Returns: (transfer full) (nullable): The data directory in the provider,
+ *  or %NULL if not found
+ */
+static gchar *
+pv_runtime_probe_lib_data (PvRuntime *self,
+                           const char *dir_basename,
+                           const char *prefix,
+                           PvRuntimeDataFlags flags)
+{
+  g_autofree gchar *dir_in_provider = NULL;
+  g_autofree gchar *dir_in_provider_usr_share = NULL;
+
+  /* If we are unable to find the lib data in the provider, we try as
+   * a last resort `/usr/share`. This should help for example Exherbo
+   * that uses the unusual `/usr/${gnu_tuple}/lib` path for shared
+   * libraries.
+   *
+   * Some libraries, like the NVIDIA proprietary driver, hard-code
+   * /usr/share even if they are installed in some other location.
+   * For these libraries, we look in this /usr/share-based path
+   * *first*. */
+  dir_in_provider_usr_share = g_build_filename ("/usr", "share", dir_basename, NULL);
+
+  if ((flags & PV_RUNTIME_DATA_FLAGS_USR_SHARE_FIRST)
+      && _srt_file_test_in_sysroot (self->provider->path_in_current_ns,
+                                    self->provider->fd,
+                                    dir_in_provider_usr_share,
+                                    G_FILE_TEST_IS_DIR))
+    {
+      g_debug ("Using %s based on hard-coded /usr/share",
+               dir_in_provider_usr_share);
+      return g_steal_pointer (&dir_in_provider_usr_share);
+    }
+
+  dir_in_provider = g_build_filename (prefix, "share", dir_basename, NULL);
+
+  if (_srt_file_test_in_sysroot (self->provider->path_in_current_ns,
+                                 self->provider->fd,
+                                 dir_in_provider,
+                                 G_FILE_TEST_IS_DIR))
+    {
+      g_debug ("Using %s based on library path %s",
+               dir_in_provider, prefix);
+      return g_steal_pointer (&dir_in_provider);
+    }
+
+  if (!(flags & PV_RUNTIME_DATA_FLAGS_USR_SHARE_FIRST)
+      && _srt_file_test_in_sysroot (self->provider->path_in_current_ns,
+                                    self->provider->fd,
+                                    dir_in_provider_usr_share,
+                                    G_FILE_TEST_IS_DIR))
+    {
+      g_debug ("Using %s based on fallback to /usr/share",
+               dir_in_provider_usr_share);
+      return g_steal_pointer (&dir_in_provider_usr_share);
+    }
+
+  if (g_strcmp0 (dir_in_provider, dir_in_provider_usr_share) == 0)
+    g_info ("We were expecting the %s directory in the provider to "
+            "be located in \"%s\", but instead it is missing",
+            dir_basename, dir_in_provider);
+  else
+    g_info ("We were expecting the %s directory in the provider to "
+            "be located in \"%s\" or \"%s\", but instead it is missing",
+            dir_basename, dir_in_provider, dir_in_provider_usr_share);
+
+  return NULL;
+}
+
+/*
+ * pv_runtime_collect_lib_data:
+ * @dir_basename: The name of a data directory, such as `drirc.d`
+ * @lib_path: The library in the overrides that owns the data directory
+ * @probes: (element-type utf8 filename): Results of previous calls to
+ *  pv_runtime_probe_lib_data(), with %NULL representing a directory
+ *  that was not found
+ * @data_in_provider: (element-type filename ignored): The data
+ *  directories to be mounted
+ *
+ * If @lib_path was captured from the provider, add its data directory
+ * to @data_in_provider. Libraries for different architectures usually
+ * share a prefix, so the results of looking for the directory are
+ * remembered in @probes to avoid repeating them.
+ */
 static void
 pv_runtime_collect_lib_data (PvRuntime *self,
                              RuntimeArchitecture *arch,
@@ -4221,6 +4454,7 @@ pv_runtime_collect_lib_data (PvRuntime *self,
                              const char *lib_path,
                              const char *provider_in_container_namespace_guarded,
                              PvRuntimeDataFlags flags,
+                             GHashTable *probes,
                              GHashTable *data_in_provider)
 {
   g_autofree char *target = NULL;
@@ -4232,32 +4466,8 @@ pv_runtime_collect_lib_data (PvRuntime *self,
     {
       g_autofree gchar *dir = NULL;
       g_autofree gchar *lib_multiarch = NULL;
-      g_autofree gchar *dir_in_provider = NULL;
-      g_autofree gchar *dir_in_provider_usr_share = NULL;
-
-      /* If we are unable to find the lib data in the provider, we try as
-       * a last resort `/usr/share`. This should help for example Exherbo
-       * that uses the unusual `/usr/${gnu_tuple}/lib` path for shared
-       * libraries.
-       *
-       * Some libraries, like the NVIDIA proprietary driver, hard-code
-       * /usr/share even if they are installed in some other location.
-       * For these libraries, we look in this /usr/share-based path
-       * *first*. */
-      dir_in_provider_usr_share = g_build_filename ("/usr", "share", dir_basename, NULL);
-
-      if ((flags & PV_RUNTIME_DATA_FLAGS_USR_SHARE_FIRST)
-          && _srt_file_test_in_sysroot (self->provider->path_in_current_ns,
-                                        self->provider->fd,
-                                        dir_in_provider_usr_share,
-                                        G_FILE_TEST_IS_DIR))
-        {
-          g_debug ("Using %s based on hard-coded /usr/share",
-                   dir_in_provider_usr_share);
-          g_hash_table_add (data_in_provider,
-                            g_steal_pointer (&dir_in_provider_usr_share));
-          return;
-        }
+      g_autofree gchar *key = NULL;
+      gchar *found = NULL;
 
       dir = g_path_get_dirname (target);
 
@@ -4276,41 +4486,17 @@ pv_runtime_collect_lib_data (PvRuntime *self,
                  dir + strlen (self->provider->path_in_container_ns),
                  strlen (dir) - strlen (self->provider->path_in_container_ns) + 1);
 
-      dir_in_provider = g_build_filename (dir, "share", dir_basename, NULL);
-
-      if (_srt_file_test_in_sysroot (self->provider->path_in_current_ns,
-                                     self->provider->fd,
-                                     dir_in_provider,
-                                     G_FILE_TEST_IS_DIR))
-        {
-          g_debug ("Using %s based on library path %s",
-                   dir_in_provider, dir);
-          g_hash_table_add (data_in_provider,
-                            g_steal_pointer (&dir_in_provider));
-          return;
-        }
+      key = g_strdup_printf ("%s:%d:%s", dir_basename, flags, dir);
 
-      if (!(flags & PV_RUNTIME_DATA_FLAGS_USR_SHARE_FIRST)
-          && _srt_file_test_in_sysroot (self->provider->path_in_current_ns,
-                                        self->provider->fd,
-                                        dir_in_provider_usr_share,
-                                        G_FILE_TEST_IS_DIR))
+      if (!g_hash_table_lookup_extended (probes, key, NULL, (gpointer *) &found))
         {
-          g_debug ("Using %s based on fallback to /usr/share",
-                   dir_in_provider_usr_share);
-          g_hash_table_add (data_in_provider,
-                            g_steal_pointer (&dir_in_provider_usr_share));
-          return;
+          found = pv_runtime_probe_lib_data (self, dir_basename, dir, flags);
+          /* Takes ownership of both */
+          g_hash_table_replace (probes, g_steal_pointer (&key), found);
         }
 
-      if (g_strcmp0 (dir_in_provider, dir_in_provider_usr_share) == 0)
-        g_info ("We were expecting the %s directory in the provider to "
-                "be located in \"%s\", but instead it is missing",
-                dir_basename, dir_in_provider);
-      else
-        g_info ("We were expecting the %s directory in the provider to "
-                "be located in \"%s\" or \"%s\", but instead it is missing",
-                dir_basename, dir_in_provider, dir_in_provider_usr_share);
+      if (found != NULL)
+        g_hash_table_add (data_in_provider, g_strdup (found));
     }
 }
 
@@ -4723,8 +4909,9 @@ collect_egl_drivers (PvRuntime *self,
       if (!srt_egl_icd_check_error (icd, NULL))
         continue;
 
-      details->resolved_library = srt_egl_icd_resolve_library_path (icd);
-      g_assert (details->resolved_library != NULL);
+      details->resolved_libraries[arch->multiarch_index] =
+        srt_egl_icd_resolve_library_path (icd);
+      g_assert (details->resolved_libraries[arch->multiarch_index] != NULL);
 
       if (!bind_icd (self, arch, j, "glvnd", details,
                      &use_numbered_subdirs, use_subdir_for_kind_soname,
@@ -4767,8 +4954,9 @@ collect_vulkan_icds (PvRuntime *self,
       if (!srt_vulkan_icd_check_error (icd, NULL))
         continue;
 
-      details->resolved_library = srt_vulkan_icd_resolve_library_path (icd);
-      g_assert (details->resolved_library != NULL);
+      details->resolved_libraries[arch->multiarch_index] =
+        srt_vulkan_icd_resolve_library_path (icd);
+      g_assert (details->resolved_libraries[arch->multiarch_index] != NULL);
 
       if (!bind_icd (self, arch, j, "vulkan", details,
                      &use_numbered_subdirs, use_subdir_for_kind_soname,
@@ -4814,9 +5002,10 @@ collect_vdpau_drivers (PvRuntime *self,
   for (icd_iter = vdpau_drivers, j = 0; icd_iter != NULL; icd_iter = icd_iter->next, j++)
     {
       g_autoptr(IcdDetails) details = icd_details_new (icd_iter->data);
-      details->resolved_library = srt_vdpau_driver_resolve_library_path (details->icd);
-      g_assert (details->resolved_library != NULL);
-      g_assert (g_path_is_absolute (details->resolved_library));
+      details->resolved_libraries[arch->multiarch_index] =
+        srt_vdpau_driver_resolve_library_path (details->icd);
+      g_assert (details->resolved_libraries[arch->multiarch_index] != NULL);
+      g_assert (g_path_is_absolute (details->resolved_libraries[arch->multiarch_index]));
 
       /* In practice we won't actually use the sequence number for VDPAU
        * because they can only be located in a single directory,
@@ -4869,9 +5058,10 @@ collect_dri_drivers (PvRuntime *self,
     {
       g_autoptr(IcdDetails) details = icd_details_new (icd_iter->data);
 
-      details->resolved_library = srt_dri_driver_resolve_library_path (details->icd);
-      g_assert (details->resolved_library != NULL);
-      g_assert (g_path_is_absolute (details->resolved_library));
+      details->resolved_libraries[arch->multiarch_index] =
+        srt_dri_driver_resolve_library_path (details->icd);
+      g_assert (details->resolved_libraries[arch->multiarch_index] != NULL);
+      g_assert (g_path_is_absolute (details->resolved_libraries[arch->multiarch_index]));
 
       if (!bind_icd (self, arch, j, "dri", details,
                      &use_numbered_subdirs, use_subdir_for_kind_soname,
@@ -4920,9 +5110,10 @@ collect_va_api_drivers (PvRuntime *self,
     {
       g_autoptr(IcdDetails) details = icd_details_new (icd_iter->data);
 
-      details->resolved_library = srt_va_api_driver_resolve_library_path (details->icd);
-      g_assert (details->resolved_library != NULL);
-      g_assert (g_path_is_absolute (details->resolved_library));
+      details->resolved_libraries[arch->multiarch_index] =
+        srt_va_api_driver_resolve_library_path (details->icd);
+      g_assert (details->resolved_libraries[arch->multiarch_index] != NULL);
+      g_assert (g_path_is_absolute (details->resolved_libraries[arch->multiarch_index]));
 
       if (!bind_icd (self, arch, j, "dri", details,
                      &use_numbered_subdirs, use_subdir_for_kind_soname,
@@ -4934,143 +5125,1051 @@ collect_va_api_drivers (PvRuntime *self,
 }
 
 static gboolean
-pv_runtime_use_provider_graphics_stack (PvRuntime *self,
-                                        FlatpakBwrap *bwrap,
-                                        PvEnviron *container_env,
-                                        GError **error)
+vulkan_layer_name_matches (const char *name,
+                           GStrv patterns)
 {
-  gsize i, j;
-  g_autoptr(GString) dri_path = g_string_new ("");
-  g_autoptr(GString) egl_path = g_string_new ("");
-  g_autoptr(GString) vulkan_path = g_string_new ("");
-  /* We are currently using the explicit and implicit Vulkan layer paths
-   * only to check if we binded at least a single layer */
-  g_autoptr(GString) vulkan_exp_layer_path = g_string_new ("");
-  g_autoptr(GString) vulkan_imp_layer_path = g_string_new ("");
-  g_autoptr(GString) va_api_path = g_string_new ("");
-  gboolean any_architecture_works = FALSE;
-  g_autoptr(SrtSystemInfo) system_info = NULL;
-  g_autoptr(SrtObjectList) egl_icds = NULL;
-  g_autoptr(SrtObjectList) vulkan_icds = NULL;
-  g_autoptr(SrtObjectList) vulkan_explicit_layers = NULL;
-  g_autoptr(SrtObjectList) vulkan_implicit_layers = NULL;
-  g_autoptr(GPtrArray) egl_icd_details = NULL;      /* (element-type IcdDetails) */
-  g_autoptr(GPtrArray) vulkan_icd_details = NULL;   /* (element-type IcdDetails) */
-  g_autoptr(GPtrArray) vulkan_exp_layer_details = NULL;   /* (element-type IcdDetails) */
-  g_autoptr(GPtrArray) vulkan_imp_layer_details = NULL;   /* (element-type IcdDetails) */
-  G_GNUC_UNUSED g_autoptr(SrtProfilingTimer) timer = NULL;
-  g_autoptr(SrtProfilingTimer) part_timer = NULL;
-  guint n_egl_icds;
-  guint n_vulkan_icds;
-  const GList *icd_iter;
-  gboolean all_libglx_from_provider = TRUE;
-  gboolean all_libdrm_from_provider = TRUE;
-  g_autoptr(GHashTable) drirc_data_in_provider = g_hash_table_new_full (g_str_hash,
-                                                                        g_str_equal,
-                                                                        g_free, NULL);
-  g_autoptr(GHashTable) libdrm_data_in_provider = g_hash_table_new_full (g_str_hash,
-                                                                         g_str_equal,
-                                                                         g_free, NULL);
-  g_autoptr(GHashTable) nvidia_data_in_provider = g_hash_table_new_full (g_str_hash,
-                                                                         g_str_equal,
-                                                                         g_free, NULL);
-  g_autoptr(GHashTable) gconv_in_provider = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                                     g_free, NULL);
-  g_autofree gchar *provider_in_container_namespace_guarded = NULL;
+  gsize i;
 
-  g_return_val_if_fail (PV_IS_RUNTIME (self), FALSE);
-  g_return_val_if_fail (self->provider != NULL, FALSE);
-  g_return_val_if_fail (bwrap != NULL || self->mutable_sysroot != NULL, FALSE);
-  g_return_val_if_fail (bwrap == NULL || !pv_bwrap_was_finished (bwrap), FALSE);
-  g_return_val_if_fail (container_env != NULL, FALSE);
-  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  if (name == NULL || patterns == NULL)
+    return FALSE;
 
-  timer = _srt_profiling_start ("Using graphics stack from %s",
-                                self->provider->path_in_current_ns);
+  for (i = 0; patterns[i] != NULL; i++)
+    {
+      if (g_pattern_match_simple (patterns[i], name))
+        return TRUE;
+    }
 
-  if (g_str_has_suffix (self->provider->path_in_container_ns, "/"))
-    provider_in_container_namespace_guarded =
-      g_strdup (self->provider->path_in_container_ns);
-  else
-    provider_in_container_namespace_guarded =
-      g_strdup_printf ("%s/", self->provider->path_in_container_ns);
+  return FALSE;
+}
 
-  if (!pv_runtime_provide_container_access (self, error))
-    return FALSE;
+typedef struct
+{
+  guint16 pci_vendor;
+  const char * const drivers[5];
+} VulkanVendorDrivers;
 
-  if (self->flags & PV_RUNTIME_FLAGS_SINGLE_THREAD)
-    system_info = pv_graphics_provider_create_system_info (self->provider);
-  else
-    system_info = g_object_ref (enumeration_thread_join (&self->indep_thread));
+/*
+ * Names of the Vulkan drivers that can drive each vendor's GPUs,
+ * in the form returned by pv_runtime_get_vulkan_driver_name()
+ */
+static const VulkanVendorDrivers vulkan_vendor_drivers[] =
+{
+  /* AMD: RADV, AMDVLK */
+  { 0x1002, { "radeon", "amdvlk", "amdvlk32", "amdvlk64", NULL } },
+  /* Intel: ANV, HASVK */
+  { 0x8086, { "intel", "intel_hasvk", NULL } },
+  /* NVIDIA: proprietary, NVK */
+  { 0x10de, { "nvidia", "nouveau", NULL } },
+};
 
-  part_timer = _srt_profiling_start ("Enumerating EGL ICDs");
-  g_debug ("Enumerating EGL ICDs on provider system...");
-  egl_icds = srt_system_info_list_egl_icds (system_info, pv_multiarch_tuples);
-  n_egl_icds = g_list_length (egl_icds);
+typedef struct
+{
+  guint16 pci_vendor;
+  guint16 first_device;
+  guint16 last_device;
+  const char * const drivers[3];
+} VulkanDeviceDrivers;
 
-  egl_icd_details = g_ptr_array_new_full (n_egl_icds,
-                                          (GDestroyNotify) G_CALLBACK (icd_details_free));
+/*
+ * Ranges of PCI device IDs for which we can narrow down the drivers
+ * from vulkan_vendor_drivers[]. The first matching entry is used.
+ */
+static const VulkanDeviceDrivers vulkan_device_drivers[] =
+{
+  /* Intel Gen7 and Gen8 (Ivybridge, Baytrail, Haswell, Broadwell,
+   * Cherryview) are driven by HASVK, or by ANV before Mesa 22.3 */
+  { 0x8086, 0x0152, 0x016a, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x0402, 0x042e, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x0a02, 0x0a2e, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x0c02, 0x0c2e, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x0d02, 0x0d2e, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x0f31, 0x0f33, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x1602, 0x162e, { "intel_hasvk", "intel", NULL } },
+  { 0x8086, 0x22b0, 0x22b3, { "intel_hasvk", "intel", NULL } },
+  /* Any other Intel GPU with Vulkan support is Gen9 or later: ANV */
+  { 0x8086, 0x0000, 0xffff, { "intel", NULL } },
+};
 
-  for (icd_iter = egl_icds, j = 0;
-       icd_iter != NULL;
-       icd_iter = icd_iter->next, j++)
-    {
-      SrtEglIcd *icd = icd_iter->data;
-      const gchar *path = srt_egl_icd_get_json_path (icd);
-      GError *local_error = NULL;
+/* Software rasterizers, which are kept as a fallback whatever the GPU */
+static const char * const software_vulkan_drivers[] =
+{
+  "lvp",
+  "swiftshader",
+};
 
-      if (!srt_egl_icd_check_error (icd, &local_error))
-        {
-          g_info ("Failed to load EGL ICD #%" G_GSIZE_FORMAT  " from %s: %s",
-                  j, path, local_error->message);
-          g_clear_error (&local_error);
-          continue;
-        }
+static gint
+compare_uint (gconstpointer a,
+              gconstpointer b)
+{
+  guint left = *(const guint *) a;
+  guint right = *(const guint *) b;
 
-      g_info ("EGL ICD #%" G_GSIZE_FORMAT " at %s: %s",
-              j, path, srt_egl_icd_get_library_path (icd));
+  if (left < right)
+    return -1;
 
-      g_ptr_array_add (egl_icd_details, icd_details_new (icd));
-    }
+  return (left > right);
+}
 
-  g_clear_pointer (&part_timer, _srt_profiling_end);
+/*
+ * Returns: The PCI ID in @path, or 0 with @error set
+ */
+static guint16
+read_pci_id (const char *path,
+             GError **error)
+{
+  g_autofree gchar *contents = NULL;
+  guint64 id;
 
-  part_timer = _srt_profiling_start ("Enumerating Vulkan ICDs");
-  g_debug ("Enumerating Vulkan ICDs on provider system...");
-  vulkan_icds = srt_system_info_list_vulkan_icds (system_info,
-                                                  pv_multiarch_tuples);
-  n_vulkan_icds = g_list_length (vulkan_icds);
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return 0;
 
-  vulkan_icd_details = g_ptr_array_new_full (n_vulkan_icds,
-                                             (GDestroyNotify) G_CALLBACK (icd_details_free));
+  id = g_ascii_strtoull (contents, NULL, 16);
 
-  for (icd_iter = vulkan_icds, j = 0;
-       icd_iter != NULL;
-       icd_iter = icd_iter->next, j++)
+  if (id == 0 || id > G_MAXUINT16)
     {
-      SrtVulkanIcd *icd = icd_iter->data;
-      const gchar *path = srt_vulkan_icd_get_json_path (icd);
-      GError *local_error = NULL;
+      glnx_throw (error, "Unable to parse PCI ID from %s", path);
+      return 0;
+    }
 
-      if (!srt_vulkan_icd_check_error (icd, &local_error))
-        {
-          g_info ("Failed to load Vulkan ICD #%" G_GSIZE_FORMAT " from %s: %s",
-                  j, path, local_error->message);
-          g_clear_error (&local_error);
-          continue;
-        }
+  return id;
+}
 
-      g_info ("Vulkan ICD #%" G_GSIZE_FORMAT " at %s: %s",
-              j, path, srt_vulkan_icd_get_library_path (icd));
+/*
+ * get_render_node_pci_ids:
+ * @index: Index of a DRM render node, in order of minor number
+ * @vendor_out: (out): Used to return the PCI vendor ID
+ * @device_out: (out): Used to return the PCI device ID, or 0 if unknown
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean
+get_render_node_pci_ids (guint64 index,
+                         guint16 *vendor_out,
+                         guint16 *device_out,
+                         GError **error)
+{
+  g_autoptr(GArray) minors = NULL;
+  g_autoptr(GDir) dir = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *path = NULL;
+  const char *member;
+  guint minor;
 
-      g_ptr_array_add (vulkan_icd_details, icd_details_new (icd));
-    }
+  dir = g_dir_open ("/sys/class/drm", 0, error);
 
-  g_clear_pointer (&part_timer, _srt_profiling_end);
+  if (dir == NULL)
+    return FALSE;
 
-  if (self->flags & PV_RUNTIME_FLAGS_IMPORT_VULKAN_LAYERS)
+  minors = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  while ((member = g_dir_read_name (dir)) != NULL)
+    {
+      const char *number;
+      char *endptr;
+      guint64 n;
+
+      if (!g_str_has_prefix (member, "renderD"))
+        continue;
+
+      number = member + strlen ("renderD");
+      n = g_ascii_strtoull (number, &endptr, 10);
+
+      if (endptr != number && *endptr == '\0' && n <= G_MAXUINT)
+        {
+          minor = n;
+          g_array_append_val (minors, minor);
+        }
+    }
+
+  if (index >= minors->len)
+    return glnx_throw (error, "Only %u DRM render nodes found", minors->len);
+
+  g_array_sort (minors, compare_uint);
+  minor = g_array_index (minors, guint, index);
+  path = g_strdup_printf ("/sys/class/drm/renderD%u/device/vendor", minor);
+  *vendor_out = read_pci_id (path, error);
+
+  if (*vendor_out == 0)
+    return FALSE;
+
+  /* If we can't tell the device ID, fall back to all of the vendor's
+   * drivers */
+  g_free (path);
+  path = g_strdup_printf ("/sys/class/drm/renderD%u/device/device", minor);
+  *device_out = read_pci_id (path, &local_error);
+
+  if (*device_out == 0)
+    g_debug ("%s", local_error->message);
+
+  return TRUE;
+}
+
+/*
+ * parse_vulkan_icd_selector:
+ * @selector: `pci:VENDOR`, `pci:VENDOR:DEVICE`, `index:N` or `driver:NAME`
+ * @vendor_out: (out): Used to return the PCI vendor ID for `pci:`
+ * @device_out: (out): Used to return the PCI device ID for
+ *  `pci:VENDOR:DEVICE`, or 0 if not specified
+ * @index_out: (out): Used to return the GPU index for `index:`
+ * @driver_out: (out) (transfer none): Used to return the driver name
+ *  for `driver:`, pointing into @selector
+ *
+ * Check the syntax of @selector, without looking at the system.
+ * Exactly one of the out parameters is set to a nonzero value.
+ */
+static gboolean
+parse_vulkan_icd_selector (const char *selector,
+                           guint16 *vendor_out,
+                           guint16 *device_out,
+                           guint64 *index_out,
+                           const char **driver_out,
+                           GError **error)
+{
+  const char *rest;
+  char *endptr;
+
+  *vendor_out = 0;
+  *device_out = 0;
+  *index_out = G_MAXUINT64;
+  *driver_out = NULL;
+
+  if (g_str_has_prefix (selector, "driver:"))
+    {
+      rest = selector + strlen ("driver:");
+
+      if (rest[0] == '\0')
+        return glnx_throw (error, "Empty Vulkan driver name");
+
+      *driver_out = rest;
+      return TRUE;
+    }
+  else if (g_str_has_prefix (selector, "pci:"))
+    {
+      guint64 vendor;
+      guint64 device = 0;
+
+      rest = selector + strlen ("pci:");
+      vendor = g_ascii_strtoull (rest, &endptr, 16);
+
+      if (!g_ascii_isxdigit (rest[0])
+          || (*endptr != '\0' && *endptr != ':')
+          || vendor == 0
+          || vendor > G_MAXUINT16)
+        return glnx_throw (error, "Invalid PCI vendor ID \"%s\"", rest);
+
+      if (*endptr == ':')
+        {
+          rest = endptr + 1;
+          device = g_ascii_strtoull (rest, &endptr, 16);
+
+          if (!g_ascii_isxdigit (rest[0])
+              || *endptr != '\0'
+              || device == 0
+              || device > G_MAXUINT16)
+            return glnx_throw (error, "Invalid PCI device ID \"%s\"", rest);
+        }
+
+      *vendor_out = vendor;
+      *device_out = device;
+      return TRUE;
+    }
+  else if (g_str_has_prefix (selector, "index:"))
+    {
+      guint64 index;
+
+      rest = selector + strlen ("index:");
+      index = g_ascii_strtoull (rest, &endptr, 10);
+
+      if (!g_ascii_isdigit (rest[0])
+          || *endptr != '\0'
+          || index == G_MAXUINT64)
+        return glnx_throw (error, "Invalid GPU index \"%s\"", rest);
+
+      *index_out = index;
+      return TRUE;
+    }
+
+  return glnx_throw (error,
+                     "Vulkan ICD selector \"%s\" should start with "
+                     "\"pci:\", \"index:\" or \"driver:\"",
+                     selector);
+}
+
+/*
+ * pv_runtime_check_vulkan_icd_selector:
+ * @selector: `pci:VENDOR`, `pci:VENDOR:DEVICE`, `index:N` or `driver:NAME`
+ * @error: Used to raise an error on failure
+ *
+ * Check that @selector is syntactically valid, so that an invalid
+ * `--vulkan-icd` can be reported as a usage error.
+ */
+gboolean
+pv_runtime_check_vulkan_icd_selector (const char *selector,
+                                      GError **error)
+{
+  const char *driver;
+  guint64 index;
+  guint16 vendor;
+  guint16 device;
+
+  return parse_vulkan_icd_selector (selector, &vendor, &device, &index,
+                                    &driver, error);
+}
+
+/*
+ * pv_runtime_get_vulkan_icd_selector_drivers:
+ * @selector: `pci:VENDOR`, `pci:VENDOR:DEVICE`, `index:N` or `driver:NAME`
+ * @error: Used to raise an error on failure
+ *
+ * If the PCI device ID is known, either from @selector or by looking
+ * at the selected GPU, it is used to narrow down the drivers where
+ * possible: for example Intel Gen7 and Gen8 GPUs need `intel_hasvk`,
+ * but newer Intel GPUs need `intel`.
+ *
+ * Returns: (transfer container) (element-type utf8): Names of the
+ *  Vulkan drivers that can drive the selected GPU, in the form
+ *  returned by pv_runtime_get_vulkan_driver_name(), or %NULL on error
+ */
+GPtrArray *
+pv_runtime_get_vulkan_icd_selector_drivers (const char *selector,
+                                            GError **error)
+{
+  g_autoptr(GPtrArray) drivers = g_ptr_array_new ();
+  const char *driver;
+  guint64 index;
+  guint16 vendor;
+  guint16 device;
+  gsize i, j;
+
+  if (!parse_vulkan_icd_selector (selector, &vendor, &device, &index,
+                                  &driver, error))
+    return NULL;
+
+  if (driver != NULL)
+    {
+      g_ptr_array_add (drivers, (char *) driver);
+      return g_steal_pointer (&drivers);
+    }
+
+  if (vendor == 0
+      && !get_render_node_pci_ids (index, &vendor, &device, error))
+    return NULL;
+
+  for (i = 0; device != 0 && i < G_N_ELEMENTS (vulkan_device_drivers); i++)
+    {
+      if (vulkan_device_drivers[i].pci_vendor != vendor
+          || device < vulkan_device_drivers[i].first_device
+          || device > vulkan_device_drivers[i].last_device)
+        continue;
+
+      for (j = 0; vulkan_device_drivers[i].drivers[j] != NULL; j++)
+        g_ptr_array_add (drivers,
+                         (char *) vulkan_device_drivers[i].drivers[j]);
+
+      return g_steal_pointer (&drivers);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (vulkan_vendor_drivers); i++)
+    {
+      if (vulkan_vendor_drivers[i].pci_vendor != vendor)
+        continue;
+
+      for (j = 0; vulkan_vendor_drivers[i].drivers[j] != NULL; j++)
+        g_ptr_array_add (drivers,
+                         (char *) vulkan_vendor_drivers[i].drivers[j]);
+
+      return g_steal_pointer (&drivers);
+    }
+
+  return glnx_null_throw (error,
+                          "Vulkan drivers for PCI vendor 0x%04x are not known",
+                          (guint) vendor);
+}
+
+/*
+ * pv_runtime_get_vulkan_driver_name:
+ * @library: The `library_path` of a Vulkan ICD
+ *
+ * Return the short name of the Vulkan driver in @library, which is its
+ * basename without any `lib`, `vulkan_`, `vk_`, `GLX_` or `EGL_` prefix
+ * or `.so` suffix: for example `intel` for `libvulkan_intel.so`,
+ * `intel_hasvk` for `libvulkan_intel_hasvk.so`, `amdvlk64` for
+ * `amdvlk64.so`, or `nvidia` for `libGLX_nvidia.so.0` or
+ * `libEGL_nvidia.so.0`.
+ *
+ * Returns: (transfer full): The driver name
+ */
+gchar *
+pv_runtime_get_vulkan_driver_name (const char *library)
+{
+  static const char * const prefixes[] = { "vulkan_", "vk_", "GLX_", "EGL_" };
+  const char *name = glnx_basename (library);
+  const char *so;
+  gsize i;
+
+  if (g_str_has_prefix (name, "lib"))
+    name += strlen ("lib");
+
+  for (i = 0; i < G_N_ELEMENTS (prefixes); i++)
+    {
+      if (g_str_has_prefix (name, prefixes[i]))
+        {
+          name += strlen (prefixes[i]);
+          break;
+        }
+    }
+
+  so = strstr (name, ".so");
+
+  if (so != NULL && (so[3] == '\0' || so[3] == '.'))
+    return g_strndup (name, so - name);
+
+  return g_strdup (name);
+}
+
+/*
+ * pv_runtime_want_vulkan_icd_library:
+ * @library: The `library_path` of a Vulkan ICD found on the graphics
+ *  provider, or %NULL if unknown
+ * @drivers: (nullable): The result of
+ *  pv_runtime_get_vulkan_icd_selector_drivers(), or %NULL if all ICDs
+ *  are wanted
+ *
+ * A driver is wanted if its name (see
+ * pv_runtime_get_vulkan_driver_name()) or the basename of @library
+ * is exactly one of @drivers, or if it is a software rasterizer.
+ *
+ * Returns: %TRUE if the ICD should be made available in the container
+ */
+gboolean
+pv_runtime_want_vulkan_icd_library (const char *library,
+                                    GPtrArray *drivers)
+{
+  g_autofree gchar *name = NULL;
+  const char *base;
+  gsize i;
+
+  if (drivers == NULL || library == NULL)
+    return TRUE;
+
+  base = glnx_basename (library);
+  name = pv_runtime_get_vulkan_driver_name (library);
+
+  for (i = 0; i < G_N_ELEMENTS (software_vulkan_drivers); i++)
+    {
+      if (strcmp (name, software_vulkan_drivers[i]) == 0)
+        return TRUE;
+    }
+
+  for (i = 0; i < drivers->len; i++)
+    {
+      const char *wanted = g_ptr_array_index (drivers, i);
+
+      if (strcmp (name, wanted) == 0 || strcmp (base, wanted) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * pv_runtime_want_vulkan_layer:
+ * @layer: A Vulkan layer found on the graphics provider
+ * @implicit: %TRUE if @layer is an implicit layer
+ * @final_environ: The environment that the game will have
+ *
+ * Returns: %TRUE if @layer should be made available in the container
+ */
+static gboolean
+pv_runtime_want_vulkan_layer (PvRuntime *self,
+                              SrtVulkanLayer *layer,
+                              gboolean implicit,
+                              const char * const *final_environ)
+{
+  const char *name = srt_vulkan_layer_get_name (layer);
+
+  if (vulkan_layer_name_matches (name, self->vulkan_layers_deny))
+    {
+      g_info ("Not importing Vulkan layer %s: excluded by configuration",
+              name);
+      return FALSE;
+    }
+
+  /* Explicit layers can be requested by the game itself, so we can't
+   * know in advance whether they will be needed */
+  if (!implicit)
+    return TRUE;
+
+  if (self->flags & PV_RUNTIME_FLAGS_IMPORT_ALL_VULKAN_LAYERS)
+    return TRUE;
+
+  if (vulkan_layer_name_matches (name, self->vulkan_layers_allow))
+    return TRUE;
+
+  if (!_srt_vulkan_layer_is_enabled_by_environ (layer, final_environ))
+    {
+      g_info ("Not importing Vulkan implicit layer %s: "
+              "not enabled by the container environment", name);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * GraphicsArchJob:
+ *
+ * The part of pv_runtime_use_provider_graphics_stack() that is specific
+ * to one architecture. A job only writes to its own fields, to the
+ * per-architecture slots of the IcdDetails, and to its own
+ * architecture's directory in the overrides, so jobs for different
+ * architectures can run in parallel. The results are merged into the
+ * shared state in architecture order afterwards, so that the search
+ * paths and bwrap arguments do not depend on which thread finished first.
+ */
+typedef struct
+{
+  PvRuntime *runtime;
+  RuntimeArchitecture arch;
+  GThread *thread;
+  /* (nullable): arguments to append to the real bwrap */
+  FlatpakBwrap *bwrap;
+  SrtSystemInfo *system_info;
+  /* Not owned; (element-type IcdDetails) */
+  GPtrArray *egl_icd_details;
+  GPtrArray *vulkan_icd_details;
+  GPtrArray *vulkan_exp_layer_details;
+  GPtrArray *vulkan_imp_layer_details;
+  /* Not owned */
+  const char *provider_in_container_namespace_guarded;
+  GString *dri_path;
+  GString *va_api_path;
+  GHashTable *gconv_in_provider;
+  GHashTable *lib_data_probes;
+  GHashTable *drirc_data_in_provider;
+  GHashTable *libdrm_data_in_provider;
+  GHashTable *nvidia_data_in_provider;
+  GError *error;
+  gboolean works;
+  gboolean any_libc_from_provider;
+  gboolean all_libc_from_provider;
+  gboolean all_libdrm_from_provider;
+  gboolean all_libglx_from_provider;
+  gboolean remove_overridden_libraries;
+} GraphicsArchJob;
+
+/*
+ * @lib_data_probes: (nullable): Share this cache of data directory probes
+ *  with other jobs, which is only safe if they run sequentially
+ */
+static GraphicsArchJob *
+graphics_arch_job_new (PvRuntime *runtime,
+                       gsize multiarch_index,
+                       FlatpakBwrap *bwrap,
+                       SrtSystemInfo *system_info,
+                       GHashTable *lib_data_probes)
+{
+  GraphicsArchJob *self = g_new0 (GraphicsArchJob, 1);
+
+  self->runtime = runtime;
+  self->arch.multiarch_index = multiarch_index;
+
+  if (bwrap != NULL)
+    self->bwrap = flatpak_bwrap_new (flatpak_bwrap_empty_env);
+
+  self->system_info = g_object_ref (system_info);
+  self->dri_path = g_string_new ("");
+  self->va_api_path = g_string_new ("");
+  self->gconv_in_provider = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+
+  if (lib_data_probes != NULL)
+    self->lib_data_probes = g_hash_table_ref (lib_data_probes);
+  else
+    self->lib_data_probes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, g_free);
+
+  self->drirc_data_in_provider = g_hash_table_new_full (g_str_hash,
+                                                        g_str_equal,
+                                                        g_free, NULL);
+  self->libdrm_data_in_provider = g_hash_table_new_full (g_str_hash,
+                                                         g_str_equal,
+                                                         g_free, NULL);
+  self->nvidia_data_in_provider = g_hash_table_new_full (g_str_hash,
+                                                         g_str_equal,
+                                                         g_free, NULL);
+  self->all_libc_from_provider = TRUE;
+  self->all_libdrm_from_provider = TRUE;
+  self->all_libglx_from_provider = TRUE;
+  return self;
+}
+
+static void
+graphics_arch_job_free (GraphicsArchJob *self)
+{
+  g_return_if_fail (self->thread == NULL);
+
+  runtime_architecture_clear (&self->arch);
+  g_clear_pointer (&self->bwrap, flatpak_bwrap_free);
+  g_clear_object (&self->system_info);
+  g_string_free (self->dri_path, TRUE);
+  g_string_free (self->va_api_path, TRUE);
+  g_hash_table_unref (self->gconv_in_provider);
+  g_hash_table_unref (self->lib_data_probes);
+  g_hash_table_unref (self->drirc_data_in_provider);
+  g_hash_table_unref (self->libdrm_data_in_provider);
+  g_hash_table_unref (self->nvidia_data_in_provider);
+  g_clear_error (&self->error);
+  g_free (self);
+}
+
+/*
+ * Collect the graphics stack for one architecture.
+ * Can be called in a worker thread.
+ */
+static gboolean
+graphics_arch_job_collect (GraphicsArchJob *self,
+                           GError **error)
+{
+  PvRuntime *runtime = self->runtime;
+  RuntimeArchitecture *arch = &self->arch;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GPtrArray) dirs = NULL;
+  g_autofree gchar *this_dri_path_in_container = NULL;
+  g_autofree gchar *libc = NULL;
+  /* Can either be relative to the sysroot, or absolute */
+  g_autofree gchar *ld_so_in_runtime = NULL;
+  g_autofree gchar *libdrm = NULL;
+  g_autofree gchar *libdrm_amdgpu = NULL;
+  g_autofree gchar *libglx_mesa = NULL;
+  g_autofree gchar *libglx_nvidia = NULL;
+  g_autofree gchar *platform_token = NULL;
+  g_autoptr(GPtrArray) patterns = NULL;
+  G_GNUC_UNUSED g_autoptr(SrtProfilingTimer) timer =
+    _srt_profiling_start ("%s libraries",
+                          pv_multiarch_tuples[arch->multiarch_index]);
+  gsize j;
+
+  g_debug ("Checking for %s libraries...",
+           pv_multiarch_tuples[arch->multiarch_index]);
+
+  if (!runtime_architecture_init (arch, runtime))
+    return TRUE;
+
+  if (!pv_runtime_get_ld_so (runtime, arch, &ld_so_in_runtime, error))
+    return FALSE;
+
+  if (ld_so_in_runtime == NULL)
+    {
+      g_info ("Container does not have %s so it cannot run "
+              "%s binaries",
+              arch->ld_so, arch->details->tuple);
+      return TRUE;
+    }
+
+  /* Reserve a size of 128 to avoid frequent reallocation due to the
+   * expected high number of patterns that will be added to the array. */
+  patterns = g_ptr_array_new_full (128, g_free);
+
+  self->works = TRUE;
+  g_debug ("Container path: %s -> %s",
+           arch->ld_so, ld_so_in_runtime);
+
+  this_dri_path_in_container = g_build_filename (arch->libdir_in_container,
+                                                 "dri", NULL);
+  pv_search_path_append (self->dri_path, this_dri_path_in_container);
+  pv_search_path_append (self->va_api_path, this_dri_path_in_container);
+
+  g_mkdir_with_parents (arch->libdir_in_current_namespace, 0755);
+  g_mkdir_with_parents (arch->aliases_in_current_namespace, 0755);
+
+  g_debug ("Collecting graphics drivers from provider system...");
+
+  collect_graphics_libraries_patterns (patterns);
+
+  if (!collect_egl_drivers (runtime, arch, self->egl_icd_details, patterns,
+                            error))
+    return FALSE;
+
+  if (!collect_vulkan_icds (runtime, arch, self->vulkan_icd_details,
+                            patterns, error))
+    return FALSE;
+
+  if (runtime->flags & PV_RUNTIME_FLAGS_IMPORT_VULKAN_LAYERS)
+    {
+      g_debug ("Collecting Vulkan explicit layers from provider...");
+      if (!collect_vulkan_layers (runtime, self->vulkan_exp_layer_details,
+                                  patterns, arch, "vulkan_exp_layer", error))
+        return FALSE;
+
+      g_debug ("Collecting Vulkan implicit layers from provider...");
+      if (!collect_vulkan_layers (runtime, self->vulkan_imp_layer_details,
+                                  patterns, arch, "vulkan_imp_layer", error))
+        return FALSE;
+    }
+
+  if (!collect_vdpau_drivers (runtime, self->system_info, arch, patterns,
+                              error))
+    return FALSE;
+
+  if (!collect_dri_drivers (runtime, self->system_info, arch, patterns,
+                            self->dri_path, error))
+    return FALSE;
+
+  if (!collect_va_api_drivers (runtime, self->system_info, arch, patterns,
+                               self->va_api_path, error))
+    return FALSE;
+
+  if (!pv_runtime_capture_libraries (runtime, arch,
+                                     arch->libdir_in_current_namespace,
+                                     patterns, error))
+    return FALSE;
+
+  libc = g_build_filename (arch->libdir_in_current_namespace, "libc.so.6", NULL);
+
+  /* If we are going to use the provider's libc6 (likely)
+   * then we have to use its ld.so too. */
+  if (g_file_test (libc, G_FILE_TEST_IS_SYMLINK))
+    {
+      if (!pv_runtime_collect_libc_family (runtime, arch, self->bwrap,
+                                           libc, ld_so_in_runtime,
+                                           self->provider_in_container_namespace_guarded,
+                                           self->gconv_in_provider,
+                                           error))
+        return FALSE;
+
+      self->any_libc_from_provider = TRUE;
+    }
+  else
+    {
+      self->all_libc_from_provider = FALSE;
+    }
+
+  libdrm = g_build_filename (arch->libdir_in_current_namespace,
+                             "libdrm.so.2", NULL);
+  libdrm_amdgpu = g_build_filename (arch->libdir_in_current_namespace,
+                                    "libdrm_amdgpu.so.1", NULL);
+
+  /* If we have libdrm_amdgpu.so.1 in overrides we also want to mount
+   * ${prefix}/share/libdrm from the provider. ${prefix} is derived from
+   * the absolute path of libdrm_amdgpu.so.1 */
+  if (g_file_test (libdrm_amdgpu, G_FILE_TEST_IS_SYMLINK))
+    {
+      pv_runtime_collect_lib_data (runtime, arch, "libdrm", libdrm_amdgpu,
+                                   self->provider_in_container_namespace_guarded,
+                                   PV_RUNTIME_DATA_FLAGS_NONE,
+                                   self->lib_data_probes,
+                                   self->libdrm_data_in_provider);
+    }
+  /* As a fallback we also try libdrm.so.2 because libdrm_amdgpu.so.1
+   * might not be available in all providers.
+   * It's important to check for libdrm_amdgpu.so.1 first, because
+   * the freedesktop.org GL runtime doesn't provide libdrm.so.2, and if
+   * we check for it first we would end up looking for the "libdrm"
+   * directory in the wrong path */
+  else if (g_file_test (libdrm, G_FILE_TEST_IS_SYMLINK))
+    {
+      pv_runtime_collect_lib_data (runtime, arch, "libdrm", libdrm,
+                                   self->provider_in_container_namespace_guarded,
+                                   PV_RUNTIME_DATA_FLAGS_NONE,
+                                   self->lib_data_probes,
+                                   self->libdrm_data_in_provider);
+    }
+  else
+    {
+      /* For at least a single architecture, libdrm is newer in the container */
+      self->all_libdrm_from_provider = FALSE;
+    }
+
+  libglx_mesa = g_build_filename (arch->libdir_in_current_namespace, "libGLX_mesa.so.0", NULL);
+
+  /* If we have libGLX_mesa.so.0 in overrides we also want to mount
+   * ${prefix}/share/drirc.d from the provider. ${prefix} is derived from
+   * the absolute path of libGLX_mesa.so.0 */
+  if (g_file_test (libglx_mesa, G_FILE_TEST_IS_SYMLINK))
+    {
+      pv_runtime_collect_lib_data (runtime, arch, "drirc.d", libglx_mesa,
+                                   self->provider_in_container_namespace_guarded,
+                                   PV_RUNTIME_DATA_FLAGS_NONE,
+                                   self->lib_data_probes,
+                                   self->drirc_data_in_provider);
+    }
+  else
+    {
+      /* For at least a single architecture, libGLX_mesa is newer in the container */
+      self->all_libglx_from_provider = FALSE;
+    }
+
+  libglx_nvidia = g_build_filename (arch->libdir_in_current_namespace, "libGLX_nvidia.so.0", NULL);
+
+  /* If we have libGLX_nvidia.so.0 in overrides we also want to mount
+   * /usr/share/nvidia from the provider. In this case it's
+   * /usr/share/nvidia that is the preferred path, with
+   * ${prefix}/share/nvidia as a fallback. */
+  if (g_file_test (libglx_nvidia, G_FILE_TEST_IS_SYMLINK))
+    {
+      pv_runtime_collect_lib_data (runtime, arch, "nvidia", libglx_nvidia,
+                                   self->provider_in_container_namespace_guarded,
+                                   PV_RUNTIME_DATA_FLAGS_USR_SHARE_FIRST,
+                                   self->lib_data_probes,
+                                   self->nvidia_data_in_provider);
+    }
+
+  dirs = pv_multiarch_details_get_libdirs (arch->details,
+                                           PV_MULTIARCH_LIBDIRS_FLAGS_NONE);
+
+  for (j = 0; j < dirs->len; j++)
+    {
+      if (!collect_s2tc (runtime, arch,
+                         g_ptr_array_index (dirs, j),
+                         error))
+        return FALSE;
+    }
+
+  /* Unfortunately VDPAU_DRIVER_PATH can hold just a single path, so we can't
+   * easily list both x86_64 and i386 paths. As a workaround we set
+   * VDPAU_DRIVER_PATH based on ${PLATFORM} - but each of our
+   * supported ABIs can have multiple values for ${PLATFORM}, so we
+   * need to create symlinks. Try to avoid making use of this,
+   * because it's fragile (a new glibc version can introduce
+   * new platform strings), but for some things like VDPAU it's our
+   * only choice. */
+  for (j = 0; j < G_N_ELEMENTS (arch->details->platforms); j++)
+    {
+      g_autofree gchar *platform_link = NULL;
+
+      if (arch->details->platforms[j] == NULL)
+        break;
+
+      platform_link = g_strdup_printf ("%s/lib/platform-%s",
+                                       runtime->overrides,
+                                       arch->details->platforms[j]);
+
+      if (symlink (arch->details->tuple, platform_link) != 0)
+        return glnx_throw_errno_prefix (error,
+                                        "Unable to create symlink %s -> %s",
+                                        platform_link, arch->details->tuple);
+    }
+
+  platform_token = srt_system_info_dup_libdl_platform (self->system_info,
+                                                       arch->details->tuple,
+                                                       &local_error);
+  if (platform_token == NULL)
+    {
+      /* This is not a critical error, try to continue */
+      g_warning ("The dynamic linker expansion of \"$PLATFORM\" is not what we "
+                 "expected, VDPAU drivers might not work: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  if (!pv_runtime_create_aliases (runtime, arch, &local_error))
+    {
+      /* This is not a critical error, try to continue */
+      g_warning ("Unable to create library aliases: %s",
+                 local_error->message);
+      return TRUE;
+    }
+
+  /* Removing overridden libraries has to wait until all architectures
+   * have been collected, because some of the directories involved
+   * (such as /usr/lib) are shared between architectures */
+  self->remove_overridden_libraries = TRUE;
+  return TRUE;
+}
+
+/* Called in worker thread, or in main thread if single-threaded */
+static gpointer
+graphics_arch_job_thread (gpointer data)
+{
+  GraphicsArchJob *self = data;
+
+  graphics_arch_job_collect (self, &self->error);
+  return NULL;
+}
+
+/*
+ * Add a copy of each member of the set @source to the set @dest.
+ */
+static void
+merge_string_set (GHashTable *dest,
+                  GHashTable *source)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, source);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_add (dest, g_strdup (key));
+}
+
+static gboolean
+pv_runtime_use_provider_graphics_stack (PvRuntime *self,
+                                        FlatpakBwrap *bwrap,
+                                        PvEnviron *container_env,
+                                        GError **error)
+{
+  gsize i, j;
+  g_autoptr(GString) dri_path = g_string_new ("");
+  g_autoptr(GString) egl_path = g_string_new ("");
+  g_autoptr(GString) vulkan_path = g_string_new ("");
+  /* We are currently using the explicit and implicit Vulkan layer paths
+   * only to check if we binded at least a single layer */
+  g_autoptr(GString) vulkan_exp_layer_path = g_string_new ("");
+  g_autoptr(GString) vulkan_imp_layer_path = g_string_new ("");
+  g_autoptr(GString) va_api_path = g_string_new ("");
+  gboolean any_architecture_works = FALSE;
+  g_autoptr(SrtSystemInfo) system_info = NULL;
+  g_autoptr(SrtObjectList) egl_icds = NULL;
+  g_autoptr(SrtObjectList) vulkan_icds = NULL;
+  g_autoptr(SrtObjectList) vulkan_explicit_layers = NULL;
+  g_autoptr(SrtObjectList) vulkan_implicit_layers = NULL;
+  g_autoptr(GPtrArray) egl_icd_details = NULL;      /* (element-type IcdDetails) */
+  g_autoptr(GPtrArray) vulkan_icd_details = NULL;   /* (element-type IcdDetails) */
+  g_autoptr(GPtrArray) wanted_vulkan_drivers = NULL;
+  g_autoptr(GPtrArray) vulkan_exp_layer_details = NULL;   /* (element-type IcdDetails) */
+  g_autoptr(GPtrArray) vulkan_imp_layer_details = NULL;   /* (element-type IcdDetails) */
+  g_autoptr(GPtrArray) jobs = NULL;   /* (element-type GraphicsArchJob) */
+  g_auto(GStrv) final_environ = NULL;
+  G_GNUC_UNUSED g_autoptr(SrtProfilingTimer) timer = NULL;
+  g_autoptr(SrtProfilingTimer) part_timer = NULL;
+  guint n_egl_icds;
+  guint n_vulkan_icds;
+  const GList *icd_iter;
+  gboolean all_libglx_from_provider = TRUE;
+  gboolean all_libdrm_from_provider = TRUE;
+  g_autoptr(GHashTable) drirc_data_in_provider = g_hash_table_new_full (g_str_hash,
+                                                                        g_str_equal,
+                                                                        g_free, NULL);
+  g_autoptr(GHashTable) libdrm_data_in_provider = g_hash_table_new_full (g_str_hash,
+                                                                         g_str_equal,
+                                                                         g_free, NULL);
+  g_autoptr(GHashTable) nvidia_data_in_provider = g_hash_table_new_full (g_str_hash,
+                                                                         g_str_equal,
+                                                                         g_free, NULL);
+  g_autoptr(GHashTable) gconv_in_provider = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                     g_free, NULL);
+  g_autoptr(GHashTable) lib_data_probes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                 g_free, g_free);
+  g_autofree gchar *provider_in_container_namespace_guarded = NULL;
+
+  g_return_val_if_fail (PV_IS_RUNTIME (self), FALSE);
+  g_return_val_if_fail (self->provider != NULL, FALSE);
+  g_return_val_if_fail (bwrap != NULL || self->mutable_sysroot != NULL, FALSE);
+  g_return_val_if_fail (bwrap == NULL || !pv_bwrap_was_finished (bwrap), FALSE);
+  g_return_val_if_fail (container_env != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  timer = _srt_profiling_start ("Using graphics stack from %s",
+                                self->provider->path_in_current_ns);
+
+  if (g_str_has_suffix (self->provider->path_in_container_ns, "/"))
+    provider_in_container_namespace_guarded =
+      g_strdup (self->provider->path_in_container_ns);
+  else
+    provider_in_container_namespace_guarded =
+      g_strdup_printf ("%s/", self->provider->path_in_container_ns);
+
+  if (!pv_runtime_provide_container_access (self, error))
+    return FALSE;
+
+  if (self->flags & PV_RUNTIME_FLAGS_SINGLE_THREAD)
+    system_info = pv_graphics_provider_create_system_info (self->provider);
+  else
+    system_info = g_object_ref (enumeration_thread_join (&self->indep_thread));
+
+  part_timer = _srt_profiling_start ("Enumerating EGL ICDs");
+  g_debug ("Enumerating EGL ICDs on provider system...");
+  egl_icds = srt_system_info_list_egl_icds (system_info, pv_multiarch_tuples);
+  n_egl_icds = g_list_length (egl_icds);
+
+  egl_icd_details = g_ptr_array_new_full (n_egl_icds,
+                                          (GDestroyNotify) G_CALLBACK (icd_details_free));
+
+  for (icd_iter = egl_icds, j = 0;
+       icd_iter != NULL;
+       icd_iter = icd_iter->next, j++)
+    {
+      SrtEglIcd *icd = icd_iter->data;
+      const gchar *path = srt_egl_icd_get_json_path (icd);
+      GError *local_error = NULL;
+
+      if (!srt_egl_icd_check_error (icd, &local_error))
+        {
+          g_info ("Failed to load EGL ICD #%" G_GSIZE_FORMAT  " from %s: %s",
+                  j, path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      g_info ("EGL ICD #%" G_GSIZE_FORMAT " at %s: %s",
+              j, path, srt_egl_icd_get_library_path (icd));
+
+      g_ptr_array_add (egl_icd_details, icd_details_new (icd));
+    }
+
+  g_clear_pointer (&part_timer, _srt_profiling_end);
+
+  part_timer = _srt_profiling_start ("Enumerating Vulkan ICDs");
+
+  if (self->vulkan_icd_selector != NULL)
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      wanted_vulkan_drivers = pv_runtime_get_vulkan_icd_selector_drivers (self->vulkan_icd_selector,
+                                                                          &local_error);
+
+      if (wanted_vulkan_drivers == NULL)
+        g_warning ("Unable to select Vulkan ICDs, using all of them: %s",
+                   local_error->message);
+    }
+
+  g_debug ("Enumerating Vulkan ICDs on provider system...");
+  vulkan_icds = srt_system_info_list_vulkan_icds (system_info,
+                                                  pv_multiarch_tuples);
+  n_vulkan_icds = g_list_length (vulkan_icds);
+
+  vulkan_icd_details = g_ptr_array_new_full (n_vulkan_icds,
+                                             (GDestroyNotify) G_CALLBACK (icd_details_free));
+
+  for (icd_iter = vulkan_icds, j = 0;
+       icd_iter != NULL;
+       icd_iter = icd_iter->next, j++)
+    {
+      SrtVulkanIcd *icd = icd_iter->data;
+      const gchar *path = srt_vulkan_icd_get_json_path (icd);
+      GError *local_error = NULL;
+
+      if (!srt_vulkan_icd_check_error (icd, &local_error))
+        {
+          g_info ("Failed to load Vulkan ICD #%" G_GSIZE_FORMAT " from %s: %s",
+                  j, path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      if (!pv_runtime_want_vulkan_icd_library (srt_vulkan_icd_get_library_path (icd),
+                                               wanted_vulkan_drivers))
+        {
+          g_info ("Not using Vulkan ICD #%" G_GSIZE_FORMAT " at %s: %s: "
+                  "not a driver for the selected GPU",
+                  j, path, srt_vulkan_icd_get_library_path (icd));
+          continue;
+        }
+
+      g_info ("Vulkan ICD #%" G_GSIZE_FORMAT " at %s: %s",
+              j, path, srt_vulkan_icd_get_library_path (icd));
+
+      g_ptr_array_add (vulkan_icd_details, icd_details_new (icd));
+    }
+
+  g_clear_pointer (&part_timer, _srt_profiling_end);
+
+  if (self->flags & PV_RUNTIME_FLAGS_IMPORT_VULKAN_LAYERS)
     {
       part_timer = _srt_profiling_start ("Enumerating Vulkan layers");
+      final_environ = pv_environ_apply (container_env,
+                                        (const char * const *) self->original_environ);
       g_debug ("Enumerating Vulkan explicit layers on provider system...");
       vulkan_explicit_layers = srt_system_info_list_explicit_vulkan_layers (system_info);
 
@@ -5096,6 +6195,10 @@ pv_runtime_use_provider_graphics_stack (PvRuntime *self,
           g_info ("Vulkan explicit layer #%" G_GSIZE_FORMAT " at %s: %s",
                   j, path, srt_vulkan_layer_get_library_path (layer));
 
+          if (!pv_runtime_want_vulkan_layer (self, layer, FALSE,
+                                             (const char * const *) final_environ))
+            continue;
+
           g_ptr_array_add (vulkan_exp_layer_details, icd_details_new (layer));
         }
 
@@ -5127,6 +6230,10 @@ pv_runtime_use_provider_graphics_stack (PvRuntime *self,
           g_info ("Vulkan implicit layer #%" G_GSIZE_FORMAT " at %s: %s",
                   j, path, library_path != NULL ? library_path : "meta-layer");
 
+          if (!pv_runtime_want_vulkan_layer (self, layer, TRUE,
+                                             (const char * const *) final_environ))
+            continue;
+
           g_ptr_array_add (vulkan_imp_layer_details, icd_details_new (layer));
         }
 
@@ -5139,252 +6246,108 @@ pv_runtime_use_provider_graphics_stack (PvRuntime *self,
 
   g_assert (pv_multiarch_tuples[PV_N_SUPPORTED_ARCHITECTURES] == NULL);
 
+  jobs = g_ptr_array_new_full (PV_N_SUPPORTED_ARCHITECTURES,
+                               (GDestroyNotify) G_CALLBACK (graphics_arch_job_free));
+
   for (i = 0; i < PV_N_SUPPORTED_ARCHITECTURES; i++)
     {
-      g_autoptr(GError) local_error = NULL;
-      g_auto (RuntimeArchitecture) arch_on_stack = { i };
-      RuntimeArchitecture *arch = &arch_on_stack;
-
-      part_timer = _srt_profiling_start ("%s libraries", pv_multiarch_tuples[i]);
-      g_debug ("Checking for %s libraries...", pv_multiarch_tuples[i]);
-
-      if (runtime_architecture_init (arch, self))
-        {
-          g_autoptr(GPtrArray) dirs = NULL;
-          g_autofree gchar *this_dri_path_in_container = g_build_filename (arch->libdir_in_container,
-                                                                           "dri", NULL);
-          g_autofree gchar *libc = NULL;
-          /* Can either be relative to the sysroot, or absolute */
-          g_autofree gchar *ld_so_in_runtime = NULL;
-          g_autofree gchar *libdrm = NULL;
-          g_autofree gchar *libdrm_amdgpu = NULL;
-          g_autofree gchar *libglx_mesa = NULL;
-          g_autofree gchar *libglx_nvidia = NULL;
-          g_autofree gchar *platform_token = NULL;
-          g_autoptr(GPtrArray) patterns = NULL;
-          SrtSystemInfo *arch_system_info;
-
-          if (!pv_runtime_get_ld_so (self, arch, &ld_so_in_runtime, error))
-            return FALSE;
-
-          if (ld_so_in_runtime == NULL)
-            {
-              g_info ("Container does not have %s so it cannot run "
-                      "%s binaries",
-                      arch->ld_so, arch->details->tuple);
-              continue;
-            }
-
-          /* Reserve a size of 128 to avoid frequent reallocation due to the
-           * expected high number of patterns that will be added to the array. */
-          patterns = g_ptr_array_new_full (128, g_free);
-
-          any_architecture_works = TRUE;
-          g_debug ("Container path: %s -> %s",
-                   arch->ld_so, ld_so_in_runtime);
-
-          pv_search_path_append (dri_path, this_dri_path_in_container);
-          pv_search_path_append (va_api_path, this_dri_path_in_container);
-
-          g_mkdir_with_parents (arch->libdir_in_current_namespace, 0755);
-          g_mkdir_with_parents (arch->aliases_in_current_namespace, 0755);
-
-          g_debug ("Collecting graphics drivers from provider system...");
-
-          collect_graphics_libraries_patterns (patterns);
-
-          if (!collect_egl_drivers (self, arch, egl_icd_details, patterns,
-                                    error))
-            return FALSE;
-
-          if (!collect_vulkan_icds (self, arch, vulkan_icd_details,
-                                    patterns, error))
-            return FALSE;
-
-          if (self->flags & PV_RUNTIME_FLAGS_IMPORT_VULKAN_LAYERS)
-            {
-              g_debug ("Collecting Vulkan explicit layers from provider...");
-              if (!collect_vulkan_layers (self, vulkan_exp_layer_details,
-                                          patterns, arch, "vulkan_exp_layer", error))
-                return FALSE;
-
-              g_debug ("Collecting Vulkan implicit layers from provider...");
-              if (!collect_vulkan_layers (self, vulkan_imp_layer_details,
-                                          patterns, arch, "vulkan_imp_layer", error))
-                return FALSE;
-            }
-
-          if (self->flags & PV_RUNTIME_FLAGS_SINGLE_THREAD)
-            arch_system_info = system_info;
-          else
-            arch_system_info = enumeration_thread_join (&self->arch_threads[i]);
-
-          if (!collect_vdpau_drivers (self, arch_system_info, arch, patterns, error))
-            return FALSE;
-
-          if (!collect_dri_drivers (self, arch_system_info, arch, patterns,
-                                    dri_path, error))
-            return FALSE;
+      GraphicsArchJob *job;
 
-          if (!collect_va_api_drivers (self, arch_system_info, arch, patterns,
-                                       va_api_path, error))
-            return FALSE;
+      if (self->flags & PV_RUNTIME_FLAGS_SINGLE_THREAD)
+        job = graphics_arch_job_new (self, i, bwrap, system_info,
+                                     lib_data_probes);
+      else
+        job = graphics_arch_job_new (self, i, bwrap,
+                                     enumeration_thread_join (&self->arch_threads[i]),
+                                     NULL);
 
-          if (!pv_runtime_capture_libraries (self, arch,
-                                             arch->libdir_in_current_namespace,
-                                             patterns, error))
-            return FALSE;
+      job->egl_icd_details = egl_icd_details;
+      job->vulkan_icd_details = vulkan_icd_details;
+      job->vulkan_exp_layer_details = vulkan_exp_layer_details;
+      job->vulkan_imp_layer_details = vulkan_imp_layer_details;
+      job->provider_in_container_namespace_guarded = provider_in_container_namespace_guarded;
+      g_ptr_array_add (jobs, job);
+    }
 
-          libc = g_build_filename (arch->libdir_in_current_namespace, "libc.so.6", NULL);
+  if (self->flags & PV_RUNTIME_FLAGS_SINGLE_THREAD)
+    {
+      for (i = 0; i < jobs->len; i++)
+        {
+          GraphicsArchJob *job = g_ptr_array_index (jobs, i);
 
-          /* If we are going to use the provider's libc6 (likely)
-           * then we have to use its ld.so too. */
-          if (g_file_test (libc, G_FILE_TEST_IS_SYMLINK))
-            {
-              if (!pv_runtime_collect_libc_family (self, arch, bwrap,
-                                                   libc, ld_so_in_runtime,
-                                                   provider_in_container_namespace_guarded,
-                                                   gconv_in_provider,
-                                                   error))
-                return FALSE;
+          graphics_arch_job_thread (job);
 
-              self->any_libc_from_provider = TRUE;
-            }
-          else
-            {
-              self->all_libc_from_provider = FALSE;
-            }
+          if (job->error != NULL)
+            break;
+        }
+    }
+  else
+    {
+      part_timer = _srt_profiling_start ("Collecting all architectures in parallel");
 
-          libdrm = g_build_filename (arch->libdir_in_current_namespace,
-                                     "libdrm.so.2", NULL);
-          libdrm_amdgpu = g_build_filename (arch->libdir_in_current_namespace,
-                                            "libdrm_amdgpu.so.1", NULL);
+      for (i = 0; i < jobs->len; i++)
+        {
+          GraphicsArchJob *job = g_ptr_array_index (jobs, i);
 
-          /* If we have libdrm_amdgpu.so.1 in overrides we also want to mount
-           * ${prefix}/share/libdrm from the provider. ${prefix} is derived from
-           * the absolute path of libdrm_amdgpu.so.1 */
-          if (g_file_test (libdrm_amdgpu, G_FILE_TEST_IS_SYMLINK))
-            {
-              pv_runtime_collect_lib_data (self, arch, "libdrm", libdrm_amdgpu,
-                                           provider_in_container_namespace_guarded,
-                                           PV_RUNTIME_DATA_FLAGS_NONE,
-                                           libdrm_data_in_provider);
-            }
-          /* As a fallback we also try libdrm.so.2 because libdrm_amdgpu.so.1
-           * might not be available in all providers.
-           * It's important to check for libdrm_amdgpu.so.1 first, because
-           * the freedesktop.org GL runtime doesn't provide libdrm.so.2, and if
-           * we check for it first we would end up looking for the "libdrm"
-           * directory in the wrong path */
-          else if (g_file_test (libdrm, G_FILE_TEST_IS_SYMLINK))
-            {
-              pv_runtime_collect_lib_data (self, arch, "libdrm", libdrm,
-                                           provider_in_container_namespace_guarded,
-                                           PV_RUNTIME_DATA_FLAGS_NONE,
-                                           libdrm_data_in_provider);
-            }
-          else
-            {
-              /* For at least a single architecture, libdrm is newer in the container */
-              all_libdrm_from_provider = FALSE;
-            }
+          job->thread = g_thread_new (pv_multiarch_tuples[i],
+                                      graphics_arch_job_thread, job);
+        }
 
-          libglx_mesa = g_build_filename (arch->libdir_in_current_namespace, "libGLX_mesa.so.0", NULL);
+      for (i = 0; i < jobs->len; i++)
+        {
+          GraphicsArchJob *job = g_ptr_array_index (jobs, i);
 
-          /* If we have libGLX_mesa.so.0 in overrides we also want to mount
-           * ${prefix}/share/drirc.d from the provider. ${prefix} is derived from
-           * the absolute path of libGLX_mesa.so.0 */
-          if (g_file_test (libglx_mesa, G_FILE_TEST_IS_SYMLINK))
-            {
-              pv_runtime_collect_lib_data (self, arch, "drirc.d", libglx_mesa,
-                                           provider_in_container_namespace_guarded,
-                                           PV_RUNTIME_DATA_FLAGS_NONE,
-                                           drirc_data_in_provider);
-            }
-          else
-            {
-              /* For at least a single architecture, libGLX_mesa is newer in the container */
-              all_libglx_from_provider = FALSE;
-            }
+          g_thread_join (g_steal_pointer (&job->thread));
+        }
 
-          libglx_nvidia = g_build_filename (arch->libdir_in_current_namespace, "libGLX_nvidia.so.0", NULL);
+      g_clear_pointer (&part_timer, _srt_profiling_end);
+    }
 
-          /* If we have libGLX_nvidia.so.0 in overrides we also want to mount
-           * /usr/share/nvidia from the provider. In this case it's
-           * /usr/share/nvidia that is the preferred path, with
-           * ${prefix}/share/nvidia as a fallback. */
-          if (g_file_test (libglx_nvidia, G_FILE_TEST_IS_SYMLINK))
-            {
-              pv_runtime_collect_lib_data (self, arch, "nvidia", libglx_nvidia,
-                                           provider_in_container_namespace_guarded,
-                                           PV_RUNTIME_DATA_FLAGS_USR_SHARE_FIRST,
-                                           nvidia_data_in_provider);
-            }
+  /* Merge in architecture order, so that the result is the same as if
+   * we had collected each architecture in turn */
+  for (i = 0; i < jobs->len; i++)
+    {
+      GraphicsArchJob *job = g_ptr_array_index (jobs, i);
 
-          dirs = pv_multiarch_details_get_libdirs (arch->details,
-                                                   PV_MULTIARCH_LIBDIRS_FLAGS_NONE);
+      if (job->error != NULL)
+        {
+          g_propagate_error (error, g_steal_pointer (&job->error));
+          return FALSE;
+        }
 
-          for (j = 0; j < dirs->len; j++)
-            {
-              if (!collect_s2tc (self, arch,
-                                 g_ptr_array_index (dirs, j),
-                                 error))
-                return FALSE;
-            }
+      if (!job->works)
+        continue;
 
-          /* Unfortunately VDPAU_DRIVER_PATH can hold just a single path, so we can't
-           * easily list both x86_64 and i386 paths. As a workaround we set
-           * VDPAU_DRIVER_PATH based on ${PLATFORM} - but each of our
-           * supported ABIs can have multiple values for ${PLATFORM}, so we
-           * need to create symlinks. Try to avoid making use of this,
-           * because it's fragile (a new glibc version can introduce
-           * new platform strings), but for some things like VDPAU it's our
-           * only choice. */
-          for (j = 0; j < G_N_ELEMENTS (arch->details->platforms); j++)
-            {
-              g_autofree gchar *platform_link = NULL;
+      any_architecture_works = TRUE;
+      pv_search_path_append (dri_path, job->dri_path->str);
+      pv_search_path_append (va_api_path, job->va_api_path->str);
 
-              if (arch->details->platforms[j] == NULL)
-                break;
+      if (bwrap != NULL)
+        flatpak_bwrap_append_bwrap (bwrap, job->bwrap);
 
-              platform_link = g_strdup_printf ("%s/lib/platform-%s",
-                                               self->overrides,
-                                               arch->details->platforms[j]);
+      merge_string_set (gconv_in_provider, job->gconv_in_provider);
+      merge_string_set (drirc_data_in_provider, job->drirc_data_in_provider);
+      merge_string_set (libdrm_data_in_provider, job->libdrm_data_in_provider);
+      merge_string_set (nvidia_data_in_provider, job->nvidia_data_in_provider);
 
-              if (symlink (arch->details->tuple, platform_link) != 0)
-                return glnx_throw_errno_prefix (error,
-                                                "Unable to create symlink %s -> %s",
-                                                platform_link, arch->details->tuple);
-            }
+      if (job->any_libc_from_provider)
+        self->any_libc_from_provider = TRUE;
 
-          platform_token = srt_system_info_dup_libdl_platform (arch_system_info,
-                                                               pv_multiarch_tuples[i],
-                                                               &local_error);
-          if (platform_token == NULL)
-            {
-              /* This is not a critical error, try to continue */
-              g_warning ("The dynamic linker expansion of \"$PLATFORM\" is not what we "
-                         "expected, VDPAU drivers might not work: %s", local_error->message);
-              g_clear_error (&local_error);
-            }
+      if (!job->all_libc_from_provider)
+        self->all_libc_from_provider = FALSE;
 
-          if (!pv_runtime_create_aliases (self, arch, &local_error))
-            {
-              /* This is not a critical error, try to continue */
-              g_warning ("Unable to create library aliases: %s",
-                         local_error->message);
-              g_clear_error (&local_error);
-              continue;
-            }
+      if (!job->all_libdrm_from_provider)
+        all_libdrm_from_provider = FALSE;
 
-          /* Make sure we do this last, so that we have really copied
-           * everything from the provider that we are going to */
-          if (self->mutable_sysroot != NULL &&
-              !pv_runtime_remove_overridden_libraries (self, arch, error))
-            return FALSE;
-        }
+      if (!job->all_libglx_from_provider)
+        all_libglx_from_provider = FALSE;
 
-      g_clear_pointer (&part_timer, _srt_profiling_end);
+      /* Make sure we do this last, so that we have really copied
+       * everything from the provider that we are going to */
+      if (job->remove_overridden_libraries
+          && self->mutable_sysroot != NULL
+          && !pv_runtime_remove_overridden_libraries (self, &job->arch, error))
+        return FALSE;
     }
 
   part_timer = _srt_profiling_start ("Finishing graphics stack capture");
@@ -5520,6 +6483,293 @@ pv_runtime_use_provider_graphics_stack (PvRuntime *self,
   return TRUE;
 }
 
+/*
+ * pv_runtime_set_vulkan_layer_filter:
+ * @allow: (nullable): Glob-style patterns matching the names of implicit
+ *  Vulkan layers to import even if the container environment does not
+ *  enable them
+ * @deny: (nullable): Glob-style patterns matching the names of Vulkan
+ *  layers that must never be imported
+ *
+ * Must be called before pv_runtime_bind(). @deny takes precedence
+ * over @allow.
+ */
+void
+pv_runtime_set_vulkan_layer_filter (PvRuntime *self,
+                                    const char * const *allow,
+                                    const char * const *deny)
+{
+  g_return_if_fail (PV_IS_RUNTIME (self));
+
+  g_strfreev (self->vulkan_layers_allow);
+  self->vulkan_layers_allow = g_strdupv ((gchar **) allow);
+  g_strfreev (self->vulkan_layers_deny);
+  self->vulkan_layers_deny = g_strdupv ((gchar **) deny);
+}
+
+/*
+ * pv_runtime_set_vulkan_icd_selector:
+ * @selector: (nullable): `pci:VENDOR`, `index:N` or
+ *  `driver:NAME` to only import the Vulkan ICDs that can drive the
+ *  selected GPU, plus software rasterizers; or %NULL or empty to
+ *  import all ICDs
+ *
+ * Must be called before pv_runtime_bind().
+ */
+void
+pv_runtime_set_vulkan_icd_selector (PvRuntime *self,
+                                    const char *selector)
+{
+  g_return_if_fail (PV_IS_RUNTIME (self));
+
+  g_free (self->vulkan_icd_selector);
+
+  if (selector != NULL && selector[0] != '\0')
+    self->vulkan_icd_selector = g_strdup (selector);
+  else
+    self->vulkan_icd_selector = NULL;
+}
+
+/* Sanity limit on the number of files in a recorded access list */
+#define MAX_PREWARM_FILES 8192
+
+/*
+ * pv_runtime_prewarm_path_in_current_ns:
+ * @prefixes: Pairs of paths, each consisting of a directory as seen in
+ *  the container and the same directory in the current namespace,
+ *  in order of precedence and terminated by %NULL
+ * @path: A path seen in the container by a previous launch
+ *
+ * Translate @path into the corresponding path in the current namespace,
+ * using the first pair in @prefixes whose container path contains it.
+ *
+ * Returns: (transfer full) (nullable): The translated path, or %NULL
+ *  if @path is not in any of @prefixes
+ */
+gchar *
+pv_runtime_prewarm_path_in_current_ns (const char * const *prefixes,
+                                       const char *path)
+{
+  gsize i;
+
+  g_return_val_if_fail (prefixes != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  for (i = 0; prefixes[i] != NULL && prefixes[i + 1] != NULL; i += 2)
+    {
+      const char *after = _srt_get_path_after (path, prefixes[i]);
+
+      if (after != NULL)
+        return g_build_filename (prefixes[i + 1], after, NULL);
+    }
+
+  return NULL;
+}
+
+/*
+ * pv_runtime_get_prewarm_filename:
+ * @name: (nullable): A name for a list of recorded files, typically
+ *  the Steam app ID, or %NULL or empty to use a generic list
+ *
+ * Returns: (transfer full): The basename of the list of recorded files,
+ *  which is always a single non-hidden path component
+ */
+gchar *
+pv_runtime_get_prewarm_filename (const char *name)
+{
+  gchar *filename;
+
+  if (name == NULL || name[0] == '\0')
+    name = "default";
+
+  /* The name comes from the environment, so make sure it is a
+   * single, non-hidden path component */
+  filename = g_strdup_printf ("%s.txt", name);
+  g_strcanon (filename,
+              "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+              "0123456789-_.",
+              '_');
+
+  if (filename[0] == '.')
+    filename[0] = '_';
+
+  return filename;
+}
+
+/* Called in prewarm thread, or in main thread if single-threaded */
+static gpointer
+prewarm_files (gpointer data)
+{
+  g_autoptr(GPtrArray) paths = data;
+  G_GNUC_UNUSED g_autoptr(SrtProfilingTimer) timer =
+    _srt_profiling_start ("Prewarming %u recorded files", paths->len);
+  gsize i;
+
+  for (i = 0; i < paths->len; i++)
+    {
+      const char *path = g_ptr_array_index (paths, i);
+      glnx_autofd int fd = -1;
+      int res;
+
+      fd = open (path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+
+      if (fd < 0)
+        {
+          g_debug ("Not prewarming \"%s\": %s", path, g_strerror (errno));
+          continue;
+        }
+
+      /* On Linux this starts asynchronous readahead of the whole file,
+       * which is what readahead(2) would do, but is not Linux-specific */
+      res = posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+
+      if (res != 0)
+        g_debug ("Unable to prewarm \"%s\": %s", path, g_strerror (res));
+    }
+
+  return NULL;
+}
+
+/*
+ * pv_runtime_start_prewarm:
+ * @self: The runtime
+ * @name: A name for the list of recorded files, typically the
+ *  Steam app ID, or %NULL to use a generic list
+ *
+ * If the variable directory contains a list of files that were
+ * opened by a previous launch with the same @name, start reading
+ * them into the page cache in a background thread, so that the disk
+ * is not idle while the container is set up. Additionally, arrange
+ * for pv_runtime_get_adverb() to tell the adverb to record the files
+ * mapped by this launch, replacing the old list.
+ *
+ * Does nothing if there is no variable directory.
+ * Must be called before pv_runtime_get_adverb().
+ */
+gboolean
+pv_runtime_start_prewarm (PvRuntime *self,
+                          const char *name,
+                          GError **error)
+{
+  G_GNUC_UNUSED g_autoptr(SrtProfilingTimer) timer = NULL;
+  g_autoptr(GPtrArray) paths = NULL;
+  g_autoptr(GPtrArray) prefixes = NULL;
+  g_autoptr(GHashTable) seen = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autofree gchar *filename = NULL;
+  g_autofree gchar *recorded = NULL;
+  glnx_autofd int dir_fd = -1;
+  glnx_autofd int fd = -1;
+  g_auto(GStrv) lines = NULL;
+  const char *data;
+  gsize len;
+  gsize i;
+
+  g_return_val_if_fail (PV_IS_RUNTIME (self), FALSE);
+  g_return_val_if_fail (self->prewarm_fd < 0, FALSE);
+  g_return_val_if_fail (self->prewarm_thread == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (self->variable_dir_fd < 0)
+    {
+      g_debug ("No variable directory, not recording or prewarming files");
+      return TRUE;
+    }
+
+  timer = _srt_profiling_start ("Loading list of files to prewarm");
+  filename = pv_runtime_get_prewarm_filename (name);
+
+  if (!glnx_shutil_mkdir_p_at (self->variable_dir_fd, "prewarm", 0700,
+                               NULL, error))
+    return glnx_prefix_error (error, "Unable to create %s/prewarm",
+                              self->variable_dir);
+
+  if (!glnx_opendirat (self->variable_dir_fd, "prewarm", TRUE,
+                       &dir_fd, error))
+    return FALSE;
+
+  /* Not truncated: the adverb will replace the contents when the
+   * game exits */
+  fd = openat (dir_fd, filename,
+               O_RDWR | O_CREAT | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW,
+               0600);
+
+  if (fd < 0)
+    return glnx_throw_errno_prefix (error, "Unable to open %s/prewarm/%s",
+                                    self->variable_dir, filename);
+
+  bytes = glnx_fd_readall_bytes (fd, NULL, error);
+
+  if (bytes == NULL)
+    return glnx_prefix_error (error, "Unable to read %s/prewarm/%s",
+                              self->variable_dir, filename);
+
+  data = g_bytes_get_data (bytes, &len);
+  recorded = g_strndup (data, len);
+  lines = g_strsplit (recorded, "\n", -1);
+  paths = g_ptr_array_new_with_free_func (g_free);
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  prefixes = g_ptr_array_new ();
+
+  if (self->provider != NULL)
+    {
+      g_ptr_array_add (prefixes, self->provider->path_in_container_ns);
+      g_ptr_array_add (prefixes, self->provider->path_in_current_ns);
+    }
+
+  /* The overrides can be below /usr, so they must be checked first */
+  if (self->overrides != NULL)
+    {
+      g_ptr_array_add (prefixes, (char *) self->overrides_in_container);
+      g_ptr_array_add (prefixes, self->overrides);
+    }
+
+  if (self->runtime_usr != NULL)
+    {
+      g_ptr_array_add (prefixes, (char *) "/usr");
+      g_ptr_array_add (prefixes, self->runtime_usr);
+    }
+
+  g_ptr_array_add (prefixes, NULL);
+
+  for (i = 0; lines[i] != NULL && paths->len < MAX_PREWARM_FILES; i++)
+    {
+      g_autofree gchar *path = NULL;
+
+      if (lines[i][0] != '/')
+        continue;
+
+      path = pv_runtime_prewarm_path_in_current_ns ((const char * const *) prefixes->pdata,
+                                                    lines[i]);
+
+      if (path == NULL || g_hash_table_contains (seen, path))
+        continue;
+
+      g_hash_table_add (seen, path);
+      g_ptr_array_add (paths, g_steal_pointer (&path));
+    }
+
+  self->prewarm_fd = glnx_steal_fd (&fd);
+
+  if (paths->len == 0)
+    {
+      g_debug ("No recorded files to prewarm in %s/prewarm/%s",
+               self->variable_dir, filename);
+      return TRUE;
+    }
+
+  g_debug ("Prewarming %u files from %s/prewarm/%s",
+           paths->len, self->variable_dir, filename);
+
+  if (self->flags & PV_RUNTIME_FLAGS_SINGLE_THREAD)
+    prewarm_files (g_steal_pointer (&paths));
+  else
+    self->prewarm_thread = g_thread_new ("prewarm", prewarm_files,
+                                         g_steal_pointer (&paths));
+
+  return TRUE;
+}
+
 gboolean
 pv_runtime_bind (PvRuntime *self,
                  FlatpakExports *exports,
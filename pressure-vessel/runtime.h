@@ -40,6 +40,11 @@
  * @PV_RUNTIME_FLAGS_GC_RUNTIMES: Garbage-collect old temporary runtimes
  * @PV_RUNTIME_FLAGS_VERBOSE: Be more verbose
  * @PV_RUNTIME_FLAGS_IMPORT_VULKAN_LAYERS: Include host Vulkan layers
+ * @PV_RUNTIME_FLAGS_IMPORT_ALL_VULKAN_LAYERS: Include host Vulkan implicit
+ *  layers even if the container environment would not enable them
+ * @PV_RUNTIME_FLAGS_LD_SO_CACHE_ONLY: After regenerating the ld.so.cache,
+ *  only keep directories that cannot be represented in the cache
+ *  in the LD_LIBRARY_PATH
  * @PV_RUNTIME_FLAGS_COPY_RUNTIME: Copy the runtime and modify the copy
  * @PV_RUNTIME_FLAGS_UNPACK_ARCHIVE: Source is an archive, not a deployment
  * @PV_RUNTIME_FLAGS_FLATPAK_SUBSANDBOX: The runtime will be used in a
@@ -58,6 +63,8 @@ typedef enum
   PV_RUNTIME_FLAGS_COPY_RUNTIME = (1 << 5),
   PV_RUNTIME_FLAGS_UNPACK_ARCHIVE = (1 << 6),
   PV_RUNTIME_FLAGS_FLATPAK_SUBSANDBOX = (1 << 7),
+  PV_RUNTIME_FLAGS_IMPORT_ALL_VULKAN_LAYERS = (1 << 8),
+  PV_RUNTIME_FLAGS_LD_SO_CACHE_ONLY = (1 << 9),
   PV_RUNTIME_FLAGS_NONE = 0
 } PvRuntimeFlags;
 
@@ -70,6 +77,8 @@ typedef enum
    | PV_RUNTIME_FLAGS_COPY_RUNTIME \
    | PV_RUNTIME_FLAGS_UNPACK_ARCHIVE \
    | PV_RUNTIME_FLAGS_FLATPAK_SUBSANDBOX \
+   | PV_RUNTIME_FLAGS_IMPORT_ALL_VULKAN_LAYERS \
+   | PV_RUNTIME_FLAGS_LD_SO_CACHE_ONLY \
    )
 
 typedef struct _PvRuntime PvRuntime;
@@ -92,6 +101,17 @@ PvRuntime *pv_runtime_new (const char *source,
                            PvRuntimeFlags flags,
                            GError **error);
 
+void pv_runtime_set_vulkan_layer_filter (PvRuntime *self,
+                                         const char * const *allow,
+                                         const char * const *deny);
+void pv_runtime_set_vulkan_icd_selector (PvRuntime *self,
+                                         const char *selector);
+gboolean pv_runtime_start_prewarm (PvRuntime *self,
+                                   const char *name,
+                                   GError **error);
+gchar *pv_runtime_prewarm_path_in_current_ns (const char * const *prefixes,
+                                              const char *path);
+gchar *pv_runtime_get_prewarm_filename (const char *name);
 gboolean pv_runtime_get_adverb (PvRuntime *self,
                                 FlatpakBwrap *adverb_args);
 gboolean pv_runtime_bind (PvRuntime *self,
@@ -115,4 +135,12 @@ gboolean pv_runtime_use_shared_sockets (PvRuntime *self,
 gboolean pv_runtime_has_library (PvRuntime *self,
                                  const char *library);
 
+gboolean pv_runtime_check_vulkan_icd_selector (const char *selector,
+                                               GError **error);
+GPtrArray *pv_runtime_get_vulkan_icd_selector_drivers (const char *selector,
+                                                       GError **error);
+gchar *pv_runtime_get_vulkan_driver_name (const char *library);
+gboolean pv_runtime_want_vulkan_icd_library (const char *library,
+                                             GPtrArray *drivers);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (PvRuntime, g_object_unref)
@@ -994,3 +994,81 @@ pv_delete_dangling_symlink (int dirfd,
                debug_path, name, g_strerror (saved_errno));
     }
 }
+
+/**
+ * pv_symlink_usr_into_sysroot:
+ * @usr: A merged /usr, which must be an absolute path
+ * @sysroot: A directory to be created, which will look like a sysroot
+ *  containing @usr
+ * @error: Used to raise an error on failure
+ *
+ * Populate @sysroot with symbolic links so that it has the same shape
+ * as a container whose /usr is @usr, as set up by pv_bwrap_bind_usr():
+ * `usr` and `etc` point to @usr and its `etc`, and `lib*`, `bin`,
+ * `sbin` and `.ref` point into `usr`.
+ *
+ * This is only suitable for tools that read from the sysroot and
+ * resolve symbolic links inside it themselves, such as
+ * capsule-capture-libs.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+pv_symlink_usr_into_sysroot (const char *usr,
+                             const char *sysroot,
+                             GError **error)
+{
+  g_autoptr(GDir) dir = NULL;
+  g_autofree gchar *etc = NULL;
+  glnx_autofd int sysroot_fd = -1;
+  const char *member;
+
+  g_return_val_if_fail (usr != NULL, FALSE);
+  g_return_val_if_fail (usr[0] == '/', FALSE);
+  g_return_val_if_fail (sysroot != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, sysroot, 0700, NULL, error))
+    return FALSE;
+
+  if (!glnx_opendirat (AT_FDCWD, sysroot, FALSE, &sysroot_fd, error))
+    return FALSE;
+
+  if (TEMP_FAILURE_RETRY (symlinkat (usr, sysroot_fd, "usr")) != 0)
+    return glnx_throw_errno_prefix (error, "Unable to create \"%s/usr\"",
+                                    sysroot);
+
+  dir = g_dir_open (usr, 0, error);
+
+  if (dir == NULL)
+    return FALSE;
+
+  for (member = g_dir_read_name (dir);
+       member != NULL;
+       member = g_dir_read_name (dir))
+    {
+      g_autofree gchar *target = NULL;
+
+      if (!(g_str_has_prefix (member, "lib")
+            && !g_str_equal (member, "libexec"))
+          && !g_str_equal (member, "bin")
+          && !g_str_equal (member, "sbin")
+          && !g_str_equal (member, ".ref"))
+        continue;
+
+      target = g_build_filename ("usr", member, NULL);
+
+      if (TEMP_FAILURE_RETRY (symlinkat (target, sysroot_fd, member)) != 0)
+        return glnx_throw_errno_prefix (error, "Unable to create \"%s/%s\"",
+                                        sysroot, member);
+    }
+
+  /* For simplicity we link to all of /etc here */
+  etc = g_build_filename (usr, "etc", NULL);
+
+  if (TEMP_FAILURE_RETRY (symlinkat (etc, sysroot_fd, "etc")) != 0)
+    return glnx_throw_errno_prefix (error, "Unable to create \"%s/etc\"",
+                                    sysroot);
+
+  return TRUE;
+}
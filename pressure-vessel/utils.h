@@ -81,3 +81,7 @@ void pv_set_up_logging (gboolean opt_verbose);
 void pv_delete_dangling_symlink (int dirfd,
                                  const char *debug_path,
                                  const char *name);
+
+gboolean pv_symlink_usr_into_sysroot (const char *usr,
+                                      const char *sysroot,
+                                      GError **error);
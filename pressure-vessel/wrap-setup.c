@@ -25,6 +25,7 @@
 #include "steam-runtime-tools/utils-internal.h"
 #include "libglnx/libglnx.h"
 
+#include <errno.h>
 #include <string.h>
 
 #include "bwrap.h"
@@ -291,6 +292,266 @@ pv_wrap_use_host_os (FlatpakExports *exports,
   return TRUE;
 }
 
+/*
+ * Returns: (transfer none) (nullable): The option used to mount the
+ *  closest parent of @path that appears in @mounts, or %NULL if none
+ */
+static const char *
+find_parent_mount (GHashTable *mounts,
+                   const char *path)
+{
+  g_autofree gchar *parent = g_path_get_dirname (path);
+
+  while (TRUE)
+    {
+      const char *opt = g_hash_table_lookup (mounts, parent);
+      gchar *next;
+
+      if (opt != NULL)
+        return opt;
+
+      if (g_str_equal (parent, "/") || g_str_equal (parent, "."))
+        return NULL;
+
+      next = g_path_get_dirname (parent);
+      g_free (parent);
+      parent = next;
+    }
+}
+
+/*
+ * pv_wrap_prune_exports:
+ * @bwrap: Arguments produced by flatpak_exports_append_bwrap_args(),
+ *  not including an executable name (the 0'th argument must be
+ *  `--bind` or similar)
+ *
+ * Remove `--bind` and `--ro-bind` arguments that mount a path onto
+ * itself, if its closest parent that is mounted at all is already
+ * mounted onto itself with the same option. The path is already visible
+ * in the container, so mounting it again would only add another mount
+ * for bwrap to set up and for the kernel to keep track of. Paths below
+ * a `--tmpfs`, `--dir` or `--symlink` are kept.
+ *
+ * This must be done before adjust_exports(), which can change the
+ * source of a bind-mount.
+ */
+void
+pv_wrap_prune_exports (FlatpakBwrap *bwrap)
+{
+  g_autoptr(GPtrArray) argv = NULL;
+  /* Mount point => option, or "" if not a bind-mount onto itself.
+   * Keys are owned by bwrap->argv. */
+  g_autoptr(GHashTable) mounts = NULL;
+  /* Indexes in bwrap->argv of the bind-mounts to remove */
+  g_autoptr(GArray) redundant = NULL;
+  guint n_binds = 0;
+  gsize i = 0;
+  gsize r;
+
+  g_return_if_fail (bwrap != NULL);
+
+  mounts = g_hash_table_new (g_str_hash, g_str_equal);
+  redundant = g_array_new (FALSE, FALSE, sizeof (gsize));
+
+  while (i < bwrap->argv->len)
+    {
+      const char *opt = bwrap->argv->pdata[i];
+      const char *mount_opt = "";
+      const char *dest;
+      gsize n_args;
+
+      g_assert (opt != NULL);
+
+      if (g_str_equal (opt, "--ro-bind")
+          || g_str_equal (opt, "--bind")
+          || g_str_equal (opt, "--symlink"))
+        {
+          n_args = 3;
+        }
+      else if (g_str_equal (opt, "--dir")
+               || g_str_equal (opt, "--tmpfs"))
+        {
+          n_args = 2;
+        }
+      else
+        {
+          g_return_if_reached ();
+        }
+
+      g_assert (i + n_args <= bwrap->argv->len);
+      dest = bwrap->argv->pdata[i + n_args - 1];
+
+      if (n_args == 3
+          && !g_str_equal (opt, "--symlink")
+          && g_str_equal (bwrap->argv->pdata[i + 1], dest))
+        {
+          const char *parent_opt = find_parent_mount (mounts, dest);
+
+          n_binds++;
+
+          if (parent_opt != NULL && g_str_equal (parent_opt, opt))
+            {
+              g_debug ("Not mounting %s: already visible via a parent", dest);
+              g_array_append_val (redundant, i);
+              i += n_args;
+              continue;
+            }
+
+          mount_opt = g_str_equal (opt, "--bind") ? "--bind" : "--ro-bind";
+        }
+
+      g_hash_table_replace (mounts, (gpointer) dest, (gpointer) mount_opt);
+      i += n_args;
+    }
+
+  g_debug ("Exporting %u paths with %u bind-mounts (%u redundant)",
+           n_binds, n_binds - redundant->len, redundant->len);
+
+  if (redundant->len == 0)
+    return;
+
+  argv = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0, r = 0; i < bwrap->argv->len; i++)
+    {
+      /* Each redundant bind-mount is an option and two paths */
+      if (r < redundant->len && i == g_array_index (redundant, gsize, r))
+        {
+          i += 2;
+          r++;
+          continue;
+        }
+
+      g_ptr_array_add (argv, g_steal_pointer (&bwrap->argv->pdata[i]));
+    }
+
+  g_ptr_array_unref (bwrap->argv);
+  bwrap->argv = g_steal_pointer (&argv);
+}
+
+/*
+ * Maximum size of each driver's on-disk shader cache, unless the user
+ * configured it. This is the same as Mesa's default, and larger than
+ * NVIDIA's default of 128 MiB, which many games outgrow.
+ */
+#define SHADER_CACHE_MAX_SIZE_MESA "1G"
+#define SHADER_CACHE_MAX_SIZE_BYTES "1073741824"
+
+/*
+ * pv_wrap_get_shader_cache_key:
+ * @command: (array zero-terminated=1): The command to be run
+ * @cwd: The current working directory, used to resolve a relative path
+ *  in @command
+ *
+ * Choose a name for the game's persistent shader cache when no app ID
+ * is available, based on the path to the executable that will be run.
+ *
+ * Returns: (transfer full) (nullable): A filename, or %NULL if @command
+ *  is empty
+ */
+gchar *
+pv_wrap_get_shader_cache_key (const char * const *command,
+                              const char *cwd)
+{
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *base = NULL;
+  g_autofree gchar *checksum = NULL;
+
+  g_return_val_if_fail (cwd != NULL, NULL);
+
+  if (command == NULL || command[0] == NULL || command[0][0] == '\0')
+    return NULL;
+
+  if (strchr (command[0], '/') != NULL)
+    path = g_canonicalize_filename (command[0], cwd);
+  else
+    path = g_find_program_in_path (command[0]);
+
+  if (path == NULL)
+    path = g_strdup (command[0]);
+
+  /* The basename is only there to make the directory recognisable:
+   * the checksum is what makes it unique */
+  base = g_path_get_basename (path);
+  g_strcanon (base,
+              G_CSET_A_2_Z G_CSET_a_2_z G_CSET_DIGITS "+-._",
+              '_');
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, path, -1);
+  return g_strdup_printf ("%s-%.16s", base, checksum);
+}
+
+/*
+ * pv_wrap_use_persistent_shader_cache:
+ * @exports: Used to share the cache with the container
+ * @container_env: Set environment variables for the container here
+ * @env: (array zero-terminated=1) (element-type filename): Environment
+ *  variables to be used instead of `environ`
+ * @cache_dir: Usually `$XDG_CACHE_HOME`
+ * @key: Identifies the game, as returned by
+ *  pv_wrap_get_shader_cache_key()
+ *
+ * With a tmpfs home directory, the drivers' shader caches would be
+ * discarded when the game exits, so every launch would recompile every
+ * shader. Give them a persistent directory on the host instead.
+ * Mesa and NVIDIA both include the driver's build in their cache keys,
+ * so one directory per game is enough, even across driver upgrades.
+ * The same caches are used by OpenGL and by their Vulkan drivers.
+ *
+ * Each driver's cache size is only limited if the cache is ours: if the
+ * user chose a cache directory, their choice of size is respected too.
+ */
+void
+pv_wrap_use_persistent_shader_cache (FlatpakExports *exports,
+                                     PvEnviron *container_env,
+                                     GStrv env,
+                                     const char *cache_dir,
+                                     const char *key)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *dir = NULL;
+  g_autofree gchar *nvidia = NULL;
+
+  g_return_if_fail (exports != NULL);
+  g_return_if_fail (container_env != NULL);
+  g_return_if_fail (cache_dir != NULL);
+  g_return_if_fail (key != NULL);
+
+  dir = g_build_filename (cache_dir, "pressure-vessel", "shader-cache",
+                          key, NULL);
+  nvidia = g_build_filename (dir, "nvidia", NULL);
+
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, nvidia, 0700, NULL, &local_error))
+    {
+      g_warning ("Unable to create persistent shader cache: %s",
+                 local_error->message);
+      return;
+    }
+
+  flatpak_exports_add_path_expose (exports,
+                                   FLATPAK_FILESYSTEM_MODE_READ_WRITE,
+                                   dir);
+
+  /* Mesa creates its own mesa_shader_cache* subdirectories in here */
+  if (g_environ_getenv (env, "MESA_SHADER_CACHE_DIR") == NULL)
+    {
+      pv_environ_setenv (container_env, "MESA_SHADER_CACHE_DIR", dir);
+
+      if (g_environ_getenv (env, "MESA_SHADER_CACHE_MAX_SIZE") == NULL)
+        pv_environ_setenv (container_env, "MESA_SHADER_CACHE_MAX_SIZE",
+                           SHADER_CACHE_MAX_SIZE_MESA);
+    }
+
+  if (g_environ_getenv (env, "__GL_SHADER_DISK_CACHE_PATH") == NULL)
+    {
+      pv_environ_setenv (container_env, "__GL_SHADER_DISK_CACHE_PATH",
+                         nvidia);
+
+      if (g_environ_getenv (env, "__GL_SHADER_DISK_CACHE_SIZE") == NULL)
+        pv_environ_setenv (container_env, "__GL_SHADER_DISK_CACHE_SIZE",
+                           SHADER_CACHE_MAX_SIZE_BYTES);
+    }
+}
+
 const char *
 pv_wrap_get_steam_app_id (const char *from_command_line)
 {
@@ -308,14 +569,267 @@ pv_wrap_get_steam_app_id (const char *from_command_line)
   return NULL;
 }
 
+/*
+ * Parse the decimal number at the beginning of @value.
+ * If @endptr is %NULL, the whole of @value must be a number.
+ */
+static gboolean
+parse_scope_uint64 (const char *name,
+                    const char *value,
+                    guint64 *out,
+                    const char **endptr,
+                    GError **error)
+{
+  gchar *end;
+  guint64 n;
+
+  if (!g_ascii_isdigit (value[0]))
+    return glnx_throw (error, "%s requires a number, not \"%s\"",
+                       name, value);
+
+  errno = 0;
+  n = g_ascii_strtoull (value, &end, 10);
+
+  if (errno == ERANGE)
+    return glnx_throw (error, "%s value \"%s\" is out of range",
+                       name, value);
+
+  if (endptr != NULL)
+    *endptr = end;
+  else if (*end != '\0')
+    return glnx_throw (error, "%s requires a number, not \"%s\"",
+                       name, value);
+
+  *out = n;
+  return TRUE;
+}
+
+/*
+ * CPUWeight and IOWeight: an integer in the range 1 to 10000
+ */
+static GVariant *
+parse_scope_weight (const char *name,
+                    const char *value,
+                    GError **error)
+{
+  guint64 n;
+
+  if (!parse_scope_uint64 (name, value, &n, NULL, error))
+    return NULL;
+
+  if (n < 1 || n > 10000)
+    {
+      glnx_throw (error, "%s must be in the range 1 to 10000, not %s",
+                  name, value);
+      return NULL;
+    }
+
+  return g_variant_new_uint64 (n);
+}
+
+/*
+ * MemoryLow: a number of bytes with an optional K, M, G or T suffix
+ * (base 1024), or "infinity"
+ */
+static GVariant *
+parse_scope_bytes (const char *name,
+                   const char *value,
+                   GError **error)
+{
+  static const char suffixes[] = "KMGT";
+  const char *end;
+  const char *suffix;
+  guint64 n;
+
+  if (strcmp (value, "infinity") == 0)
+    return g_variant_new_uint64 (G_MAXUINT64);
+
+  if (!parse_scope_uint64 (name, value, &n, &end, error))
+    return NULL;
+
+  if (*end != '\0')
+    {
+      gsize i;
+
+      suffix = strchr (suffixes, *end);
+
+      if (suffix == NULL || end[1] != '\0')
+        {
+          glnx_throw (error, "%s requires a number of bytes with optional "
+                      "suffix K, M, G or T, not \"%s\"", name, value);
+          return NULL;
+        }
+
+      for (i = 0; i <= (gsize) (suffix - suffixes); i++)
+        {
+          if (n > G_MAXUINT64 / 1024)
+            {
+              glnx_throw (error, "%s value \"%s\" is out of range",
+                          name, value);
+              return NULL;
+            }
+
+          n *= 1024;
+        }
+    }
+
+  return g_variant_new_uint64 (n);
+}
+
+/* The same as the maximum number of CPUs supported by systemd */
+#define MAX_SCOPE_CPUS 8192
+
+/*
+ * AllowedCPUs: a list of CPU indexes or ranges of indexes such as
+ * "0-3,6", separated by commas or spaces. The result is a bitmask
+ * of type ay, with CPU 0 represented by the least significant bit of
+ * the first byte.
+ */
+static GVariant *
+parse_scope_cpus (const char *name,
+                  const char *value,
+                  GError **error)
+{
+  g_autoptr(GByteArray) mask = g_byte_array_new ();
+  g_auto(GStrv) items = g_strsplit_set (value, ", ", -1);
+  gsize i;
+
+  for (i = 0; items[i] != NULL; i++)
+    {
+      const char *end;
+      guint64 first;
+      guint64 last;
+      guint64 cpu;
+
+      if (items[i][0] == '\0')
+        continue;
+
+      if (!parse_scope_uint64 (name, items[i], &first, &end, error))
+        return NULL;
+
+      if (*end == '-')
+        {
+          if (!parse_scope_uint64 (name, end + 1, &last, NULL, error))
+            return NULL;
+        }
+      else if (*end == '\0')
+        {
+          last = first;
+        }
+      else
+        {
+          glnx_throw (error, "%s requires a list of CPUs such as 0-3,6, "
+                      "not \"%s\"", name, value);
+          return NULL;
+        }
+
+      if (first > last || last >= MAX_SCOPE_CPUS)
+        {
+          glnx_throw (error, "Invalid CPU range \"%s\" in %s",
+                      items[i], name);
+          return NULL;
+        }
+
+      if (mask->len <= last / 8)
+        {
+          gsize old_len = mask->len;
+
+          g_byte_array_set_size (mask, last / 8 + 1);
+          memset (mask->data + old_len, 0, mask->len - old_len);
+        }
+
+      for (cpu = first; cpu <= last; cpu++)
+        mask->data[cpu / 8] |= 1 << (cpu % 8);
+    }
+
+  return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                    mask->data, mask->len, 1);
+}
+
+/*
+ * pv_wrap_parse_scope_properties:
+ * @properties: (array zero-terminated=1): Resource-control properties
+ *  of the form NAME=VALUE, similar to `systemd-run --property`
+ * @error: Used to raise an error on failure
+ *
+ * Parse the resource-control properties that we allow to be set on
+ * the game's systemd scope. The supported properties are `CPUWeight`,
+ * `IOWeight`, `MemoryLow` and `AllowedCPUs`.
+ *
+ * Returns: (transfer floating): A variant of type `a(sv)` suitable for
+ *  passing to StartTransientUnit(), or %NULL on error
+ */
+GVariant *
+pv_wrap_parse_scope_properties (const char * const *properties,
+                                GError **error)
+{
+  GVariantBuilder builder;
+  gsize i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sv)"));
+
+  for (i = 0; properties != NULL && properties[i] != NULL; i++)
+    {
+      g_autofree gchar *name = NULL;
+      const char *equals = strchr (properties[i], '=');
+      const char *value;
+      GVariant *parsed;
+
+      if (equals == NULL)
+        {
+          glnx_throw (error, "systemd scope property must be of the form "
+                      "NAME=VALUE, not \"%s\"", properties[i]);
+          goto fail;
+        }
+
+      name = g_strndup (properties[i], equals - properties[i]);
+      value = equals + 1;
+
+      if (strcmp (name, "CPUWeight") == 0
+          || strcmp (name, "IOWeight") == 0)
+        parsed = parse_scope_weight (name, value, error);
+      else if (strcmp (name, "MemoryLow") == 0)
+        parsed = parse_scope_bytes (name, value, error);
+      else if (strcmp (name, "AllowedCPUs") == 0)
+        parsed = parse_scope_cpus (name, value, error);
+      else
+        {
+          glnx_throw (error, "Unsupported systemd scope property \"%s\"",
+                      name);
+          goto fail;
+        }
+
+      if (parsed == NULL)
+        goto fail;
+
+      g_variant_builder_add (&builder, "(sv)", name, parsed);
+    }
+
+  return g_variant_builder_end (&builder);
+
+fail:
+  g_variant_builder_clear (&builder);
+  return NULL;
+}
+
 /*
  * Try to move the current process into a scope defined by the given
- * Steam app ID. If that's not possible, ignore.
+ * Steam app ID, with the given @properties (see
+ * pv_wrap_parse_scope_properties()) if not %NULL.
+ * If the properties are rejected, for example by an older systemd
+ * that does not support them, try again without them.
+ * If that's not possible, ignore.
+ *
+ * @bus is the connection to the systemd user manager, or %NULL to
+ * use the usual private socket.
  */
 void
-pv_wrap_move_into_scope (const char *steam_app_id)
+pv_wrap_move_into_scope (GDBusConnection *bus,
+                         const char *steam_app_id,
+                         GVariant *properties)
 {
   g_autoptr(GError) local_error = NULL;
+  const char *prefix = "app";
 
   if (steam_app_id != NULL)
     {
@@ -325,13 +839,30 @@ pv_wrap_move_into_scope (const char *steam_app_id)
         steam_app_id = NULL;
     }
 
-  if (steam_app_id != NULL)
-    flatpak_run_in_transient_unit ("steam", "app", steam_app_id, &local_error);
-  else
-    flatpak_run_in_transient_unit ("steam", "", "unknown", &local_error);
+  if (steam_app_id == NULL)
+    {
+      prefix = "";
+      steam_app_id = "unknown";
+    }
+
+  if (flatpak_run_in_transient_unit (bus, "steam", prefix, steam_app_id,
+                                     properties, &local_error))
+    return;
+
+  /* Only a reply from systemd can mean that it rejected the properties:
+   * if we couldn't reach it at all, trying again won't help */
+  if (properties != NULL && g_dbus_error_is_remote_error (local_error))
+    {
+      g_warning ("Cannot move into a systemd scope with the requested "
+                 "properties, trying without: %s", local_error->message);
+      g_clear_error (&local_error);
+
+      if (flatpak_run_in_transient_unit (bus, "steam", prefix, steam_app_id,
+                                         NULL, &local_error))
+        return;
+    }
 
-  if (local_error != NULL)
-    g_debug ("Cannot move into a systemd scope: %s", local_error->message);
+  g_debug ("Cannot move into a systemd scope: %s", local_error->message);
 }
 
 static void
@@ -770,3 +1301,78 @@ pv_wrap_append_preload (GPtrArray *argv,
         break;
     }
 }
+
+/**
+ * pv_wrap_append_ld_profiler:
+ * @argv: (element-type filename): Array of command-line options to populate
+ * @runtime: (nullable): Runtime to be used in container
+ *
+ * Append `--ld-audit` options to @argv to load the bundled
+ * library-loading profiler, for each architecture for which it was
+ * installed. The paths in @argv are valid in the container.
+ */
+gboolean
+pv_wrap_append_ld_profiler (GPtrArray *argv,
+                            PvRuntime *runtime,
+                            GError **error)
+{
+  const char *helpers_path = NULL;
+  const char *helpers_in_prefix = NULL;
+  const char *prefix;
+  gboolean found = FALSE;
+  gsize i;
+
+  g_return_val_if_fail (argv != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  prefix = _srt_find_myself (&helpers_path, error);
+
+  if (prefix == NULL)
+    return FALSE;
+
+  /* If we are using a runtime, pv_runtime_bind() makes our prefix
+   * available as /run/pressure-vessel/pv-from-host; otherwise it is
+   * at the same path as outside the container */
+  if (runtime != NULL)
+    {
+      helpers_in_prefix = _srt_get_path_after (helpers_path, prefix);
+
+      if (helpers_in_prefix == NULL)
+        return glnx_throw (error, "\"%s\" is not below \"%s\"",
+                           helpers_path, prefix);
+    }
+
+  for (i = 0; i < PV_N_SUPPORTED_ARCHITECTURES; i++)
+    {
+      const char *tuple = pv_multiarch_details[i].tuple;
+      g_autofree gchar *path = NULL;
+      g_autofree gchar *in_container = NULL;
+
+      path = g_build_filename (helpers_path, tuple, "libpv-ld-profiler.so",
+                               NULL);
+
+      if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        {
+          g_debug ("No %s library-loading profiler at \"%s\"", tuple, path);
+          continue;
+        }
+
+      if (runtime != NULL)
+        in_container = g_build_filename ("/run/pressure-vessel/pv-from-host",
+                                         helpers_in_prefix, tuple,
+                                         "libpv-ld-profiler.so", NULL);
+      else
+        in_container = g_steal_pointer (&path);
+
+      g_ptr_array_add (argv, g_strdup_printf ("--ld-audit=%s:abi=%s",
+                                              in_container, tuple));
+      found = TRUE;
+    }
+
+  if (!found)
+    return glnx_throw (error,
+                       "Library-loading profiler not found in \"%s\"",
+                       helpers_path);
+
+  return TRUE;
+}
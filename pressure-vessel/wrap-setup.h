@@ -21,6 +21,7 @@
 #pragma once
 
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "environ.h"
 
@@ -37,11 +38,24 @@ void pv_wrap_share_sockets (FlatpakBwrap *bwrap,
 gboolean pv_wrap_use_host_os (FlatpakExports *exports,
                               FlatpakBwrap *bwrap,
                               GError **error);
+void pv_wrap_prune_exports (FlatpakBwrap *bwrap);
 
-void pv_wrap_move_into_scope (const char *steam_app_id);
+GVariant *pv_wrap_parse_scope_properties (const char * const *properties,
+                                          GError **error);
+void pv_wrap_move_into_scope (GDBusConnection *bus,
+                              const char *steam_app_id,
+                              GVariant *properties);
 
 const char *pv_wrap_get_steam_app_id (const char *from_command_line);
 
+gchar *pv_wrap_get_shader_cache_key (const char * const *command,
+                                     const char *cwd);
+void pv_wrap_use_persistent_shader_cache (FlatpakExports *exports,
+                                          PvEnviron *container_env,
+                                          GStrv env,
+                                          const char *cache_dir,
+                                          const char *key);
+
 /**
  * PvAppendPreloadFlags:
  * @PV_APPEND_PRELOAD_FLAGS_FLATPAK_SUBSANDBOX: The game will be run in
@@ -67,3 +81,7 @@ void pv_wrap_append_preload (GPtrArray *argv,
                              PvAppendPreloadFlags flags,
                              PvRuntime *runtime,
                              FlatpakExports *exports);
+
+gboolean pv_wrap_append_ld_profiler (GPtrArray *argv,
+                                     PvRuntime *runtime,
+                                     GError **error);
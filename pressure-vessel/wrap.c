@@ -29,6 +29,8 @@
 #include <locale.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "steam-runtime-tools/glib-backports-internal.h"
 #include "steam-runtime-tools/profiling-internal.h"
@@ -138,6 +140,126 @@ find_bwrap (const char *tools_dir)
   return NULL;
 }
 
+/* Kernel parameters that affect whether an unprivileged bwrap can
+ * create the user namespace it needs. Missing files are recorded as
+ * such, so that a knob appearing or disappearing invalidates the cache. */
+static const char * const bwrap_check_sysctls[] =
+{
+  "/proc/sys/kernel/random/boot_id",
+  "/proc/sys/kernel/unprivileged_userns_clone",
+  "/proc/sys/user/max_user_namespaces",
+  "/proc/sys/kernel/apparmor_restrict_unprivileged_userns",
+  "/proc/sys/kernel/apparmor_restrict_unprivileged_unconfined",
+};
+
+/*
+ * get_bwrap_check_key:
+ * @bwrap_executable: Path to bwrap
+ *
+ * Return a string that changes whenever the result of check_bwrap()
+ * could be different: a different or modified bwrap executable, a reboot,
+ * a change to the user-namespace sysctls, running in a different user
+ * namespace, or running under a different AppArmor (or other LSM)
+ * confinement label.
+ *
+ * Returns: (transfer full): The key, or %NULL if @bwrap_executable
+ *  cannot be inspected
+ */
+static gchar *
+get_bwrap_check_key (const char *bwrap_executable)
+{
+  g_autoptr(GString) key = g_string_new ("");
+  g_autofree gchar *userns = NULL;
+  g_autofree gchar *label = NULL;
+  struct stat stat_buf;
+  gsize i;
+
+  if (stat (bwrap_executable, &stat_buf) != 0)
+    return NULL;
+
+  g_string_append_printf (key,
+                          "bwrap=%s\n"
+                          "uid=%ld\n"
+                          "dev=%" G_GUINT64_FORMAT "\n"
+                          "ino=%" G_GUINT64_FORMAT "\n"
+                          "mode=0%o\n"
+                          "mtime=%" G_GINT64_FORMAT ".%09ld\n"
+                          "ctime=%" G_GINT64_FORMAT ".%09ld\n",
+                          bwrap_executable,
+                          (long) getuid (),
+                          (guint64) stat_buf.st_dev,
+                          (guint64) stat_buf.st_ino,
+                          (unsigned) stat_buf.st_mode,
+                          (gint64) stat_buf.st_mtim.tv_sec,
+                          (long) stat_buf.st_mtim.tv_nsec,
+                          (gint64) stat_buf.st_ctim.tv_sec,
+                          (long) stat_buf.st_ctim.tv_nsec);
+
+  for (i = 0; i < G_N_ELEMENTS (bwrap_check_sysctls); i++)
+    {
+      g_autofree gchar *contents = NULL;
+
+      if (g_file_get_contents (bwrap_check_sysctls[i], &contents, NULL, NULL))
+        {
+          g_strstrip (contents);
+          g_string_append_printf (key, "%s=%s\n",
+                                  bwrap_check_sysctls[i], contents);
+        }
+      else
+        {
+          g_string_append_printf (key, "%s (missing)\n",
+                                  bwrap_check_sysctls[i]);
+        }
+    }
+
+  /* Nested containers can have their own user namespace, which might
+   * not allow creating another one. The link target is unique to the
+   * namespace, for example user:[4026531837] */
+  userns = g_file_read_link ("/proc/self/ns/user", NULL);
+  g_string_append_printf (key, "userns=%s\n",
+                          userns != NULL ? userns : "(unknown)");
+
+  /* An AppArmor profile can stop us from creating user namespaces,
+   * for example on Ubuntu 24.04 */
+  if (g_file_get_contents ("/proc/self/attr/current", &label, NULL, NULL))
+    {
+      g_strstrip (label);
+      g_string_append_printf (key, "label=%s\n", label);
+    }
+  else
+    {
+      g_string_append (key, "label (missing)\n");
+    }
+
+  return g_string_free (g_steal_pointer (&key), FALSE);
+}
+
+static gchar *
+get_bwrap_check_cache_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "pressure-vessel",
+                           "bwrap-check", NULL);
+}
+
+/*
+ * Only successful results are cached: if bwrap doesn't work, we are
+ * going to fail anyway, and re-checking gives the user a chance to
+ * see the diagnostic output again after fixing their system.
+ */
+static void
+remember_bwrap_check (const char *cache_path,
+                      const char *key)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *dir = g_path_get_dirname (cache_path);
+
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, dir, 0700, NULL, &local_error)
+      || !glnx_file_replace_contents_at (AT_FDCWD, cache_path,
+                                         (const guint8 *) key, -1,
+                                         0, NULL, &local_error))
+    g_debug ("Unable to cache bwrap check result: %s", local_error->message);
+}
+
 static gchar *
 check_bwrap (const char *tools_dir,
              gboolean only_prepare)
@@ -174,6 +296,17 @@ check_bwrap (const char *tools_dir,
       int wait_status;
       g_autofree gchar *child_stdout = NULL;
       g_autofree gchar *child_stderr = NULL;
+      g_autofree gchar *cache_path = get_bwrap_check_cache_path ();
+      g_autofree gchar *key = get_bwrap_check_key (bwrap_executable);
+      g_autofree gchar *cached_key = NULL;
+
+      if (key != NULL
+          && g_file_get_contents (cache_path, &cached_key, NULL, NULL)
+          && strcmp (key, cached_key) == 0)
+        {
+          g_debug ("Using cached result: %s was usable last time", bwrap_executable);
+          return g_steal_pointer (&bwrap_executable);
+        }
 
       bwrap_test_argv[0] = bwrap_executable;
 
@@ -204,6 +337,9 @@ check_bwrap (const char *tools_dir,
         }
       else
         {
+          if (key != NULL)
+            remember_bwrap_check (cache_path, key);
+
           return g_steal_pointer (&bwrap_executable);
         }
     }
@@ -691,12 +827,20 @@ static char *opt_home = NULL;
 static char *opt_graphics_provider = NULL;
 static char *graphics_provider_mount_point = NULL;
 static gboolean opt_launcher = FALSE;
+static char *opt_ld_profile_dir = NULL;
+static gboolean opt_ld_so_cache_only = FALSE;
 static gboolean opt_only_prepare = FALSE;
 static gboolean opt_remove_game_overlay = FALSE;
 static gboolean opt_import_vulkan_layers = TRUE;
+static gboolean opt_import_all_vulkan_layers = FALSE;
+static char **opt_vulkan_layer_allow = NULL;
+static char **opt_vulkan_layer_deny = NULL;
+static char *opt_vulkan_icd = NULL;
+static char **opt_systemd_scope_properties = NULL;
 static PvShell opt_shell = PV_SHELL_NONE;
 static GArray *opt_pass_fds = NULL;
 static GArray *opt_preload_modules = NULL;
+static gboolean opt_prewarm_runtime = FALSE;
 static char *opt_runtime = NULL;
 static char *opt_runtime_archive = NULL;
 static char *opt_runtime_base = NULL;
@@ -1130,10 +1274,40 @@ static GOptionEntry options[] =
     "Add MODULE from current execution environment to LD_PRELOAD when "
     "executing COMMAND.",
     "MODULE" },
+  { "ld-profile-dir", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_ld_profile_dir,
+    "Record how each process finds and loads its libraries, writing "
+    "one trace per process into DIR. "
+    "[Default: $PRESSURE_VESSEL_LD_PROFILE_DIR if set]",
+    "DIR" },
+  { "ld-so-cache-only", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_ld_so_cache_only,
+    "Find libraries from the graphics provider via the container's "
+    "ld.so.cache only, without adding them to LD_LIBRARY_PATH. "
+    "[Default if $PRESSURE_VESSEL_LD_SO_CACHE_ONLY is 1]",
+    NULL },
+  { "no-ld-so-cache-only", '\0',
+    G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_ld_so_cache_only,
+    "Add directories containing libraries from the graphics provider "
+    "to LD_LIBRARY_PATH. "
+    "[Default unless $PRESSURE_VESSEL_LD_SO_CACHE_ONLY is 1]",
+    NULL },
   { "pass-fd", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_CALLBACK, opt_pass_fd_cb,
     "Let the launched process inherit the given fd.",
     NULL },
+  { "prewarm-runtime", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_prewarm_runtime,
+    "Record which files from the runtime and graphics stack the game "
+    "maps, and read them into the page cache during container setup "
+    "on its next launch. "
+    "[Default if $PRESSURE_VESSEL_PREWARM_RUNTIME is 1]",
+    NULL },
+  { "no-prewarm-runtime", '\0',
+    G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_prewarm_runtime,
+    "Do not record or prewarm runtime files. "
+    "[Default unless $PRESSURE_VESSEL_PREWARM_RUNTIME is 1]",
+    NULL },
   { "remove-game-overlay", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_remove_game_overlay,
     "Disable the Steam Overlay. "
@@ -1158,6 +1332,18 @@ static GOptionEntry options[] =
     "home directory."
     "[Default if $PRESSURE_VESSEL_IMPORT_VULKAN_LAYERS is 0]",
     NULL },
+  { "import-all-vulkan-layers", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_import_all_vulkan_layers,
+    "Import Vulkan implicit layers even if their enable_environment and "
+    "disable_environment mean they would not be loaded. "
+    "[Default if --launcher or $PRESSURE_VESSEL_IMPORT_ALL_VULKAN_LAYERS is 1]",
+    NULL },
+  { "import-enabled-vulkan-layers", '\0',
+    G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_import_all_vulkan_layers,
+    "Only import Vulkan implicit layers that would be loaded with the "
+    "container's environment. "
+    "[Default unless --launcher or $PRESSURE_VESSEL_IMPORT_ALL_VULKAN_LAYERS is 1]",
+    NULL },
   { "runtime", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_runtime,
     "Mount the given sysroot or merged /usr in the container, and augment "
@@ -1232,6 +1418,12 @@ static GOptionEntry options[] =
   { "no-systemd-scope", '\0',
     G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_systemd_scope,
     "Do not run the game in a systemd scope", NULL },
+  { "systemd-scope-property", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY, &opt_systemd_scope_properties,
+    "Set a resource-control property on the game's systemd scope. "
+    "NAME can be CPUWeight, IOWeight, MemoryLow or AllowedCPUs. "
+    "May be repeated. [Default: $PRESSURE_VESSEL_SYSTEMD_SCOPE_PROPERTIES]",
+    "NAME=VALUE" },
   { "terminal", '\0',
     G_OPTION_FLAG_NONE, G_OPTION_ARG_CALLBACK, opt_terminal_cb,
     "none: disable features that would use a terminal; "
@@ -1273,6 +1465,23 @@ static GOptionEntry options[] =
   { "version-only", '\0',
     G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &opt_version_only,
     "Print version number (no other information) and exit.", NULL },
+  { "vulkan-icd", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &opt_vulkan_icd,
+    "Only import the Vulkan drivers for the GPU selected by "
+    "pci:VENDOR[:DEVICE], index:N or driver:NAME, plus software "
+    "rasterizers. [Default: $PRESSURE_VESSEL_VULKAN_ICD or all drivers]",
+    "SELECTOR" },
+  { "vulkan-layer-allow", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY, &opt_vulkan_layer_allow,
+    "Always import Vulkan implicit layers whose name matches PATTERN, "
+    "even if the container's environment would not enable them. "
+    "May be repeated.",
+    "PATTERN" },
+  { "vulkan-layer-deny", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY, &opt_vulkan_layer_deny,
+    "Never import Vulkan layers whose name matches PATTERN. "
+    "May be repeated.",
+    "PATTERN" },
   { "with-host-graphics", '\0',
     G_OPTION_FLAG_NO_ARG | G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_CALLBACK,
     opt_with_host_graphics_cb,
@@ -1343,6 +1552,7 @@ main (int argc,
   const gchar *home;
   g_autofree gchar *tools_dir = NULL;
   g_autoptr(PvRuntime) runtime = NULL;
+  g_autoptr(GVariant) scope_properties = NULL;
   g_autoptr(FILE) original_stdout = NULL;
   g_autoptr(GArray) pass_fds_through_adverb = g_array_new (FALSE, FALSE, sizeof (int));
   const char *steam_app_id;
@@ -1406,12 +1616,43 @@ main (int argc,
   if (opt_home != NULL && opt_home[0] == '\0')
     g_clear_pointer (&opt_home, g_free);
 
+  opt_ld_profile_dir = g_strdup (g_getenv ("PRESSURE_VESSEL_LD_PROFILE_DIR"));
+
+  if (opt_ld_profile_dir != NULL && opt_ld_profile_dir[0] == '\0')
+    g_clear_pointer (&opt_ld_profile_dir, g_free);
+
+  opt_ld_so_cache_only = pv_boolean_environment ("PRESSURE_VESSEL_LD_SO_CACHE_ONLY",
+                                                 FALSE);
+  opt_prewarm_runtime = pv_boolean_environment ("PRESSURE_VESSEL_PREWARM_RUNTIME",
+                                                FALSE);
   opt_remove_game_overlay = pv_boolean_environment ("PRESSURE_VESSEL_REMOVE_GAME_OVERLAY",
                                                     FALSE);
   opt_systemd_scope = pv_boolean_environment ("PRESSURE_VESSEL_SYSTEMD_SCOPE",
                                               opt_systemd_scope);
+
+    {
+      const char *value = g_getenv ("PRESSURE_VESSEL_SYSTEMD_SCOPE_PROPERTIES");
+
+      if (value != NULL)
+        {
+          g_autoptr(GPtrArray) properties = g_ptr_array_new_with_free_func (g_free);
+          g_auto(GStrv) split = g_strsplit_set (value, " \t\n", -1);
+
+          for (i = 0; split[i] != NULL; i++)
+            {
+              if (split[i][0] != '\0')
+                g_ptr_array_add (properties, g_strdup (split[i]));
+            }
+
+          g_ptr_array_add (properties, NULL);
+          opt_systemd_scope_properties = (char **) g_ptr_array_free (g_steal_pointer (&properties),
+                                                                     FALSE);
+        }
+    }
   opt_import_vulkan_layers = pv_boolean_environment ("PRESSURE_VESSEL_IMPORT_VULKAN_LAYERS",
                                                      TRUE);
+  opt_import_all_vulkan_layers = pv_boolean_environment ("PRESSURE_VESSEL_IMPORT_ALL_VULKAN_LAYERS",
+                                                         FALSE);
 
   opt_share_home = tristate_environment ("PRESSURE_VESSEL_SHARE_HOME");
   opt_gc_legacy_runtimes = pv_boolean_environment ("PRESSURE_VESSEL_GC_LEGACY_RUNTIMES", FALSE);
@@ -1422,6 +1663,7 @@ main (int argc,
   opt_single_thread = pv_boolean_environment ("PRESSURE_VESSEL_SINGLE_THREAD",
                                               opt_single_thread);
   opt_verbose = pv_boolean_environment ("PRESSURE_VESSEL_VERBOSE", FALSE);
+  opt_vulkan_icd = g_strdup (g_getenv ("PRESSURE_VESSEL_VULKAN_ICD"));
 
   if (!opt_shell_cb ("$PRESSURE_VESSEL_SHELL",
                      g_getenv ("PRESSURE_VESSEL_SHELL"), NULL, error))
@@ -1654,6 +1896,17 @@ main (int argc,
       goto out;
     }
 
+  if (opt_systemd_scope_properties != NULL)
+    {
+      scope_properties = pv_wrap_parse_scope_properties ((const char * const *) opt_systemd_scope_properties,
+                                                         error);
+
+      if (scope_properties == NULL)
+        goto out;
+
+      g_variant_ref_sink (scope_properties);
+    }
+
   if (opt_filesystems != NULL)
     {
       for (i = 0; opt_filesystems[i] != NULL; i++)
@@ -1674,12 +1927,31 @@ main (int argc,
         }
     }
 
+  if (opt_ld_profile_dir != NULL && !g_path_is_absolute (opt_ld_profile_dir))
+    {
+      usage_error ("--ld-profile-dir argument must be an absolute path, "
+                   "not \"%s\"", opt_ld_profile_dir);
+      goto out;
+    }
+
   if (opt_copy_runtime && opt_variable_dir == NULL)
     {
       usage_error ("--copy-runtime requires --variable-dir");
       goto out;
     }
 
+  if (opt_vulkan_icd != NULL)
+    {
+      g_autoptr(GError) selector_error = NULL;
+
+      if (!pv_runtime_check_vulkan_icd_selector (opt_vulkan_icd,
+                                                 &selector_error))
+        {
+          usage_error ("--vulkan-icd: %s", selector_error->message);
+          goto out;
+        }
+    }
+
   /* Finished parsing arguments, so any subsequent failures will make
    * us exit 1. */
   ret = 1;
@@ -1907,9 +2179,17 @@ main (int argc,
       if (opt_import_vulkan_layers)
         flags |= PV_RUNTIME_FLAGS_IMPORT_VULKAN_LAYERS;
 
+      /* Commands sent to the launcher later can have a different
+       * environment, so we can't predict which layers they will need */
+      if (opt_import_all_vulkan_layers || opt_launcher)
+        flags |= PV_RUNTIME_FLAGS_IMPORT_ALL_VULKAN_LAYERS;
+
       if (opt_copy_runtime)
         flags |= PV_RUNTIME_FLAGS_COPY_RUNTIME;
 
+      if (opt_ld_so_cache_only)
+        flags |= PV_RUNTIME_FLAGS_LD_SO_CACHE_ONLY;
+
       if (opt_single_thread)
         flags |= PV_RUNTIME_FLAGS_SINGLE_THREAD;
 
@@ -1959,6 +2239,21 @@ main (int argc,
       if (runtime == NULL)
         goto out;
 
+      /* Do this as early as possible, so that reading the files
+       * overlaps with setting up the graphics stack */
+      if (opt_prewarm_runtime
+          && !pv_runtime_start_prewarm (runtime, steam_app_id, &local_error))
+        {
+          g_warning ("Unable to prewarm runtime files: %s",
+                     local_error->message);
+          g_clear_error (&local_error);
+        }
+
+      pv_runtime_set_vulkan_layer_filter (runtime,
+                                          (const char * const *) opt_vulkan_layer_allow,
+                                          (const char * const *) opt_vulkan_layer_deny);
+      pv_runtime_set_vulkan_icd_selector (runtime, opt_vulkan_icd);
+
       if (!pv_runtime_bind (runtime,
                             exports,
                             bwrap_filesystem_arguments,
@@ -2057,6 +2352,25 @@ main (int argc,
               if (!use_tmpfs_home (exports, bwrap_home_arguments,
                                    container_env, error))
                 goto out;
+
+              /* There is no app ID in this code path, so key the
+               * shader cache on the game's executable. In --launcher
+               * mode there is no single game, so leave the caches in
+               * the tmpfs home directory. */
+              if (!opt_launcher)
+                {
+                  g_autofree gchar *cache_key = NULL;
+
+                  cache_key = pv_wrap_get_shader_cache_key ((const char * const *) &argv[1],
+                                                            cwd_p);
+
+                  if (cache_key != NULL)
+                    pv_wrap_use_persistent_shader_cache (exports,
+                                                         container_env,
+                                                         environ,
+                                                         g_get_user_cache_dir (),
+                                                         cache_key);
+                }
             }
           else
             {
@@ -2149,6 +2463,22 @@ main (int argc,
         }
     }
 
+  if (opt_ld_profile_dir != NULL)
+    {
+      g_info ("Recording library-loading traces in \"%s\"",
+              opt_ld_profile_dir);
+
+      if (!glnx_shutil_mkdir_p_at (AT_FDCWD, opt_ld_profile_dir, 0700,
+                                   NULL, error))
+        goto out;
+
+      if (!pv_wrap_append_ld_profiler (adverb_preload_argv, runtime, error))
+        goto out;
+
+      pv_environ_setenv (container_env, "PRESSURE_VESSEL_LD_PROFILE_DIR",
+                         opt_ld_profile_dir);
+    }
+
   if (flatpak_subsandbox == NULL)
     {
       g_assert (bwrap != NULL);
@@ -2188,6 +2518,11 @@ main (int argc,
             }
         }
 
+      if (opt_ld_profile_dir != NULL)
+        flatpak_exports_add_path_expose (exports,
+                                         FLATPAK_FILESYSTEM_MODE_READ_WRITE,
+                                         opt_ld_profile_dir);
+
       /* Make sure the current working directory (the game we are going to
        * run) is available. Some games write here. */
       g_debug ("Making current working directory available...");
@@ -2282,6 +2617,7 @@ main (int argc,
         }
 
       flatpak_exports_append_bwrap_args (exports, exports_bwrap);
+      pv_wrap_prune_exports (exports_bwrap);
       adjust_exports (exports_bwrap, home);
       g_warn_if_fail (g_strv_length (exports_bwrap->envp) == 0);
       flatpak_bwrap_append_bwrap (bwrap, exports_bwrap);
@@ -2684,7 +3020,7 @@ main (int argc,
     }
 
   if (opt_systemd_scope)
-    pv_wrap_move_into_scope (steam_app_id);
+    pv_wrap_move_into_scope (NULL, steam_app_id, scope_properties);
 
   pv_bwrap_execve (final_argv, fileno (original_stdout), error);
 
@@ -2699,12 +3035,17 @@ out:
   g_clear_pointer (&opt_steam_app_id, g_free);
   g_clear_pointer (&opt_home, g_free);
   g_clear_pointer (&opt_fake_home, g_free);
+  g_clear_pointer (&opt_ld_profile_dir, g_free);
   g_clear_pointer (&opt_runtime, g_free);
   g_clear_pointer (&opt_runtime_archive, g_free);
   g_clear_pointer (&opt_runtime_base, g_free);
   g_clear_pointer (&opt_runtime_id, g_free);
   g_clear_pointer (&opt_pass_fds, g_array_unref);
   g_clear_pointer (&opt_variable_dir, g_free);
+  g_clear_pointer (&opt_vulkan_layer_allow, g_strfreev);
+  g_clear_pointer (&opt_vulkan_layer_deny, g_strfreev);
+  g_clear_pointer (&opt_vulkan_icd, g_free);
+  g_clear_pointer (&opt_systemd_scope_properties, g_strfreev);
 
   g_debug ("Exiting with status %d", ret);
   return ret;
@@ -33,10 +33,27 @@ typedef struct
 {
   const char *multiarch_tuple;
   const char *interoperable_runtime_linker;
+  /* ELFCLASS32 or ELFCLASS64 */
+  unsigned char elf_class;
+  /* EM_386, EM_X86_64, etc. */
+  guint16 elf_machine;
 } SrtKnownArchitecture;
 
 G_GNUC_INTERNAL const SrtKnownArchitecture *_srt_architecture_get_known (void);
 
+typedef enum
+{
+  SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE = 0,
+  SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN,
+  SRT_ARCHITECTURE_EVIDENCE_CAN_RUN,
+} SrtArchitectureEvidence;
+
+G_GNUC_INTERNAL
+SrtArchitectureEvidence _srt_architecture_get_static_evidence (const char *multiarch,
+                                                               const char *interpreter,
+                                                               const char *proc,
+                                                               int pid);
+
 G_GNUC_INTERNAL gboolean _srt_architecture_can_run (gchar **envp,
                                                     const char *helpers_path,
                                                     const char *multiarch);
@@ -31,7 +31,15 @@
 #include "steam-runtime-tools/utils.h"
 #include "steam-runtime-tools/utils-internal.h"
 
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <glib-object.h>
+#include <libglnx.h>
 
 /**
  * SECTION:architecture
@@ -51,16 +59,22 @@ static const SrtKnownArchitecture known_architectures[] =
     {
       .multiarch_tuple = SRT_ABI_X86_64,
       .interoperable_runtime_linker = "/lib64/ld-linux-x86-64.so.2",
+      .elf_class = ELFCLASS64,
+      .elf_machine = EM_X86_64,
     },
 
     {
       .multiarch_tuple = SRT_ABI_I386,
       .interoperable_runtime_linker = "/lib/ld-linux.so.2",
+      .elf_class = ELFCLASS32,
+      .elf_machine = EM_386,
     },
 
     {
       .multiarch_tuple = "x86_64-linux-gnux32",
       .interoperable_runtime_linker = "/libx32/ld-linux-x32.so.2",
+      .elf_class = ELFCLASS32,
+      .elf_machine = EM_X86_64,
     },
 
     { NULL }
@@ -76,6 +90,194 @@ _srt_architecture_get_known (void)
   return &known_architectures[0];
 }
 
+static const SrtKnownArchitecture *
+get_known_architecture (const char *multiarch_tuple)
+{
+  gsize i;
+
+  for (i = 0; known_architectures[i].multiarch_tuple != NULL; i++)
+    {
+      if (strcmp (multiarch_tuple,
+                  known_architectures[i].multiarch_tuple) == 0)
+        return &known_architectures[i];
+    }
+
+  return NULL;
+}
+
+/*
+ * Look at the ELF header of @path.
+ *
+ * Returns: %SRT_ARCHITECTURE_EVIDENCE_CAN_RUN if @path is an ELF object
+ *  of the class and machine used by @known,
+ *  %SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN if it does not exist or is
+ *  not, or %SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE if it cannot be read
+ */
+static SrtArchitectureEvidence
+get_elf_evidence (const char *path,
+                  const SrtKnownArchitecture *known)
+{
+  /* e_ident, e_type and e_machine are at the same offsets in
+   * 32- and 64-bit ELF headers */
+  unsigned char header[EI_NIDENT + 2 * sizeof (guint16)];
+  glnx_autofd int fd = -1;
+  guint16 machine;
+  ssize_t n;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    {
+      int saved_errno = errno;
+
+      g_debug ("... cannot open %s: %s", path, g_strerror (saved_errno));
+
+      if (saved_errno == ENOENT || saved_errno == ENOTDIR)
+        return SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN;
+
+      /* Perhaps we can execute it without being able to read it */
+      return SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE;
+    }
+
+  n = TEMP_FAILURE_RETRY (read (fd, header, sizeof (header)));
+
+  if (n != sizeof (header)
+      || memcmp (header, ELFMAG, SELFMAG) != 0
+      || header[EI_CLASS] != known->elf_class
+      || header[EI_DATA] != ELFDATA2LSB)
+    {
+      g_debug ("... %s is not a suitable ELF object", path);
+      return SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN;
+    }
+
+  memcpy (&machine, header + EI_NIDENT + sizeof (guint16), sizeof (machine));
+  machine = GUINT16_FROM_LE (machine);
+
+  if (machine != known->elf_machine)
+    {
+      g_debug ("... %s is for ELF machine %u, not %u",
+               path, machine, known->elf_machine);
+      return SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN;
+    }
+
+  return SRT_ARCHITECTURE_EVIDENCE_CAN_RUN;
+}
+
+/*
+ * Returns: %TRUE if @pid or one of its ancestors is running an
+ *  executable for @known, proving that the kernel supports it
+ */
+static gboolean
+ancestor_runs_architecture (const char *proc,
+                            int pid,
+                            const SrtKnownArchitecture *known)
+{
+  guint depth;
+
+  /* Don't loop forever if a fake /proc has a cycle */
+  for (depth = 0; pid > 0 && depth < 64; depth++)
+    {
+      g_autofree gchar *contents = NULL;
+      g_autofree gchar *exe = NULL;
+      g_autofree gchar *stat_path = NULL;
+      const char *p;
+      int ppid;
+
+      /* /proc/PID/exe is whatever the kernel actually loaded. For a
+       * process run under an emulator via binfmt_misc, that is the
+       * emulator, so this cannot be fooled into trusting emulation. */
+      exe = g_strdup_printf ("%s/%d/exe", proc, pid);
+
+      if (get_elf_evidence (exe, known) == SRT_ARCHITECTURE_EVIDENCE_CAN_RUN)
+        {
+          g_debug ("... process %d is already running %s code",
+                   pid, known->multiarch_tuple);
+          return TRUE;
+        }
+
+      stat_path = g_strdup_printf ("%s/%d/stat", proc, pid);
+
+      if (!g_file_get_contents (stat_path, &contents, NULL, NULL))
+        return FALSE;
+
+      /* The format is "PID (COMM) STATE PPID ...", where COMM can
+       * contain anything, including parentheses */
+      p = strrchr (contents, ')');
+
+      if (p == NULL || sscanf (p + 1, " %*c %d", &ppid) != 1 || ppid == pid)
+        return FALSE;
+
+      pid = ppid;
+    }
+
+  return FALSE;
+}
+
+/*
+ * _srt_architecture_get_static_evidence:
+ * @multiarch: A multiarch tuple
+ * @interpreter: (nullable): The ELF interpreter to inspect, or %NULL
+ *  to use the interoperable runtime linker for @multiarch
+ * @proc: (nullable): The mount point of proc(5), or %NULL for `/proc`
+ * @pid: The first process to inspect, or 0 for the current process
+ *
+ * Decide whether executables for @multiarch can be run by looking at
+ * files, without running anything.
+ *
+ * Every executable for a known architecture has the interoperable
+ * runtime linker as its ELF interpreter, so if that is missing or is
+ * not an ELF object of the right class and machine, the kernel will
+ * refuse to start the executable.
+ *
+ * If it is present and correct, we also need to know that the kernel
+ * supports the architecture: an x86_64 kernel might have been built
+ * or booted without 32-bit compatibility. That is certainly true for
+ * the architecture this library was built for, and for any other
+ * architecture that the current process or one of its ancestors is
+ * running, such as a 32-bit Steam client. Otherwise the caller has to
+ * try it.
+ */
+SrtArchitectureEvidence
+_srt_architecture_get_static_evidence (const char *multiarch,
+                                       const char *interpreter,
+                                       const char *proc,
+                                       int pid)
+{
+  const SrtKnownArchitecture *known = get_known_architecture (multiarch);
+  SrtArchitectureEvidence evidence;
+
+  if (known == NULL)
+    return SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE;
+
+  if (interpreter == NULL)
+    interpreter = known->interoperable_runtime_linker;
+
+  if (interpreter == NULL)
+    return SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE;
+
+  evidence = get_elf_evidence (interpreter, known);
+
+  if (evidence != SRT_ARCHITECTURE_EVIDENCE_CAN_RUN)
+    return evidence;
+
+  if (strcmp (multiarch, _SRT_MULTIARCH) == 0)
+    {
+      g_debug ("... native architecture");
+      return SRT_ARCHITECTURE_EVIDENCE_CAN_RUN;
+    }
+
+  if (proc == NULL)
+    proc = "/proc";
+
+  if (pid <= 0)
+    pid = getpid ();
+
+  if (ancestor_runs_architecture (proc, pid, known))
+    return SRT_ARCHITECTURE_EVIDENCE_CAN_RUN;
+
+  return SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE;
+}
+
 gboolean
 _srt_architecture_can_run (gchar **envp,
                            const char *helpers_path,
@@ -105,18 +307,31 @@ _srt_architecture_can_run (gchar **envp,
   g_debug ("Testing architecture %s with %s",
            multiarch, (const char *) g_ptr_array_index (argv, 0));
 
+  /* Avoid the cost of running the helper if we can already tell */
+  switch (_srt_architecture_get_static_evidence (multiarch, NULL, NULL, 0))
+    {
+      case SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN:
+        goto out;
+
+      case SRT_ARCHITECTURE_EVIDENCE_CAN_RUN:
+        g_debug ("... it works");
+        ret = TRUE;
+        goto out;
+
+      case SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE:
+      default:
+        break;
+    }
+
   my_environ = _srt_filter_gameoverlayrenderer_from_envp (envp);
 
-  if (!g_spawn_sync (NULL,       /* working directory */
-                     (gchar **) argv->pdata,
-                     my_environ, /* envp */
-                     0,          /* flags */
-                     _srt_child_setup_unblock_signals,
-                     NULL,       /* user data */
-                     NULL,       /* stdout */
-                     NULL,       /* stderr */
-                     &exit_status,
-                     &error))
+  if (!_srt_spawn_helper_sync ((gchar **) argv->pdata,
+                               my_environ, /* envp */
+                               0,          /* flags */
+                               NULL,       /* stdout */
+                               NULL,       /* stderr */
+                               &exit_status,
+                               &error))
     {
       g_debug ("... %s", error->message);
       goto out;
@@ -202,18 +417,16 @@ srt_architecture_can_run_x86_64 (void)
 const char *
 srt_architecture_get_expected_runtime_linker (const char *multiarch_tuple)
 {
-  gsize i;
+  const SrtKnownArchitecture *known;
 
   g_return_val_if_fail (multiarch_tuple != NULL, NULL);
 
-  for (i = 0; known_architectures[i].multiarch_tuple != NULL; i++)
-    {
-      if (strcmp (multiarch_tuple,
-                  known_architectures[i].multiarch_tuple) == 0)
-        return known_architectures[i].interoperable_runtime_linker;
-    }
+  known = get_known_architecture (multiarch_tuple);
 
-  return NULL;
+  if (known == NULL)
+    return NULL;
+
+  return known->interoperable_runtime_linker;
 }
 
 /**
@@ -52,95 +52,76 @@ remove_last_component_in_place (char *path)
     *slash = '\0';
 }
 
-/*
- * @path: The path to a device directory in /sys
- *
- * Returns: (nullable) (transfer full): The closest ancestor of @path
- *  that is an input device with evdev capabilities, or %NULL if not found
- */
-static gchar *
-find_input_ancestor (const char *path)
+typedef enum
 {
-  g_autofree char *ancestor = NULL;
-
-  for (ancestor = g_strdup (path);
-       g_str_has_prefix (ancestor, "/sys/");
-       remove_last_component_in_place (ancestor))
-    {
-      g_autofree char *subsys = g_build_filename (ancestor, "subsystem", NULL);
-      g_autofree char *caps = g_build_filename (ancestor, "capabilities", "ev", NULL);
-      g_autofree char *target = glnx_readlinkat_malloc (AT_FDCWD, subsys,
-                                                        NULL, NULL);
-      const char *slash = NULL;
-
-      if (!g_file_test (caps, G_FILE_TEST_IS_REGULAR))
-        continue;
-
-      if (target != NULL)
-        slash = strrchr (target, '/');
-
-      if (slash == NULL || strcmp (slash + 1, "input") != 0)
-        continue;
-
-      return g_steal_pointer (&ancestor);
-    }
-
-  return NULL;
-}
+  ATTR_INPUT_BUS_TYPE,
+  ATTR_INPUT_VENDOR_ID,
+  ATTR_INPUT_PRODUCT_ID,
+  ATTR_INPUT_VERSION,
+  ATTR_INPUT_NAME,
+  ATTR_INPUT_PHYS,
+  ATTR_INPUT_UNIQ,
+  ATTR_USB_VENDOR_ID,
+  ATTR_USB_PRODUCT_ID,
+  ATTR_USB_DEVICE_VERSION,
+  ATTR_USB_MANUFACTURER,
+  ATTR_USB_PRODUCT,
+  N_ATTRS
+} AncestorAttribute;
+
+#define FIRST_INPUT_ATTR ATTR_INPUT_BUS_TYPE
+#define LAST_INPUT_ATTR ATTR_INPUT_UNIQ
+#define FIRST_USB_ATTR ATTR_USB_VENDOR_ID
+#define LAST_USB_ATTR ATTR_USB_PRODUCT
+
+static const char * const ancestor_attribute_names[N_ATTRS] =
+{
+  [ATTR_INPUT_BUS_TYPE] = "id/bustype",
+  [ATTR_INPUT_VENDOR_ID] = "id/vendor",
+  [ATTR_INPUT_PRODUCT_ID] = "id/product",
+  [ATTR_INPUT_VERSION] = "id/version",
+  [ATTR_INPUT_NAME] = "name",
+  [ATTR_INPUT_PHYS] = "phys",
+  [ATTR_INPUT_UNIQ] = "uniq",
+  [ATTR_USB_VENDOR_ID] = "idVendor",
+  [ATTR_USB_PRODUCT_ID] = "idProduct",
+  [ATTR_USB_DEVICE_VERSION] = "bcdDevice",
+  [ATTR_USB_MANUFACTURER] = "manufacturer",
+  [ATTR_USB_PRODUCT] = "product",
+};
 
 /*
- * @path: The path to a device directory in /sys
- * @subsystem: A desired subsystem, such as "hid" or "usb", or %NULL to accept any
- * @devtype: A desired device type, such as "usb_device", or %NULL to accept any
- * @uevent_out: (out) (optional): Optionally return the text of /sys/.../uevent
- *
- * Returns: (nullable) (transfer full): The closest ancestor of @path
- *  that has a subsystem of @subsystem, or %NULL if not found.
+ * Everything we need to know about a directory in /sys that might be
+ * an ancestor of an input device, read in a single pass. A game
+ * controller typically has several evdev nodes and a hidraw node
+ * sharing the same HID and USB ancestors, so we cache these per
+ * monitor instead of re-reading them for each device node.
  */
-static gchar *
-get_ancestor_with_subsystem_devtype (const char *path,
-                                     const char *subsystem,
-                                     const char *devtype,
-                                     gchar **uevent_out)
+typedef struct
 {
-  g_autofree char *ancestor = NULL;
-
-  for (ancestor = g_strdup (path);
-       g_str_has_prefix (ancestor, "/sys/");
-       remove_last_component_in_place (ancestor))
-    {
-      g_autofree char *uevent = g_build_filename (ancestor, "uevent", NULL);
-      g_autofree char *text = NULL;
+  /* Contents of uevent, or %NULL if it isn't a real device */
+  gchar *uevent;
+  /* Last component of the subsystem symlink, or %NULL */
+  gchar *subsystem;
+  /* %TRUE if capabilities/ev exists */
+  gboolean has_evdev_capabilities;
+  /* Only the attributes that are relevant for @subsystem are read */
+  gchar *attributes[N_ATTRS];
+} SysfsAncestor;
 
-      /* If it doesn't have a uevent file, it isn't a real device */
-      if (!g_file_get_contents (uevent, &text, NULL, NULL))
-        continue;
-
-      if (subsystem != NULL)
-        {
-          g_autofree char *subsys = g_build_filename (ancestor, "subsystem", NULL);
-          g_autofree char *target = glnx_readlinkat_malloc (AT_FDCWD, subsys,
-                                                            NULL, NULL);
-          const char *slash = NULL;
-
-          if (target != NULL)
-            slash = strrchr (target, '/');
-
-          if (slash == NULL || strcmp (slash + 1, subsystem) != 0)
-            continue;
-        }
-
-      if (devtype != NULL
-          && !_srt_input_device_uevent_field_equals (text, "DEVTYPE", devtype))
-        continue;
+static void
+sysfs_ancestor_free (gpointer p)
+{
+  SysfsAncestor *self = p;
+  gsize i;
 
-      if (uevent_out != NULL)
-        *uevent_out = g_steal_pointer (&text);
+  g_free (self->uevent);
+  g_free (self->subsystem);
 
-      return g_steal_pointer (&ancestor);
-    }
+  for (i = 0; i < N_ATTRS; i++)
+    g_free (self->attributes[i]);
 
-  return NULL;
+  g_free (self);
 }
 
 static GQuark quark_hidraw = 0;
@@ -209,6 +190,8 @@ struct _SrtDirectInputDeviceMonitor
 {
   GObject parent;
   GHashTable *devices;
+  /* (element-type filename SysfsAncestor) */
+  GHashTable *ancestors;
   GMainContext *monitor_context;
   GSource *monitor_source;
   SrtInputDeviceMonitorFlags flags;
@@ -492,6 +475,10 @@ _srt_direct_input_device_monitor_init (SrtDirectInputDeviceMonitor *self)
                                          g_str_equal,
                                          NULL,
                                          g_object_unref);
+  self->ancestors = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           g_free,
+                                           sysfs_ancestor_free);
   self->inotify_fd = -1;
   self->dev_watch = -1;
   self->devinput_watch = -1;
@@ -608,27 +595,23 @@ dup_string (const char *sys_path,
 }
 
 /*
- * Get a sysfs attribute that is a uint32 (or smaller) in hexadecimal
+ * Parse a sysfs attribute that is a uint32 (or smaller) in hexadecimal
  * (with or without 0x prefix).
  *
  * On success, set *out and return TRUE.
  * On failure, leave *out untouched and return FALSE.
  */
 static gboolean
-get_uint32_hex (const char *sys_path,
-                const char *attribute,
-                guint32 *out)
+parse_uint32_hex (const char *text,
+                  guint32 *out)
 {
-  g_autofree gchar *buf = NULL;
-  const char *tmp;
+  const char *tmp = text;
   guint64 ret;
   gchar *endptr;
 
-  if (!dup_string (sys_path, attribute, &buf))
+  if (tmp == NULL)
     return FALSE;
 
-  tmp = buf;
-
   if (tmp[0] == '0' && (tmp[1] == 'x' || tmp[1] == 'X'))
     tmp += 2;
 
@@ -645,18 +628,202 @@ get_uint32_hex (const char *sys_path,
   return TRUE;
 }
 
+/*
+ * If @text is non-%NULL, replace *out with a copy of it.
+ * Otherwise leave *out untouched.
+ */
+static void
+replace_string (const char *text,
+                gchar **out)
+{
+  if (text == NULL)
+    return;
+
+  g_free (*out);
+  *out = g_strdup (text);
+}
+
+/*
+ * @path: The path to a device directory in /sys
+ *
+ * Read everything we might need to know about @path.
+ *
+ * Returns: (transfer full): Information about @path
+ */
+static SysfsAncestor *
+sysfs_ancestor_new (const char *path)
+{
+  SysfsAncestor *self = g_new0 (SysfsAncestor, 1);
+  g_autofree gchar *subsys = g_build_filename (path, "subsystem", NULL);
+  g_autofree gchar *caps = g_build_filename (path, "capabilities", "ev", NULL);
+  g_autofree gchar *target = glnx_readlinkat_malloc (AT_FDCWD, subsys,
+                                                     NULL, NULL);
+  const char *slash = NULL;
+  gsize i;
+
+  dup_string (path, "uevent", &self->uevent);
+
+  if (target != NULL)
+    slash = strrchr (target, '/');
+
+  if (slash != NULL)
+    self->subsystem = g_strdup (slash + 1);
+
+  self->has_evdev_capabilities = g_file_test (caps, G_FILE_TEST_IS_REGULAR);
+
+  if (self->has_evdev_capabilities
+      && g_strcmp0 (self->subsystem, "input") == 0)
+    {
+      for (i = FIRST_INPUT_ATTR; i <= LAST_INPUT_ATTR; i++)
+        dup_string (path, ancestor_attribute_names[i], &self->attributes[i]);
+    }
+
+  if (self->uevent != NULL
+      && g_strcmp0 (self->subsystem, "usb") == 0
+      && _srt_input_device_uevent_field_equals (self->uevent, "DEVTYPE",
+                                                "usb_device"))
+    {
+      for (i = FIRST_USB_ATTR; i <= LAST_USB_ATTR; i++)
+        dup_string (path, ancestor_attribute_names[i], &self->attributes[i]);
+    }
+
+  return self;
+}
+
+/*
+ * @path: The path to a device directory in /sys
+ *
+ * Returns: (transfer none): Information about @path, read from /sys
+ *  if it was not already cached
+ */
+static const SysfsAncestor *
+get_sysfs_ancestor (SrtDirectInputDeviceMonitor *self,
+                    const char *path)
+{
+  SysfsAncestor *ancestor = g_hash_table_lookup (self->ancestors, path);
+
+  if (ancestor == NULL)
+    {
+      ancestor = sysfs_ancestor_new (path);
+      g_hash_table_replace (self->ancestors, g_strdup (path), ancestor);
+    }
+
+  return ancestor;
+}
+
+/*
+ * @path: The path to a device directory in /sys
+ *
+ * Forget cached information about @path and all of its ancestors,
+ * so that it will be re-read if a new device appears at the same
+ * place in the device hierarchy.
+ */
 static void
-read_hid_ancestor (SrtDirectInputDevice *device)
+forget_sysfs_ancestors (SrtDirectInputDeviceMonitor *self,
+                        const char *path)
 {
-  g_autofree gchar *uevent = NULL;
+  g_autofree char *ancestor = NULL;
 
-  if (device->hid_ancestor.sys_path == NULL)
+  if (self->ancestors == NULL)
     return;
 
-  if (!dup_string (device->hid_ancestor.sys_path, "uevent", &uevent))
+  for (ancestor = g_strdup (path);
+       g_str_has_prefix (ancestor, "/sys/");
+       remove_last_component_in_place (ancestor))
+    g_hash_table_remove (self->ancestors, ancestor);
+}
+
+/*
+ * @path: The path to a device directory in /sys
+ * @info_out: (out) (optional) (transfer none): Optionally return
+ *  the cached attributes of the ancestor
+ *
+ * Returns: (nullable) (transfer full): The closest ancestor of @path
+ *  that is an input device with evdev capabilities, or %NULL if not found
+ */
+static gchar *
+find_input_ancestor (SrtDirectInputDeviceMonitor *self,
+                     const char *path,
+                     const SysfsAncestor **info_out)
+{
+  g_autofree char *ancestor = NULL;
+
+  for (ancestor = g_strdup (path);
+       g_str_has_prefix (ancestor, "/sys/");
+       remove_last_component_in_place (ancestor))
+    {
+      const SysfsAncestor *info = get_sysfs_ancestor (self, ancestor);
+
+      if (!info->has_evdev_capabilities)
+        continue;
+
+      if (g_strcmp0 (info->subsystem, "input") != 0)
+        continue;
+
+      if (info_out != NULL)
+        *info_out = info;
+
+      return g_steal_pointer (&ancestor);
+    }
+
+  return NULL;
+}
+
+/*
+ * @path: The path to a device directory in /sys
+ * @subsystem: A desired subsystem, such as "hid" or "usb", or %NULL to accept any
+ * @devtype: A desired device type, such as "usb_device", or %NULL to accept any
+ * @info_out: (out) (optional) (transfer none): Optionally return
+ *  the cached attributes of the ancestor, including the text of
+ *  /sys/.../uevent
+ *
+ * Returns: (nullable) (transfer full): The closest ancestor of @path
+ *  that has a subsystem of @subsystem, or %NULL if not found.
+ */
+static gchar *
+get_ancestor_with_subsystem_devtype (SrtDirectInputDeviceMonitor *self,
+                                     const char *path,
+                                     const char *subsystem,
+                                     const char *devtype,
+                                     const SysfsAncestor **info_out)
+{
+  g_autofree char *ancestor = NULL;
+
+  for (ancestor = g_strdup (path);
+       g_str_has_prefix (ancestor, "/sys/");
+       remove_last_component_in_place (ancestor))
+    {
+      const SysfsAncestor *info = get_sysfs_ancestor (self, ancestor);
+
+      /* If it doesn't have a uevent file, it isn't a real device */
+      if (info->uevent == NULL)
+        continue;
+
+      if (subsystem != NULL && g_strcmp0 (info->subsystem, subsystem) != 0)
+        continue;
+
+      if (devtype != NULL
+          && !_srt_input_device_uevent_field_equals (info->uevent,
+                                                     "DEVTYPE", devtype))
+        continue;
+
+      if (info_out != NULL)
+        *info_out = info;
+
+      return g_steal_pointer (&ancestor);
+    }
+
+  return NULL;
+}
+
+static void
+read_hid_ancestor (SrtDirectInputDevice *device,
+                   const SysfsAncestor *info)
+{
+  if (device->hid_ancestor.sys_path == NULL || info->uevent == NULL)
     return;
 
-  _srt_get_identity_from_hid_uevent (uevent,
+  _srt_get_identity_from_hid_uevent (info->uevent,
                                      &device->hid.bus_type,
                                      &device->hid.vendor_id,
                                      &device->hid.product_id,
@@ -666,40 +833,42 @@ read_hid_ancestor (SrtDirectInputDevice *device)
 }
 
 static void
-read_input_ancestor (SrtDirectInputDevice *device)
+read_input_ancestor (SrtDirectInputDevice *device,
+                     const SysfsAncestor *info)
 {
   if (device->input_ancestor.sys_path == NULL)
     return;
 
-  get_uint32_hex (device->input_ancestor.sys_path, "id/bustype",
-                  &device->evdev.bus_type);
-  get_uint32_hex (device->input_ancestor.sys_path, "id/vendor",
-                  &device->evdev.vendor_id);
-  get_uint32_hex (device->input_ancestor.sys_path, "id/product",
-                  &device->evdev.product_id);
-  get_uint32_hex (device->input_ancestor.sys_path, "id/version",
-                  &device->evdev.version);
-  dup_string (device->input_ancestor.sys_path, "name", &device->evdev.name);
-  dup_string (device->input_ancestor.sys_path, "phys", &device->evdev.phys);
-  dup_string (device->input_ancestor.sys_path, "uniq", &device->evdev.uniq);
+  parse_uint32_hex (info->attributes[ATTR_INPUT_BUS_TYPE],
+                    &device->evdev.bus_type);
+  parse_uint32_hex (info->attributes[ATTR_INPUT_VENDOR_ID],
+                    &device->evdev.vendor_id);
+  parse_uint32_hex (info->attributes[ATTR_INPUT_PRODUCT_ID],
+                    &device->evdev.product_id);
+  parse_uint32_hex (info->attributes[ATTR_INPUT_VERSION],
+                    &device->evdev.version);
+  replace_string (info->attributes[ATTR_INPUT_NAME], &device->evdev.name);
+  replace_string (info->attributes[ATTR_INPUT_PHYS], &device->evdev.phys);
+  replace_string (info->attributes[ATTR_INPUT_UNIQ], &device->evdev.uniq);
 }
 
 static void
-read_usb_device_ancestor (SrtDirectInputDevice *device)
+read_usb_device_ancestor (SrtDirectInputDevice *device,
+                          const SysfsAncestor *info)
 {
   if (device->usb_device_ancestor.sys_path == NULL)
     return;
 
-  get_uint32_hex (device->usb_device_ancestor.sys_path, "idVendor",
-                  &device->usb_device_ancestor.vendor_id);
-  get_uint32_hex (device->usb_device_ancestor.sys_path, "idProduct",
-                  &device->usb_device_ancestor.product_id);
-  get_uint32_hex (device->usb_device_ancestor.sys_path, "bcdDevice",
-                  &device->usb_device_ancestor.device_version);
-  dup_string (device->usb_device_ancestor.sys_path, "manufacturer",
-              &device->usb_device_ancestor.manufacturer);
-  dup_string (device->usb_device_ancestor.sys_path, "product",
-              &device->usb_device_ancestor.product);
+  parse_uint32_hex (info->attributes[ATTR_USB_VENDOR_ID],
+                    &device->usb_device_ancestor.vendor_id);
+  parse_uint32_hex (info->attributes[ATTR_USB_PRODUCT_ID],
+                    &device->usb_device_ancestor.product_id);
+  parse_uint32_hex (info->attributes[ATTR_USB_DEVICE_VERSION],
+                    &device->usb_device_ancestor.device_version);
+  replace_string (info->attributes[ATTR_USB_MANUFACTURER],
+                  &device->usb_device_ancestor.manufacturer);
+  replace_string (info->attributes[ATTR_USB_PRODUCT],
+                  &device->usb_device_ancestor.product);
 }
 
 static void
@@ -708,6 +877,7 @@ add_device (SrtDirectInputDeviceMonitor *self,
             GQuark subsystem)
 {
   SrtDirectInputDevice *device = NULL;
+  const SysfsAncestor *info = NULL;
   const char *slash = strrchr (devnode, '/');
   g_autofree char *sys_symlink = NULL;
   int fd;
@@ -813,20 +983,24 @@ add_device (SrtDirectInputDeviceMonitor *self,
       return;
     }
 
-  device->hid_ancestor.sys_path = get_ancestor_with_subsystem_devtype (device->sys_path,
+  device->hid_ancestor.sys_path = get_ancestor_with_subsystem_devtype (self,
+                                                                       device->sys_path,
                                                                        "hid", NULL,
-                                                                       NULL);
-  read_hid_ancestor (device);
-  device->input_ancestor.sys_path = find_input_ancestor (device->sys_path);
-  read_input_ancestor (device);
+                                                                       &info);
+  read_hid_ancestor (device, info);
+  device->input_ancestor.sys_path = find_input_ancestor (self,
+                                                         device->sys_path,
+                                                         &info);
+  read_input_ancestor (device, info);
 
   if (device->hid.bus_type == BUS_USB || device->evdev.bus_type == BUS_USB)
     {
-      device->usb_device_ancestor.sys_path = get_ancestor_with_subsystem_devtype (device->sys_path,
+      device->usb_device_ancestor.sys_path = get_ancestor_with_subsystem_devtype (self,
+                                                                                  device->sys_path,
                                                                                   "usb",
                                                                                   "usb_device",
-                                                                                  NULL);
-      read_usb_device_ancestor (device);
+                                                                                  &info);
+      read_usb_device_ancestor (device, info);
     }
 
   g_hash_table_replace (self->devices, device->dev_node, device);
@@ -845,6 +1019,7 @@ remove_device (SrtDirectInputDeviceMonitor *self,
   if (g_hash_table_lookup_extended (self->devices, devnode, NULL, &device))
     {
       g_hash_table_steal (self->devices, devnode);
+      forget_sysfs_ancestors (self, SRT_DIRECT_INPUT_DEVICE (device)->sys_path);
       _srt_input_device_monitor_emit_removed (SRT_INPUT_DEVICE_MONITOR (self),
                                               device);
       g_object_unref (device);
@@ -1087,6 +1262,7 @@ srt_direct_input_device_monitor_stop (SrtInputDeviceMonitor *monitor)
   g_clear_pointer (&self->monitor_source, g_source_unref);
   g_clear_pointer (&self->monitor_context, g_main_context_unref);
   g_clear_pointer (&self->devices, g_hash_table_unref);
+  g_clear_pointer (&self->ancestors, g_hash_table_unref);
 
   if (self->inotify_fd >= 0)
     {
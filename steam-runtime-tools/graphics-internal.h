@@ -307,6 +307,9 @@ GList *_srt_load_vulkan_layers_extended (const char *helpers_path,
                                          gboolean explicit,
                                          SrtCheckFlags check_flags);
 
+gboolean _srt_vulkan_layer_is_enabled_by_environ (SrtVulkanLayer *self,
+                                                  const char * const *envp);
+
 void _srt_graphics_get_from_report (JsonObject *json_obj,
                                     const gchar *multiarch_tuple,
                                     GHashTable **cached_graphics);
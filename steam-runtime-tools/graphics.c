@@ -1021,10 +1021,16 @@ out:
   return argv;
 }
 
+/*
+ * @info_platform: If not %NULL, ask check-gl to report the renderer
+ *  and version in the same format as wflinfo, using this platform
+ *  ("glx" or "egl"), as well as carrying out the drawing test
+ */
 static GPtrArray *
 _argv_for_check_gl (const char *helpers_path,
                     SrtTestFlags test_flags,
                     const char *multiarch_tuple,
+                    const char *info_platform,
                     GError **error)
 {
   GPtrArray *argv;
@@ -1039,6 +1045,12 @@ _argv_for_check_gl (const char *helpers_path,
   if (argv == NULL)
     return NULL;
 
+  if (info_platform != NULL)
+    {
+      g_ptr_array_add (argv, g_strdup ("--info"));
+      g_ptr_array_add (argv, g_strdup_printf ("--platform=%s", info_platform));
+    }
+
   g_ptr_array_add (argv, NULL);
   return argv;
 }
@@ -1304,16 +1316,13 @@ _srt_run_helper (GStrv *my_environ,
   g_free(*child_stderr);
   *child_stderr = NULL;
 
-  if (!g_spawn_sync (NULL,    /* working directory */
-                     (gchar **) argv->pdata,
-                     *my_environ,    /* envp */
-                     G_SPAWN_SEARCH_PATH,       /* flags */
-                     _srt_child_setup_unblock_signals,
-                     NULL,    /* user data */
-                     output, /* stdout */
-                     child_stderr,
-                     wait_status,
-                     &error))
+  if (!_srt_spawn_helper_sync ((gchar **) argv->pdata,
+                               *my_environ,    /* envp */
+                               G_SPAWN_SEARCH_PATH,       /* flags */
+                               output, /* stdout */
+                               child_stderr,
+                               wait_status,
+                               &error))
     {
       g_debug ("An error occurred calling the helper: %s", error->message);
       *child_stderr = g_strdup (error->message);
@@ -1339,6 +1348,209 @@ _srt_run_helper (GStrv *my_environ,
   return issues;
 }
 
+/*
+ * _srt_process_check_va_api:
+ * @output: The output of `check-va-api --verbose`
+ * @graphics_devices: (element-type SrtGraphicsDevice): Used to return
+ *  one device for each render node (or X11 display) that was tested,
+ *  named after its VA-API vendor string if it works
+ * @renderer_out: (out) (not optional): Used to return the vendor string
+ *  of the first device that works
+ *
+ * Parse the JSON object that check-va-api outputs on a line by itself
+ * for each device that it tests.
+ *
+ * Returns: %FALSE if @output is not in that format, for example
+ *  because it is from an older check-va-api that only printed the
+ *  vendor string
+ */
+static gboolean
+_srt_process_check_va_api (const char *output,
+                           GPtrArray *graphics_devices,
+                           gchar **renderer_out)
+{
+  g_auto(GStrv) lines = NULL;
+  gsize i;
+
+  if (output[0] != '{')
+    return FALSE;
+
+  lines = g_strsplit (output, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      g_autoptr(GError) error = NULL;
+      g_autoptr(JsonNode) node = NULL;
+      g_autofree gchar *messages = NULL;
+      SrtGraphicsDevice *device;
+      JsonObject *object;
+      const char *path;
+      const char *vendor;
+      const char *message;
+      gboolean can_draw;
+
+      if (lines[i][0] == '\0')
+        continue;
+
+      node = json_from_string (lines[i], &error);
+
+      if (node == NULL || !JSON_NODE_HOLDS_OBJECT (node))
+        {
+          g_debug ("The VA-API helper output is not a valid JSON object: %s",
+                   error != NULL ? error->message : lines[i]);
+          continue;
+        }
+
+      object = json_node_get_object (node);
+      path = json_object_get_string_member_with_default (object, "device",
+                                                         "X11");
+      vendor = json_object_get_string_member_with_default (object, "vendor",
+                                                           NULL);
+      can_draw = json_object_get_boolean_member_with_default (object,
+                                                              "can-draw",
+                                                              FALSE);
+      message = json_object_get_string_member_with_default (object, "error",
+                                                            NULL);
+
+      device = _srt_graphics_device_new (can_draw ? vendor : NULL,
+                                         NULL, NULL, NULL, NULL,
+                                         SRT_VK_PHYSICAL_DEVICE_TYPE_OTHER,
+                                         SRT_GRAPHICS_ISSUES_NONE);
+      _srt_graphics_device_set_can_draw (device, can_draw);
+
+      if (message != NULL)
+        {
+          messages = g_strdup_printf ("%s: %s\n", path, message);
+          _srt_graphics_device_set_messages (device, messages);
+        }
+
+      g_ptr_array_add (graphics_devices, device);
+
+      /* For compatibility with older versions, which reported the
+       * helper's output verbatim, end it with a newline */
+      if (can_draw && vendor != NULL && *renderer_out == NULL)
+        *renderer_out = g_strdup_printf ("%s\n", vendor);
+    }
+
+  return TRUE;
+}
+
+/*
+ * _srt_check_gl_combined:
+ * @my_environ: (inout): The environment for the helper
+ * @node: (out) (not optional): Used to return the parsed JSON, which
+ *  owns @renderer_string
+ * @version_string: (out) (not optional):
+ * @renderer_string: (out) (transfer none) (not optional):
+ * @child_stderr: (out) (not optional):
+ * @exit_status: (out) (not optional):
+ * @terminating_signal: (out) (not optional):
+ *
+ * @platform: "glx" to draw in an X11 window with GLX, or "egl" to draw
+ *  in an X11 window with EGL
+ *
+ * Ask check-gl to report the same information as wflinfo and carry out
+ * its drawing test in a single process, so that the GL driver only
+ * needs to be loaded once.
+ *
+ * Returns: The issues found, or %SRT_GRAPHICS_ISSUES_UNKNOWN if check-gl
+ *  did not report the renderer and version (for example because it is
+ *  an older version without `--info`, or the driver could not be
+ *  loaded), in which case the caller should fall back to using wflinfo
+ *  for a more specific diagnosis
+ */
+static SrtGraphicsIssues
+_srt_check_gl_combined (GStrv *my_environ,
+                        const char *helpers_path,
+                        SrtTestFlags test_flags,
+                        const char *multiarch_tuple,
+                        const char *platform,
+                        JsonNode **node,
+                        gchar **version_string,
+                        const gchar **renderer_string,
+                        gchar **child_stderr,
+                        int *exit_status,
+                        int *terminating_signal)
+{
+  g_autoptr(GPtrArray) argv = NULL;
+  g_autoptr(JsonNode) parsed = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *output = NULL;
+  g_autofree gchar *stderr_buf = NULL;
+  g_autofree gchar *version = NULL;
+  const gchar *renderer = NULL;
+  SrtGraphicsIssues issues = SRT_GRAPHICS_ISSUES_NONE;
+  SrtGraphicsIssues info_issues;
+  int wait_status = -1;
+  int exit_status_buf = -1;
+  int terminating_signal_buf = 0;
+
+  argv = _argv_for_check_gl (helpers_path, test_flags, multiarch_tuple,
+                             platform, &error);
+
+  if (argv == NULL)
+    {
+      g_debug ("%s", error->message);
+      return SRT_GRAPHICS_ISSUES_UNKNOWN;
+    }
+
+  issues |= _srt_run_helper (my_environ,
+                             &output,
+                             &stderr_buf,
+                             argv,
+                             &wait_status,
+                             &exit_status_buf,
+                             &terminating_signal_buf,
+                             FALSE,
+                             SRT_GRAPHICS_ISSUES_CANNOT_DRAW);
+
+  if (output == NULL || output[0] == '\0')
+    {
+      g_debug ("check-gl did not report renderer information");
+      return SRT_GRAPHICS_ISSUES_UNKNOWN;
+    }
+
+  parsed = json_from_string (output, &error);
+
+  if (parsed == NULL)
+    {
+      g_debug ("check-gl output is not valid JSON: %s",
+               error != NULL ? error->message : "(empty)");
+      return SRT_GRAPHICS_ISSUES_UNKNOWN;
+    }
+
+  info_issues = _srt_process_wflinfo (parsed, &version, &renderer);
+
+  if (info_issues & SRT_GRAPHICS_ISSUES_CANNOT_LOAD)
+    return SRT_GRAPHICS_ISSUES_UNKNOWN;
+
+  issues |= info_issues;
+
+  if (issues != SRT_GRAPHICS_ISSUES_NONE)
+    {
+      g_autofree gchar *verbose_output = NULL;
+
+      // Issues found, so run again with LIBGL_DEBUG=verbose set in environment
+      issues |= _srt_run_helper (my_environ,
+                                 &verbose_output,
+                                 &stderr_buf,
+                                 argv,
+                                 &wait_status,
+                                 &exit_status_buf,
+                                 &terminating_signal_buf,
+                                 TRUE,
+                                 SRT_GRAPHICS_ISSUES_CANNOT_DRAW);
+    }
+
+  *node = g_steal_pointer (&parsed);
+  *version_string = g_steal_pointer (&version);
+  *renderer_string = renderer;
+  *child_stderr = g_steal_pointer (&stderr_buf);
+  *exit_status = exit_status_buf;
+  *terminating_signal = terminating_signal_buf;
+  return issues;
+}
+
 /**
  * _srt_check_graphics:
  * @envp: (not nullable): Used instead of `environ`
@@ -1379,6 +1591,7 @@ _srt_check_graphics (gchar **envp,
   SrtGraphicsLibraryVendor library_vendor = SRT_GRAPHICS_LIBRARY_VENDOR_UNKNOWN;
   g_auto(GStrv) json_output = NULL;
   g_autoptr(GPtrArray) graphics_device = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autofree gchar *va_api_renderer = NULL;
   gsize i;
 
   g_return_val_if_fail (details_out == NULL || *details_out == NULL, SRT_GRAPHICS_ISSUES_UNKNOWN);
@@ -1408,6 +1621,39 @@ _srt_check_graphics (gchar **envp,
                                               window_system,
                                               rendering_interface);
 
+  if (rendering_interface == SRT_RENDERING_INTERFACE_GL
+      && (window_system == SRT_WINDOW_SYSTEM_GLX
+          || window_system == SRT_WINDOW_SYSTEM_EGL_X11))
+    {
+      SrtGraphicsIssues combined_issues;
+      /* Draw with the window system we were asked about. If there is
+       * no X11 display then neither can work, and check-gl will fail
+       * rather than falling back to a headless platform. */
+      const char *platform = (window_system == SRT_WINDOW_SYSTEM_EGL_X11
+                              ? "egl" : "glx");
+
+      /* Try to get the renderer information and do the drawing test
+       * in a single process, falling back to wflinfo followed by a
+       * separate drawing test if that doesn't work */
+      combined_issues = _srt_check_gl_combined (&my_environ,
+                                                helpers_path,
+                                                test_flags,
+                                                multiarch_tuple,
+                                                platform,
+                                                &node,
+                                                &version_string,
+                                                &renderer_string,
+                                                &child_stderr,
+                                                &exit_status,
+                                                &terminating_signal);
+
+      if (combined_issues != SRT_GRAPHICS_ISSUES_UNKNOWN)
+        {
+          issues |= combined_issues;
+          goto out;
+        }
+    }
+
   switch (rendering_interface)
     {
       case SRT_RENDERING_INTERFACE_GL:
@@ -1454,6 +1700,12 @@ _srt_check_graphics (gchar **envp,
                                  TRUE,
                                  non_zero_wait_status_issue);
 
+      /* Even if no device worked, or the helper had to be killed, it
+       * might have reported the devices that it tested */
+      if (rendering_interface == SRT_RENDERING_INTERFACE_VAAPI
+          && output != NULL)
+        _srt_process_check_va_api (output, graphics_device, &va_api_renderer);
+
       goto out;
     }
 
@@ -1510,6 +1762,7 @@ _srt_check_graphics (gchar **envp,
             argv = _argv_for_check_gl (helpers_path,
                                        test_flags,
                                        multiarch_tuple,
+                                       NULL,
                                        &error);
 
             if (argv == NULL)
@@ -1653,8 +1906,16 @@ _srt_check_graphics (gchar **envp,
           }
         break;
 
-      case SRT_RENDERING_INTERFACE_VDPAU:
       case SRT_RENDERING_INTERFACE_VAAPI:
+        if (output != NULL
+            && _srt_process_check_va_api (output, graphics_device,
+                                          &va_api_renderer))
+          renderer_string = va_api_renderer;
+        else if (output != NULL)
+          renderer_string = output;
+        break;
+
+      case SRT_RENDERING_INTERFACE_VDPAU:
         if (output != NULL)
           renderer_string = output;
         break;
@@ -4238,16 +4499,13 @@ _srt_list_modules_from_directory (gchar **envp,
   g_return_if_fail (known_table != NULL);
   g_return_if_fail (modules_out != NULL);
 
-  if (!g_spawn_sync (NULL,    /* working directory */
-                     (gchar **) argv->pdata,
-                     envp,
-                     G_SPAWN_SEARCH_PATH,       /* flags */
-                     _srt_child_setup_unblock_signals,
-                     NULL,    /* user data */
-                     &output, /* stdout */
-                     &stderr_output,
-                     &exit_status,
-                     &error))
+  if (!_srt_spawn_helper_sync ((gchar **) argv->pdata,
+                               envp,
+                               G_SPAWN_SEARCH_PATH,       /* flags */
+                               &output, /* stdout */
+                               &stderr_output,
+                               &exit_status,
+                               &error))
     {
       g_debug ("An error occurred calling the helper: %s", error->message);
       goto out;
@@ -7381,6 +7639,70 @@ srt_vulkan_layer_check_error (const SrtVulkanLayer *self,
   return (self->layer.error == NULL);
 }
 
+/*
+ * _srt_vulkan_layer_is_enabled_by_environ:
+ * @self: An implicit Vulkan layer
+ * @envp: (array zero-terminated=1): The environment of a process that
+ *  will load Vulkan
+ *
+ * Return whether the Vulkan loader could load @self as an implicit layer
+ * in a process with environment @envp, following the rules for
+ * `enable_environment` and `disable_environment` described in the
+ * Vulkan loader documentation.
+ *
+ * This errs on the side of returning %TRUE: if the layer might be
+ * enabled by some other mechanism such as `$VK_INSTANCE_LAYERS` or
+ * `$VK_LOADER_LAYERS_ENABLE`, it is assumed to be enabled.
+ *
+ * Returns: %FALSE if the Vulkan loader will certainly ignore @self
+ */
+gboolean
+_srt_vulkan_layer_is_enabled_by_environ (SrtVulkanLayer *self,
+                                         const char * const *envp)
+{
+  const char *value;
+
+  g_return_val_if_fail (SRT_IS_VULKAN_LAYER (self), TRUE);
+
+  /* The disable_environment has priority over everything else:
+   * if it is set, even to an empty value, the layer is disabled */
+  if (self->layer.disable_env_var.name != NULL
+      && g_environ_getenv ((gchar **) envp,
+                           self->layer.disable_env_var.name) != NULL)
+    return FALSE;
+
+  if (self->layer.enable_env_var.name == NULL)
+    return TRUE;
+
+  value = g_environ_getenv ((gchar **) envp, self->layer.enable_env_var.name);
+
+  if (g_strcmp0 (value, self->layer.enable_env_var.value) == 0)
+    return TRUE;
+
+  /* Newer loaders can force-enable layers by name */
+  if (g_environ_getenv ((gchar **) envp, "VK_LOADER_LAYERS_ENABLE") != NULL)
+    return TRUE;
+
+  if (self->layer.name != NULL)
+    {
+      value = g_environ_getenv ((gchar **) envp, "VK_INSTANCE_LAYERS");
+
+      if (value != NULL)
+        {
+          g_auto(GStrv) names = g_strsplit (value, ":", -1);
+          gsize i;
+
+          for (i = 0; names[i] != NULL; i++)
+            {
+              if (strcmp (names[i], self->layer.name) == 0)
+                return TRUE;
+            }
+        }
+    }
+
+  return FALSE;
+}
+
 /**
  * _srt_get_explicit_vulkan_layers_from_json_report:
  * @json_obj: (not nullable): A JSON Object used to search for
@@ -64,16 +64,13 @@ _srt_libdl_run_helper (gchar **envp,
 
   g_debug ("Running %s", (const char *) g_ptr_array_index (argv, 0));
 
-  if (!g_spawn_sync (NULL,    /* working directory */
-                     (gchar **) argv->pdata,
-                     my_environ,
-                     G_SPAWN_DEFAULT,
-                     _srt_child_setup_unblock_signals,
-                     NULL,    /* user data */
-                     &child_stdout,
-                     &child_stderr,
-                     &wait_status,
-                     error))
+  if (!_srt_spawn_helper_sync ((gchar **) argv->pdata,
+                               my_environ,
+                               G_SPAWN_DEFAULT,
+                               &child_stdout,
+                               &child_stderr,
+                               &wait_status,
+                               error))
     return NULL;
 
   if (!WIFEXITED (wait_status))
@@ -721,16 +721,13 @@ _srt_check_library_presence (const char *helpers_path,
 
   my_environ = _srt_filter_gameoverlayrenderer_from_envp (envp);
 
-  if (!g_spawn_sync (NULL,       /* working directory */
-                     (gchar **) argv->pdata,
-                     my_environ, /* envp */
-                     G_SPAWN_SEARCH_PATH,          /* flags */
-                     _srt_child_setup_unblock_signals,
-                     NULL,       /* user data */
-                     &output,    /* stdout */
-                     &child_stderr,
-                     &wait_status,
-                     &error))
+  if (!_srt_spawn_helper_sync ((gchar **) argv->pdata,
+                               my_environ, /* envp */
+                               G_SPAWN_SEARCH_PATH,          /* flags */
+                               &output,    /* stdout */
+                               &child_stderr,
+                               &wait_status,
+                               &error))
     {
       g_debug ("An error occurred calling the helper: %s", error->message);
       issues |= SRT_LIBRARY_ISSUES_CANNOT_LOAD;
@@ -242,16 +242,13 @@ _srt_check_locale (gchar **envp,
            (const char *) g_ptr_array_index (argv, 0),
            (const char *) g_ptr_array_index (argv, 1));
 
-  if (!g_spawn_sync (NULL,    /* working directory */
-                     (gchar **) argv->pdata,
-                     my_environ,
-                     G_SPAWN_DEFAULT,
-                     _srt_child_setup_unblock_signals,
-                     NULL,    /* user data */
-                     &output, /* stdout */
-                     NULL,    /* stderr */
-                     &exit_status,
-                     error))
+  if (!_srt_spawn_helper_sync ((gchar **) argv->pdata,
+                               my_environ,
+                               G_SPAWN_DEFAULT,
+                               &output, /* stdout */
+                               NULL,    /* stderr */
+                               &exit_status,
+                               error))
     {
       g_debug ("-> g_spawn error");
       goto out;
@@ -77,6 +77,19 @@ gboolean srt_add_flag_from_nick (GType flags_type,
 
 G_GNUC_INTERNAL void _srt_child_setup_unblock_signals (gpointer ignored);
 
+/* Helpers that write more than this to stdout are assumed to be broken */
+#define SRT_HELPER_MAX_STDOUT (64 * 1024 * 1024)
+/* Only this much of a helper's stderr is kept */
+#define SRT_HELPER_MAX_STDERR (64 * 1024)
+
+G_GNUC_INTERNAL gboolean _srt_spawn_helper_sync (gchar **argv,
+                                                 gchar **envp,
+                                                 GSpawnFlags flags,
+                                                 gchar **standard_output,
+                                                 gchar **standard_error,
+                                                 int *wait_status,
+                                                 GError **error);
+
 _SRT_PRIVATE_EXPORT
 void _srt_unblock_signals (void);
 
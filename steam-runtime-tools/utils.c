@@ -26,15 +26,18 @@
 #include "steam-runtime-tools/utils.h"
 #include "steam-runtime-tools/utils-internal.h"
 
+#include <dirent.h>
 #include <dlfcn.h>
 #include <elf.h>
 #include <errno.h>
-#include <ftw.h>
+#include <fcntl.h>
 #include <link.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -716,6 +719,284 @@ _srt_unblock_signals (void)
     }
 }
 
+typedef struct
+{
+  int fd;
+  GString *buffer;
+  /* Maximum number of bytes to keep */
+  gsize max;
+  /* Number of bytes discarded from the beginning */
+  gsize discarded;
+  /* If %TRUE, discard the oldest output when @max is reached;
+   * if %FALSE, reaching @max is an error */
+  gboolean keep_tail;
+} HelperStream;
+
+static void
+helper_stream_clear (HelperStream *stream)
+{
+  if (stream->fd >= 0)
+    close (stream->fd);
+
+  stream->fd = -1;
+
+  if (stream->buffer != NULL)
+    g_string_free (stream->buffer, TRUE);
+
+  stream->buffer = NULL;
+}
+
+/*
+ * Returns: %FALSE if @stream has exceeded its maximum size
+ */
+static gboolean
+helper_stream_append (HelperStream *stream,
+                      const char *data,
+                      gsize len)
+{
+  g_string_append_len (stream->buffer, data, len);
+
+  if (stream->buffer->len <= stream->max)
+    return TRUE;
+
+  if (!stream->keep_tail)
+    return FALSE;
+
+  /* Let the buffer grow to twice its maximum size before trimming it,
+   * so that the cost of moving the tail to the beginning is amortized */
+  if (stream->buffer->len >= 2 * stream->max)
+    {
+      gsize excess = stream->buffer->len - stream->max;
+
+      g_string_erase (stream->buffer, 0, excess);
+      stream->discarded += excess;
+    }
+
+  return TRUE;
+}
+
+static gchar *
+helper_stream_steal (HelperStream *stream)
+{
+  gchar *ret;
+
+  if (stream->buffer->len > stream->max)
+    {
+      gsize excess = stream->buffer->len - stream->max;
+
+      g_string_erase (stream->buffer, 0, excess);
+      stream->discarded += excess;
+    }
+
+  if (stream->discarded > 0)
+    {
+      g_autofree gchar *marker = NULL;
+
+      marker = g_strdup_printf ("[... %" G_GSIZE_FORMAT " bytes of earlier "
+                                "output discarded ...]\n",
+                                stream->discarded);
+      g_string_prepend (stream->buffer, marker);
+    }
+
+  ret = g_string_free (stream->buffer, FALSE);
+  stream->buffer = NULL;
+  return ret;
+}
+
+/*
+ * _srt_spawn_helper_sync:
+ * @argv: (array zero-terminated=1): Arguments, as for g_spawn_sync()
+ * @envp: (array zero-terminated=1) (nullable): Environment, as for
+ *  g_spawn_sync()
+ * @flags: Flags, as for g_spawn_sync()
+ * @standard_output: (out) (optional): Used to return the child's
+ *  standard output
+ * @standard_error: (out) (optional): Used to return the last
+ *  %SRT_HELPER_MAX_STDERR bytes of the child's standard error, prefixed
+ *  by a marker if earlier output was discarded
+ * @wait_status: (out) (optional): Used to return the wait status
+ * @error: Used to raise an error on failure
+ *
+ * A replacement for g_spawn_sync() for running helper subprocesses,
+ * with _srt_child_setup_unblock_signals() as the child setup function.
+ *
+ * Unlike g_spawn_sync(), the memory used is bounded: a helper that
+ * writes more than %SRT_HELPER_MAX_STDOUT bytes to standard output is
+ * killed and treated as a failure, and only the most recent part of
+ * its standard error is kept.
+ *
+ * Returns: %TRUE if the helper was run, even if it was unsuccessful
+ */
+gboolean
+_srt_spawn_helper_sync (gchar **argv,
+                        gchar **envp,
+                        GSpawnFlags flags,
+                        gchar **standard_output,
+                        gchar **standard_error,
+                        int *wait_status,
+                        GError **error)
+{
+  HelperStream streams[2] =
+  {
+    { .fd = -1, .max = SRT_HELPER_MAX_STDOUT, .keep_tail = FALSE },
+    { .fd = -1, .max = SRT_HELPER_MAX_STDERR, .keep_tail = TRUE },
+  };
+  GError *local_error = NULL;
+  gsize peak = 0;
+  GPid pid;
+  int status = -1;
+  gsize i;
+
+  g_return_val_if_fail (argv != NULL, FALSE);
+  g_return_val_if_fail (argv[0] != NULL, FALSE);
+  g_return_val_if_fail (!(flags & G_SPAWN_DO_NOT_REAP_CHILD), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (standard_output != NULL)
+    *standard_output = NULL;
+
+  if (standard_error != NULL)
+    *standard_error = NULL;
+
+  if (!g_spawn_async_with_pipes (NULL,    /* working directory */
+                                 argv,
+                                 envp,
+                                 flags | G_SPAWN_DO_NOT_REAP_CHILD,
+                                 _srt_child_setup_unblock_signals,
+                                 NULL,    /* user data */
+                                 &pid,
+                                 NULL,    /* stdin */
+                                 standard_output != NULL ? &streams[0].fd : NULL,
+                                 standard_error != NULL ? &streams[1].fd : NULL,
+                                 error))
+    return FALSE;
+
+  for (i = 0; i < G_N_ELEMENTS (streams); i++)
+    streams[i].buffer = g_string_new ("");
+
+  while (local_error == NULL && (streams[0].fd >= 0 || streams[1].fd >= 0))
+    {
+      struct pollfd pollfds[G_N_ELEMENTS (streams)];
+      HelperStream *polled[G_N_ELEMENTS (streams)];
+      nfds_t n = 0;
+
+      for (i = 0; i < G_N_ELEMENTS (streams); i++)
+        {
+          if (streams[i].fd >= 0)
+            {
+              pollfds[n].fd = streams[i].fd;
+              pollfds[n].events = POLLIN;
+              pollfds[n].revents = 0;
+              polled[n] = &streams[i];
+              n++;
+            }
+        }
+
+      if (poll (pollfds, n, -1) < 0)
+        {
+          int saved_errno = errno;
+
+          if (saved_errno == EINTR)
+            continue;
+
+          g_set_error (&local_error, G_IO_ERROR,
+                       g_io_error_from_errno (saved_errno),
+                       "Unable to poll output of %s: %s",
+                       argv[0], g_strerror (saved_errno));
+          break;
+        }
+
+      for (i = 0; i < n && local_error == NULL; i++)
+        {
+          HelperStream *stream = polled[i];
+          char buf[4096];
+          gssize len;
+
+          if (pollfds[i].revents == 0)
+            continue;
+
+          len = read (stream->fd, buf, sizeof (buf));
+
+          if (len < 0)
+            {
+              int saved_errno = errno;
+
+              if (saved_errno == EINTR || saved_errno == EAGAIN)
+                continue;
+
+              g_set_error (&local_error, G_IO_ERROR,
+                           g_io_error_from_errno (saved_errno),
+                           "Unable to read output of %s: %s",
+                           argv[0], g_strerror (saved_errno));
+            }
+          else if (len == 0)
+            {
+              close (stream->fd);
+              stream->fd = -1;
+            }
+          else if (!helper_stream_append (stream, buf, len))
+            {
+              g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "%s produced more than %" G_GSIZE_FORMAT
+                           " bytes of output",
+                           argv[0], stream->max);
+            }
+        }
+
+      peak = MAX (peak, streams[0].buffer->len + streams[1].buffer->len);
+    }
+
+  /* If we stopped reading early, the helper might be blocked writing
+   * to us, so it will never exit of its own accord */
+  if (local_error != NULL)
+    kill (pid, SIGKILL);
+
+  while (waitpid (pid, &status, 0) < 0)
+    {
+      if (errno != EINTR)
+        {
+          int saved_errno = errno;
+
+          if (local_error == NULL)
+            g_set_error (&local_error, G_IO_ERROR,
+                         g_io_error_from_errno (saved_errno),
+                         "Unable to wait for %s: %s",
+                         argv[0], g_strerror (saved_errno));
+          break;
+        }
+    }
+
+  g_spawn_close_pid (pid);
+
+  g_debug ("%s: at most %" G_GSIZE_FORMAT " bytes of output buffered, "
+           "%" G_GSIZE_FORMAT " bytes of diagnostic messages discarded",
+           argv[0], peak, streams[1].discarded);
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+
+      for (i = 0; i < G_N_ELEMENTS (streams); i++)
+        helper_stream_clear (&streams[i]);
+
+      return FALSE;
+    }
+
+  if (standard_output != NULL)
+    *standard_output = helper_stream_steal (&streams[0]);
+
+  if (standard_error != NULL)
+    *standard_error = helper_stream_steal (&streams[1]);
+
+  if (wait_status != NULL)
+    *wait_status = status;
+
+  for (i = 0; i < G_N_ELEMENTS (streams); i++)
+    helper_stream_clear (&streams[i]);
+
+  return TRUE;
+}
+
 /*
  * _srt_indirect_strcmp0:
  * @left: A non-%NULL pointer to a (possibly %NULL) `const char *`
@@ -739,19 +1020,120 @@ _srt_indirect_strcmp0 (gconstpointer left,
   return g_strcmp0 (*l, *r);
 }
 
-static gint
-ftw_remove (const gchar *path,
-            const struct stat *sb,
-            gint typeflags,
-            struct FTW *ftwbuf)
+/*
+ * rm_rf_at:
+ * @parent_fd: A directory fd, or `AT_FDCWD`
+ * @parent_path: The path of @parent_fd, for diagnostic messages
+ * @name: A directory relative to @parent_fd
+ * @dev: The file system that we are allowed to delete from
+ *
+ * Recursively delete @name without following symbolic links or crossing
+ * mount points. Each entry is removed relative to an open fd for its
+ * directory, so the kernel only has to look up one path component
+ * per entry.
+ *
+ * Returns: %TRUE if everything was removed
+ */
+static gboolean
+rm_rf_at (int parent_fd,
+          const char *parent_path,
+          const char *name,
+          dev_t dev)
 {
-  if (remove (path) < 0)
+  g_autofree gchar *path = NULL;
+  struct stat stat_buf;
+  struct dirent *dent;
+  gboolean ret = TRUE;
+  DIR *dir;
+  int fd;
+
+  if (parent_path != NULL)
+    path = g_build_filename (parent_path, name, NULL);
+  else
+    path = g_strdup (name);
+
+  fd = openat (parent_fd, name,
+               O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY);
+
+  if (fd < 0)
+    {
+      g_debug ("Unable to open %s: %s", path, g_strerror (errno));
+      return FALSE;
+    }
+
+  if (fstat (fd, &stat_buf) < 0)
+    {
+      g_debug ("Unable to stat %s: %s", path, g_strerror (errno));
+      close (fd);
+      return FALSE;
+    }
+
+  if (stat_buf.st_dev != dev)
+    {
+      g_debug ("Not removing %s: it is a different file system", path);
+      close (fd);
+      return FALSE;
+    }
+
+  /* On success, dir takes ownership of fd */
+  dir = fdopendir (fd);
+
+  if (dir == NULL)
+    {
+      g_debug ("Unable to read %s: %s", path, g_strerror (errno));
+      close (fd);
+      return FALSE;
+    }
+
+  while ((dent = readdir (dir)) != NULL)
+    {
+      gboolean is_dir;
+
+      if (strcmp (dent->d_name, ".") == 0 || strcmp (dent->d_name, "..") == 0)
+        continue;
+
+      if (dent->d_type == DT_UNKNOWN)
+        {
+          struct stat child_stat;
+
+          if (fstatat (dirfd (dir), dent->d_name, &child_stat,
+                       AT_SYMLINK_NOFOLLOW) < 0)
+            {
+              g_debug ("Unable to stat %s/%s: %s",
+                       path, dent->d_name, g_strerror (errno));
+              ret = FALSE;
+              continue;
+            }
+
+          is_dir = S_ISDIR (child_stat.st_mode);
+        }
+      else
+        {
+          is_dir = (dent->d_type == DT_DIR);
+        }
+
+      if (is_dir)
+        {
+          if (!rm_rf_at (dirfd (dir), path, dent->d_name, dev))
+            ret = FALSE;
+        }
+      else if (unlinkat (dirfd (dir), dent->d_name, 0) < 0)
+        {
+          g_debug ("Unable to remove %s/%s: %s",
+                   path, dent->d_name, g_strerror (errno));
+          ret = FALSE;
+        }
+    }
+
+  closedir (dir);
+
+  if (unlinkat (parent_fd, name, AT_REMOVEDIR) < 0)
     {
       g_debug ("Unable to remove %s: %s", path, g_strerror (errno));
-      return -1;
+      return FALSE;
     }
 
-  return 0;
+  return ret;
 }
 
 /**
@@ -766,12 +1148,28 @@ ftw_remove (const gchar *path,
 gboolean
 _srt_rm_rf (const char *directory)
 {
+  struct stat stat_buf;
+
   g_return_val_if_fail (directory != NULL, FALSE);
 
-  if (nftw (directory, ftw_remove, 10, FTW_DEPTH|FTW_MOUNT|FTW_PHYS) < 0)
-    return FALSE;
+  if (fstatat (AT_FDCWD, directory, &stat_buf, AT_SYMLINK_NOFOLLOW) < 0)
+    {
+      g_debug ("Unable to stat %s: %s", directory, g_strerror (errno));
+      return FALSE;
+    }
 
-  return TRUE;
+  if (!S_ISDIR (stat_buf.st_mode))
+    {
+      if (unlink (directory) < 0)
+        {
+          g_debug ("Unable to remove %s: %s", directory, g_strerror (errno));
+          return FALSE;
+        }
+
+      return TRUE;
+    }
+
+  return rm_rf_at (AT_FDCWD, NULL, directory, stat_buf.st_dev);
 }
 
 /*
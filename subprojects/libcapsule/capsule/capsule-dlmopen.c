@@ -37,6 +37,7 @@
 
 #include <capsule/capsule.h>
 #include "capsule/capsule-private.h"
+#include "capsule/capsule-load-cache.h"
 
 #include "utils/utils.h"
 #include "utils/dump.h"
@@ -70,8 +71,6 @@ wrap (const char *name,
       ElfW(Dyn) *dyn,
       capsule_item *wrappers)
 {
-    int mmap_errno = 0;
-    const char *mmap_error = NULL;
     ElfW(Addr) start = (ElfW(Addr)) dyn - base;
     // we don't know the size so we'll have to rely on the linker putting
     // well formed entries into the mmap()ed DSO region.
@@ -84,6 +83,9 @@ wrap (const char *name,
     // the utility functions expect an upper bound though so set that to
     // something suitably large:
     relocation_data rdata = { 0 };
+    mmapinfo *mmap_info = NULL;
+    Dl_info dso_info = { 0 };
+    int have_relro = -1;
 
     DEBUG( DEBUG_WRAPPERS,
            "\"%s\": base address %" PRIxPTR ", dynamic section at %p",
@@ -94,23 +96,49 @@ wrap (const char *name,
     rdata.relocs    = wrappers;
 
     // if RELRO linking has happened we'll need to tweak the mprotect flags
-    // before monkeypatching the symbol tables, for which we will need the
-    // sizes, locations and current protections of any mmap()ed regions:
-    rdata.mmap_info = load_mmap_info( &mmap_errno, &mmap_error );
-
-    if( mmap_errno || mmap_error )
+    // of this DSO's RELRO segment before monkeypatching its symbol tables.
+    // The DSO is in the capsule's namespace, where dl_iterate_phdr()
+    // can't see it, but dladdr() searches every namespace and tells us
+    // where its ELF header (and so its program headers) are mapped:
+    if( dladdr( dyn, &dso_info ) != 0 )
+        have_relro = find_relro_info_from_ehdr( dso_info.dli_fbase, base,
+                                                &rdata.relro );
+
+    if( have_relro > 0 )
     {
         DEBUG( DEBUG_MPROTECT,
-               "mmap/mprotect flags information load error (errno: %d): %s",
-               mmap_errno, mmap_error );
-        DEBUG( DEBUG_MPROTECT,
-               "relocation will be unable to handle RELRO linked libraries" );
+               "making RELRO segment %p-%p of \"%s\" writable",
+               rdata.relro.start, rdata.relro.end, name );
+
+        if( add_relro_protection( &rdata.relro, PROT_WRITE ) != 0 )
+            DEBUG( DEBUG_MPROTECT,
+                   "cannot make RELRO segment %p-%p of \"%s\" writable: %s",
+                   rdata.relro.start, rdata.relro.end, name,
+                   strerror( errno ) );
     }
+    else if( have_relro < 0 )
+    {
+        int mmap_errno = 0;
+        const char *mmap_error = NULL;
 
-    // make all the mmap()s writable:
-    for( int i = 0; rdata.mmap_info[i].start != MAP_FAILED; i++ )
-        if( mmap_entry_should_be_writable( &rdata.mmap_info[i] ) )
-            add_mmap_protection( &rdata.mmap_info[i], PROT_WRITE );
+        // we can't tell where the RELRO segment is, so fall back to
+        // making all the mmap()s writable:
+        DEBUG( DEBUG_MPROTECT,
+               "cannot find program headers of \"%s\", unprotecting "
+               "all mappings", name );
+        mmap_info = load_mmap_info( &mmap_errno, &mmap_error );
+
+        if( mmap_errno || mmap_error )
+            DEBUG( DEBUG_MPROTECT,
+                   "mmap/mprotect flags information load error (errno: %d): %s",
+                   mmap_errno, mmap_error );
+
+        for( int i = 0;
+             mmap_info && mmap_info[i].start != MAP_FAILED;
+             i++ )
+            if( mmap_entry_should_be_writable( &mmap_info[i] ) )
+                add_mmap_protection( &mmap_info[i], PROT_WRITE );
+    }
 
     // if we're debugging wrapper installation in detail we
     // will end up in a path that's normally only DEBUG_ELF
@@ -129,13 +157,15 @@ wrap (const char *name,
     // put the debug flags back in case we changed them
     debug_flags = rdata.debug;
 
-    // put the mmap()/mprotect() permissions back the way they were:
-    for( int i = 0; rdata.mmap_info[i].start != MAP_FAILED; i++ )
-        if( mmap_entry_should_be_writable( &rdata.mmap_info[i] ) )
-            reset_mmap_protection( &rdata.mmap_info[i] );
+    // put the mprotect() permissions back the way they were:
+    if( rdata.relro.writable )
+        reset_relro_protection( &rdata.relro );
+
+    for( int i = 0; mmap_info && mmap_info[i].start != MAP_FAILED; i++ )
+        if( mmap_entry_should_be_writable( &mmap_info[i] ) )
+            reset_mmap_protection( &mmap_info[i] );
 
-    free_mmap_info( rdata.mmap_info );
-    rdata.mmap_info = NULL;
+    free_mmap_info( mmap_info );
 }
 
 static inline int
@@ -263,12 +293,30 @@ _capsule_load (const capsule cap,
 {
     void *ret = NULL;
     ld_libs ldlibs = {};
+    const char *paths[DSO_LIMIT];
+    int order[DSO_LIMIT];
+    char **cached = NULL;
+    int n;
 
     if( !ld_libs_init( &ldlibs,
                        (const char **) cap->ns->combined_exclude,
                        cap->ns->prefix, debug_flags, errcode, error ) )
         return NULL;
 
+    // ==================================================================
+    // if we have resolved this capsule's dependencies before, and none
+    // of the files involved have changed since, we can skip straight
+    // to loading them:
+    cached = _capsule_load_cache_lookup( &ldlibs, cap->meta->soname, &n );
+
+    if( cached )
+    {
+        ret = ld_libs_load_paths( &ldlibs, (const char * const *) cached, n,
+                                  &cap->ns->ns, 0, errcode, error );
+        free_strv_full( cached );
+        goto loaded;
+    }
+
     // ==================================================================
     // read in the ldo.so.cache - this will contain all architectures
     // currently installed (x86_64, i386, x32) in no particular order
@@ -295,9 +343,22 @@ _capsule_load (const capsule cap,
         goto cleanup;
 
     // ==================================================================
-    // load the stack of DSOs we need:
-    ret = ld_libs_load( &ldlibs, &cap->ns->ns, 0, errcode, error );
+    // load the stack of DSOs we need, and remember them for next time:
+    n = ld_libs_get_load_order( &ldlibs, order, errcode, error );
+
+    if( n == 0 )
+        goto cleanup;
+
+    for( int i = 0; i < n; i++ )
+        paths[i] = ldlibs.needed[ order[i] ].path;
+
+    ret = ld_libs_load_paths( &ldlibs, paths, n, &cap->ns->ns, 0,
+                              errcode, error );
+
+    if( ret )
+        _capsule_load_cache_store( &ldlibs, cap->meta->soname, paths, n );
 
+loaded:
     if( debug_flags & DEBUG_CAPSULE )
     {
         dump_link_map( ret  );
@@ -151,6 +151,7 @@ static capsule_item alloc_func[] =
     { "-dlopen"       , (capsule_addr) NULL                       },
     { "-free"         , (capsule_addr) NULL                       },
     { "-realloc"      , (capsule_addr) NULL                       },
+    { "-dlclose"      , (capsule_addr) NULL                       },
     { "malloc"        , (capsule_addr) &_capsule_original_malloc  },
     { "calloc"        , (capsule_addr) &_capsule_original_calloc  },
     { "posix_memalign", (capsule_addr) &_capsule_original_pmalign },
@@ -247,6 +248,15 @@ get_capsule_metadata (struct link_map *map, const char *only)
                 (capsule_addr) meta->int_realloc,
             };
 
+            // libcapsule's own wrapper, so that unloading a library
+            // from the capsule invalidates the dlsym() cache
+            const capsule_item int_dlclose_wrapper =
+            {
+                "dlclose",
+                (capsule_addr) _capsule_shim_dlclose,
+                (capsule_addr) _capsule_shim_dlclose,
+            };
+
             cap = xcalloc( 1, sizeof(struct _capsule) );
             cap->ns = get_namespace( meta->default_prefix, meta->soname );
             DEBUG( DEBUG_CAPSULE,
@@ -259,8 +269,9 @@ get_capsule_metadata (struct link_map *map, const char *only)
             cap->internal_wrappers[ 0 ] = int_dlopen_wrapper;
             cap->internal_wrappers[ 1 ] = int_free_wrapper;
             cap->internal_wrappers[ 2 ] = int_realloc_wrapper;
+            cap->internal_wrappers[ 3 ] = int_dlclose_wrapper;
 
-            for( i = 3; alloc_func[ i ].name != NULL; i++ )
+            for( i = 4; alloc_func[ i ].name != NULL; i++ )
             {
                 // pre-populated functions that we should skip are
                 // flagged with an invalid name starting with '-'.
@@ -440,6 +451,9 @@ update_namespaces (void)
                                           N_ELEMENTS( never_encapsulated ) );
         ns->combined_export  = cook_list( ns->exports, NULL, 0 );
     }
+
+    // the set of exported DSOs might have changed
+    _capsule_invalidate_dlsym_cache();
 }
 
 static void __attribute__ ((constructor)) _init_capsule (void)
@@ -607,6 +621,9 @@ capsule_init (const char *soname)
         abort();
     }
 
+    // dlsym() might now find symbols in this capsule
+    _capsule_invalidate_dlsym_cache();
+
     int rloc = _capsule_relocate( cap, &capsule_error );
 
     if( rloc != 0 ) // relocation failed. we're dead.
@@ -661,6 +678,7 @@ capsule_close (capsule cap)
 
     CLEAR( ptr_list_free, cap->seen.all  );
     CLEAR( ptr_list_free, cap->seen.some );
+    CLEAR( str_index_free, cap->relocs_index );
 
     // poison the capsule struct and free it
     memset( cap, 'X', sizeof(struct _capsule) );
@@ -0,0 +1,428 @@
+// Copyright © 2026 Collabora Ltd
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// This file is part of libcapsule.
+
+// libcapsule is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// libcapsule is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public
+// License along with libcapsule.  If not, see <http://www.gnu.org/licenses/>.
+
+// Resolving a capsule's dependencies means parsing the ld.so.cache and
+// walking the ELF headers of its whole dependency tree, which every
+// process that loads the capsule would otherwise have to repeat.
+//
+// Instead, remember the list of paths that ld_libs_load() opened, in
+// order, in a small text file below $XDG_CACHE_HOME/libcapsule. The file
+// starts with a key describing everything the resolution depended on:
+//
+//   libcapsule load cache 1
+//   target=libGL.so.1
+//   prefix=/host
+//   elf=2:62
+//   exclude=libdl.so.2          (once per excluded soname)
+//   ldcache=/host/etc/ld.so.cache 2049:1234:56789:1600000000.000000000
+//
+// followed by one line per library, in the order it must be opened:
+//
+//   lib=2049:5678:123456:1600000000.000000000 /host/usr/lib/libGL.so.1
+//
+// If the key does not match exactly, or any of the libraries has a
+// different device, inode, size or mtime, the file is ignored and
+// the dependencies are resolved from scratch.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "capsule/capsule-load-cache.h"
+
+#include "utils/debug.h"
+#include "utils/ld-cache.h"
+#include "utils/utils.h"
+
+#define LOAD_CACHE_MAGIC "libcapsule load cache 1\n"
+
+// cache files are tiny, anything bigger than this is not one of ours:
+#define LOAD_CACHE_MAX_SIZE (DSO_LIMIT * (PATH_MAX + 128))
+
+static void
+format_identity (char *buf, size_t len, const struct stat *sb)
+{
+    snprintf( buf, len, "%ju:%ju:%jd:%jd.%09ld",
+              (uintmax_t) sb->st_dev, (uintmax_t) sb->st_ino,
+              (intmax_t) sb->st_size, (intmax_t) sb->st_mtim.tv_sec,
+              (long) sb->st_mtim.tv_nsec );
+}
+
+// Return the directory in which we keep load caches, or NULL if we
+// should not use one (for example in setuid processes). Free with free().
+static char *
+get_cache_dir (void)
+{
+#ifdef HAVE_SECURE_GETENV
+    const char *no_cache = secure_getenv( "CAPSULE_NO_LOAD_CACHE" );
+    const char *cache_home = secure_getenv( "XDG_CACHE_HOME" );
+    const char *home;
+
+    if( no_cache && *no_cache )
+        return NULL;
+
+    if( cache_home && cache_home[0] == '/' )
+        return build_filename_alloc( cache_home, "libcapsule", NULL );
+
+    home = secure_getenv( "HOME" );
+
+    if( home && home[0] == '/' )
+        return build_filename_alloc( home, ".cache", "libcapsule", NULL );
+#endif
+
+    // without secure_getenv() we can't tell whether it's safe to
+    // trust the environment, so don't cache anything
+    return NULL;
+}
+
+// Build the key describing everything the dependency resolution for
+// target depended on, and the name of the file to keep it in (which
+// depends only on the parts of the key that do not change when the
+// system is upgraded, so that we overwrite our own stale entries).
+//
+// returns false if the resolution cannot be cached:
+static int
+build_key (ld_libs *ldlibs, const char *target, char **key, char **filename)
+{
+    char prefixed[PATH_MAX];
+    char identity[128];
+    char *stable = NULL;
+    char *tmp = NULL;
+    const char *ldpath;
+    char *dir;
+
+    *key = NULL;
+    *filename = NULL;
+
+    // LD_LIBRARY_PATH makes the result depend on the contents of
+    // arbitrary directories, which we have no cheap way to revalidate:
+    ldpath = getenv( "LD_LIBRARY_PATH" );
+
+    if( ldpath && *ldpath )
+        return 0;
+
+    if( strchr( target, '\n' ) ||
+        strchr( target, '/' ) ||
+        strchr( ldlibs->prefix.path, '\n' ) )
+        return 0;
+
+    dir = get_cache_dir();
+
+    if( !dir )
+        return 0;
+
+    xasprintf( &stable, "%starget=%s\nprefix=%s\nelf=%d:%d\n",
+               LOAD_CACHE_MAGIC, target, ldlibs->prefix.path,
+               ldlibs->elf_class, (int) ldlibs->elf_machine );
+
+    for( int i = 0; ldlibs->exclude && ldlibs->exclude[i]; i++ )
+    {
+        if( strchr( ldlibs->exclude[i], '\n' ) )
+            goto fail;
+
+        xasprintf( &tmp, "%sexclude=%s\n", stable, ldlibs->exclude[i] );
+        free( stable );
+        stable = tmp;
+        tmp = NULL;
+    }
+
+    xasprintf( filename, "%s/%s.%08x", dir, target, str_hash( stable ) );
+    *key = xstrdup( stable );
+
+    // same search order as ld_libs_load_cache()
+    for( int i = 0; ld_cache_filenames[i] != NULL; i++ )
+    {
+        struct stat sb;
+
+        if( build_filename( prefixed, sizeof(prefixed), ldlibs->prefix.path,
+                            ld_cache_filenames[i], NULL ) >= sizeof(prefixed) )
+            continue;
+
+        if( stat( prefixed, &sb ) < 0 )
+            continue;
+
+        format_identity( identity, sizeof(identity), &sb );
+        xasprintf( &tmp, "%sldcache=%s %s\n", *key, prefixed, identity );
+        free( *key );
+        *key = tmp;
+        tmp = NULL;
+    }
+
+    free( stable );
+    free( dir );
+    return 1;
+
+fail:
+    free( stable );
+    free( dir );
+    return 0;
+}
+
+/*
+ * _capsule_load_cache_lookup:
+ * @ldlibs: an #ld_libs on which ld_libs_init() has been called
+ * @target: the SONAME of the library we want to load
+ * @n_paths: (out): used to return the number of paths
+ *
+ * Returns: (transfer full) (nullable): the paths of the libraries
+ *  needed to load @target, in the order in which they must be opened,
+ *  or %NULL if there is no valid cached result. Free with free_strv_full().
+ */
+char **
+_capsule_load_cache_lookup (ld_libs *ldlibs, const char *target, int *n_paths)
+{
+    char *key = NULL;
+    char *filename = NULL;
+    char *data = NULL;
+    char **paths = NULL;
+    char *line;
+    char *next;
+    struct stat sb;
+    ssize_t got;
+    size_t len = 0;
+    int fd = -1;
+    int n = 0;
+
+    *n_paths = 0;
+
+    if( !build_key( ldlibs, target, &key, &filename ) )
+        goto out;
+
+    fd = open( filename, O_RDONLY | O_CLOEXEC );
+
+    if( fd < 0 )
+    {
+        DEBUG( DEBUG_CAPSULE, "no load cache for %s: %s: %s",
+               target, filename, strerror( errno ) );
+        goto out;
+    }
+
+    if( fstat( fd, &sb ) < 0 ||
+        !S_ISREG( sb.st_mode ) ||
+        sb.st_size > LOAD_CACHE_MAX_SIZE )
+        goto out;
+
+    data = xcalloc( sb.st_size + 1, 1 );
+
+    while( len < (size_t) sb.st_size )
+    {
+        got = read( fd, data + len, sb.st_size - len );
+
+        if( got < 0 && errno == EINTR )
+            continue;
+
+        if( got <= 0 )
+            goto out;
+
+        len += got;
+    }
+
+    data[len] = '\0';
+
+    if( strncmp( data, key, strlen( key ) ) != 0 )
+    {
+        DEBUG( DEBUG_CAPSULE, "load cache %s for %s is out of date",
+               filename, target );
+        goto out;
+    }
+
+    paths = xcalloc( DSO_LIMIT + 1, sizeof(char *) );
+
+    for( line = data + strlen( key ); *line != '\0'; line = next )
+    {
+        char identity[128];
+        const char *path;
+        char *space;
+
+        next = strchr( line, '\n' );
+
+        if( !next )
+            goto invalid;
+
+        *next = '\0';
+        next++;
+
+        if( strncmp( line, "lib=", 4 ) != 0 || n >= DSO_LIMIT )
+            goto invalid;
+
+        space = strchr( line, ' ' );
+
+        if( !space )
+            goto invalid;
+
+        *space = '\0';
+        path = space + 1;
+
+        if( stat( path, &sb ) < 0 )
+        {
+            DEBUG( DEBUG_CAPSULE, "load cache %s for %s is out of date: "
+                   "%s: %s", filename, target, path, strerror( errno ) );
+            goto invalid;
+        }
+
+        format_identity( identity, sizeof(identity), &sb );
+
+        if( strcmp( line + 4, identity ) != 0 )
+        {
+            DEBUG( DEBUG_CAPSULE, "load cache %s for %s is out of date: "
+                   "%s has changed", filename, target, path );
+            goto invalid;
+        }
+
+        paths[n++] = xstrdup( path );
+    }
+
+    if( n == 0 )
+        goto invalid;
+
+    DEBUG( DEBUG_CAPSULE, "using load cache %s for %s (%d libraries)",
+           filename, target, n );
+    *n_paths = n;
+    goto out;
+
+invalid:
+    free_strv_full( paths );
+    paths = NULL;
+
+out:
+    if( fd >= 0 )
+        close( fd );
+
+    free( data );
+    free( filename );
+    free( key );
+    return paths;
+}
+
+/*
+ * _capsule_load_cache_store:
+ * @ldlibs: the #ld_libs that was used to find the dependencies of @target
+ * @target: the SONAME of the library that was loaded
+ * @paths: (array length=n_paths): the paths of the libraries that
+ *  were opened, in order
+ * @n_paths: number of items in @paths
+ *
+ * Remember @paths for the next time @target is loaded with the same
+ * prefix, exclusions and ld.so.cache. Failure is not an error: we
+ * will just have to resolve the dependencies again next time.
+ */
+void
+_capsule_load_cache_store (ld_libs *ldlibs, const char *target,
+                           const char * const *paths, int n_paths)
+{
+    char *key = NULL;
+    char *filename = NULL;
+    char *tmpname = NULL;
+    char *dir = NULL;
+    char *slash;
+    FILE *fh = NULL;
+    int fd = -1;
+
+    if( !build_key( ldlibs, target, &key, &filename ) )
+        goto out;
+
+    // create $XDG_CACHE_HOME (or ~/.cache) and the libcapsule
+    // directory below it, if necessary:
+    dir = get_cache_dir();
+
+    if( !dir )
+        goto out;
+
+    slash = strrchr( dir, '/' );
+    *slash = '\0';
+
+    if( mkdir( dir, 0700 ) < 0 && errno != EEXIST )
+        goto out;
+
+    *slash = '/';
+
+    if( mkdir( dir, 0700 ) < 0 && errno != EEXIST )
+        goto out;
+
+    xasprintf( &tmpname, "%s.XXXXXX", filename );
+    fd = mkostemp( tmpname, O_CLOEXEC );
+
+    if( fd < 0 )
+    {
+        DEBUG( DEBUG_CAPSULE, "unable to create %s: %s",
+               tmpname, strerror( errno ) );
+        free( tmpname );
+        tmpname = NULL;
+        goto out;
+    }
+
+    fh = fdopen( fd, "w" );
+
+    if( !fh )
+        goto out;
+
+    fd = -1;
+    fputs( key, fh );
+
+    for( int i = 0; i < n_paths; i++ )
+    {
+        char identity[128];
+        struct stat sb;
+
+        if( strchr( paths[i], '\n' ) || stat( paths[i], &sb ) < 0 )
+            goto out;
+
+        format_identity( identity, sizeof(identity), &sb );
+        fprintf( fh, "lib=%s %s\n", identity, paths[i] );
+    }
+
+    if( fclose( fh ) != 0 )
+    {
+        fh = NULL;
+        goto out;
+    }
+
+    fh = NULL;
+
+    if( rename( tmpname, filename ) < 0 )
+        goto out;
+
+    DEBUG( DEBUG_CAPSULE, "stored load cache %s for %s (%d libraries)",
+           filename, target, n_paths );
+    free( tmpname );
+    tmpname = NULL;
+
+out:
+    if( fh )
+        fclose( fh );
+
+    if( fd >= 0 )
+        close( fd );
+
+    if( tmpname )
+    {
+        unlink( tmpname );
+        free( tmpname );
+    }
+
+    free( dir );
+    free( filename );
+    free( key );
+}
@@ -0,0 +1,30 @@
+// Copyright © 2026 Collabora Ltd
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// This file is part of libcapsule.
+
+// libcapsule is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// libcapsule is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public
+// License along with libcapsule.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "utils/ld-libs.h"
+
+char **_capsule_load_cache_lookup (ld_libs *ldlibs,
+                                   const char *target,
+                                   int *n_paths);
+
+void   _capsule_load_cache_store  (ld_libs *ldlibs,
+                                   const char *target,
+                                   const char * const *paths,
+                                   int n_paths);
@@ -42,9 +42,10 @@ struct _capsule
 {
     void  *dl_handle;
     struct { ptr_list *all; ptr_list *some; } seen;
+    str_index *relocs_index;
     capsule_metadata *meta;
     capsule_namespace *ns;
-    capsule_item internal_wrappers[7];
+    capsule_item internal_wrappers[8];
 };
 
 extern ptr_list *_capsule_list;
@@ -96,6 +97,28 @@ void *_capsule_load (const capsule capsule,
                      int *errcode,
                      char **error);
 
+/*
+ * _capsule_invalidate_dlsym_cache:
+ *
+ * Forget the cached results of looking up symbols in capsules via
+ * dlsym(). This must be called whenever a capsule is loaded or closed,
+ * or a capsule loads a new library.
+ */
+void _capsule_invalidate_dlsym_cache (void);
+
+/*
+ * _capsule_shim_dlclose:
+ * @handle: a handle as returned by dlopen() or capsule_shim_dlopen()
+ *
+ * The implementation used when a library inside a capsule calls
+ * dlclose(). Unloading a library from the capsule's namespace can
+ * leave cached dlsym() results pointing into it, so this calls
+ * _capsule_invalidate_dlsym_cache() after the real dlclose().
+ *
+ * Returns: the result of dlclose()
+ */
+int _capsule_shim_dlclose (void *handle);
+
 /*
  * _capsule_relocate:
  * @capsule: a #capsule handle as returned by capsule_init()
@@ -17,6 +17,7 @@
 // License along with libcapsule.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -60,6 +61,15 @@ process_phdr (struct dl_phdr_info *info,
 {
     int ret = 0;
 
+    // if the DSO was RELRO linked, we need its RELRO segment to have the
+    // PROT_WRITE flag set so that we can still overwrite its GOT entries:
+    if( find_relro_info( info->dlpi_phdr, info->dlpi_phnum,
+                         info->dlpi_addr, &rdata->relro ) &&
+        add_relro_protection( &rdata->relro, PROT_WRITE ) != 0 )
+        DEBUG( DEBUG_RELOCS|DEBUG_MPROTECT,
+               "cannot make RELRO segment %p-%p writable: %s",
+               rdata->relro.start, rdata->relro.end, strerror( errno ) );
+
     for( int j = 0; !ret && (j < info->dlpi_phnum); j++ )
     {
         if( info->dlpi_phdr[j].p_type == PT_DYNAMIC )
@@ -73,6 +83,10 @@ process_phdr (struct dl_phdr_info *info,
         }
     }
 
+    // and now we put the RELRO protection back the way it was:
+    if( rdata->relro.writable )
+        reset_relro_protection( &rdata->relro );
+
     if( ret == 0 && rdata->seen != NULL )
         ptr_list_push_addr( rdata->seen, info->dlpi_addr );
 
@@ -148,33 +162,23 @@ relocate_cb (struct dl_phdr_info *info, size_t size, void *data)
 
 static int relocate (const capsule cap,
                      capsule_item *relocations,
+                     str_index *index,
                      relocation_flags flags,
                      ptr_list *seen,
                      char **error)
 {
     relocation_data rdata = { 0 };
     capsule_item *map;
-    int mmap_errno = 0;
-    const char *mmap_error = NULL;
     int rval = 0;
 
     // load the relevant metadata into the callback argument:
     rdata.debug     = debug_flags;
     rdata.error     = NULL;
     rdata.flags     = flags;
-    rdata.mmap_info = load_mmap_info( &mmap_errno, &mmap_error );
     rdata.relocs    = relocations;
+    rdata.index     = index;
     rdata.seen      = seen;
 
-    if( mmap_errno || mmap_error )
-    {
-        DEBUG( DEBUG_RELOCS|DEBUG_MPROTECT,
-               "mmap/mprotect flags information load error (errno: %d): %s\n",
-               mmap_errno, mmap_error );
-        DEBUG( DEBUG_RELOCS|DEBUG_MPROTECT,
-               "relocation will be unable to handle relro linked libraries" );
-    }
-
     // no source dl handle means we must have a pre-populated
     // map of shim-to-real function pointers in `relocations',
     // otherwise populate the map using [the real] dlsym():
@@ -188,21 +192,11 @@ static int relocate (const capsule cap,
                 map->real = (ElfW(Addr)) _capsule_original_dlsym( cap->dl_handle, map->name );
         }
 
-    // time to enter some sort of ... dangerous... zone:
-    // we need the mmap()ed DSO regions to have the PROT_WRITE
-    // flag set, so that if they've been RELRO linked we can still
-    // overwrite their GOT entries.
-    for( int i = 0; rdata.mmap_info[i].start != MAP_FAILED; i++ )
-        if( mmap_entry_should_be_writable( &rdata.mmap_info[i] ) )
-            add_mmap_protection( &rdata.mmap_info[i], PROT_WRITE );
-
+    // time to enter some sort of ... dangerous... zone: each DSO's
+    // RELRO segment is made writable while we process it (see
+    // process_phdr()), and only if we have not already relocated it:
     dl_iterate_phdr( relocate_cb, &rdata );
 
-    // and now we put those PROT_WRITE permissions back the way they were:
-    for( int i = 0; rdata.mmap_info[i].start != MAP_FAILED; i++ )
-        if( mmap_entry_should_be_writable( &rdata.mmap_info[i] ) )
-            reset_mmap_protection( &rdata.mmap_info[i] );
-
     if( rdata.error )
     {
         if( error )
@@ -213,9 +207,6 @@ static int relocate (const capsule cap,
         rval = (rdata.count.failure == 0) ? -1 : rdata.count.failure;
     }
 
-    free_mmap_info( rdata.mmap_info );
-    rdata.mmap_info = NULL;
-
     return rval;
 }
 
@@ -223,7 +214,25 @@ int
 _capsule_relocate (const capsule cap, char **error)
 {
     DEBUG( DEBUG_RELOCS, "beginning global symbol relocation:" );
-    return relocate( cap, cap->meta->items, RELOCATION_FLAGS_NONE, cap->seen.all, error );
+
+    // a capsule can export thousands of symbols, and every DSO we visit
+    // can have thousands of relocations, so index the symbols by name
+    // once instead of scanning them for each relocation:
+    if( !cap->relocs_index )
+    {
+        size_t n = 0;
+
+        for( capsule_item *map = cap->meta->items; map->name; map++ )
+            n++;
+
+        cap->relocs_index = str_index_alloc( n );
+
+        for( capsule_item *map = cap->meta->items; map->name; map++ )
+            str_index_add( cap->relocs_index, map->name, map );
+    }
+
+    return relocate( cap, cap->meta->items, cap->relocs_index,
+                     RELOCATION_FLAGS_NONE, cap->seen.all, error );
 }
 
 static capsule_item capsule_external_dl_relocs[] =
@@ -244,7 +253,7 @@ _capsule_relocate_dlopen (const capsule cap,
         debug_flags |= DEBUG_RELOCS;
 
     DEBUG( DEBUG_RELOCS, "beginning restricted symbol relocation:" );
-    int rv = relocate( cap, capsule_external_dl_relocs,
+    int rv = relocate( cap, capsule_external_dl_relocs, NULL,
                        RELOCATION_FLAGS_AVOID_LIBC, cap->seen.some, error );
 
     debug_flags = df;
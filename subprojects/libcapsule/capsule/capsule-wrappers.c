@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <malloc.h>
+#include <pthread.h>
 
 static int
 dso_is_exported (const char *dsopath, char **exported)
@@ -25,8 +26,111 @@ dso_is_exported (const char *dsopath, char **exported)
     return 0;
 }
 
+// Games can resolve thousands of GL or Vulkan entry points via dlsym(),
+// some of them repeatedly, and looking each one up in every capsule is
+// not cheap. Remember the result of _dlsym_from_capsules() for each
+// symbol, including negative results, and whether each DSO that
+// provides symbols is exported from its capsule. The cache is
+// invalidated when a capsule is loaded or closed, and when a library
+// inside a capsule calls dlopen() or dlclose(). Everything here is
+// protected by dlsym_cache.lock.
+typedef struct
+{
+    capsule cap;
+    void *base;
+    int exported;
+} dso_verdict;
+
+static struct
+{
+    pthread_mutex_t lock;
+    // Incremented whenever the cache is invalidated
+    unsigned long generation;
+    // symbol name (owned) → address, or &symbol_not_found
+    str_index *symbols;
+    dso_verdict *dsos;
+    size_t n_dsos;
+} dlsym_cache = { PTHREAD_MUTEX_INITIALIZER };
+
+static char symbol_not_found;
+
+/*
+ * _capsule_invalidate_dlsym_cache:
+ *
+ * Forget all cached dlsym() results. This must be called whenever
+ * the set of capsules or the symbols they export might have changed.
+ */
+void
+_capsule_invalidate_dlsym_cache (void)
+{
+    pthread_mutex_lock( &dlsym_cache.lock );
+
+    dlsym_cache.generation++;
+
+    if( dlsym_cache.symbols )
+    {
+        str_index *index = dlsym_cache.symbols;
+
+        for( size_t n = 0; n <= index->mask; n++ )
+            free( (char *) index->slots[ n ].key );
+
+        str_index_free( index );
+        dlsym_cache.symbols = NULL;
+    }
+
+    free( dlsym_cache.dsos );
+    dlsym_cache.dsos = NULL;
+    dlsym_cache.n_dsos = 0;
+
+    pthread_mutex_unlock( &dlsym_cache.lock );
+}
+
+int
+_capsule_shim_dlclose (void *handle)
+{
+    int ret = dlclose( handle );
+
+    DEBUG( DEBUG_WRAPPERS|DEBUG_DLFUNC, "dlclose(%p) wrapper: %d", handle, ret );
+
+    if( ret == 0 )
+        _capsule_invalidate_dlsym_cache();
+
+    return ret;
+}
+
+// Returns 1 if the DSO described by @dso is exported from @cap, 0 if not.
+// Must be called with dlsym_cache.lock held.
+static int
+dso_is_exported_cached (capsule cap,
+                        const Dl_info *dso,
+                        unsigned long generation)
+{
+    dso_verdict *verdict;
+
+    // don't cache a verdict that might already be out of date
+    if( generation != dlsym_cache.generation )
+        return dso_is_exported( dso->dli_fname, cap->ns->combined_export );
+
+    for( size_t n = 0; n < dlsym_cache.n_dsos; n++ )
+    {
+        verdict = &dlsym_cache.dsos[ n ];
+
+        if( verdict->cap == cap && verdict->base == dso->dli_fbase )
+            return verdict->exported;
+    }
+
+    dlsym_cache.dsos = xrealloc( dlsym_cache.dsos,
+                                 (dlsym_cache.n_dsos + 1) * sizeof(dso_verdict) );
+    verdict = &dlsym_cache.dsos[ dlsym_cache.n_dsos++ ];
+    verdict->cap = cap;
+    verdict->base = dso->dli_fbase;
+    verdict->exported = dso_is_exported( dso->dli_fname,
+                                         cap->ns->combined_export );
+    return verdict->exported;
+}
+
 static void *
-_dlsym_from_capsules (const char *symbol)
+_dlsym_from_capsules_uncached (const char *symbol, unsigned long generation)
 {
     void *addr = NULL;
 
@@ -49,7 +153,13 @@ _dlsym_from_capsules (const char *symbol)
             // or if we are unable to determine where it came from (what?)
             if( dladdr( addr, &dso ) )
             {
-                if( !dso_is_exported( dso.dli_fname, cap->ns->combined_export ) )
+                int exported;
+
+                pthread_mutex_lock( &dlsym_cache.lock );
+                exported = dso_is_exported_cached( cap, &dso, generation );
+                pthread_mutex_unlock( &dlsym_cache.lock );
+
+                if( !exported )
                     addr = NULL;
 
                 DEBUG( DEBUG_DLFUNC|DEBUG_WRAPPERS,
@@ -65,6 +175,49 @@ _dlsym_from_capsules (const char *symbol)
     return addr;
 }
 
+static void *
+_dlsym_from_capsules (const char *symbol)
+{
+    unsigned long generation;
+    void *addr;
+
+    pthread_mutex_lock( &dlsym_cache.lock );
+
+    addr = dlsym_cache.symbols
+           ? str_index_lookup( dlsym_cache.symbols, symbol )
+           : NULL;
+    generation = dlsym_cache.generation;
+
+    pthread_mutex_unlock( &dlsym_cache.lock );
+
+    if( addr )
+    {
+        DEBUG( DEBUG_DLFUNC|DEBUG_WRAPPERS, "symbol %s was cached", symbol );
+        return (addr == &symbol_not_found) ? NULL : addr;
+    }
+
+    // Don't hold the lock while we call into the dynamic linker
+    addr = _dlsym_from_capsules_uncached( symbol, generation );
+
+    pthread_mutex_lock( &dlsym_cache.lock );
+
+    // If a capsule was loaded or closed meanwhile, our result might
+    // already be out of date, so don't cache it
+    if( generation == dlsym_cache.generation )
+    {
+        if( !dlsym_cache.symbols )
+            dlsym_cache.symbols = str_index_alloc( 0 );
+
+        if( str_index_lookup( dlsym_cache.symbols, symbol ) == NULL )
+            str_index_add( dlsym_cache.symbols, xstrdup( symbol ),
+                           addr ? addr : &symbol_not_found );
+    }
+
+    pthread_mutex_unlock( &dlsym_cache.lock );
+
+    return addr;
+}
+
 static int
 _dlsymbol_is_encapsulated (const void *addr)
 {
@@ -252,7 +405,9 @@ capsule_shim_dlopen(const capsule cap, const char *file, int flag)
         // load them up in reverse dependency order:
         res = ld_libs_load( &ldlibs, &cap->ns->ns, flag, &code, &errors );
 
-        if( !res )
+        if( res )
+            _capsule_invalidate_dlsym_cache();
+        else
             DEBUG( DEBUG_WRAPPERS|DEBUG_DLFUNC,
                    "capsule dlopen error %d: %s", code, errors );
 
@@ -262,7 +417,9 @@ capsule_shim_dlopen(const capsule cap, const char *file, int flag)
     {
         res = dlmopen( cap->ns->ns, file, flag );
 
-        if( !res )
+        if( res )
+            _capsule_invalidate_dlsym_cache();
+        else
             DEBUG( DEBUG_WRAPPERS|DEBUG_DLFUNC,
                    "capsule dlopen error %s: %s", file, dlerror() );
     }
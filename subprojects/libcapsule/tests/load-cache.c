@@ -0,0 +1,487 @@
+// Copyright © 2026 Collabora Ltd
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// This file is part of libcapsule.
+
+// libcapsule is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// libcapsule is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public
+// License along with libcapsule.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "capsule/capsule-load-cache.h"
+#include "tests/test-helpers.h"
+#include "utils/ld-cache.h"
+#include "utils/utils.h"
+
+// Any library that is always available will do, as long as it has
+// at least one dependency other than the dynamic linker:
+#define TARGET "libm.so.6"
+
+#define assert_with_errno(expr) \
+  do { \
+    errno = 0; \
+    \
+    if (!(expr)) \
+      g_error ("Assertion failed: %s: %s", #expr, g_strerror (errno)); \
+  } while (0)
+
+typedef struct
+{
+  gchar *tmpdir;
+  gchar *sysroot;
+  // paths of the libraries to load, outside the sysroot
+  GPtrArray *libraries;
+} Fixture;
+
+/*
+ * Resolve the dependencies of @target in @prefix, the same way
+ * _capsule_load() does when there is no cached result.
+ *
+ * Returns: (transfer full) (element-type utf8): the paths of the
+ *  libraries to open, in order, or %NULL on error
+ */
+static GPtrArray *
+resolve (const char *prefix,
+         const char *target)
+{
+  GPtrArray *paths = NULL;
+  ld_libs ldlibs = {};
+  int order[DSO_LIMIT];
+  int code = 0;
+  char *message = NULL;
+  int n;
+
+  if (!ld_libs_init (&ldlibs, NULL, prefix, debug_flags, &code, &message)
+      || !ld_libs_load_cache (&ldlibs, &code, &message)
+      || !ld_libs_set_target (&ldlibs, target, &code, &message)
+      || !ld_libs_find_dependencies (&ldlibs, &code, &message))
+    goto out;
+
+  n = ld_libs_get_load_order (&ldlibs, order, &code, &message);
+
+  if (n == 0)
+    goto out;
+
+  paths = g_ptr_array_new_with_free_func (g_free);
+
+  for (int i = 0; i < n; i++)
+    g_ptr_array_add (paths, g_strdup (ldlibs.needed[order[i]].path));
+
+out:
+  if (message != NULL)
+    g_test_message ("Unable to resolve %s in \"%s\": %s",
+                    target, prefix, message);
+
+  free (message);
+  ld_libs_finish (&ldlibs);
+  return paths;
+}
+
+/*
+ * Look up @target in the load cache for @prefix.
+ *
+ * Returns: (transfer full) (element-type utf8) (nullable): the cached
+ *  paths, or %NULL if there was no valid cached result
+ */
+static GPtrArray *
+lookup (const char *prefix,
+        const char *target)
+{
+  GPtrArray *paths = NULL;
+  ld_libs ldlibs = {};
+  char **cached = NULL;
+  int code = 0;
+  char *message = NULL;
+  int n = -1;
+
+  if (!ld_libs_init (&ldlibs, NULL, prefix, debug_flags, &code, &message))
+    g_error ("%s", message);
+
+  cached = _capsule_load_cache_lookup (&ldlibs, target, &n);
+
+  if (cached != NULL)
+    {
+      paths = g_ptr_array_new_with_free_func (g_free);
+
+      for (int i = 0; i < n; i++)
+        g_ptr_array_add (paths, g_strdup (cached[i]));
+
+      g_assert_null (cached[n]);
+    }
+  else
+    {
+      g_assert_cmpint (n, ==, 0);
+    }
+
+  free_strv_full (cached);
+  ld_libs_finish (&ldlibs);
+  return paths;
+}
+
+static void
+store (const char *prefix,
+       const char *target,
+       GPtrArray *paths)
+{
+  ld_libs ldlibs = {};
+  int code = 0;
+  char *message = NULL;
+
+  if (!ld_libs_init (&ldlibs, NULL, prefix, debug_flags, &code, &message))
+    g_error ("%s", message);
+
+  _capsule_load_cache_store (&ldlibs, target,
+                             (const char * const *) paths->pdata,
+                             paths->len);
+  ld_libs_finish (&ldlibs);
+}
+
+static void
+assert_same_paths (GPtrArray *got,
+                   GPtrArray *expected)
+{
+  g_assert_nonnull (got);
+  g_assert_nonnull (expected);
+  g_assert_cmpuint (got->len, ==, expected->len);
+
+  for (guint i = 0; i < expected->len; i++)
+    g_assert_cmpstr (g_ptr_array_index (got, i), ==,
+                     g_ptr_array_index (expected, i));
+}
+
+static void
+copy_file (const char *from,
+           const char *to)
+{
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gchar *dir = g_path_get_dirname (to);
+  gsize len;
+
+  assert_with_errno (g_mkdir_with_parents (dir, 0755) == 0);
+  g_file_get_contents (from, &contents, &len, &error);
+  g_assert_no_error (error);
+  g_file_set_contents (to, contents, len, &error);
+  g_assert_no_error (error);
+  g_free (contents);
+  g_free (dir);
+}
+
+/*
+ * Change the modification time of @path, without changing its contents,
+ * as happens when a library or the ld.so.cache is upgraded in-place
+ * to a file of the same size.
+ */
+static void
+change_mtime (const char *path)
+{
+  struct stat sb;
+  struct timespec times[2];
+
+  assert_with_errno (stat (path, &sb) == 0);
+  times[0] = sb.st_atim;
+  times[1] = sb.st_mtim;
+  times[1].tv_sec += 60;
+  assert_with_errno (utimensat (AT_FDCWD, path, times, 0) == 0);
+}
+
+static void
+setup (Fixture *f,
+       gconstpointer data)
+{
+  GError *error = NULL;
+  gchar *cache_home;
+  GPtrArray *system_paths;
+
+  f->tmpdir = g_dir_make_tmp ("libcapsule-load-cache-XXXXXX", &error);
+  g_assert_no_error (error);
+  f->sysroot = g_build_filename (f->tmpdir, "sysroot", NULL);
+
+  // The load cache is not used in these situations
+  g_unsetenv ("CAPSULE_NO_LOAD_CACHE");
+  g_unsetenv ("LD_LIBRARY_PATH");
+
+  cache_home = g_build_filename (f->tmpdir, "cache", NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_home, TRUE);
+  g_free (cache_home);
+
+  // Build a sysroot containing copies of the ld.so.cache and the
+  // libraries that it points to, so that we can change them
+  system_paths = resolve (NULL, TARGET);
+
+  if (system_paths == NULL)
+    return;
+
+  f->libraries = system_paths;
+
+  for (int i = 0; ld_cache_filenames[i] != NULL; i++)
+    {
+      gchar *copy;
+
+      if (!g_file_test (ld_cache_filenames[i], G_FILE_TEST_EXISTS))
+        continue;
+
+      copy = g_build_filename (f->sysroot, ld_cache_filenames[i], NULL);
+      copy_file (ld_cache_filenames[i], copy);
+      g_free (copy);
+    }
+
+  for (guint i = 0; i < system_paths->len; i++)
+    {
+      const char *path = g_ptr_array_index (system_paths, i);
+      gchar *copy = g_build_filename (f->sysroot, path, NULL);
+
+      copy_file (path, copy);
+      g_free (copy);
+    }
+}
+
+/*
+ * Returns: (transfer full): the paths that the copies of the libraries
+ *  in the sysroot are expected to be loaded from
+ */
+static GPtrArray *
+expected_paths (Fixture *f)
+{
+  GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+
+  for (guint i = 0; i < f->libraries->len; i++)
+    g_ptr_array_add (paths,
+                     g_build_filename (f->sysroot,
+                                       g_ptr_array_index (f->libraries, i),
+                                       NULL));
+
+  return paths;
+}
+
+static gboolean
+skip_if_unresolved (Fixture *f)
+{
+  if (f->libraries == NULL)
+    {
+      g_test_skip ("Unable to resolve " TARGET " on this system");
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+test_hit (Fixture *f,
+          gconstpointer data)
+{
+  GPtrArray *expected;
+  GPtrArray *uncached;
+  GPtrArray *cached;
+  struct link_map *map = NULL;
+  Lmid_t ns = LM_ID_NEWLM;
+  int code = 0;
+  char *message = NULL;
+  ld_libs ldlibs = {};
+  void *handle;
+
+  if (skip_if_unresolved (f))
+    return;
+
+  expected = expected_paths (f);
+
+  // Nothing has been cached yet
+  g_assert_null (lookup (f->sysroot, TARGET));
+
+  uncached = resolve (f->sysroot, TARGET);
+  assert_same_paths (uncached, expected);
+  store (f->sysroot, TARGET, uncached);
+
+  // The cache gives us the same result as resolving from scratch
+  cached = lookup (f->sysroot, TARGET);
+  assert_same_paths (cached, uncached);
+
+  // Nothing is cached for a different library or a different sysroot
+  g_assert_null (lookup (f->sysroot, "libc.so.6"));
+  g_assert_null (lookup (f->tmpdir, TARGET));
+
+  // We can load the cached result, and the handle is for the target
+  if (!ld_libs_init (&ldlibs, NULL, f->sysroot, debug_flags, &code, &message))
+    g_error ("%s", message);
+
+  handle = ld_libs_load_paths (&ldlibs, (const char * const *) cached->pdata,
+                               cached->len, &ns, 0, &code, &message);
+
+  if (handle == NULL)
+    g_error ("%s", message);
+
+  g_assert_cmpint (ns, !=, LM_ID_NEWLM);
+  g_assert_cmpint (ns, !=, LM_ID_BASE);
+  assert_with_errno (dlinfo (handle, RTLD_DI_LINKMAP, &map) == 0);
+  g_assert_cmpstr (map->l_name, ==,
+                   g_ptr_array_index (cached, cached->len - 1));
+
+  dlclose (handle);
+  ld_libs_finish (&ldlibs);
+  g_ptr_array_unref (cached);
+  g_ptr_array_unref (uncached);
+  g_ptr_array_unref (expected);
+}
+
+static void
+test_ldcache_changed (Fixture *f,
+                      gconstpointer data)
+{
+  GPtrArray *uncached;
+  GPtrArray *cached;
+  gchar *ldcache;
+
+  if (skip_if_unresolved (f))
+    return;
+
+  uncached = resolve (f->sysroot, TARGET);
+  g_assert_nonnull (uncached);
+  store (f->sysroot, TARGET, uncached);
+  cached = lookup (f->sysroot, TARGET);
+  assert_same_paths (cached, uncached);
+  g_ptr_array_unref (cached);
+
+  ldcache = g_build_filename (f->sysroot, "etc", "ld.so.cache", NULL);
+  change_mtime (ldcache);
+  g_assert_null (lookup (f->sysroot, TARGET));
+
+  // Storing the result again replaces the out-of-date entry
+  g_ptr_array_unref (uncached);
+  uncached = resolve (f->sysroot, TARGET);
+  g_assert_nonnull (uncached);
+  store (f->sysroot, TARGET, uncached);
+  cached = lookup (f->sysroot, TARGET);
+  assert_same_paths (cached, uncached);
+
+  g_ptr_array_unref (cached);
+  g_ptr_array_unref (uncached);
+  g_free (ldcache);
+}
+
+static void
+test_library_changed (Fixture *f,
+                      gconstpointer data)
+{
+  GPtrArray *uncached;
+  GPtrArray *cached;
+
+  if (skip_if_unresolved (f))
+    return;
+
+  uncached = resolve (f->sysroot, TARGET);
+  g_assert_nonnull (uncached);
+  g_assert_cmpuint (uncached->len, >=, 2);
+
+  for (guint i = 0; i < uncached->len; i++)
+    {
+      const char *path = g_ptr_array_index (uncached, i);
+
+      store (f->sysroot, TARGET, uncached);
+      cached = lookup (f->sysroot, TARGET);
+      assert_same_paths (cached, uncached);
+      g_ptr_array_unref (cached);
+
+      // Changing any of the libraries, not just the target,
+      // invalidates the cached result
+      g_test_message ("Changing %s", path);
+      change_mtime (path);
+      g_assert_null (lookup (f->sysroot, TARGET));
+
+      // ... and so does replacing it with a different file
+      store (f->sysroot, TARGET, uncached);
+      cached = lookup (f->sysroot, TARGET);
+      assert_same_paths (cached, uncached);
+      g_ptr_array_unref (cached);
+
+      copy_file (path, path);
+      g_assert_null (lookup (f->sysroot, TARGET));
+    }
+
+  g_ptr_array_unref (uncached);
+}
+
+static void
+test_disabled (Fixture *f,
+               gconstpointer data)
+{
+  GPtrArray *uncached;
+  GPtrArray *cached;
+
+  if (skip_if_unresolved (f))
+    return;
+
+  uncached = resolve (f->sysroot, TARGET);
+  g_assert_nonnull (uncached);
+  store (f->sysroot, TARGET, uncached);
+
+  g_setenv ("LD_LIBRARY_PATH", f->tmpdir, TRUE);
+  g_assert_null (lookup (f->sysroot, TARGET));
+  g_unsetenv ("LD_LIBRARY_PATH");
+
+  g_setenv ("CAPSULE_NO_LOAD_CACHE", "1", TRUE);
+  g_assert_null (lookup (f->sysroot, TARGET));
+  g_unsetenv ("CAPSULE_NO_LOAD_CACHE");
+
+  cached = lookup (f->sysroot, TARGET);
+  assert_same_paths (cached, uncached);
+
+  g_ptr_array_unref (cached);
+  g_ptr_array_unref (uncached);
+}
+
+static void
+teardown (Fixture *f,
+          gconstpointer data)
+{
+  if (f->tmpdir != NULL)
+    rm_rf (f->tmpdir);
+
+  g_unsetenv ("XDG_CACHE_HOME");
+
+  if (f->libraries != NULL)
+    g_ptr_array_unref (f->libraries);
+
+  g_free (f->sysroot);
+  g_free (f->tmpdir);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_set_nonfatal_assertions ();
+
+  set_debug_flags (g_getenv ("CAPSULE_DEBUG"));
+
+  g_test_add ("/load-cache/hit", Fixture, NULL, setup,
+              test_hit, teardown);
+  g_test_add ("/load-cache/disabled", Fixture, NULL, setup,
+              test_disabled, teardown);
+  g_test_add ("/load-cache/invalidated/ldcache", Fixture, NULL, setup,
+              test_ldcache_changed, teardown);
+  g_test_add ("/load-cache/invalidated/library", Fixture, NULL, setup,
+              test_library_changed, teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,117 @@
+// Copyright © 2026 Collabora Ltd
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// This file is part of libcapsule.
+//
+// libcapsule is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+//
+// libcapsule is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libcapsule.  If not, see <http://www.gnu.org/licenses/>.
+
+// Exercise libcapsule's cache of dlsym() results: look up the same
+// symbols repeatedly, and check that the results change when a
+// capsule is loaded or unloaded.
+
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "notgl.h"
+
+static void die( const char *format, ... )
+    __attribute__((noreturn))
+    __attribute__((format(printf, 1, 2)));
+
+static void
+die( const char *format, ... )
+{
+    va_list ap;
+
+    va_start( ap, format );
+    vfprintf( stderr, format, ap );
+    va_end( ap );
+    abort();
+}
+
+static void *
+xdlopen( const char *filename, int flags )
+{
+    void *handle = dlopen( filename, flags );
+
+    if( handle == NULL )
+        die( "dlopen(\"%s\", %d): %s", filename, flags, dlerror() );
+
+    return handle;
+}
+
+static void
+xdlclose( void *handle )
+{
+    if( dlclose( handle ) != 0 )
+        die( "dlclose(%p): %s", handle, dlerror() );
+}
+
+static notgl_extension_function
+show_extension( const char *when,
+                const char *name )
+{
+    notgl_extension_function f = dlsym( RTLD_DEFAULT, name );
+
+    if( f )
+        printf( "%s: %s: %s\n", when, name, f() );
+    else
+        printf( "%s: %s: (not found)\n", when, name );
+
+    return f;
+}
+
+int
+main ( int argc,
+       char **argv )
+{
+    notgl_extension_function first;
+    notgl_extension_function again;
+    void *gl;
+    void *gles;
+
+    // Select line-buffering for output, in case we crash
+    setvbuf( stdout, NULL, _IOLBF, 0 );
+
+    gl = xdlopen( "libnotgl.so.0", RTLD_NOW|RTLD_LOCAL );
+
+    // The second lookup of each symbol is answered from the cache,
+    // and must give the same result as the first
+    first = show_extension( "first", "notgl_extension_red" );
+    again = show_extension( "again", "notgl_extension_red" );
+    printf( "same result: %s\n", first == again ? "yes" : "no" );
+
+    // A negative result is cached too...
+    show_extension( "before", "notgles_extension_red" );
+    show_extension( "before", "notgles_extension_red" );
+
+    // ... but loading another capsule invalidates it
+    gles = xdlopen( "libnotgles.so.1", RTLD_NOW|RTLD_LOCAL );
+    show_extension( "loaded", "notgles_extension_red" );
+    show_extension( "loaded", "notgles_extension_red" );
+
+    // Unloading the capsule invalidates the positive result, which
+    // would otherwise point into a library that is no longer there
+    xdlclose( gles );
+    show_extension( "unloaded", "notgles_extension_red" );
+
+    // Symbols from the capsule that is still loaded are unaffected
+    again = show_extension( "still loaded", "notgl_extension_red" );
+    printf( "same result after unload: %s\n", first == again ? "yes" : "no" );
+
+    xdlclose( gl );
+    return 0;
+}
@@ -22,6 +22,8 @@
 #include "notgl.h"
 
 #include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "notgl-helper.h"
 
@@ -40,7 +42,14 @@ notgl_extension_both( void )
 const char *
 notgl_extension_red( void )
 {
-    return "red-only extension";
+    static char *last = NULL;
+
+    // Really call free(), so that libcapsule has to redirect this DSO's
+    // GOT entry for it, which is in the RELRO segment (we are linked
+    // with -z now)
+    free( last );
+    last = strdup( "red-only extension" );
+    return last;
 }
 
 const char *
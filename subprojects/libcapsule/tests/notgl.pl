@@ -44,6 +44,7 @@ my $libs = '';
 my $notgl_user = "$builddir/tests/notgl-user";
 my $notgl_helper_user = "$builddir/tests/notgl-helper-user";
 my $notgl_dlopener = "$builddir/tests/notgl-dlopener";
+my $notgl_dlsym_cache = "$builddir/tests/notgl-dlsym-cache";
 my $stdout;
 
 if (exists $ENV{CAPSULE_TESTS_UNINSTALLED}) {
@@ -66,6 +67,11 @@ if (exists $ENV{CAPSULE_TESTS_UNINSTALLED}) {
         "$builddir/tests/notgl-dlopener"
     ], '>', \$notgl_dlopener) or BAIL_OUT 'Cannot find notgl-dlopener: $?';
     chomp $notgl_dlopener;
+    run_ok([
+        "$builddir/libtool", qw(--mode=execute ls -1),
+        "$builddir/tests/notgl-dlsym-cache"
+    ], '>', \$notgl_dlsym_cache) or BAIL_OUT 'Cannot find notgl-dlsym-cache: $?';
+    chomp $notgl_dlsym_cache;
 }
 else {
     diag 'Running uninstalled: no';
@@ -317,6 +323,70 @@ like($stdout,
 like($stdout, qr/^notgles_extension_red: \(not found\)$/m);
 like($stdout, qr/^notgles_extension_green: green-only extension$/m);
 
+# Results of dlsym() are cached, but the cache is invalidated when a
+# capsule is loaded or unloaded.
+diag 'With libcapsule loading red implementation, caching dlsym():';
+my $stderr;
+run_ok([qw(bwrap
+        --ro-bind / /
+        --dev-bind /dev /dev
+        --ro-bind /), $capsule_prefix,
+        '--tmpfs', realpath("$builddir/tests/lib$libs"),
+        '--tmpfs', $capsule_prefix.realpath($builddir),
+        '--ro-bind', realpath("$builddir/tests/red"),
+            $capsule_prefix.realpath("$builddir/tests/lib"),
+        '--setenv', 'CAPSULE_DEBUG', 'dlfunc',
+        '--setenv', 'CAPSULE_PREFIX', $capsule_prefix,
+        '--setenv', 'LD_LIBRARY_PATH', join(':',
+            realpath("$builddir/tests/shim$libs"),
+            realpath("$builddir/tests/helper$libs"),
+            realpath("$builddir/tests/lib$libs"),
+        ),
+        $notgl_dlsym_cache],
+    '>', \$stdout, '2>', \$stderr);
+diag_multiline $stdout;
+like($stdout, qr/^first: notgl_extension_red: red-only extension$/m);
+like($stdout, qr/^again: notgl_extension_red: red-only extension$/m);
+like($stdout, qr/^same result: yes$/m);
+like($stderr, qr/symbol notgl_extension_red was cached/);
+like($stdout, qr/^before: notgles_extension_red: \(not found\)$/m);
+like($stderr, qr/symbol notgles_extension_red was cached/);
+unlike($stdout, qr/^loaded: notgles_extension_red: \(not found\)$/m);
+like($stdout, qr/^loaded: notgles_extension_red: red-only extension$/m);
+like($stdout, qr/^unloaded: notgles_extension_red: \(not found\)$/m);
+like($stdout,
+    qr/^still loaded: notgl_extension_red: red-only extension$/m);
+like($stdout, qr/^same result after unload: yes$/m);
+
+# The red libnotgl is linked with -z relro -z now, so its GOT entry for
+# free() is read-only by the time libcapsule installs its wrapper. We can
+# only replace it if we find the RELRO segment of a DSO that is in the
+# capsule's namespace, where dl_iterate_phdr() doesn't look.
+diag 'With libcapsule wrapping free() in a BIND_NOW library:';
+run_ok([qw(bwrap
+        --ro-bind / /
+        --dev-bind /dev /dev
+        --ro-bind /), $capsule_prefix,
+        '--tmpfs', realpath("$builddir/tests/lib$libs"),
+        '--tmpfs', $capsule_prefix.realpath($builddir),
+        '--ro-bind', realpath("$builddir/tests/red"),
+            $capsule_prefix.realpath("$builddir/tests/lib"),
+        '--setenv', 'CAPSULE_DEBUG', 'mprotect',
+        '--setenv', 'CAPSULE_PREFIX', $capsule_prefix,
+        '--setenv', 'LD_LIBRARY_PATH', join(':',
+            realpath("$builddir/tests/shim$libs"),
+            realpath("$builddir/tests/helper$libs"),
+            realpath("$builddir/tests/lib$libs"),
+        ),
+        $notgl_user],
+    '>', \$stdout, '2>', \$stderr);
+diag_multiline $stdout;
+like($stdout, qr/^notgl_extension_red: red-only extension$/m);
+like($stderr,
+    qr/making RELRO segment \S+ of "[^"]*\/libnotgl\.so\.0" writable/);
+unlike($stderr, qr/cannot find program headers of "[^"]*\/libnotgl/);
+unlike($stderr, qr/cannot make RELRO segment/);
+
 done_testing;
 
 # vim:set sw=4 sts=4 et:
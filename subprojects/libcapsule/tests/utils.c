@@ -785,6 +785,80 @@ test_ptr_list (Fixture *f,
   ptr_list_free (list);
 }
 
+static void
+test_str_index (Fixture *f,
+                gconstpointer data)
+{
+  /* Roughly the number of symbols exported by a libGL capsule */
+  const size_t n = 5000;
+  const size_t lookups = 100000;
+  GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+  str_index *index;
+  size_t i;
+
+  index = str_index_alloc (0);
+
+  for (i = 0; i < n; i++)
+    g_ptr_array_add (names, g_strdup_printf ("glSymbol%zu", i));
+
+  for (i = 0; i < n; i++)
+    g_assert_cmpint (str_index_add (index, g_ptr_array_index (names, i),
+                                    GSIZE_TO_POINTER (i + 1)), ==, 1);
+
+  /* Duplicates are not added, and the first value wins */
+  g_assert_cmpint (str_index_add (index, "glSymbol0", NULL), ==, 0);
+  g_assert_cmpuint (index->used, ==, n);
+  g_assert_cmpuint (index->used * 2, <=, index->mask + 1);
+
+  for (i = 0; i < n; i++)
+    g_assert_cmpuint (GPOINTER_TO_SIZE (str_index_lookup (index,
+                                                          g_ptr_array_index (names, i))),
+                      ==, i + 1);
+
+  g_assert_null (str_index_lookup (index, "glNotASymbol"));
+  g_assert_null (str_index_lookup (index, ""));
+
+  if (g_test_perf ())
+    {
+      gdouble elapsed;
+      size_t found = 0;
+
+      g_test_timer_start ();
+
+      for (i = 0; i < lookups; i++)
+        if (str_index_lookup (index, g_ptr_array_index (names, i % n)))
+          found++;
+
+      elapsed = g_test_timer_elapsed ();
+      g_test_minimized_result (elapsed, "%zu hashed lookups: %.3f s",
+                               lookups, elapsed);
+
+      g_test_timer_start ();
+
+      for (i = 0; i < lookups; i++)
+        {
+          const char *name = g_ptr_array_index (names, i % n);
+          size_t j;
+
+          for (j = 0; j < n; j++)
+            if (strcmp (name, g_ptr_array_index (names, j)) == 0)
+              break;
+
+          if (j < n)
+            found++;
+        }
+
+      elapsed = g_test_timer_elapsed ();
+      g_test_minimized_result (elapsed, "%zu linear lookups: %.3f s",
+                               lookups, elapsed);
+      g_assert_cmpuint (found, ==, 2 * lookups);
+    }
+
+  str_index_free (index);
+  str_index_free (NULL);
+  g_ptr_array_unref (names);
+}
+
 static void
 teardown (Fixture *f,
           gconstpointer data)
@@ -816,6 +890,7 @@ main (int argc,
   g_test_add ("/library-knowledge/good", Fixture, NULL,
               setup, test_library_knowledge_good, teardown);
   g_test_add ("/ptr-list", Fixture, NULL, setup, test_ptr_list, teardown);
+  g_test_add ("/str-index", Fixture, NULL, setup, test_str_index, teardown);
 
   return g_test_run ();
 }
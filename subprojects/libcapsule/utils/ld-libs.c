@@ -936,20 +936,27 @@ ld_libs_find_dependencies (ld_libs *ldlibs, int *code, char **message)
     return dso_iterate_sections( ldlibs, 0, code, message );
 }
 
-// And now we actually open everything we have found, in reverse
+// Work out the order in which to open everything we have found: reverse
 // dependency order (which prevents dlmopen from going and finding
 // DT_NEEDED values from outside the capsule), which it will do
-// if we don't work backwards:
-void *
-ld_libs_load (ld_libs *ldlibs, Lmid_t *namespace, int flag, int *error,
-              char **message)
+// if we don't work backwards.
+//
+// order must have space for DSO_LIMIT entries: it is filled with indices
+// into ldlibs->needed, and the _last_ one will be the DSO we actually
+// asked for.
+//
+// returns the number of entries in order, or 0 on error:
+int
+ld_libs_get_load_order (ld_libs *ldlibs, int *order, int *error,
+                        char **message)
 {
+    int depcount[DSO_LIMIT];
+    int done[DSO_LIMIT] = { 0 };
+    int n = 0;
     int go;
-    Lmid_t lm = (*namespace >= 0) ? *namespace : LM_ID_NEWLM;
-    void *ret = NULL;
 
-    if( !flag )
-        flag = RTLD_LAZY;
+    for( int j = 0; j < DSO_LIMIT; j++ )
+        depcount[j] = ldlibs->needed[j].depcount;
 
     do
     {
@@ -957,55 +964,19 @@ ld_libs_load (ld_libs *ldlibs, Lmid_t *namespace, int flag, int *error,
 
         for( int j = 0; j < DSO_LIMIT; j++ )
         {
-            // reached the end of the list
-            if( !ldlibs->needed[j].name )
+            // reached the end of the list, or already scheduled
+            if( !ldlibs->needed[j].name || done[j] )
                 continue;
 
             // library has no further dependencies which have not already
             // been satisfied (except for the libc and linker DSOs),
             // this means we can safely open it without dlmopen accidentally
             // pulling in DSOs from outside the encapsulated tree:
-            if( ldlibs->needed[j].depcount == 0 )
+            if( depcount[j] == 0 )
             {
-                const char *path = ldlibs->needed[j].path;
                 go++;
-
-                LDLIB_DEBUG( ldlibs, DEBUG_CAPSULE,
-                             "DLMOPEN needed[%d]: %p %s %s",
-                             j, (void *)lm, _rtldstr(flag), path );
-
-                // The actual dlmopen. If this was the first one, it may
-                // have created a new link map id, wich we record later on:
-
-                // note that since we do the opens in reverse dependency order,
-                // the _last_ one we open will be the DSO we actually asked for
-                // so if we succeed, ret has to contain the right handle.
-                ret = dlmopen( lm, path, flag );
-
-                if( !ret )
-                {
-                    if (lm == LM_ID_NEWLM)
-                        _capsule_set_error( error, message, EINVAL,
-                                            "dlmopen(LM_ID_NEWLM, \"%s\", %s): %s",
-                                            path, _rtldstr( flag ), dlerror() );
-                    else
-                        _capsule_set_error( error, message, EINVAL,
-                                            "dlmopen(%p, \"%s\", %s): %s",
-                                            (void *) lm, path,
-                                            _rtldstr( flag ), dlerror() );
-
-                    return NULL;
-                }
-
-                // If this was the first dlmopen, record the new LM Id
-                // for return to our caller:
-                if( lm == LM_ID_NEWLM )
-                {
-                    dlinfo( ret, RTLD_DI_LMID, namespace );
-                    lm = *namespace;
-                    LDLIB_DEBUG( ldlibs, DEBUG_CAPSULE,
-                                 "new Lmid_t handle %p\n", (void *)lm );
-                }
+                done[j] = 1;
+                order[n++] = j;
 
                 // go through the map of DSOs and reduce the dependency
                 // count for any DSOs which had the current DSO as a dep:
@@ -1013,33 +984,108 @@ ld_libs_load (ld_libs *ldlibs, Lmid_t *namespace, int flag, int *error,
                 {
                     if( ldlibs->needed[j].requestors[k] )
                     {
-                        ldlibs->needed[k].depcount--;
+                        depcount[k]--;
                         LDLIB_DEBUG( ldlibs, DEBUG_CAPSULE,
                                      "needed[%d] (%s) dependency on \"%s\" "
                                      "satisfied, %d more libraries needed",
-                                     k, ldlibs->needed[k].name, path,
-                                     ldlibs->needed[k].depcount );
+                                     k, ldlibs->needed[k].name,
+                                     ldlibs->needed[j].path, depcount[k] );
                     }
                 }
-
-                LDLIB_DEBUG( ldlibs, DEBUG_CAPSULE,
-                             "Forgetting about needed[%d] (%s)",
-                             j, ldlibs->needed[j].name );
-                clear_needed( &ldlibs->needed[j] );
             }
         }
     } while (go);
 
-    if( !ret )
-    {
+    if( n == 0 )
         _capsule_set_error( error, message, EINVAL,
                             "How do we get here? go = 0" );
-        return NULL;
+
+    return n;
+}
+
+// Open each of the n_paths libraries in paths, which must already be in
+// reverse dependency order (see ld_libs_get_load_order()).
+//
+// note that since we do the opens in reverse dependency order,
+// the _last_ one we open will be the DSO we actually asked for
+// so if we succeed, the return value is the right handle:
+void *
+ld_libs_load_paths (ld_libs *ldlibs, const char * const *paths, int n_paths,
+                    Lmid_t *namespace, int flag, int *error, char **message)
+{
+    Lmid_t lm = (*namespace >= 0) ? *namespace : LM_ID_NEWLM;
+    void *ret = NULL;
+
+    if( !flag )
+        flag = RTLD_LAZY;
+
+    for( int i = 0; i < n_paths; i++ )
+    {
+        const char *path = paths[i];
+
+        LDLIB_DEBUG( ldlibs, DEBUG_CAPSULE,
+                     "DLMOPEN %d/%d: %p %s %s",
+                     i + 1, n_paths, (void *)lm, _rtldstr(flag), path );
+
+        // The actual dlmopen. If this was the first one, it may
+        // have created a new link map id, wich we record later on:
+        ret = dlmopen( lm, path, flag );
+
+        if( !ret )
+        {
+            if (lm == LM_ID_NEWLM)
+                _capsule_set_error( error, message, EINVAL,
+                                    "dlmopen(LM_ID_NEWLM, \"%s\", %s): %s",
+                                    path, _rtldstr( flag ), dlerror() );
+            else
+                _capsule_set_error( error, message, EINVAL,
+                                    "dlmopen(%p, \"%s\", %s): %s",
+                                    (void *) lm, path,
+                                    _rtldstr( flag ), dlerror() );
+
+            return NULL;
+        }
+
+        // If this was the first dlmopen, record the new LM Id
+        // for return to our caller:
+        if( lm == LM_ID_NEWLM )
+        {
+            dlinfo( ret, RTLD_DI_LMID, namespace );
+            lm = *namespace;
+            LDLIB_DEBUG( ldlibs, DEBUG_CAPSULE,
+                         "new Lmid_t handle %p\n", (void *)lm );
+        }
     }
 
+    if( !ret )
+        _capsule_set_error_literal( error, message, EINVAL,
+                                    "No libraries to load" );
+
     return ret;
 }
 
+// And now we actually open everything we have found, in reverse
+// dependency order:
+void *
+ld_libs_load (ld_libs *ldlibs, Lmid_t *namespace, int flag, int *error,
+              char **message)
+{
+    const char *paths[DSO_LIMIT];
+    int order[DSO_LIMIT];
+    int n;
+
+    n = ld_libs_get_load_order( ldlibs, order, error, message );
+
+    if( n == 0 )
+        return NULL;
+
+    for( int i = 0; i < n; i++ )
+        paths[i] = ldlibs->needed[ order[i] ].path;
+
+    return ld_libs_load_paths( ldlibs, paths, n, namespace, flag,
+                               error, message );
+}
+
 void
 ld_libs_finish (ld_libs *ldlibs)
 {
@@ -106,6 +106,13 @@ int   ld_libs_find_dependencies (ld_libs *ldlibs, int *code, char **message);
 void  ld_libs_finish            (ld_libs *ldlibs);
 int   ld_libs_load_cache        (ld_libs *libs, int *code, char **message);
 
+int   ld_libs_get_load_order    (ld_libs *ldlibs, int *order, int *error,
+                                 char **message);
+
+void *ld_libs_load_paths (ld_libs *ldlibs, const char * const *paths,
+                          int n_paths, Lmid_t *namespace, int flag,
+                          int *error, char **message);
+
 void *ld_libs_load (ld_libs *ldlibs, Lmid_t *namespace, int flag, int *error,
                     char **message);
 
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <string.h>
 #include <link.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -263,3 +264,117 @@ mmap_entry_should_be_writable (mmapinfo *mmap_info)
     return 1;
 }
 
+
+/*
+ * find_relro_info:
+ * @phdr: the program headers of a loaded DSO
+ * @phnum: number of entries in @phdr
+ * @base: the DSO's load address (dlpi_addr or l_addr)
+ * @relro: (out): the DSO's RELRO segment
+ *
+ * Returns: 1 if the DSO has a non-empty RELRO segment, 0 otherwise
+ */
+int
+find_relro_info (const ElfW(Phdr) *phdr,
+                 ElfW(Half) phnum,
+                 ElfW(Addr) base,
+                 relro_info *relro)
+{
+    ElfW(Addr) pagesize = (ElfW(Addr)) getpagesize();
+
+    relro->start = relro->end = NULL;
+    relro->writable = 0;
+
+    for( int i = 0; i < phnum; i++ )
+    {
+        ElfW(Addr) start;
+        ElfW(Addr) end;
+
+        if( phdr[i].p_type != PT_GNU_RELRO )
+            continue;
+
+        // ld.so rounds both ends down: a partial page at the end of the
+        // segment is shared with ordinary data and stays writable.
+        start = (base + phdr[i].p_vaddr) & ~(pagesize - 1);
+        end = (base + phdr[i].p_vaddr + phdr[i].p_memsz) & ~(pagesize - 1);
+
+        if( start >= end )
+            return 0;
+
+        relro->start = (char *) start;
+        relro->end   = (char *) end;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * find_relro_info_from_ehdr:
+ * @ehdr: the ELF header of a loaded DSO, as mapped into memory
+ * @base: the DSO's load address (l_addr)
+ * @relro: (out): the DSO's RELRO segment
+ *
+ * Like find_relro_info(), for a DSO we only have a link_map entry for.
+ * dl_iterate_phdr() only lists the DSOs in the caller's link-map
+ * namespace, so it cannot find those inside a capsule; but the
+ * program headers are mapped along with the ELF header, which is at
+ * the start of the DSO's first mapping.
+ *
+ * Returns: 1 if the DSO has a non-empty RELRO segment, 0 if it does
+ *  not, or -1 if @ehdr does not look like a suitable ELF header
+ */
+int
+find_relro_info_from_ehdr (const ElfW(Ehdr) *ehdr,
+                           ElfW(Addr) base,
+                           relro_info *relro)
+{
+    relro->start = relro->end = NULL;
+    relro->writable = 0;
+
+    if( ehdr == NULL ||
+        memcmp( ehdr->e_ident, ELFMAG, SELFMAG ) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ( __ELF_NATIVE_CLASS == 64 ?
+                                     ELFCLASS64 : ELFCLASS32 ) ||
+        ehdr->e_phentsize != sizeof(ElfW(Phdr)) ||
+        ehdr->e_phoff == 0 )
+        return -1;
+
+    return find_relro_info( (const ElfW(Phdr) *)
+                            ( (const char *) ehdr + ehdr->e_phoff ),
+                            ehdr->e_phnum, base, relro );
+}
+
+int
+relro_info_contains (const relro_info *relro, const void *addr)
+{
+    return ( (ElfW(Addr)) addr >= (ElfW(Addr)) relro->start &&
+             (ElfW(Addr)) addr <  (ElfW(Addr)) relro->end );
+}
+
+int
+add_relro_protection (relro_info *relro, unsigned int flags)
+{
+    size_t size = relro->end - relro->start;
+
+    if( size == 0 )
+        return 0;
+
+    if( mprotect( relro->start, size, PROT_READ | flags ) != 0 )
+        return -1;
+
+    relro->writable = !!(flags & PROT_WRITE);
+    return 0;
+}
+
+int
+reset_relro_protection (relro_info *relro)
+{
+    size_t size = relro->end - relro->start;
+
+    if( size == 0 )
+        return 0;
+
+    relro->writable = 0;
+    return mprotect( relro->start, size, PROT_READ );
+}
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <link.h>
 #include <sys/param.h>
 #include <sys/mman.h>
 
@@ -39,3 +40,24 @@ int reset_mmap_protection (mmapinfo *mmap_info);
 
 int mmap_entry_should_be_writable (mmapinfo *mmap_info);
 
+
+// The PT_GNU_RELRO segment of a single loaded DSO, page-aligned the
+// same way ld.so aligns it when it makes the segment read-only:
+typedef struct
+{
+    char *start;
+    char *end;
+    int writable;
+} relro_info;
+
+int find_relro_info (const ElfW(Phdr) *phdr,
+                     ElfW(Half) phnum,
+                     ElfW(Addr) base,
+                     relro_info *relro);
+int find_relro_info_from_ehdr (const ElfW(Ehdr) *ehdr,
+                               ElfW(Addr) base,
+                               relro_info *relro);
+int relro_info_contains (const relro_info *relro, const void *addr);
+
+int add_relro_protection   (relro_info *relro, unsigned int flags);
+int reset_relro_protection (relro_info *relro);
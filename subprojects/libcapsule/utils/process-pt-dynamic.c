@@ -55,11 +55,22 @@ try_relocation (ElfW(Addr) *reloc_addr, const char *name, void *data)
     if( !name || !*name || !reloc_addr )
         return 0;
 
-    for( map = rdata->relocs; map->name; map++ )
+    if( rdata->index )
     {
-        if( strcmp( name, map->name ) )
-            continue;
+        map = str_index_lookup( rdata->index, name );
+    }
+    else
+    {
+        for( map = rdata->relocs; map->name; map++ )
+            if( strcmp( name, map->name ) == 0 )
+                break;
 
+        if( !map->name )
+            map = NULL;
+    }
+
+    if( map )
+    {
         DEBUG( DEBUG_RELOCS,
                "relocation for %s (%p->{ %p }, %p, %p)",
                name, reloc_addr, NULL, (void *)map->shim, (void *)map->real );
@@ -116,16 +127,18 @@ try_relocation (ElfW(Addr) *reloc_addr, const char *name, void *data)
         // but⁰ RELRO linking also mprotect()s the relevant pages to be read-only
         // which prevents us from overwriting the address.
 
-        // but¹ we are smarter than the average bear, and we tried to harvest
-        // the mprotect info: If we did, then we will already have toggled the
-        // write permission on everything that didn't have it and can proceed
+        // but¹ we are smarter than the average bear, and we looked up the
+        // PT_GNU_RELRO segment of the DSO being processed: If we did, then we
+        // will already have toggled the write permission on it and can proceed
         // (we're also not savages, so we'll put those permissions back later)
 
-        // however, if we don't have any mprotect into for this relocation entry,
-        // then we can't de-shim the RELROd PLT entry, and it's sad 🐼 time.
+        // however, if this relocation entry is in a RELRO segment we could not
+        // make writable, then we can't de-shim the RELROd PLT entry, and it's
+        // sad 🐼 time.
         // ======================================================================
         if( (*reloc_addr == map->shim) &&
-            !find_mmap_info(rdata->mmap_info, reloc_addr) )
+            relro_info_contains( &rdata->relro, reloc_addr ) &&
+            !rdata->relro.writable )
         {
             DEBUG( DEBUG_RELOCS|DEBUG_MPROTECT,
                    " ERROR: cannot update relocation record for %s", name );
@@ -39,10 +39,13 @@ typedef enum
 typedef struct
 {
     capsule_item *relocs;
+    // optional: @relocs indexed by name
+    str_index *index;
     struct { int success; int failure; } count;
     int debug;
     char *error;
-    mmapinfo *mmap_info;
+    // the RELRO segment of the DSO currently being processed
+    relro_info relro;
     relocation_flags flags;
     ptr_list *seen;
 } relocation_data;
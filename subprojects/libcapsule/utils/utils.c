@@ -574,6 +574,127 @@ ptr_list_nth_ptr (ptr_list *list, size_t nth)
     return NULL;
 }
 
+/*
+ * str_hash:
+ * @str: a string
+ *
+ * The hash function used for DT_GNU_HASH, which is cheap to compute
+ * and distributes symbol names well.
+ */
+unsigned int
+str_hash (const char *str)
+{
+    unsigned int h = 5381;
+
+    for( const unsigned char *c = (const unsigned char *) str; *c; c++ )
+        h = (h << 5) + h + *c;
+
+    return h;
+}
+
+/*
+ * str_index_alloc:
+ * @size: the number of entries we expect to add
+ *
+ * Returns: (transfer full): a new hash table mapping strings to
+ *  pointers, with open addressing. The keys are not copied, so they
+ *  must remain valid until the index is freed.
+ */
+str_index *
+str_index_alloc (size_t size)
+{
+    str_index *index = xcalloc( 1, sizeof(str_index) );
+    size_t n_slots = 16;
+
+    // keep the load factor at or below 50%
+    while( n_slots < size * 2 )
+        n_slots *= 2;
+
+    index->slots = xcalloc( n_slots, sizeof(str_index_entry) );
+    index->mask = n_slots - 1;
+    index->used = 0;
+    return index;
+}
+
+void
+str_index_free (str_index *index)
+{
+    if( !index )
+        return;
+
+    free( index->slots );
+    index->slots = NULL;
+    index->mask = 0;
+    index->used = 0;
+    free( index );
+}
+
+static str_index_entry *
+str_index_find_slot (const str_index *index, const char *key)
+{
+    size_t i = str_hash( key ) & index->mask;
+
+    while( index->slots[ i ].key != NULL &&
+           strcmp( index->slots[ i ].key, key ) != 0 )
+        i = (i + 1) & index->mask;
+
+    return &index->slots[ i ];
+}
+
+/*
+ * str_index_add:
+ * @index: the index
+ * @key: (transfer none): a string that must remain valid until
+ *  @index is freed
+ * @value: a pointer to associate with @key
+ *
+ * Returns: 1 if @key was added, or 0 if it was already present,
+ *  in which case the existing value is kept
+ */
+int
+str_index_add (str_index *index, const char *key, void *value)
+{
+    str_index_entry *slot;
+
+    if( (index->used + 1) * 2 > index->mask + 1 )
+    {
+        str_index_entry *old = index->slots;
+        size_t old_size = index->mask + 1;
+
+        index->slots = xcalloc( old_size * 2, sizeof(str_index_entry) );
+        index->mask = (old_size * 2) - 1;
+
+        for( size_t n = 0; n < old_size; n++ )
+            if( old[ n ].key != NULL )
+                *str_index_find_slot( index, old[ n ].key ) = old[ n ];
+
+        free( old );
+    }
+
+    slot = str_index_find_slot( index, key );
+
+    if( slot->key != NULL )
+        return 0;
+
+    slot->key = key;
+    slot->value = value;
+    index->used++;
+    return 1;
+}
+
+/*
+ * str_index_lookup:
+ * @index: the index
+ * @key: a string
+ *
+ * Returns: the value associated with @key, or %NULL if not found
+ */
+void *
+str_index_lookup (const str_index *index, const char *key)
+{
+    return str_index_find_slot( index, key )->value;
+}
+
 void
 oom( void )
 {
@@ -82,6 +82,25 @@ void ptr_list_push_addr (ptr_list *list, ElfW(Addr) addr);
 int  ptr_list_contains  (ptr_list *list, ElfW(Addr) addr);
 int  ptr_list_add_ptr   (ptr_list *list, void *ptr, ptrcmp equals);
 
+typedef struct str_index_entry
+{
+    const char *key;
+    void *value;
+} str_index_entry;
+
+typedef struct str_index
+{
+    size_t mask;
+    size_t used;
+    str_index_entry *slots;
+} str_index;
+
+unsigned int str_hash (const char *str);
+str_index *str_index_alloc (size_t size);
+void str_index_free (str_index *index);
+int   str_index_add    (str_index *index, const char *key, void *value);
+void *str_index_lookup (const str_index *index, const char *key);
+
 #define strstarts(str, start) \
   (strncmp( str, start, strlen( start ) ) == 0)
 
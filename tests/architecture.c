@@ -25,13 +25,21 @@
 
 #include <steam-runtime-tools/steam-runtime-tools.h>
 
+#include <elf.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <glib.h>
+#include <glib/gstdio.h>
 
+#include "steam-runtime-tools/architecture-internal.h"
+#include "steam-runtime-tools/glib-backports-internal.h"
+#include "steam-runtime-tools/utils-internal.h"
 #include "test-utils.h"
 
 typedef struct
 {
-  int unused;
+  gchar *tmpdir;
 } Fixture;
 
 typedef struct
@@ -44,6 +52,10 @@ setup (Fixture *f,
        gconstpointer context)
 {
   G_GNUC_UNUSED const Config *config = context;
+  g_autoptr(GError) error = NULL;
+
+  f->tmpdir = g_dir_make_tmp ("srt-architecture-XXXXXX", &error);
+  g_assert_no_error (error);
 }
 
 static void
@@ -51,6 +63,12 @@ teardown (Fixture *f,
           gconstpointer context)
 {
   G_GNUC_UNUSED const Config *config = context;
+
+  if (f->tmpdir != NULL)
+    {
+      _srt_rm_rf (f->tmpdir);
+      g_free (f->tmpdir);
+    }
 }
 
 /*
@@ -76,6 +94,173 @@ test_architecture (Fixture *f,
                    ==, NULL);
 }
 
+static void
+write_elf_header (const char *path,
+                  unsigned char elf_class,
+                  guint16 machine)
+{
+  g_autoptr(GError) error = NULL;
+  unsigned char header[EI_NIDENT + 2 * sizeof (guint16)] = { 0 };
+
+  memcpy (header, ELFMAG, SELFMAG);
+  header[EI_CLASS] = elf_class;
+  header[EI_DATA] = ELFDATA2LSB;
+  header[EI_VERSION] = EV_CURRENT;
+  machine = GUINT16_TO_LE (machine);
+  memcpy (header + EI_NIDENT + sizeof (guint16), &machine, sizeof (machine));
+
+  g_file_set_contents (path, (const char *) header, sizeof (header), &error);
+  g_assert_no_error (error);
+}
+
+static void
+write_fake_process (const char *proc,
+                    int pid,
+                    int ppid,
+                    unsigned char elf_class,
+                    guint16 machine)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *dir = g_strdup_printf ("%s/%d", proc, pid);
+  g_autofree gchar *exe = g_build_filename (dir, "exe", NULL);
+  g_autofree gchar *stat_path = g_build_filename (dir, "stat", NULL);
+  g_autofree gchar *stat_contents = NULL;
+
+  g_assert_no_errno (g_mkdir_with_parents (dir, 0755));
+  write_elf_header (exe, elf_class, machine);
+  /* The command name can contain parentheses and spaces */
+  stat_contents = g_strdup_printf ("%d (fake) (%d)) S %d %d 0 0\n",
+                                   pid, pid, ppid, pid);
+  g_file_set_contents (stat_path, stat_contents, -1, &error);
+  g_assert_no_error (error);
+}
+
+/*
+ * Test that we can decide whether an architecture can run by
+ * looking at its runtime linker and at the processes that are
+ * already running, without running anything.
+ */
+static void
+test_static_evidence (Fixture *f,
+                      gconstpointer context)
+{
+  const SrtKnownArchitecture *known;
+  g_autofree gchar *missing = g_build_filename (f->tmpdir, "missing", NULL);
+  g_autofree gchar *not_elf = g_build_filename (f->tmpdir, "not-elf", NULL);
+  g_autofree gchar *empty_proc = g_build_filename (f->tmpdir, "empty-proc",
+                                                   NULL);
+  g_autoptr(GError) error = NULL;
+
+  g_file_set_contents (not_elf, "#!/bin/sh\n", -1, &error);
+  g_assert_no_error (error);
+  g_assert_no_errno (g_mkdir (empty_proc, 0755));
+
+  g_assert_cmpint (_srt_architecture_get_static_evidence ("potato-glados",
+                                                          NULL, NULL, 0),
+                   ==, SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE);
+
+  for (known = _srt_architecture_get_known ();
+       known->multiarch_tuple != NULL;
+       known++)
+    {
+      const char *tuple = known->multiarch_tuple;
+      unsigned char other_class;
+      g_autofree gchar *good = NULL;
+      g_autofree gchar *wrong_class = NULL;
+      g_autofree gchar *wrong_machine = NULL;
+      g_autofree gchar *proc = NULL;
+
+      g_test_message ("%s", tuple);
+
+      if (known->elf_class == ELFCLASS64)
+        other_class = ELFCLASS32;
+      else
+        other_class = ELFCLASS64;
+
+      good = g_strdup_printf ("%s/%s-good", f->tmpdir, tuple);
+      write_elf_header (good, known->elf_class, known->elf_machine);
+      wrong_class = g_strdup_printf ("%s/%s-wrong-class", f->tmpdir, tuple);
+      write_elf_header (wrong_class, other_class, known->elf_machine);
+      wrong_machine = g_strdup_printf ("%s/%s-wrong-machine", f->tmpdir, tuple);
+      write_elf_header (wrong_machine, known->elf_class, EM_ARM);
+
+      /* If the runtime linker is missing or unsuitable, the kernel
+       * will not be able to start an executable */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, missing,
+                                                              empty_proc, 1),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN);
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, not_elf,
+                                                              empty_proc, 1),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN);
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple,
+                                                              wrong_class,
+                                                              empty_proc, 1),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN);
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple,
+                                                              wrong_machine,
+                                                              empty_proc, 1),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN);
+
+      /* We are already running code for our own architecture */
+      if (strcmp (tuple, _SRT_MULTIARCH) == 0)
+        {
+          g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                                  empty_proc,
+                                                                  1),
+                           ==, SRT_ARCHITECTURE_EVIDENCE_CAN_RUN);
+          continue;
+        }
+
+      /* For any other architecture, if we can't see a process that
+       * is running it, we can't know whether the kernel supports it */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              empty_proc, 1),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE);
+
+      proc = g_strdup_printf ("%s/%s-proc", f->tmpdir, tuple);
+      write_fake_process (proc, 100, 50, other_class, known->elf_machine);
+      write_fake_process (proc, 50, 20, known->elf_class, EM_ARM);
+      write_fake_process (proc, 20, 1, known->elf_class, known->elf_machine);
+      write_fake_process (proc, 1, 0, other_class, EM_ARM);
+      /* 10 and 11 are each other's parent, which can't happen in
+       * the real /proc */
+      write_fake_process (proc, 10, 11, other_class, known->elf_machine);
+      write_fake_process (proc, 11, 10, other_class, known->elf_machine);
+      write_fake_process (proc, 12, 12, other_class, known->elf_machine);
+
+      /* An ancestor of process 100 is running code for this
+       * architecture, so the kernel supports it */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              proc, 100),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CAN_RUN);
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              proc, 20),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CAN_RUN);
+      /* ... but that doesn't help if the runtime linker is unsuitable */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple,
+                                                              wrong_machine,
+                                                              proc, 100),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_CANNOT_RUN);
+
+      /* Process 1 and its ancestors are not running code for this
+       * architecture */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              proc, 1),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE);
+      /* Process 99 doesn't exist */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              proc, 99),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE);
+      /* Cycles are not followed forever */
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              proc, 10),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE);
+      g_assert_cmpint (_srt_architecture_get_static_evidence (tuple, good,
+                                                              proc, 12),
+                       ==, SRT_ARCHITECTURE_EVIDENCE_INCONCLUSIVE);
+    }
+}
+
 int
 main (int argc,
       char **argv)
@@ -83,6 +268,8 @@ main (int argc,
   g_test_init (&argc, &argv, NULL);
   g_test_add ("/architecture", Fixture, NULL,
               setup, test_architecture, teardown);
+  g_test_add ("/architecture/static-evidence", Fixture, NULL,
+              setup, test_static_evidence, teardown);
 
   return g_test_run ();
 }
@@ -1713,6 +1713,74 @@ test_layer_vulkan (Fixture *f,
     g_debug ("Unable to remove the temp layers directory: %s", tmp_dir);
 }
 
+static void
+test_layer_vulkan_environ (Fixture *f,
+                           gconstpointer context)
+{
+  g_auto(GStrv) envp = g_get_environ ();
+  g_autoptr(SrtSystemInfo) info = NULL;
+  g_autoptr(SrtObjectList) layers = NULL;
+  g_autofree gchar *sysroot = NULL;
+  SrtVulkanLayer *mangohud = NULL;
+  const GList *iter;
+  const char * const unset[] = { "PATH=/usr/bin", NULL };
+  const char * const enabled[] = { "MANGOHUD=1", NULL };
+  const char * const wrong_value[] = { "MANGOHUD=0", NULL };
+  const char * const disabled[] = { "MANGOHUD=1", "DISABLE_MANGOHUD=", NULL };
+  const char * const instance_layers[] =
+  {
+    "VK_INSTANCE_LAYERS=VK_LAYER_foo:VK_LAYER_MANGOHUD_overlay",
+    NULL
+  };
+  const char * const other_instance_layers[] =
+  {
+    "VK_INSTANCE_LAYERS=VK_LAYER_foo:VK_LAYER_MANGOHUD",
+    NULL
+  };
+  const char * const loader_enable[] = { "VK_LOADER_LAYERS_ENABLE=*", NULL };
+  const char * const loader_enable_disabled[] =
+  {
+    "VK_LOADER_LAYERS_ENABLE=*",
+    "DISABLE_MANGOHUD=1",
+    NULL
+  };
+  const char * const multiarchs[] = { "x86_64-mock-abi", "i386-mock-abi", NULL };
+
+  sysroot = g_build_filename (f->sysroots, "debian10", NULL);
+  envp = g_environ_setenv (envp, "SRT_TEST_SYSROOT", sysroot, TRUE);
+  envp = g_environ_setenv (envp, "VK_LAYER_PATH", "/custom_path", TRUE);
+
+  info = srt_system_info_new (NULL);
+  srt_system_info_set_environ (info, envp);
+  srt_system_info_set_sysroot (info, sysroot);
+  srt_system_info_set_multiarch_tuples (info, multiarchs);
+  srt_system_info_set_helpers_path (info, f->builddir);
+
+  /* MangoHud is really an implicit layer, but for this test it doesn't
+   * matter how we found it */
+  layers = srt_system_info_list_explicit_vulkan_layers (info);
+
+  for (iter = layers; iter != NULL; iter = iter->next)
+    {
+      if (g_strcmp0 (srt_vulkan_layer_get_name (iter->data),
+                     "VK_LAYER_MANGOHUD_overlay") == 0)
+        mangohud = iter->data;
+    }
+
+  g_assert_nonnull (mangohud);
+
+  g_assert_false (_srt_vulkan_layer_is_enabled_by_environ (mangohud, unset));
+  g_assert_true (_srt_vulkan_layer_is_enabled_by_environ (mangohud, enabled));
+  g_assert_false (_srt_vulkan_layer_is_enabled_by_environ (mangohud, wrong_value));
+  g_assert_false (_srt_vulkan_layer_is_enabled_by_environ (mangohud, disabled));
+  g_assert_true (_srt_vulkan_layer_is_enabled_by_environ (mangohud, instance_layers));
+  g_assert_false (_srt_vulkan_layer_is_enabled_by_environ (mangohud,
+                                                           other_instance_layers));
+  g_assert_true (_srt_vulkan_layer_is_enabled_by_environ (mangohud, loader_enable));
+  g_assert_false (_srt_vulkan_layer_is_enabled_by_environ (mangohud,
+                                                           loader_enable_disabled));
+}
+
 static void
 check_list_suffixes (const GList *list,
                      const gchar * const *suffixes,
@@ -2580,6 +2648,18 @@ static const GraphicsTest graphics_test[] =
     .exit_status = 1,
   },
 
+  {
+    /* There is no mock-combined-wflinfo, so this only succeeds if
+     * check-gl is used to report the renderer and version */
+    .description = "gl info from check-gl",
+    .window_system = SRT_WINDOW_SYSTEM_GLX,
+    .rendering_interface = SRT_RENDERING_INTERFACE_GL,
+    .issues = SRT_GRAPHICS_ISSUES_NONE,
+    .multiarch_tuple = "mock-combined",
+    .renderer_string = SRT_TEST_GOOD_GRAPHICS_RENDERER,
+    .version_string = SRT_TEST_GOOD_GRAPHICS_VERSION,
+  },
+
   {
     .description = "good vulkan",
     .window_system = SRT_WINDOW_SYSTEM_X11,
@@ -2666,6 +2746,18 @@ static const GraphicsTest graphics_test[] =
     .issues = SRT_GRAPHICS_ISSUES_NONE,
     .multiarch_tuple = "mock-good",
     .renderer_string = SRT_TEST_GOOD_VAAPI_RENDERER,
+    .devices =
+    {
+      {
+        .type = SRT_VK_PHYSICAL_DEVICE_TYPE_OTHER,
+        .messages = SRT_TEST_GOOD_VAAPI_MESSAGES_1,
+        .issues = SRT_GRAPHICS_ISSUES_CANNOT_DRAW,
+      },
+      {
+        .name = SRT_TEST_GOOD_VAAPI_VENDOR,
+        .type = SRT_VK_PHYSICAL_DEVICE_TYPE_OTHER,
+      },
+    },
     .vendor_neutral = TRUE,
   },
 
@@ -2787,6 +2879,56 @@ test_check_graphics (Fixture *f,
     }
 }
 
+/*
+ * With no X11 display, neither GLX nor EGL on X11 can work, even if
+ * the driver could draw into a pbuffer on the surfaceless platform,
+ * as it would with llvmpipe on a headless CI machine.
+ */
+static void
+test_check_graphics_headless (Fixture *f,
+                              gconstpointer context)
+{
+  static const SrtWindowSystem window_systems[] =
+  {
+    SRT_WINDOW_SYSTEM_GLX,
+    SRT_WINDOW_SYSTEM_EGL_X11,
+  };
+  gsize i;
+
+  for (i = 0; i < G_N_ELEMENTS (window_systems); i++)
+    {
+      g_autoptr(SrtSystemInfo) info = NULL;
+      g_autoptr(SrtGraphics) graphics = NULL;
+      g_auto(GStrv) envp = g_get_environ ();
+      SrtGraphicsIssues issues;
+
+      g_test_message ("Window system #%d", window_systems[i]);
+
+      envp = g_environ_unsetenv (envp, "DISPLAY");
+      envp = g_environ_unsetenv (envp, "WAYLAND_DISPLAY");
+      envp = g_environ_setenv (envp, "EGL_PLATFORM", "surfaceless", TRUE);
+      envp = g_environ_setenv (envp, "LIBGL_ALWAYS_SOFTWARE", "1", TRUE);
+
+      info = srt_system_info_new (NULL);
+      srt_system_info_set_environ (info, envp);
+      srt_system_info_set_helpers_path (info, f->builddir);
+
+      /* The mock check-gl only succeeds headless with
+       * --platform=surfaceless, which must not be used here, and there
+       * is no mock-combined-wflinfo to fall back to */
+      issues = srt_system_info_check_graphics (info,
+                                               "mock-combined",
+                                               window_systems[i],
+                                               SRT_RENDERING_INTERFACE_GL,
+                                               &graphics);
+      g_assert_cmpint (issues & SRT_GRAPHICS_ISSUES_CANNOT_LOAD, ==,
+                       SRT_GRAPHICS_ISSUES_CANNOT_LOAD);
+      g_assert_cmpint (issues & SRT_GRAPHICS_ISSUES_SOFTWARE_RENDERING, ==, 0);
+      g_assert_cmpstr (srt_graphics_get_renderer_string (graphics), ==, NULL);
+      g_assert_cmpstr (srt_graphics_get_version_string (graphics), ==, NULL);
+    }
+}
+
 static gint
 glx_icd_compare (SrtGlxIcd *a, SrtGlxIcd *b)
 {
@@ -2943,6 +3085,8 @@ main (int argc,
 
   g_test_add ("/graphics/layers/vulkan/xdg", Fixture, NULL,
               setup, test_layer_vulkan, teardown);
+  g_test_add ("/graphics/layers/vulkan/environ", Fixture, NULL,
+              setup, test_layer_vulkan_environ, teardown);
 
   g_test_add ("/graphics/dri/debian10", Fixture, NULL,
               setup, test_dri_debian10, teardown);
@@ -2960,6 +3104,8 @@ main (int argc,
 
   g_test_add ("/graphics/check", Fixture, NULL,
               setup, test_check_graphics, teardown);
+  g_test_add ("/graphics/check/headless", Fixture, NULL,
+              setup, test_check_graphics_headless, teardown);
 
   g_test_add ("/graphics/glx/debian", Fixture, NULL,
               setup, test_glx_debian, teardown);
@@ -0,0 +1,104 @@
+/*
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../steam-runtime-tools/graphics-test-defines.h"
+
+/*
+ * A check-gl that supports --info, so the renderer and version are
+ * reported by the same process that does the drawing test, and
+ * there is no need to run wflinfo.
+ *
+ * Like the real check-gl, --platform=glx and --platform=egl fail if
+ * there is no X11 display, and only --platform=surfaceless works
+ * headless. $LIBGL_ALWAYS_SOFTWARE selects llvmpipe, as it would with
+ * Mesa.
+ */
+int
+main (int argc,
+      char **argv)
+{
+  const char *platform = "glx";
+  const char *display = g_getenv ("DISPLAY");
+  const char *renderer = SRT_TEST_GOOD_GRAPHICS_RENDERER;
+  const char *version = SRT_TEST_GOOD_GRAPHICS_VERSION;
+  const char *waffle_platform;
+  gboolean headless;
+  gboolean info = FALSE;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      if (g_strcmp0 (argv[i], "--info") == 0)
+        info = TRUE;
+      else if (g_str_has_prefix (argv[i], "--platform="))
+        platform = argv[i] + strlen ("--platform=");
+    }
+
+  headless = (display == NULL || display[0] == '\0');
+
+  if (g_strcmp0 (platform, "glx") == 0
+      || g_strcmp0 (platform, "egl") == 0)
+    {
+      if (headless)
+        {
+          fprintf (stderr, "Unable to open display\n");
+          return 1;
+        }
+
+      if (g_strcmp0 (platform, "egl") == 0)
+        waffle_platform = "x11_egl";
+      else
+        waffle_platform = "glx";
+    }
+  else if (g_strcmp0 (platform, "surfaceless") == 0)
+    {
+      waffle_platform = "surfaceless_egl";
+    }
+  else
+    {
+      fprintf (stderr, "Unknown platform: %s\n", platform);
+      return 2;
+    }
+
+  if (g_strcmp0 (g_getenv ("LIBGL_ALWAYS_SOFTWARE"), "1") == 0)
+    {
+      renderer = SRT_TEST_SOFTWARE_GRAPHICS_RENDERER;
+      version = SRT_TEST_SOFTWARE_GRAPHICS_VERSION;
+    }
+
+  if (info)
+    printf ("{\n\t\"waffle\": {\n\t\t\"platform\": \"%s\",\n\t\t\"api\": \"gl\"\n\t},\n\t\"OpenGL\": {\n\t\t\"vendor string\": \"Intel Open Source Technology Center\",\n"
+            "\t\t\"renderer string\": \"%s\",\n"
+            "\t\t\"version string\": \"%s\",\n"
+            "\t\t\"shading language version string\": \"1.30\"\n"
+            "\t}\n}\n",
+            waffle_platform, renderer, version);
+
+  return 0;
+}
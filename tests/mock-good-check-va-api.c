@@ -29,8 +29,12 @@ int
 main (int argc,
       char **argv)
 {
-  // Give good output
-  printf ("Mesa Gallium driver 20.0.4 for AMD Radeon RX 5700 XT (NAVI10, DRM 3.36.0, 5.6.3-arch1-1, LLVM 9.0.1)\n");
+  // Give good output: the first render node doesn't work, but the
+  // second one does
+  printf ("{\"device\": \"/dev/dri/renderD128\", \"can-draw\": false, "
+          "\"error\": \"Failed with exit status 1\"}\n");
+  printf ("{\"device\": \"/dev/dri/renderD129\", \"can-draw\": true, "
+          "\"vendor\": \"Mesa Gallium driver 20.0.4 for AMD Radeon RX 5700 XT (NAVI10, DRM 3.36.0, 5.6.3-arch1-1, LLVM 9.0.1)\"}\n");
   return 0;
 }
 
@@ -38,6 +38,7 @@ export MYPYPATH="${PYTHONPATH:="$(pwd)"}"
 i=0
 for script in \
     ./pressure-vessel/*.py \
+    ./pressure-vessel/pressure-vessel-ld-profile-report \
     ./pressure-vessel/pressure-vessel-test-ui \
     ./sysroot/*.py \
     ./tests/*/*.py \
@@ -9,6 +9,8 @@ import re
 import signal
 import subprocess
 import sys
+import tempfile
+import time
 
 
 try:
@@ -243,6 +245,105 @@ class TestAdverb(BaseTest):
             proc.wait()
             self.assertEqual(proc.returncode, 0)
 
+    def test_record_mapped_files(self) -> None:
+        with tempfile.TemporaryFile() as recording:
+            fd = recording.fileno()
+            recording.write(b'previous contents that will be replaced\n')
+            recording.flush()
+
+            # Keep running for long enough to be sampled at least once,
+            # and check that the fd was not inherited
+            completed = self.run_subprocess(
+                self.adverb + [
+                    '--record-mapped-files=%d' % fd,
+                    '--',
+                    'sh', '-euc',
+                    'test ! -e /proc/$$/fd/%d; sleep 3' % fd,
+                ],
+                pass_fds=[fd],
+                stdout=2,
+                stderr=2,
+            )
+            self.assertEqual(completed.returncode, 0)
+
+            recording.seek(0)
+            lines = recording.read().decode('utf-8').splitlines()
+            logger.info('Recorded: %r', lines)
+            self.assertNotIn('previous contents that will be replaced', lines)
+            self.assertEqual(lines, sorted(set(lines)))
+
+            for line in lines:
+                self.assertTrue(line.startswith('/'))
+
+            # sh maps its own executable and the libc
+            self.assertTrue(
+                any(re.search(r'/libc[.-]', line) for line in lines)
+            )
+
+    def test_background_cleanup(self) -> None:
+        with tempfile.TemporaryDirectory() as temp:
+            tmpdir = os.path.join(temp, 'tmp')
+            bindir = os.path.join(temp, 'bin')
+            release = os.path.join(temp, 'release')
+            os.mkdir(tmpdir)
+            os.mkdir(bindir)
+
+            # Don't let the temporary files be deleted until we say so,
+            # so that we can tell whether the adverb waited for it
+            with open(os.path.join(bindir, 'rm'), 'w') as writer:
+                writer.write(
+                    '#!/bin/sh\n'
+                    'while ! [ -e "$TEST_RELEASE_CLEANUP" ]; do\n'
+                    '    sleep 0.1\n'
+                    'done\n'
+                    'exec /bin/rm "$@"\n'
+                )
+            os.chmod(os.path.join(bindir, 'rm'), 0o755)
+
+            env = dict(os.environ)
+            env['PATH'] = bindir + ':' + env.get('PATH', '/usr/bin:/bin')
+            env['TEST_RELEASE_CLEANUP'] = release
+            env['TMPDIR'] = tmpdir
+
+            # The cleanup must not hold our stdout pipe open, or this
+            # would time out
+            completed = self.run_subprocess(
+                self.adverb + [
+                    '--background-cleanup',
+                    '--',
+                    'sh', '-euc', 'echo hello',
+                ],
+                env=env,
+                stdout=subprocess.PIPE,
+                stderr=2,
+                timeout=30,
+                universal_newlines=True,
+            )
+            self.assertEqual(completed.returncode, 0)
+            self.assertEqual(completed.stdout, 'hello\n')
+
+            # The adverb exited before its temporary files were deleted
+            leftovers = os.listdir(tmpdir)
+            logger.info('Temporary files after exit: %r', leftovers)
+            self.assertTrue(
+                any(
+                    name.startswith('pressure-vessel-libs-')
+                    for name in leftovers
+                )
+            )
+
+            # ... but they are deleted eventually
+            with open(release, 'w'):
+                pass
+
+            for i in range(300):
+                if not os.listdir(tmpdir):
+                    break
+
+                time.sleep(0.1)
+
+            self.assertEqual(os.listdir(tmpdir), [])
+
     def test_wrong_options(self) -> None:
         for option in (
             '--an-unknown-option',
@@ -250,6 +351,7 @@ class TestAdverb(BaseTest):
             '--ld-preload=/nonexistent/libfoo.so:abi=i386-linux-gnu:foo',
             '--ld-preload=/nonexistent/libfoo.so:foo=bar',
             '--pass-fd=-1',
+            '--record-mapped-files=-1',
             '--shell=wrong',
             '--terminal=wrong',
         ):
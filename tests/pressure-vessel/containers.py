@@ -89,8 +89,11 @@ import glob
 import json
 import logging
 import os
+import re
+import shlex
 import shutil
 import struct
+import subprocess
 import sys
 import tempfile
 import time
@@ -149,6 +152,50 @@ FILESYSTEM_ENV_VARS = [
 ]
 
 
+LD_DEBUG_PREFIX = re.compile(r'^\s*[0-9]+:\s?')
+
+
+def count_failed_attempts(
+    lines: typing.Iterable[str],
+) -> typing.Tuple[int, int]:
+    """
+    Given the LD_DEBUG=libs output of one process, return how many
+    attempts to open a library failed, and how many libraries were
+    looked up.
+
+    An attempt failed if it is followed by another attempt or by
+    another search location. The last attempt for a library that
+    could not be found at all is not counted.
+    """
+    failed = 0
+    lookups = 0
+    pending = False     # A "trying file=" line with an unknown outcome
+
+    for line in lines:
+        message = LD_DEBUG_PREFIX.sub('', line).strip()
+
+        if message.startswith('trying file='):
+            if pending:
+                failed += 1
+
+            pending = True
+        elif (
+            message.startswith('search path=')
+            or message.startswith('search cache=')
+        ):
+            if pending:
+                failed += 1
+
+            pending = False
+        else:
+            if message.startswith('find library='):
+                lookups += 1
+
+            pending = False
+
+    return failed, lookups
+
+
 class TestContainers(BaseTest):
     bwrap = None            # type: typing.Optional[str]
     containers_dir = ''
@@ -1351,6 +1398,536 @@ class TestContainers(BaseTest):
         with self.subTest('transient'):
             self._test_soldier('soldier', soldier)
 
+    def _count_failed_library_lookups(
+        self,
+        soldier: str,
+        artifacts: str,
+        ld_so_cache_only: bool,
+        copy: bool
+    ) -> int:
+        """
+        Start a representative program in soldier, and return how many
+        times the dynamic linker tried to open a library that was not
+        there, each of which is a failed openat() call.
+        """
+        var = os.path.join(self.containers_dir, 'var')
+        os.makedirs(var, exist_ok=True)
+
+        if ld_so_cache_only:
+            mode = 'ld-so-cache-only'
+        else:
+            mode = 'no-ld-so-cache-only'
+
+        if copy:
+            copy_option = '--copy-runtime'
+        else:
+            copy_option = '--no-copy-runtime'
+
+        debug_output = os.path.join(artifacts, mode)
+
+        with tempfile.TemporaryDirectory(prefix='test-', dir=var) as temp:
+            argv = [
+                self.pv_wrap,
+                '--verbose',
+                '--filesystem', self.artifacts,
+                '--runtime', soldier,
+                '--variable-dir', temp,
+                copy_option,
+                '--no-generate-locales',
+                '--' + mode,
+                '--',
+                'env',
+                'LD_DEBUG=libs',
+                'LD_DEBUG_OUTPUT=' + debug_output,
+                'python3',
+                '-c', 'import ctypes, ssl',
+            ]
+
+            with open(
+                os.path.join(artifacts, mode + '.log'), 'w'
+            ) as writer:
+                completed = self.run_subprocess(
+                    argv,
+                    cwd=self.artifacts,
+                    stdout=writer,
+                    stderr=writer,
+                    universal_newlines=True,
+                )
+
+            self.assertEqual(completed.returncode, 0)
+
+        # LD_DEBUG_OUTPUT is suffixed with the process ID, so each file
+        # describes one process. An attempt to open a library ("trying
+        # file=") failed if the dynamic linker went on to try another
+        # file or another search location for the same lookup.
+        # A library found via ld.so.cache has a "search cache=" line
+        # followed by one successful attempt, so it is not counted.
+        failed = 0
+        lookups = 0
+
+        for member in os.listdir(artifacts):
+            if not member.startswith(mode + '.'):
+                continue
+
+            if member.endswith('.log'):
+                continue
+
+            with open(os.path.join(artifacts, member)) as reader:
+                failed_here, lookups_here = count_failed_attempts(reader)
+
+            failed += failed_here
+            lookups += lookups_here
+
+        self.assertGreater(lookups, 0)
+        logger.info('%s: %d lookups, %d failed attempts',
+                    mode, lookups, failed)
+        return failed
+
+    def test_soldier_ld_so_cache_only(self) -> None:
+        if self.bwrap is None:
+            self.skipTest('Unable to run bwrap (in a container?)')
+
+        soldier = os.path.join(self.containers_dir, 'soldier')
+
+        if not os.path.isdir(soldier):
+            self.skipTest('{} not found'.format(soldier))
+
+        for copy in (True, False):
+            with self.subTest(copy=copy):
+                if copy:
+                    name = 'ld-so-cache-only-copy'
+                else:
+                    name = 'ld-so-cache-only-no-copy'
+
+                artifacts = os.path.join(self.artifacts, name)
+                os.makedirs(artifacts, exist_ok=True)
+
+                with_ldlp = self._count_failed_library_lookups(
+                    soldier, artifacts, ld_so_cache_only=False, copy=copy,
+                )
+                cache_only = self._count_failed_library_lookups(
+                    soldier, artifacts, ld_so_cache_only=True, copy=copy,
+                )
+                self.assertGreater(with_ldlp, 0)
+
+                if copy:
+                    # With a mutable sysroot, the graphics provider's
+                    # libraries are never added to LD_LIBRARY_PATH, so
+                    # the only difference is that empty aliases
+                    # directories are left out
+                    self.assertLessEqual(cache_only, with_ldlp)
+                else:
+                    self.assertLess(cache_only, with_ldlp)
+
+    def _get_bwrap_args(self, log: str) -> typing.List[str]:
+        """
+        Return the bwrap arguments that pv-wrap logged in verbose mode,
+        before they were bundled into a file descriptor.
+        """
+        bwrap_args = []     # type: typing.List[str]
+        in_bwrap_args = False
+
+        with open(log) as reader:
+            for line in reader:
+                if line.rstrip('\n').endswith(' options before bundling:'):
+                    in_bwrap_args = True
+                    continue
+
+                if in_bwrap_args:
+                    match = re.search(r': D: \t(.*)$', line)
+
+                    if match is None:
+                        break
+
+                    bwrap_args.extend(shlex.split(match.group(1)))
+
+        return bwrap_args
+
+    def _collect_graphics_stack(
+        self,
+        soldier: str,
+        artifacts: str,
+        name: str,
+        extra_args: typing.List[str]
+    ) -> typing.Tuple[typing.List[str], typing.List[str]]:
+        """
+        Run a command in soldier with the host system as graphics
+        provider, and return the bwrap arguments and the environment
+        that the command saw. Anything that is expected to differ
+        between runs, such as temporary directory names and file
+        descriptor numbers, is replaced with a placeholder.
+        """
+        var = os.path.join(self.containers_dir, 'var')
+        os.makedirs(var, exist_ok=True)
+        log = os.path.join(artifacts, name + '.log')
+
+        with tempfile.TemporaryDirectory(prefix='test-', dir=var) as temp:
+            env = dict(os.environ)
+            env['TMPDIR'] = temp
+            argv = [
+                self.pv_wrap,
+                '--verbose',
+                '--filesystem', self.artifacts,
+                '--runtime', soldier,
+                '--graphics-provider', '/',
+                '--no-generate-locales',
+            ] + extra_args + [
+                '--',
+                'env', '-0',
+            ]
+
+            with open(log, 'w') as writer:
+                completed = self.run_subprocess(
+                    argv,
+                    cwd=self.artifacts,
+                    env=env,
+                    stdout=subprocess.PIPE,
+                    stderr=writer,
+                )
+
+            self.assertEqual(completed.returncode, 0)
+
+            def normalize(s: str) -> str:
+                s = s.replace(temp, '${TMPDIR}')
+                return re.sub(
+                    r'pressure-vessel-wrap\.[^/]+',
+                    'pressure-vessel-wrap.XXXXXX',
+                    s,
+                )
+
+            environ = sorted(
+                normalize(item)
+                for item in completed.stdout.decode('utf-8').split('\0')
+                if item
+            )
+            bwrap_args = []     # type: typing.List[str]
+            replace_next = False
+
+            for arg in self._get_bwrap_args(log):
+                if replace_next:
+                    bwrap_args.append('${FD}')
+                    replace_next = False
+                    continue
+
+                bwrap_args.append(normalize(arg))
+                replace_next = arg in (
+                    '--args', '--bind-data', '--block-fd', '--file',
+                    '--info-fd', '--ro-bind-data', '--seccomp', '--sync-fd',
+                    '--userns-block-fd',
+                )
+
+        with open(os.path.join(artifacts, name + '.txt'), 'w') as writer:
+            for arg in bwrap_args:
+                writer.write(arg + '\n')
+
+            writer.write('\n')
+
+            for item in environ:
+                writer.write(item + '\n')
+
+        return bwrap_args, environ
+
+    def test_soldier_single_thread(self) -> None:
+        """
+        Collecting the graphics stack in parallel must give the same
+        container as collecting it in the main thread.
+        """
+        if self.bwrap is None:
+            self.skipTest('Unable to run bwrap (in a container?)')
+
+        soldier = os.path.join(self.containers_dir, 'soldier')
+
+        if not os.path.isdir(soldier):
+            self.skipTest('{} not found'.format(soldier))
+
+        artifacts = os.path.join(self.artifacts, 'single-thread')
+        os.makedirs(artifacts, exist_ok=True)
+
+        parallel_args, parallel_env = self._collect_graphics_stack(
+            soldier, artifacts, 'parallel', [],
+        )
+        single_args, single_env = self._collect_graphics_stack(
+            soldier, artifacts, 'single-thread', ['--single-thread'],
+        )
+
+        self.assertGreater(len(parallel_args), 0)
+        self.assertEqual(parallel_args, single_args)
+        self.assertEqual(parallel_env, single_env)
+
+    def _list_captured(self, dest: str) -> typing.Dict[str, str]:
+        """
+        Return a map from paths relative to dest to the targets of the
+        symbolic links that capsule-capture-libs created there.
+        """
+        ret = {}    # type: typing.Dict[str, str]
+
+        for dirpath, dirnames, filenames in os.walk(dest):
+            for name in dirnames + filenames:
+                path = os.path.join(dirpath, name)
+
+                if os.path.islink(path):
+                    ret[os.path.relpath(path, dest)] = os.readlink(path)
+
+        return ret
+
+    def test_soldier_container_access(self) -> None:
+        """
+        capsule-capture-libs must resolve the same libraries in the
+        tree of symlinks that pv-wrap uses to look at a runtime that
+        is just /usr, as it did when the runtime was bind-mounted
+        into place with bwrap.
+        """
+        if self.bwrap is None:
+            self.skipTest('Unable to run bwrap (in a container?)')
+
+        helper = os.path.join(self.G_TEST_BUILDDIR, 'test-helper')
+
+        if not os.path.exists(helper):
+            self.skipTest('{} not found'.format(helper))
+
+        usr = os.path.join(self.containers_dir, 'soldier')
+
+        if os.path.isdir(os.path.join(usr, 'files')):
+            usr = os.path.join(usr, 'files')
+
+        if not os.path.isdir(os.path.join(usr, 'lib')):
+            self.skipTest('{} is not a merged /usr'.format(usr))
+
+        tool = os.path.join(
+            self.pv_dir, 'libexec', 'steam-runtime-tools-0',
+            'x86_64-linux-gnu-capsule-capture-libs',
+        )
+
+        if not os.path.exists(tool):
+            self.skipTest('{} not found'.format(tool))
+
+        artifacts = os.path.join(self.artifacts, 'container-access')
+        os.makedirs(artifacts, exist_ok=True)
+        members = sorted(
+            member for member in os.listdir(usr)
+            if (member.startswith('lib') and member != 'libexec')
+            or member in ('bin', 'sbin', '.ref')
+        )
+        # Paths in the container that capsule-capture-libs reads
+        paths = ['usr', 'etc/ld.so.cache'] + members
+        patterns = [
+            'if-exists:soname:libc.so.6',
+            'if-exists:soname:libgcc_s.so.1',
+            'if-exists:soname:libstdc++.so.6',
+            'if-exists:soname:libz.so.1',
+            'if-exists:even-if-older:soname-match:libGL.so.*',
+            'if-exists:soname-match:libvulkan.so.*',
+        ]
+        stat_script = (
+            'for p in "$@"; do '
+            'stat -L -c "%n %d %i" "$p" 2>/dev/null || echo "$p missing"; '
+            'done'
+        )
+
+        with tempfile.TemporaryDirectory(
+            prefix='test-', dir=self.tmpdir.name,
+        ) as temp:
+            symlink_view = os.path.join(temp, 'mnt')
+            bind_view = os.path.join(temp, 'bind')
+            symlink_dest = os.path.join(temp, 'symlink-dest')
+            bind_dest = os.path.join(temp, 'bind-dest')
+
+            for d in (bind_view, symlink_dest, bind_dest):
+                os.makedirs(d)
+
+            self.run_subprocess(
+                [helper, 'symlink-usr-into-sysroot', usr, symlink_view],
+                check=True,
+                stdout=2,
+                stderr=2,
+            )
+
+            # This is what pv-wrap used to do
+            bwrap = [
+                self.bwrap,
+                '--ro-bind', '/', '/',
+                '--bind', bind_dest, bind_dest,
+                '--tmpfs', bind_view,
+                '--ro-bind', usr, os.path.join(bind_view, 'usr'),
+            ]
+
+            for member in members:
+                bwrap.extend([
+                    '--symlink', os.path.join('usr', member),
+                    os.path.join(bind_view, member),
+                ])
+
+            bwrap.extend([
+                '--ro-bind', os.path.join(usr, 'etc'),
+                os.path.join(bind_view, 'etc'),
+            ])
+
+            symlink_stat = self.run_subprocess(
+                ['sh', '-c', stat_script, 'sh'] + paths,
+                check=True,
+                cwd=symlink_view,
+                stdout=subprocess.PIPE,
+                stderr=2,
+                universal_newlines=True,
+            ).stdout
+            bind_stat = self.run_subprocess(
+                bwrap + [
+                    '--chdir', bind_view,
+                    'sh', '-c', stat_script, 'sh',
+                ] + paths,
+                check=True,
+                stdout=subprocess.PIPE,
+                stderr=2,
+                universal_newlines=True,
+            ).stdout
+
+            with open(os.path.join(artifacts, 'stat.txt'), 'w') as writer:
+                writer.write(symlink_stat)
+                writer.write('\n')
+                writer.write(bind_stat)
+
+            self.assertEqual(symlink_stat, bind_stat)
+
+            def capture(view: str, dest: str) -> typing.List[str]:
+                return [
+                    tool,
+                    '--container', view,
+                    '--remap-link-prefix', '/usr/=/run/host/usr/',
+                    '--remap-link-prefix', '/lib=/run/host/lib',
+                    '--provider', '/',
+                    '--dest', dest,
+                ] + patterns
+
+            self.run_subprocess(
+                capture(symlink_view, symlink_dest),
+                check=True,
+                stdout=2,
+                stderr=2,
+            )
+            self.run_subprocess(
+                bwrap + capture(bind_view, bind_dest),
+                check=True,
+                stdout=2,
+                stderr=2,
+            )
+
+            symlink_captured = self._list_captured(symlink_dest)
+            bind_captured = self._list_captured(bind_dest)
+
+        with open(
+            os.path.join(artifacts, 'captured.json'), 'w',
+        ) as writer:
+            json.dump(
+                {'symlinks': symlink_captured, 'bind': bind_captured},
+                writer,
+                indent=4,
+                sort_keys=True,
+            )
+
+        self.assertEqual(symlink_captured, bind_captured)
+
+    def test_soldier_overrides_lifetime(self) -> None:
+        """
+        Without a mutable sysroot, the overrides are bind-mounted from
+        a temporary directory, which must stay there until the container
+        exits and must be deleted afterwards.
+        """
+        if self.bwrap is None:
+            self.skipTest('Unable to run bwrap (in a container?)')
+
+        soldier = os.path.join(self.containers_dir, 'soldier')
+
+        if not os.path.isdir(soldier):
+            self.skipTest('{} not found'.format(soldier))
+
+        artifacts = os.path.join(self.artifacts, 'overrides-lifetime')
+        os.makedirs(artifacts, exist_ok=True)
+        var = os.path.join(self.containers_dir, 'var')
+        os.makedirs(var, exist_ok=True)
+
+        with tempfile.TemporaryDirectory(prefix='test-', dir=var) as temp:
+            env = dict(os.environ)
+            env['TMPDIR'] = temp
+            argv = [
+                self.pv_wrap,
+                '--verbose',
+                '--filesystem', self.artifacts,
+                '--runtime', soldier,
+                '--no-generate-locales',
+                '--',
+                'sh', '-c', 'test -d /overrides/lib; echo "ready $?"; read x',
+            ]
+            logger.info('Running: %r', argv)
+
+            with open(os.path.join(artifacts, 'log'), 'w') as writer:
+                proc = subprocess.Popen(
+                    argv,
+                    cwd=self.artifacts,
+                    env=env,
+                    stdin=subprocess.PIPE,
+                    stdout=subprocess.PIPE,
+                    stderr=writer,
+                    universal_newlines=True,
+                )
+
+                try:
+                    line = proc.stdout.readline()
+                    self.assertEqual(line, 'ready 0\n')
+
+                    # pv-wrap has exec'd bwrap, so it has already done
+                    # its cleanup, but the container is still running
+                    tmpdirs = glob.glob(
+                        os.path.join(temp, 'pressure-vessel-wrap.*'),
+                    )
+                    self.assertEqual(len(tmpdirs), 1)
+                    self.assertTrue(
+                        os.path.isdir(os.path.join(tmpdirs[0], 'overrides')),
+                    )
+                finally:
+                    proc.stdin.close()
+                    proc.stdout.close()
+                    proc.wait()
+
+            self.assertEqual(proc.returncode, 0)
+
+            # The temporary directory is deleted asynchronously after
+            # the container exits
+            for i in range(300):
+                if not os.path.exists(tmpdirs[0]):
+                    break
+
+                time.sleep(0.1)
+
+            self.assertFalse(os.path.exists(tmpdirs[0]))
+
+        # The overrides are mounted into the container as a single tree,
+        # so the number of bwrap arguments does not depend on how many
+        # files the graphics stack has
+        overrides_args = []   # type: typing.List[typing.List[str]]
+        bwrap_args = self._get_bwrap_args(os.path.join(artifacts, 'log'))
+        self.assertIn('--sync-fd', bwrap_args)
+
+        for i, arg in enumerate(bwrap_args):
+            if arg == '--dir':
+                dest = bwrap_args[i + 1]
+            elif arg in (
+                '--bind', '--file', '--ro-bind', '--ro-bind-data',
+                '--symlink',
+            ):
+                dest = bwrap_args[i + 2]
+            else:
+                continue
+
+            if dest == '/overrides' or dest.startswith('/overrides/'):
+                overrides_args.append(bwrap_args[i:i + 3])
+
+        self.assertEqual(len(overrides_args), 1)
+        self.assertEqual(overrides_args[0][0], '--ro-bind')
+        self.assertEqual(overrides_args[0][2], '/overrides')
+        self.assertEqual(
+            os.path.basename(overrides_args[0][1]), 'overrides',
+        )
+
     def test_no_runtime(self) -> None:
         if self.bwrap is None:
             self.skipTest('Unable to run bwrap (in a container?)')
@@ -55,6 +55,16 @@ try_divert_stdout (void)
   fflush (original_stdout);
 }
 
+static void
+try_symlink_usr_into_sysroot (const char *usr,
+                              const char *sysroot)
+{
+  g_autoptr(GError) error = NULL;
+
+  pv_symlink_usr_into_sysroot (usr, sysroot, &error);
+  g_assert_no_error (error);
+}
+
 int
 main (int argc,
       char **argv)
@@ -66,6 +76,13 @@ main (int argc,
     {
       try_divert_stdout ();
     }
+  else if (g_strcmp0 (argv[1], "symlink-usr-into-sysroot") == 0)
+    {
+      if (argc != 4)
+        g_error ("Usage: %s symlink-usr-into-sysroot USR SYSROOT", argv[0]);
+
+      try_symlink_usr_into_sysroot (argv[2], argv[3]);
+    }
   else
     {
       g_error ("Unknown argv[1]: %s", argv[1]);
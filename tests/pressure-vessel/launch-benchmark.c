@@ -0,0 +1,296 @@
+/*
+ * Compare the cost of starting short-lived commands via
+ * pressure-vessel-launcher's D-Bus interface and via its fast channel.
+ *
+ * Copyright © 2026 Collabora Ltd.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+
+#include "steam-runtime-tools/glib-backports-internal.h"
+#include "steam-runtime-tools/utils-internal.h"
+#include "libglnx/libglnx.h"
+
+#include "launch-channel.h"
+#include "launcher.h"
+
+typedef GUnixFDList AutoUnixFDList;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(AutoUnixFDList, g_object_unref)
+
+static gint opt_iterations = 200;
+
+static const GOptionEntry options[] =
+{
+  { "iterations", '\0',
+    G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_iterations,
+    "Start this many commands with each transport [default: 200]",
+    "N" },
+  { NULL }
+};
+
+static const char * const command[] = { "true", NULL };
+
+static void
+process_exited_cb (G_GNUC_UNUSED GDBusConnection *connection,
+                   G_GNUC_UNUSED const gchar *sender_name,
+                   G_GNUC_UNUSED const gchar *object_path,
+                   G_GNUC_UNUSED const gchar *interface_name,
+                   G_GNUC_UNUSED const gchar *signal_name,
+                   GVariant *parameters,
+                   gpointer user_data)
+{
+  guint32 *exited_pid = user_data;
+  guint32 wait_status;
+
+  g_variant_get (parameters, "(uu)", exited_pid, &wait_status);
+}
+
+static gint64
+run_via_dbus (GDBusConnection *connection)
+{
+  guint32 exited_pid = 0;
+  gint64 start;
+  guint subscription;
+  gint i;
+
+  subscription = g_dbus_connection_signal_subscribe (connection,
+                                                     NULL,
+                                                     LAUNCHER_IFACE,
+                                                     "ProcessExited",
+                                                     LAUNCHER_PATH,
+                                                     NULL,
+                                                     G_DBUS_SIGNAL_FLAGS_NONE,
+                                                     process_exited_cb,
+                                                     &exited_pid, NULL);
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < opt_iterations; i++)
+    {
+      g_autoptr(GError) error = NULL;
+      g_autoptr(GVariant) reply = NULL;
+      GVariantBuilder fds;
+      GVariantBuilder env;
+      GVariantBuilder opts;
+      guint32 pid;
+
+      g_variant_builder_init (&fds, G_VARIANT_TYPE ("a{uh}"));
+      g_variant_builder_init (&env, G_VARIANT_TYPE ("a{ss}"));
+      g_variant_builder_init (&opts, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&env, "{ss}", "PV_BENCHMARK", "1");
+
+      reply = g_dbus_connection_call_with_unix_fd_list_sync (connection,
+                                                             NULL,
+                                                             LAUNCHER_PATH,
+                                                             LAUNCHER_IFACE,
+                                                             "Launch",
+                                                             g_variant_new ("(^ay^aaya{uh}a{ss}ua{sv})",
+                                                                            "",
+                                                                            command,
+                                                                            &fds,
+                                                                            &env,
+                                                                            0,
+                                                                            &opts),
+                                                             G_VARIANT_TYPE ("(u)"),
+                                                             G_DBUS_CALL_FLAGS_NONE,
+                                                             -1,
+                                                             NULL,
+                                                             NULL,
+                                                             NULL,
+                                                             &error);
+      g_assert_no_error (error);
+      g_variant_get (reply, "(u)", &pid);
+
+      while (exited_pid != pid)
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_dbus_connection_signal_unsubscribe (connection, subscription);
+  return g_get_monotonic_time () - start;
+}
+
+static gint64
+run_via_fast_channel (GDBusConnection *connection)
+{
+  g_autoptr(AutoUnixFDList) fd_list = NULL;
+  g_autoptr(PvLaunchChannelFrame) frame = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+  glnx_autofd int fd = -1;
+  gint64 start;
+  gint i;
+  int sv[2];
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv),
+                   ==, 0);
+  fd = sv[0];
+  fd_list = g_unix_fd_list_new_from_array (&sv[1], 1);
+  reply = g_dbus_connection_call_with_unix_fd_list_sync (connection,
+                                                         NULL,
+                                                         LAUNCHER_PATH,
+                                                         LAUNCHER_IFACE,
+                                                         "OpenFastChannel",
+                                                         g_variant_new ("(h)", 0),
+                                                         G_VARIANT_TYPE ("(u)"),
+                                                         G_DBUS_CALL_FLAGS_NONE,
+                                                         -1,
+                                                         fd_list,
+                                                         NULL,
+                                                         NULL,
+                                                         &error);
+  g_assert_no_error (error);
+
+  /* The environment is registered once and reused by each command */
+  frame = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_SET_ENV);
+  pv_launch_channel_frame_add_uint32 (frame, 1);
+  pv_launch_channel_frame_add_string (frame, "PV_BENCHMARK=1");
+  pv_launch_channel_send (fd, frame, &error);
+  g_assert_no_error (error);
+  g_clear_pointer (&frame, pv_launch_channel_frame_free);
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < opt_iterations; i++)
+    {
+      g_autoptr(PvLaunchChannelFrame) started = NULL;
+      g_autoptr(PvLaunchChannelFrame) exited = NULL;
+      guint32 pid;
+      guint32 exited_pid;
+
+      frame = pv_launch_channel_frame_new (PV_LAUNCH_CHANNEL_FRAME_LAUNCH);
+      pv_launch_channel_frame_add_uint32 (frame, 1);   /* environment */
+      pv_launch_channel_frame_add_uint32 (frame, 0);   /* flags */
+      pv_launch_channel_frame_add_uint32 (frame, 0);   /* terminate-after */
+      pv_launch_channel_frame_add_uint32 (frame, 0);   /* fds */
+      pv_launch_channel_frame_add_uint32 (frame, 1);   /* argc */
+      pv_launch_channel_frame_add_string (frame, "");
+      pv_launch_channel_frame_add_string (frame, command[0]);
+      pv_launch_channel_send (fd, frame, &error);
+      g_assert_no_error (error);
+      g_clear_pointer (&frame, pv_launch_channel_frame_free);
+
+      started = pv_launch_channel_receive (fd, &error);
+      g_assert_no_error (error);
+      g_assert_cmpuint (started->type, ==, PV_LAUNCH_CHANNEL_FRAME_STARTED);
+      pv_launch_channel_frame_get_uint32 (started, &pid, &error);
+      g_assert_no_error (error);
+
+      exited = pv_launch_channel_receive (fd, &error);
+      g_assert_no_error (error);
+      g_assert_cmpuint (exited->type, ==, PV_LAUNCH_CHANNEL_FRAME_EXITED);
+      pv_launch_channel_frame_get_uint32 (exited, &exited_pid, &error);
+      g_assert_no_error (error);
+      g_assert_cmpuint (exited_pid, ==, pid);
+    }
+
+  return g_get_monotonic_time () - start;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GDBusConnection) connection = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *socket_path = NULL;
+  g_autofree gchar *address = NULL;
+  g_autofree gchar *escaped = NULL;
+  g_autofree gchar *info = NULL;
+  const char *launcher_argv[] = { NULL, "--socket", NULL, NULL };
+  gint64 dbus_time;
+  gint64 fast_time;
+  GPid launcher_pid;
+  int stdout_fd;
+  int wait_status;
+
+  context = g_option_context_new ("LAUNCHER");
+  g_option_context_set_summary (context,
+                                "Benchmark pressure-vessel-launcher transports.");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("%s", error->message);
+
+  if (argc != 2 || opt_iterations <= 0)
+    g_error ("Usage: %s [--iterations=N] PRESSURE_VESSEL_LAUNCHER",
+             g_get_prgname ());
+
+  tmpdir = g_dir_make_tmp ("pv-launch-benchmark-XXXXXX", &error);
+  g_assert_no_error (error);
+  socket_path = g_build_filename (tmpdir, "socket", NULL);
+  launcher_argv[0] = argv[1];
+  launcher_argv[2] = socket_path;
+
+  g_spawn_async_with_pipes (NULL, (gchar **) launcher_argv, NULL,
+                            G_SPAWN_DO_NOT_REAP_CHILD,
+                            NULL, NULL, &launcher_pid,
+                            NULL, &stdout_fd, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The launcher closes its stdout when it is ready */
+  info = glnx_fd_readall_utf8 (stdout_fd, NULL, NULL, &error);
+  g_assert_no_error (error);
+  close (stdout_fd);
+
+  escaped = g_dbus_address_escape_value (socket_path);
+  address = g_strdup_printf ("unix:path=%s", escaped);
+  connection = g_dbus_connection_new_for_address_sync (address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                       NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  dbus_time = run_via_dbus (connection);
+  fast_time = run_via_fast_channel (connection);
+
+  g_print ("D-Bus: %d commands in %.3f ms (%.3f ms each)\n",
+           opt_iterations, dbus_time / 1000.0,
+           dbus_time / 1000.0 / opt_iterations);
+  g_print ("Fast channel: %d commands in %.3f ms (%.3f ms each)\n",
+           opt_iterations, fast_time / 1000.0,
+           fast_time / 1000.0 / opt_iterations);
+
+  reply = g_dbus_connection_call_sync (connection,
+                                       NULL,
+                                       LAUNCHER_PATH,
+                                       LAUNCHER_IFACE,
+                                       "Terminate",
+                                       NULL,
+                                       G_VARIANT_TYPE ("()"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpint (waitpid (launcher_pid, &wait_status, 0), ==, launcher_pid);
+  g_rmdir (tmpdir);
+  return 0;
+}
@@ -124,6 +124,48 @@ class TestLauncher(BaseTest):
                 )
                 self.assertEqual(completed.stdout, b'hello')
 
+                completed = run_subprocess(
+                    self.launch + [
+                        '--fast-channel',
+                        '--socket', socket,
+                        '--',
+                        'printf', 'hello',
+                    ],
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    stderr=2,
+                )
+                self.assertEqual(completed.stdout, b'hello')
+
+                completed = run_subprocess(
+                    self.launch + [
+                        '--env=PV_TEST_VAR=fast',
+                        '--fast-channel',
+                        '--socket', socket,
+                        '--',
+                        'sh', '-euc', 'printf \'%s\' "$PV_TEST_VAR"',
+                    ],
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    stderr=2,
+                )
+                self.assertEqual(completed.stdout, b'fast')
+
+                completed = run_subprocess(
+                    self.launch + [
+                        '--fast-channel',
+                        '--unset-env=PV_TEST_VAR',
+                        '--socket', socket,
+                        '--',
+                        'sh', '-euc',
+                        'printf \'%s\' "${PV_TEST_VAR-cleared}"; exit 42',
+                    ],
+                    stdout=subprocess.PIPE,
+                    stderr=2,
+                )
+                self.assertEqual(completed.returncode, 42)
+                self.assertEqual(completed.stdout, b'cleared')
+
                 completed = run_subprocess(
                     self.launch + [
                         '--dbus-address', dbus_address,
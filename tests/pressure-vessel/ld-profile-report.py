@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+# Copyright © 2026 Collabora Ltd.
+#
+# SPDX-License-Identifier: MIT
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+
+try:
+    import typing
+    typing      # placate pyflakes
+except ImportError:
+    pass
+
+from testutils import (
+    BaseTest,
+    test_main,
+)
+
+
+TRACE = '''\
+V\t1
+P\t1234\t1\t/home/me/game/bin/game
+O\t10\t0\t/lib64/ld-linux-x86-64.so.2
+A\t20
+O\t21\t0\t/home/me/game/bin/game
+Q\t100\tlibGL.so.1
+C\t110\tlibpath\t/home/me/game/lib/libGL.so.1
+C\t120\tlibpath\t/overrides/lib/x86_64-linux-gnu/libGL.so.1
+O\t2100\t0\t/overrides/lib/x86_64-linux-gnu/libGL.so.1
+Q\t2200\tlibc.so.6
+C\t2210\tconfig\t/lib/x86_64-linux-gnu/libc.so.6
+O\t2300\t0\t/lib/x86_64-linux-gnu/libc.so.6
+Z\t3000
+Q\t5000\tlibfoo.so
+C\t5010\tlibpath\t/home/me/game/lib/libfoo.so
+C\t5020\tlibpath\t/overrides/lib/x86_64-linux-gnu/libfoo.so
+C\t5030\tconfig\t/usr/lib/libfoo.so
+C\t9000\tdefault\t/lib/libfoo.so
+Q\t10000\t/home/me/game/lib/plugin.so
+A\t10100
+O\t10200\t0\t/home/me/game/lib/plugin.so
+Q\t10300\tlibcurl.so.3
+C\t10310\tlibpath\t/home/me/game/lib/libcurl.so.3
+C\t10320\tlibpath\t/overrides/lib/x86_64-linux-gnu/aliases/libcurl.so.3
+O\t10500\t0\t/overrides/lib/x86_64-linux-gnu/aliases/libcurl.so.3
+Z\t12000
+'''
+
+
+class TestLdProfileReport(BaseTest):
+    def setUp(self) -> None:
+        super().setUp()
+        self.report = os.path.join(
+            self.top_srcdir,
+            'pressure-vessel',
+            'pressure-vessel-ld-profile-report',
+        )
+
+    def test_report(self) -> None:
+        with tempfile.TemporaryDirectory(
+            prefix='test-ld-profile-',
+        ) as tmpdir:
+            with open(
+                os.path.join(tmpdir, 'ld-profile.1234.txt'), 'w',
+            ) as writer:
+                writer.write(TRACE)
+
+            # Files in the directory that are not traces are ignored
+            with open(os.path.join(tmpdir, 'README'), 'w') as writer:
+                writer.write('hello\n')
+
+            completed = subprocess.run(
+                [sys.executable, self.report, tmpdir],
+                check=True,
+                stdout=subprocess.PIPE,
+                universal_newlines=True,
+            )
+
+        lines = completed.stdout.splitlines()
+
+        for line in lines:
+            print('# ' + line)
+
+        self.assertEqual(lines[0], 'Processes: 1')
+        self.assertEqual(
+            lines[1],
+            'Time adding objects: 2.980 ms at startup, '
+            '2.000 ms in 1 dlopen() calls',
+        )
+        self.assertEqual(
+            lines[2],
+            'Library searches: 5 (1 unresolved), 9 paths probed',
+        )
+
+        def table(title):
+            # type: (str) -> typing.List[typing.List[str]]
+            start = lines.index(title + ':') + 2
+            rows = []
+
+            for line in lines[start:]:
+                if not line.startswith('  '):
+                    break
+
+                rows.append(line.split())
+
+            return rows
+
+        layers = {row[-1]: row[:-1] for row in table('Libraries by layer')}
+        self.assertEqual(layers['overrides'], ['1', '2.000', '2'])
+        self.assertEqual(layers['aliases'], ['1', '0.200', '2'])
+        self.assertEqual(layers['runtime'], ['1', '0.100', '1'])
+        self.assertEqual(layers['other'], ['1', '0.200', '0'])
+
+        slowest = table('Slowest searches')
+        self.assertEqual(
+            slowest[0][:5],
+            ['4.000', '4', '-', '-', 'libfoo.so'],
+        )
+        self.assertEqual(
+            slowest[1][:5],
+            ['2.000', '2', 'overrides', 'libpath', 'libGL.so.1'],
+        )
+
+        self.assertEqual(
+            table('Unresolved searches'),
+            [['1', '4', '4.000', 'libfoo.so']],
+        )
+
+        dlopens = table('Slowest dlopen() calls')
+        self.assertEqual(len(dlopens), 1)
+        self.assertEqual(
+            dlopens[0][:3],
+            ['2.000', '2', '/home/me/game/lib/plugin.so'],
+        )
+
+    def test_no_traces(self) -> None:
+        with tempfile.TemporaryDirectory(
+            prefix='test-ld-profile-',
+        ) as tmpdir:
+            completed = subprocess.run(
+                [sys.executable, self.report, tmpdir],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+        self.assertEqual(completed.returncode, 1)
+
+    def test_audit_module(self) -> None:
+        """
+        Trace a real program with the LD_AUDIT module, and check that
+        the report script can parse the result.
+        """
+        module = os.path.join(
+            self.top_builddir, 'helpers', 'libpv-ld-profiler.so',
+        )
+
+        if not os.path.exists(module):
+            self.skipTest('{} not found'.format(module))
+
+        program = shutil.which('true')
+
+        if program is None:
+            self.skipTest('true(1) not found')
+
+        with tempfile.TemporaryDirectory(
+            prefix='test-ld-profile-',
+        ) as tmpdir:
+            trace_dir = os.path.join(tmpdir, 'traces')
+            empty_dir = os.path.join(tmpdir, 'empty')
+            os.mkdir(trace_dir)
+            os.mkdir(empty_dir)
+
+            env = dict(os.environ)
+            env['LD_AUDIT'] = module
+            # Searching an empty directory first gives us some
+            # unsuccessful attempts to report
+            env['LD_LIBRARY_PATH'] = empty_dir
+            env['PRESSURE_VESSEL_LD_PROFILE_DIR'] = trace_dir
+            subprocess.run(
+                [program],
+                check=True,
+                env=env,
+            )
+
+            traces = [
+                name for name in os.listdir(trace_dir)
+                if name.startswith('ld-profile.')
+            ]
+            self.assertEqual(len(traces), 1)
+
+            with open(os.path.join(trace_dir, traces[0])) as reader:
+                trace = reader.read()
+
+            for line in trace.splitlines():
+                print('# ' + line)
+
+            lines = [line.split('\t') for line in trace.splitlines()]
+            self.assertEqual(lines[0], ['V', '1'])
+            self.assertEqual(lines[1][0], 'P')
+            self.assertEqual(lines[1][1], traces[0].split('.')[1])
+            self.assertEqual(
+                os.path.realpath(lines[1][3]), os.path.realpath(program),
+            )
+
+            events = set(line[0] for line in lines)
+
+            for event in ('A', 'Q', 'C', 'O', 'Z'):
+                self.assertIn(event, events)
+
+            self.assertIn(
+                ['libpath', os.path.join(empty_dir, 'libc.so.6')],
+                [line[2:] for line in lines if line[0] == 'C'],
+            )
+
+            completed = subprocess.run(
+                [sys.executable, self.report, trace_dir],
+                check=True,
+                stdout=subprocess.PIPE,
+                universal_newlines=True,
+            )
+
+        lines = completed.stdout.splitlines()
+
+        for line in lines:
+            print('# ' + line)
+
+        self.assertEqual(lines[0], 'Processes: 1')
+        self.assertTrue(lines[2].startswith('Library searches: '))
+
+
+if __name__ == '__main__':
+    assert sys.version_info >= (3, 5), \
+        'Python 3.5+ is required (configure with -Dpython=python3.5 ' \
+        'if necessary)'
+
+    test_main()
+
+# vi: set sw=4 sts=4 et:
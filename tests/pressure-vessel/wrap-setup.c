@@ -24,10 +24,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
 
 #include "steam-runtime-tools/glib-backports-internal.h"
 #include "steam-runtime-tools/utils-internal.h"
@@ -35,6 +38,8 @@
 
 #include "tests/test-utils.h"
 
+#include "flatpak-run-private.h"
+#include "flatpak-systemd-dbus-generated.h"
 #include "supported-architectures.h"
 #include "wrap-setup.h"
 #include "utils.h"
@@ -282,6 +287,148 @@ populate_ld_preload (Fixture *f,
   g_test_message ("argv->len: %" G_GSIZE_FORMAT, i);
 }
 
+static void
+test_exports_nested (Fixture *f,
+                     gconstpointer context)
+{
+  g_autoptr(FlatpakExports) exports = fixture_create_exports (f);
+  g_autoptr(FlatpakBwrap) bwrap = flatpak_bwrap_new (flatpak_bwrap_empty_env);
+  GPtrArray *argv;
+  gsize i;
+
+  flatpak_exports_add_path_tmpfs (exports, "/future");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_WRITE,
+                                   "/future/libs-post2038");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_WRITE,
+                                   "/home/me");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_WRITE,
+                                   "/home");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_ONLY,
+                                   "/opt");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_WRITE,
+                                   "/opt/lib");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_ONLY,
+                                   "/steam/lib");
+  flatpak_exports_add_path_expose (exports, FLATPAK_FILESYSTEM_MODE_READ_ONLY,
+                                   "/steam");
+
+  flatpak_exports_append_bwrap_args (exports, bwrap);
+  pv_wrap_prune_exports (bwrap);
+  argv = bwrap->argv;
+
+  for (i = 0; i < argv->len; i++)
+    g_test_message ("argv[%" G_GSIZE_FORMAT "]: %s",
+                    i, (const char *) g_ptr_array_index (argv, i));
+
+  i = 0;
+
+  /* A tmpfs hides the parent, so the child needs its own mount */
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--dir");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/future");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/future/libs-post2038");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/future/libs-post2038");
+
+  /* /home/me is already visible via /home with the same mode */
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/home");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/home");
+
+  /* /opt/lib is writable but /opt is not, so we need both */
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--ro-bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/opt");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/opt");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/opt/lib");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/opt/lib");
+
+  /* /steam/lib is already visible via /steam with the same mode */
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--ro-bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/steam");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/steam");
+
+  g_assert_cmpuint (argv->len, ==, i);
+}
+
+static void
+test_prune_exports (Fixture *f,
+                    gconstpointer context)
+{
+  g_autoptr(FlatpakBwrap) bwrap = flatpak_bwrap_new (flatpak_bwrap_empty_env);
+  GPtrArray *argv;
+  gsize i;
+
+  flatpak_bwrap_add_args (bwrap,
+                          "--ro-bind", "/usr", "/run/host/usr",
+                          "--ro-bind", "/usr/lib", "/run/host/usr/lib",
+                          "--bind", "/srv", "/srv",
+                          "--symlink", "../data", "/srv/link",
+                          "--bind", "/srv/link/x", "/srv/link/x",
+                          "--tmpfs", "/srv/tmp",
+                          "--bind", "/srv/tmp/x", "/srv/tmp/x",
+                          "--dir", "/srv/dir",
+                          "--bind", "/srv/dir/x", "/srv/dir/x",
+                          "--bind", "/srv/a", "/srv/a",
+                          "--bind", "/srv/a/b/c", "/srv/a/b/c",
+                          NULL);
+  pv_wrap_prune_exports (bwrap);
+  argv = bwrap->argv;
+
+  for (i = 0; i < argv->len; i++)
+    g_test_message ("argv[%" G_GSIZE_FORMAT "]: %s",
+                    i, (const char *) g_ptr_array_index (argv, i));
+
+  i = 0;
+
+  /* Only bind-mounts of a path onto itself are considered */
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--ro-bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/usr");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/run/host/usr");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--ro-bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/usr/lib");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/run/host/usr/lib");
+
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv");
+
+  /* Anything below a symlink, tmpfs or directory is kept */
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--symlink");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "../data");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/link");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/link/x");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/link/x");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--tmpfs");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/tmp");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/tmp/x");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/tmp/x");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--dir");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/dir");
+  g_assert_cmpuint (argv->len, >, i);
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "--bind");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/dir/x");
+  g_assert_cmpstr (g_ptr_array_index (argv, i++), ==, "/srv/dir/x");
+
+  /* /srv/a and /srv/a/b/c are already visible via /srv */
+  g_assert_cmpuint (argv->len, ==, i);
+}
+
 static void
 test_remap_ld_preload (Fixture *f,
                        gconstpointer context)
@@ -862,6 +1009,726 @@ test_remap_ld_preload_flatpak_no_runtime (Fixture *f,
   g_assert_cmpuint (argv->len, ==, i);
 }
 
+static void
+test_scope_properties (Fixture *f,
+                       gconstpointer context)
+{
+  static const char * const valid[] =
+  {
+    "CPUWeight=1000",
+    "IOWeight=1",
+    "MemoryLow=2G",
+    "MemoryLow=infinity",
+    "AllowedCPUs=0-3,9",
+    NULL
+  };
+  static const char * const invalid[] =
+  {
+    "CPUWeight",
+    "CPUWeight=0",
+    "CPUWeight=10001",
+    "IOWeight=-1",
+    "IOWeight=lots",
+    "MemoryLow=1X",
+    "MemoryLow=1KB",
+    "MemoryLow=99999999999999999999",
+    "MemoryLow=17179869184G",
+    "AllowedCPUs=3-1",
+    "AllowedCPUs=0-",
+    "AllowedCPUs=100000",
+    "CPUQuota=50%",
+  };
+  static const guint8 expected_cpus[] = { 0x0f, 0x02 };
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) properties = NULL;
+  g_autoptr(GVariant) value = NULL;
+  const char *name;
+  gconstpointer cpus;
+  gsize n_cpus;
+  gsize i;
+
+  properties = pv_wrap_parse_scope_properties (valid, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (properties);
+  g_variant_ref_sink (properties);
+  g_assert_cmpstr (g_variant_get_type_string (properties), ==, "a(sv)");
+  g_assert_cmpuint (g_variant_n_children (properties), ==, 5);
+
+  g_variant_get_child (properties, 0, "(&sv)", &name, &value);
+  g_assert_cmpstr (name, ==, "CPUWeight");
+  g_assert_cmpuint (g_variant_get_uint64 (value), ==, 1000);
+  g_clear_pointer (&value, g_variant_unref);
+
+  g_variant_get_child (properties, 1, "(&sv)", &name, &value);
+  g_assert_cmpstr (name, ==, "IOWeight");
+  g_assert_cmpuint (g_variant_get_uint64 (value), ==, 1);
+  g_clear_pointer (&value, g_variant_unref);
+
+  g_variant_get_child (properties, 2, "(&sv)", &name, &value);
+  g_assert_cmpstr (name, ==, "MemoryLow");
+  g_assert_cmpuint (g_variant_get_uint64 (value), ==, 2 * 1024 * 1024 * G_GUINT64_CONSTANT (1024));
+  g_clear_pointer (&value, g_variant_unref);
+
+  g_variant_get_child (properties, 3, "(&sv)", &name, &value);
+  g_assert_cmpstr (name, ==, "MemoryLow");
+  g_assert_cmpuint (g_variant_get_uint64 (value), ==, G_MAXUINT64);
+  g_clear_pointer (&value, g_variant_unref);
+
+  g_variant_get_child (properties, 4, "(&sv)", &name, &value);
+  g_assert_cmpstr (name, ==, "AllowedCPUs");
+  g_assert_cmpstr (g_variant_get_type_string (value), ==, "ay");
+  cpus = g_variant_get_fixed_array (value, &n_cpus, 1);
+  g_assert_cmpuint (n_cpus, ==, G_N_ELEMENTS (expected_cpus));
+  g_assert_cmpint (memcmp (cpus, expected_cpus, n_cpus), ==, 0);
+  g_clear_pointer (&value, g_variant_unref);
+
+  for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+    {
+      const char * const one[] = { invalid[i], NULL };
+      g_autoptr(GVariant) unused = NULL;
+
+      unused = pv_wrap_parse_scope_properties (one, &local_error);
+      g_test_message ("%s -> %s", invalid[i],
+                      local_error != NULL ? local_error->message : "(no error)");
+      g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_FAILED);
+      g_assert_null (unused);
+      g_clear_error (&local_error);
+    }
+}
+
+/*
+ * A mock implementation of the systemd user manager, running in its
+ * own thread and main-context on one end of a peer-to-peer D-Bus
+ * connection.
+ */
+typedef struct
+{
+  GMutex mutex;
+  GCond cond;
+  GMainContext *context;
+  GMainLoop *loop;
+  GSocket *socket;
+  GThread *thread;
+  GSocketConnection *client_stream;
+  GDBusConnection *client;
+  gchar *guid;
+  gboolean ready;
+  /* If true, reject any properties other than PIDs, like a systemd
+   * version that does not support them */
+  gboolean reject_properties;
+  guint n_calls;
+  gchar *unit_name;
+  gchar *mode;
+  GVariant *properties;
+} MockSystemd;
+
+static gboolean
+mock_systemd_start_transient_unit_cb (SystemdManager *manager,
+                                      GDBusMethodInvocation *invocation,
+                                      const char *name,
+                                      const char *mode,
+                                      GVariant *properties,
+                                      GVariant *aux,
+                                      gpointer user_data)
+{
+  static const char job[] = "/org/freedesktop/systemd1/job/42";
+  MockSystemd *mock = user_data;
+
+  g_mutex_lock (&mock->mutex);
+  mock->n_calls++;
+
+  if (mock->reject_properties && g_variant_n_children (properties) > 1)
+    {
+      g_mutex_unlock (&mock->mutex);
+      g_dbus_method_invocation_return_dbus_error (invocation,
+                                                  "org.freedesktop.DBus.Error.InvalidArgs",
+                                                  "Cannot set property AllowedCPUs, or unknown property.");
+      return TRUE;
+    }
+
+  g_free (mock->unit_name);
+  mock->unit_name = g_strdup (name);
+  g_free (mock->mode);
+  mock->mode = g_strdup (mode);
+  g_clear_pointer (&mock->properties, g_variant_unref);
+  mock->properties = g_variant_ref (properties);
+  g_mutex_unlock (&mock->mutex);
+
+  systemd_manager_complete_start_transient_unit (manager, invocation, job);
+  systemd_manager_emit_job_removed (manager, 42, job, name, "done");
+  return TRUE;
+}
+
+static gboolean
+mock_systemd_quit_cb (gpointer user_data)
+{
+  MockSystemd *mock = user_data;
+
+  g_main_loop_quit (mock->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer
+mock_systemd_thread (gpointer data)
+{
+  MockSystemd *mock = data;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GDBusConnection) connection = NULL;
+  GSocketConnection *stream;
+  SystemdManager *manager;
+
+  g_main_context_push_thread_default (mock->context);
+
+  stream = g_socket_connection_factory_create_connection (mock->socket);
+  connection = g_dbus_connection_new_sync (G_IO_STREAM (stream),
+                                           mock->guid,
+                                           G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER,
+                                           NULL, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  manager = systemd_manager_skeleton_new ();
+  g_signal_connect (manager, "handle-start-transient-unit",
+                    G_CALLBACK (mock_systemd_start_transient_unit_cb), mock);
+  g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (manager),
+                                    connection,
+                                    "/org/freedesktop/systemd1",
+                                    &local_error);
+  g_assert_no_error (local_error);
+
+  g_mutex_lock (&mock->mutex);
+  mock->ready = TRUE;
+  g_cond_signal (&mock->cond);
+  g_mutex_unlock (&mock->mutex);
+
+  g_main_loop_run (mock->loop);
+
+  g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (manager));
+  g_object_unref (manager);
+  g_dbus_connection_close_sync (connection, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_object_unref (stream);
+  g_main_context_pop_thread_default (mock->context);
+  return NULL;
+}
+
+/*
+ * Start @mock in a thread, and connect @mock->client to it.
+ */
+static void
+mock_systemd_start (MockSystemd *mock)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GSocket) client_socket = NULL;
+  int sv[2];
+
+  g_assert_no_errno (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv));
+  mock->socket = g_socket_new_from_fd (sv[0], &local_error);
+  g_assert_no_error (local_error);
+  client_socket = g_socket_new_from_fd (sv[1], &local_error);
+  g_assert_no_error (local_error);
+
+  g_mutex_init (&mock->mutex);
+  g_cond_init (&mock->cond);
+  mock->context = g_main_context_new ();
+  mock->loop = g_main_loop_new (mock->context, FALSE);
+  mock->guid = g_dbus_generate_guid ();
+  mock->thread = g_thread_new ("mock-systemd", mock_systemd_thread, mock);
+
+  mock->client_stream = g_socket_connection_factory_create_connection (client_socket);
+  mock->client = g_dbus_connection_new_sync (G_IO_STREAM (mock->client_stream),
+                                             NULL,
+                                             G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                             NULL, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  g_mutex_lock (&mock->mutex);
+
+  while (!mock->ready)
+    g_cond_wait (&mock->cond, &mock->mutex);
+
+  g_mutex_unlock (&mock->mutex);
+}
+
+/*
+ * Stop @mock and free everything except the results.
+ */
+static void
+mock_systemd_stop (MockSystemd *mock)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_main_context_invoke (mock->context, mock_systemd_quit_cb, mock);
+  g_thread_join (g_steal_pointer (&mock->thread));
+  g_dbus_connection_close_sync (mock->client, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  g_clear_object (&mock->client);
+  g_clear_object (&mock->client_stream);
+  g_clear_object (&mock->socket);
+  g_main_loop_unref (mock->loop);
+  g_main_context_unref (mock->context);
+  g_mutex_clear (&mock->mutex);
+  g_cond_clear (&mock->cond);
+  g_free (mock->guid);
+}
+
+static void
+mock_systemd_clear_results (MockSystemd *mock)
+{
+  g_free (mock->unit_name);
+  g_free (mock->mode);
+  g_clear_pointer (&mock->properties, g_variant_unref);
+}
+
+static void
+test_transient_unit_properties (Fixture *f,
+                                gconstpointer context)
+{
+  static const char * const wanted[] =
+  {
+    "CPUWeight=500",
+    "IOWeight=500",
+    "MemoryLow=512M",
+    "AllowedCPUs=1",
+    NULL
+  };
+  MockSystemd mock = {};
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) extra = NULL;
+  g_autofree gchar *expected_name = NULL;
+  const char *name;
+  gsize i;
+
+  extra = pv_wrap_parse_scope_properties (wanted, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_ref_sink (extra);
+
+  mock_systemd_start (&mock);
+  flatpak_run_in_transient_unit (mock.client, "steam", "app", "123", extra,
+                                 &local_error);
+  g_assert_no_error (local_error);
+  mock_systemd_stop (&mock);
+
+  expected_name = g_strdup_printf ("app-steam-app123-%d.scope", getpid ());
+  g_assert_cmpuint (mock.n_calls, ==, 1);
+  g_assert_cmpstr (mock.unit_name, ==, expected_name);
+  g_assert_cmpstr (mock.mode, ==, "fail");
+  g_assert_nonnull (mock.properties);
+
+  /* The PIDs come first, followed by the extra properties in order */
+  g_assert_cmpuint (g_variant_n_children (mock.properties),
+                    ==, 1 + g_variant_n_children (extra));
+  g_variant_get_child (mock.properties, 0, "(&sv)", &name, NULL);
+  g_assert_cmpstr (name, ==, "PIDs");
+
+  for (i = 0; i < g_variant_n_children (extra); i++)
+    {
+      g_autoptr(GVariant) expected = g_variant_get_child_value (extra, i);
+      g_autoptr(GVariant) actual = g_variant_get_child_value (mock.properties,
+                                                              i + 1);
+
+      g_assert_true (g_variant_equal (expected, actual));
+    }
+
+  mock_systemd_clear_results (&mock);
+}
+
+static void
+test_transient_unit_properties_rejected (Fixture *f,
+                                         gconstpointer context)
+{
+  static const char * const wanted[] =
+  {
+    "AllowedCPUs=0-1",
+    NULL
+  };
+  MockSystemd mock = { .reject_properties = TRUE };
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) extra = NULL;
+  g_autofree gchar *expected_name = NULL;
+  GLogLevelFlags old_fatal_mask;
+  const char *name;
+
+  extra = pv_wrap_parse_scope_properties (wanted, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_ref_sink (extra);
+
+  mock_systemd_start (&mock);
+
+  /* The test framework makes warnings fatal, but we expect one here */
+  old_fatal_mask = g_log_set_always_fatal (G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL);
+#if GLIB_CHECK_VERSION(2, 34, 0)
+  g_test_expect_message ("pressure-vessel", G_LOG_LEVEL_WARNING,
+                         "Cannot move into a systemd scope with the requested "
+                         "properties, trying without: *");
+#endif
+
+  pv_wrap_move_into_scope (mock.client, "123", extra);
+
+#if GLIB_CHECK_VERSION(2, 34, 0)
+  g_test_assert_expected_messages ();
+#endif
+  g_log_set_always_fatal (old_fatal_mask);
+
+  mock_systemd_stop (&mock);
+
+  /* The first attempt was rejected, but the second attempt without
+   * the extra properties still put us in a scope */
+  expected_name = g_strdup_printf ("app-steam-app123-%d.scope", getpid ());
+  g_assert_cmpuint (mock.n_calls, ==, 2);
+  g_assert_cmpstr (mock.unit_name, ==, expected_name);
+  g_assert_nonnull (mock.properties);
+  g_assert_cmpuint (g_variant_n_children (mock.properties), ==, 1);
+  g_variant_get_child (mock.properties, 0, "(&sv)", &name, NULL);
+  g_assert_cmpstr (name, ==, "PIDs");
+
+  mock_systemd_clear_results (&mock);
+}
+
+static void
+test_prewarm_filename (Fixture *f,
+                       gconstpointer context)
+{
+  static const struct
+  {
+    const char *name;
+    const char *expected;
+  } tests[] =
+  {
+    { NULL, "default.txt" },
+    { "", "default.txt" },
+    { "70", "70.txt" },
+    { "my-game_1.2", "my-game_1.2.txt" },
+    { "../../etc/passwd", "_._.._etc_passwd.txt" },
+    { ".hidden", "_hidden.txt" },
+    { "a/b", "a_b.txt" },
+    { "caf\xc3\xa9 bar", "caf___bar.txt" },
+  };
+  gsize i;
+
+  for (i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      g_autofree gchar *filename = pv_runtime_get_prewarm_filename (tests[i].name);
+
+      g_test_message ("%s -> %s", tests[i].name, filename);
+      g_assert_cmpstr (filename, ==, tests[i].expected);
+      g_assert_null (strchr (filename, '/'));
+      g_assert_cmpint (filename[0], !=, '.');
+    }
+}
+
+static void
+test_prewarm_path (Fixture *f,
+                   gconstpointer context)
+{
+  static const char * const prefixes[] =
+  {
+    "/run/host", "/",
+    "/usr/lib/pressure-vessel/overrides", "/tmp/pv.123/overrides",
+    "/usr", "/srv/runtime/files",
+    NULL
+  };
+  static const char * const no_provider[] =
+  {
+    "/overrides", "/tmp/pv.123/overrides",
+    "/usr", "/srv/runtime/files",
+    NULL
+  };
+  static const struct
+  {
+    const char * const *prefixes;
+    const char *path;
+    const char *expected;
+  } tests[] =
+  {
+    /* Paths from the graphics provider */
+    { prefixes, "/run/host/usr/lib/libGLX_mesa.so.0",
+      "/usr/lib/libGLX_mesa.so.0" },
+    { prefixes, "/run/host", "/" },
+    { prefixes, "//run//host//lib/libc.so.6", "/lib/libc.so.6" },
+    /* The overrides are inside /usr, but take precedence */
+    { prefixes, "/usr/lib/pressure-vessel/overrides/lib/libGL.so.1",
+      "/tmp/pv.123/overrides/lib/libGL.so.1" },
+    { prefixes, "/usr/lib/pressure-vessel/overrides",
+      "/tmp/pv.123/overrides" },
+    { prefixes, "/usr/lib/pressure-vessel/overrides-not/libfoo.so",
+      "/srv/runtime/files/lib/pressure-vessel/overrides-not/libfoo.so" },
+    /* Paths from the runtime */
+    { prefixes, "/usr/lib/x86_64-linux-gnu/libz.so.1",
+      "/srv/runtime/files/lib/x86_64-linux-gnu/libz.so.1" },
+    { prefixes, "/usr", "/srv/runtime/files" },
+    { no_provider, "/overrides/lib/libGL.so.1",
+      "/tmp/pv.123/overrides/lib/libGL.so.1" },
+    { no_provider, "/usr/bin/env", "/srv/runtime/files/bin/env" },
+    /* Paths outside those trees are ignored */
+    { prefixes, "/home/me/game/bin/game", NULL },
+    { prefixes, "/run/hostile/libfoo.so", NULL },
+    { prefixes, "/usrmerge/libfoo.so", NULL },
+    { prefixes, "/lib/x86_64-linux-gnu/libc.so.6", NULL },
+    { prefixes, "/", NULL },
+    { no_provider, "/run/host/usr/lib/libGLX_mesa.so.0", NULL },
+  };
+  gsize i;
+
+  for (i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      g_autofree gchar *path = NULL;
+
+      path = pv_runtime_prewarm_path_in_current_ns (tests[i].prefixes,
+                                                    tests[i].path);
+      g_test_message ("%s -> %s", tests[i].path, path);
+      g_assert_cmpstr (path, ==, tests[i].expected);
+    }
+}
+
+static void
+test_vulkan_icd_selector (Fixture *f,
+                          gconstpointer context)
+{
+  static const struct
+  {
+    const char *selector;
+    const char *drivers;
+  } valid[] =
+  {
+    { "pci:1002", "radeon amdvlk amdvlk32 amdvlk64" },
+    { "pci:8086", "intel intel_hasvk" },
+    { "pci:10DE", "nvidia nouveau" },
+    /* Ivybridge and Broadwell need HASVK, or ANV from older Mesa */
+    { "pci:8086:0166", "intel_hasvk intel" },
+    { "pci:8086:1616", "intel_hasvk intel" },
+    /* Tiger Lake is Gen12, so only ANV */
+    { "pci:8086:9a49", "intel" },
+    /* We can't narrow these down any further than the vendor */
+    { "pci:1002:731f", "radeon amdvlk amdvlk32 amdvlk64" },
+    { "pci:10de:2204", "nvidia nouveau" },
+    { "driver:intel", "intel" },
+    { "driver:libvulkan_intel.so", "libvulkan_intel.so" },
+  };
+  static const char * const invalid[] =
+  {
+    "",
+    "1002",
+    "pci:",
+    "pci:0",
+    "pci:10000",
+    "pci:1002:",
+    "pci:1002:0",
+    "pci:1002:10000",
+    "pci:1002:731g",
+    "pci:1002:731f:0",
+    "pci::731f",
+    "pci:amd",
+    "pci:1002x",
+    "index:",
+    "index:-1",
+    "index:-2",
+    "pci: 1002",
+    "index:one",
+    "driver:",
+    "vendor:1002",
+  };
+  gsize i;
+
+  for (i = 0; i < G_N_ELEMENTS (valid); i++)
+    {
+      g_autoptr(GError) local_error = NULL;
+      g_autoptr(GPtrArray) drivers = NULL;
+      g_auto(GStrv) expected = g_strsplit (valid[i].drivers, " ", -1);
+      gsize j;
+
+      g_test_message ("%s", valid[i].selector);
+      g_assert_true (pv_runtime_check_vulkan_icd_selector (valid[i].selector,
+                                                           &local_error));
+      g_assert_no_error (local_error);
+
+      drivers = pv_runtime_get_vulkan_icd_selector_drivers (valid[i].selector,
+                                                            &local_error);
+      g_assert_no_error (local_error);
+      g_assert_nonnull (drivers);
+      g_assert_cmpuint (drivers->len, ==, g_strv_length (expected));
+
+      for (j = 0; j < drivers->len; j++)
+        g_assert_cmpstr (g_ptr_array_index (drivers, j), ==, expected[j]);
+    }
+
+  /* This depends on the GPUs in the system, but it must be
+   * syntactically valid */
+  g_assert_true (pv_runtime_check_vulkan_icd_selector ("index:0", NULL));
+
+  /* Syntactically valid, but we don't know what drivers it needs */
+    {
+      g_autoptr(GError) local_error = NULL;
+      g_autoptr(GPtrArray) drivers = NULL;
+
+      drivers = pv_runtime_get_vulkan_icd_selector_drivers ("pci:1234",
+                                                            &local_error);
+      g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_FAILED);
+      g_assert_null (drivers);
+      g_clear_error (&local_error);
+
+      drivers = pv_runtime_get_vulkan_icd_selector_drivers ("pci:1234:5678",
+                                                            &local_error);
+      g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_FAILED);
+      g_assert_null (drivers);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+    {
+      g_autoptr(GError) local_error = NULL;
+      g_autoptr(GPtrArray) drivers = NULL;
+
+      g_assert_false (pv_runtime_check_vulkan_icd_selector (invalid[i],
+                                                            &local_error));
+      g_test_message ("%s -> %s", invalid[i], local_error->message);
+      g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_FAILED);
+      g_clear_error (&local_error);
+
+      drivers = pv_runtime_get_vulkan_icd_selector_drivers (invalid[i],
+                                                            &local_error);
+      g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_FAILED);
+      g_assert_null (drivers);
+    }
+}
+
+static void
+test_vulkan_icd_filter (Fixture *f,
+                        gconstpointer context)
+{
+  static const struct
+  {
+    const char *library;
+    const char *name;
+    gboolean amd;
+    gboolean intel;
+    gboolean hasvk;
+    gboolean amdvlk64_so;
+  } libraries[] =
+  {
+    { "/usr/lib/x86_64-linux-gnu/libvulkan_radeon.so", "radeon",
+      TRUE, FALSE, FALSE, FALSE },
+    { "/usr/lib/x86_64-linux-gnu/amdvlk64.so", "amdvlk64",
+      TRUE, FALSE, FALSE, TRUE },
+    { "amdvlk32.so", "amdvlk32", TRUE, FALSE, FALSE, FALSE },
+    { "/usr/lib/libvulkan_intel.so", "intel", FALSE, TRUE, FALSE, FALSE },
+    { "/usr/lib/libvulkan_intel_hasvk.so", "intel_hasvk",
+      FALSE, TRUE, TRUE, FALSE },
+    { "libGLX_nvidia.so.0", "nvidia", FALSE, FALSE, FALSE, FALSE },
+    { "/usr/lib/libEGL_nvidia.so.0", "nvidia", FALSE, FALSE, FALSE, FALSE },
+    { "/usr/lib/libvulkan_nouveau.so", "nouveau",
+      FALSE, FALSE, FALSE, FALSE },
+    /* Software rasterizers are always wanted */
+    { "/usr/lib/libvulkan_lvp.so", "lvp", TRUE, TRUE, TRUE, TRUE },
+    { "/opt/swiftshader/libvk_swiftshader.so", "swiftshader",
+      TRUE, TRUE, TRUE, TRUE },
+    /* A substring of a driver name is not enough */
+    { "/usr/lib/libvulkan_intelligent.so", "intelligent",
+      FALSE, FALSE, FALSE, FALSE },
+    { "/usr/lib/libvulkan_lvplus.so", "lvplus",
+      FALSE, FALSE, FALSE, FALSE },
+  };
+  g_autoptr(GPtrArray) amd = NULL;
+  g_autoptr(GPtrArray) intel = NULL;
+  g_autoptr(GPtrArray) hasvk = NULL;
+  g_autoptr(GPtrArray) amdvlk64_so = NULL;
+  gsize i;
+
+  amd = pv_runtime_get_vulkan_icd_selector_drivers ("pci:1002", NULL);
+  g_assert_nonnull (amd);
+  intel = pv_runtime_get_vulkan_icd_selector_drivers ("pci:8086", NULL);
+  g_assert_nonnull (intel);
+  hasvk = pv_runtime_get_vulkan_icd_selector_drivers ("driver:intel_hasvk",
+                                                      NULL);
+  g_assert_nonnull (hasvk);
+  amdvlk64_so = pv_runtime_get_vulkan_icd_selector_drivers ("driver:amdvlk64.so",
+                                                            NULL);
+  g_assert_nonnull (amdvlk64_so);
+
+  for (i = 0; i < G_N_ELEMENTS (libraries); i++)
+    {
+      const char *library = libraries[i].library;
+      g_autofree gchar *name = pv_runtime_get_vulkan_driver_name (library);
+
+      g_test_message ("%s", library);
+      g_assert_cmpstr (name, ==, libraries[i].name);
+      g_assert_true (pv_runtime_want_vulkan_icd_library (library, NULL));
+      g_assert_cmpint (pv_runtime_want_vulkan_icd_library (library, amd),
+                       ==, libraries[i].amd);
+      g_assert_cmpint (pv_runtime_want_vulkan_icd_library (library, intel),
+                       ==, libraries[i].intel);
+      g_assert_cmpint (pv_runtime_want_vulkan_icd_library (library, hasvk),
+                       ==, libraries[i].hasvk);
+      g_assert_cmpint (pv_runtime_want_vulkan_icd_library (library,
+                                                           amdvlk64_so),
+                       ==, libraries[i].amdvlk64_so);
+    }
+
+  /* If we don't know the library, we have to assume it's wanted */
+  g_assert_true (pv_runtime_want_vulkan_icd_library (NULL, intel));
+}
+
+static void
+test_shader_cache (Fixture *f,
+                   gconstpointer context)
+{
+  static const char * const relative[] = { "./bin/game.x86_64", "-fs", NULL };
+  static const char * const absolute[] = { "/games/foo/bin/game.x86_64", NULL };
+  static const char * const other[] = { "/games/bar/bin/game.x86_64", NULL };
+  static const char * const empty[] = { NULL };
+  g_autoptr(FlatpakExports) exports = flatpak_exports_new ();
+  g_autoptr(PvEnviron) container_env = pv_environ_new ();
+  g_auto(GStrv) env = g_new0 (gchar *, 1);
+  g_autofree gchar *cache = g_build_filename (f->tmpdir, "cache", NULL);
+  g_autofree gchar *key = NULL;
+  g_autofree gchar *other_key = NULL;
+  g_autofree gchar *expected = NULL;
+  g_autofree gchar *expected_nvidia = NULL;
+
+  key = pv_wrap_get_shader_cache_key (relative, "/games/foo");
+  g_assert_nonnull (key);
+  g_assert_true (g_str_has_prefix (key, "game.x86_64-"));
+  g_assert_null (strchr (key, '/'));
+
+  other_key = pv_wrap_get_shader_cache_key (absolute, "/");
+  g_assert_cmpstr (key, ==, other_key);
+  g_clear_pointer (&other_key, g_free);
+
+  other_key = pv_wrap_get_shader_cache_key (other, "/games/foo");
+  g_assert_cmpstr (key, !=, other_key);
+
+  g_assert_null (pv_wrap_get_shader_cache_key (empty, "/"));
+
+  /* With nothing set by the user, the caches and their sizes are ours */
+  pv_wrap_use_persistent_shader_cache (exports, container_env, env,
+                                       cache, key);
+  expected = g_build_filename (cache, "pressure-vessel", "shader-cache",
+                               key, NULL);
+  expected_nvidia = g_build_filename (expected, "nvidia", NULL);
+  g_assert_true (g_file_test (expected_nvidia, G_FILE_TEST_IS_DIR));
+  g_assert_true (flatpak_exports_path_is_visible (exports, expected));
+  g_assert_cmpstr (pv_environ_getenv (container_env, "MESA_SHADER_CACHE_DIR"),
+                   ==, expected);
+  g_assert_cmpstr (pv_environ_getenv (container_env, "MESA_SHADER_CACHE_MAX_SIZE"),
+                   ==, "1G");
+  g_assert_cmpstr (pv_environ_getenv (container_env, "__GL_SHADER_DISK_CACHE_PATH"),
+                   ==, expected_nvidia);
+  g_assert_cmpstr (pv_environ_getenv (container_env, "__GL_SHADER_DISK_CACHE_SIZE"),
+                   ==, "1073741824");
+
+  /* If the user chose a cache directory, its size is not our concern */
+  g_clear_pointer (&container_env, pv_environ_free);
+  container_env = pv_environ_new ();
+  env = g_environ_setenv (env, "MESA_SHADER_CACHE_DIR", "/mesa", TRUE);
+  env = g_environ_setenv (env, "__GL_SHADER_DISK_CACHE_SIZE", "1", TRUE);
+  pv_wrap_use_persistent_shader_cache (exports, container_env, env,
+                                       cache, key);
+  g_assert_null (pv_environ_getenv (container_env, "MESA_SHADER_CACHE_DIR"));
+  g_assert_null (pv_environ_getenv (container_env, "MESA_SHADER_CACHE_MAX_SIZE"));
+  g_assert_cmpstr (pv_environ_getenv (container_env, "__GL_SHADER_DISK_CACHE_PATH"),
+                   ==, expected_nvidia);
+  g_assert_null (pv_environ_getenv (container_env, "__GL_SHADER_DISK_CACHE_SIZE"));
+}
+
 int
 main (int argc,
       char **argv)
@@ -869,6 +1736,10 @@ main (int argc,
   _srt_setenv_disable_gio_modules ();
 
   g_test_init (&argc, &argv, NULL);
+  g_test_add ("/exports-nested", Fixture, NULL,
+              setup, test_exports_nested, teardown);
+  g_test_add ("/prune-exports", Fixture, NULL,
+              setup, test_prune_exports, teardown);
   g_test_add ("/remap-ld-preload", Fixture, NULL,
               setup, test_remap_ld_preload, teardown);
   g_test_add ("/remap-ld-preload-flatpak", Fixture, NULL,
@@ -877,6 +1748,22 @@ main (int argc,
               setup, test_remap_ld_preload_no_runtime, teardown);
   g_test_add ("/remap-ld-preload-flatpak-no-runtime", Fixture, NULL,
               setup, test_remap_ld_preload_flatpak_no_runtime, teardown);
+  g_test_add ("/shader-cache", Fixture, NULL,
+              setup, test_shader_cache, teardown);
+  g_test_add ("/scope-properties", Fixture, NULL,
+              setup, test_scope_properties, teardown);
+  g_test_add ("/transient-unit-properties", Fixture, NULL,
+              setup, test_transient_unit_properties, teardown);
+  g_test_add ("/transient-unit-properties/rejected", Fixture, NULL,
+              setup, test_transient_unit_properties_rejected, teardown);
+  g_test_add ("/prewarm/filename", Fixture, NULL,
+              setup, test_prewarm_filename, teardown);
+  g_test_add ("/prewarm/path", Fixture, NULL,
+              setup, test_prewarm_path, teardown);
+  g_test_add ("/vulkan-icd/filter", Fixture, NULL,
+              setup, test_vulkan_icd_filter, teardown);
+  g_test_add ("/vulkan-icd/selector", Fixture, NULL,
+              setup, test_vulkan_icd_selector, teardown);
 
   return g_test_run ();
 }
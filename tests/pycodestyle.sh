@@ -48,6 +48,7 @@ echo "1..1"
 if "${PYCODESTYLE}" \
     --ignore=E402,W503 \
     ./pressure-vessel/*.py \
+    ./pressure-vessel/pressure-vessel-ld-profile-report \
     ./pressure-vessel/pressure-vessel-test-ui \
     ./sysroot/*.py \
     ./tests/*/*.py \
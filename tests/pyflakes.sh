@@ -38,6 +38,7 @@ if [ "x${PYFLAKES:=pyflakes3}" = xfalse ] || \
     echo "1..0 # SKIP pyflakes3 not found"
 elif "${PYFLAKES}" \
     ./pressure-vessel/*.py \
+    ./pressure-vessel/pressure-vessel-ld-profile-report \
     ./pressure-vessel/pressure-vessel-test-ui \
     ./sysroot/*.py \
     ./tests/*/*.py \
@@ -25,8 +25,10 @@
 
 #include <steam-runtime-tools/steam-runtime-tools.h>
 
+#include <string.h>
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -375,6 +377,62 @@ test_gstring_replace (Fixture *f,
     }
 }
 
+static void
+test_rm_rf (Fixture *f,
+            gconstpointer context)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *outside = NULL;
+  g_autofree gchar *outside_file = NULL;
+  g_autofree gchar *temp = NULL;
+  g_autofree gchar *deep = NULL;
+  g_autofree gchar *path = NULL;
+
+  outside = g_dir_make_tmp (NULL, &error);
+  g_assert_no_error (error);
+  outside_file = g_build_filename (outside, "keep-me", NULL);
+  g_file_set_contents (outside_file, "hello", -1, &error);
+  g_assert_no_error (error);
+
+  temp = g_dir_make_tmp (NULL, &error);
+  g_assert_no_error (error);
+  deep = g_build_filename (temp, "a", "b", "c", NULL);
+  g_assert_no_errno (g_mkdir_with_parents (deep, 0755));
+
+  path = g_build_filename (deep, "file", NULL);
+  g_file_set_contents (path, "hello", -1, &error);
+  g_assert_no_error (error);
+  g_clear_pointer (&path, g_free);
+
+  /* Symbolic links are removed, not followed */
+  path = g_build_filename (temp, "a", "link-to-dir", NULL);
+  g_assert_no_errno (symlink (outside, path));
+  g_clear_pointer (&path, g_free);
+  path = g_build_filename (temp, "link-to-file", NULL);
+  g_assert_no_errno (symlink (outside_file, path));
+  g_clear_pointer (&path, g_free);
+  path = g_build_filename (temp, "dangling", NULL);
+  g_assert_no_errno (symlink ("/nonexistent", path));
+  g_clear_pointer (&path, g_free);
+
+  g_assert_true (_srt_rm_rf (temp));
+  g_assert_false (g_file_test (temp, G_FILE_TEST_EXISTS));
+  g_assert_true (g_file_test (outside_file, G_FILE_TEST_IS_REGULAR));
+
+  /* Removing something that does not exist is an error */
+  g_assert_false (_srt_rm_rf (temp));
+
+  /* A non-directory is removed, too */
+  path = g_build_filename (outside, "link", NULL);
+  g_assert_no_errno (symlink (outside_file, path));
+  g_assert_true (_srt_rm_rf (path));
+  g_assert_false (g_file_test (path, G_FILE_TEST_EXISTS));
+  g_assert_true (g_file_test (outside_file, G_FILE_TEST_IS_REGULAR));
+
+  g_assert_true (_srt_rm_rf (outside));
+  g_assert_false (g_file_test (outside, G_FILE_TEST_EXISTS));
+}
+
 G_STATIC_ASSERT (FD_SETSIZE == 1024);
 
 static void
@@ -471,6 +529,52 @@ test_same_file (Fixture *f,
   g_assert_no_error (error);
 }
 
+static void
+test_spawn_helper_sync (Fixture *f,
+                        gconstpointer context)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *output = NULL;
+  g_autofree gchar *messages = NULL;
+  g_autofree gchar *script = NULL;
+  const char *argv[] = { "sh", "-euc", NULL, NULL };
+  int wait_status = -1;
+
+  /* Write more than SRT_HELPER_MAX_STDERR to stderr, then a marker */
+  script = g_strdup_printf ("i=0; "
+                            "while [ \"$i\" -lt %d ]; do "
+                            "printf '%%1023s\\n' '' >&2; "
+                            "i=$((i + 1)); "
+                            "done; "
+                            "echo last >&2; "
+                            "echo hello; "
+                            "exit 3",
+                            2 * SRT_HELPER_MAX_STDERR / 1024);
+  argv[2] = script;
+
+  _srt_spawn_helper_sync ((gchar **) argv, NULL, G_SPAWN_SEARCH_PATH,
+                          &output, &messages, &wait_status, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (output, ==, "hello\n");
+  g_assert_true (WIFEXITED (wait_status));
+  g_assert_cmpint (WEXITSTATUS (wait_status), ==, 3);
+  g_assert_true (g_str_has_prefix (messages, "[... "));
+  g_assert_true (g_str_has_suffix (messages, "\nlast\n"));
+  g_assert_cmpuint (strlen (strchr (messages, '\n') + 1),
+                    ==, SRT_HELPER_MAX_STDERR);
+
+  /* Small amounts of output are kept verbatim */
+  argv[2] = "echo out; echo err >&2";
+  g_clear_pointer (&output, g_free);
+  g_clear_pointer (&messages, g_free);
+  _srt_spawn_helper_sync ((gchar **) argv, NULL, G_SPAWN_SEARCH_PATH,
+                          &output, &messages, &wait_status, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (output, ==, "out\n");
+  g_assert_cmpstr (messages, ==, "err\n");
+  g_assert_cmpint (wait_status, ==, 0);
+}
+
 static void
 test_str_is_integer (Fixture *f,
                      gconstpointer context)
@@ -562,8 +666,12 @@ main (int argc,
               setup, test_gstring_replace, teardown);
   g_test_add ("/utils/rlimit", Fixture, NULL,
               setup, test_rlimit, teardown);
+  g_test_add ("/utils/rm-rf", Fixture, NULL,
+              setup, test_rm_rf, teardown);
   g_test_add ("/utils/same-file", Fixture, NULL,
               setup, test_same_file, teardown);
+  g_test_add ("/utils/spawn-helper-sync", Fixture, NULL,
+              setup, test_spawn_helper_sync, teardown);
   g_test_add ("/utils/str_is_integer", Fixture, NULL,
               setup, test_str_is_integer, teardown);
   g_test_add ("/utils/uevent-field", Fixture, NULL,
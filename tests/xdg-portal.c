@@ -29,9 +29,17 @@
 
 #include <steam-runtime-tools/steam-runtime-tools.h>
 
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glib-object.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
 
 #include "steam-runtime-tools/xdg-portal-internal.h"
 #include "test-utils.h"
@@ -244,6 +252,513 @@ test_check_xdg_portal (Fixture *f,
     }
 }
 
+/*
+ * A portal interface implemented by MockService, replying to
+ * Properties.Get("version") after @delay_ms milliseconds.
+ */
+typedef struct
+{
+  const gchar *name;
+  guint32 version;
+  guint delay_ms;
+} MockPortalInterface;
+
+typedef struct
+{
+  const gchar *description;
+  const gchar *timeout;
+  MockPortalInterface mock_interfaces[3];
+  const gchar *mock_backends[3];
+  XdgPortalInterfaceTest expected_interfaces[3];
+  XdgPortalBackendTest expected_backends[3];
+  int exit_status;
+  const gchar *expected_message;
+} XdgPortalAsyncTest;
+
+static const XdgPortalAsyncTest xdg_portal_async_test[] =
+{
+  {
+    .description = "All replies arrive before the deadline",
+    .timeout = "10",
+    .mock_interfaces =
+    {
+      { .name = "org.freedesktop.portal.OpenURI", .version = 3 },
+      { .name = "org.freedesktop.portal.Email", .version = 2, .delay_ms = 200 },
+    },
+    .mock_backends = { "org.freedesktop.impl.portal.desktop.gtk" },
+    .expected_interfaces =
+    {
+      {
+        .name = "org.freedesktop.portal.OpenURI",
+        .is_available = TRUE,
+        .version = 3,
+      },
+      {
+        .name = "org.freedesktop.portal.Email",
+        .is_available = TRUE,
+        .version = 2,
+      },
+    },
+    .expected_backends =
+    {
+      {
+        .name = "org.freedesktop.impl.portal.desktop.gtk",
+        .is_available = TRUE,
+      },
+      {
+        .name = "org.freedesktop.impl.portal.desktop.kde",
+        .is_available = FALSE,
+      },
+    },
+  },
+
+  {
+    .description = "One interface is too slow",
+    .timeout = "0.5",
+    .mock_interfaces =
+    {
+      { .name = "org.freedesktop.portal.OpenURI", .version = 3 },
+      { .name = "org.freedesktop.portal.Email", .version = 2, .delay_ms = 60000 },
+    },
+    .mock_backends = { "org.freedesktop.impl.portal.desktop.kde" },
+    .expected_interfaces =
+    {
+      {
+        .name = "org.freedesktop.portal.OpenURI",
+        .is_available = TRUE,
+        .version = 3,
+      },
+      {
+        .name = "org.freedesktop.portal.Email",
+        .is_available = FALSE,
+      },
+    },
+    .expected_backends =
+    {
+      {
+        .name = "org.freedesktop.impl.portal.desktop.gtk",
+        .is_available = FALSE,
+      },
+      {
+        .name = "org.freedesktop.impl.portal.desktop.kde",
+        .is_available = TRUE,
+      },
+    },
+    .exit_status = 1,
+    .expected_message = "Timed out waiting for the 'version' property of "
+                        "'org.freedesktop.portal.Email'",
+  },
+};
+
+/*
+ * A private dbus-daemon with a connection that pretends to be
+ * xdg-desktop-portal and some of its backends. Delayed replies are
+ * sent from a separate thread, because the test itself blocks while
+ * waiting for check-xdg-portal.
+ */
+typedef struct
+{
+  const XdgPortalAsyncTest *test;
+  gchar *tmpdir;
+  gchar *address;
+  GPid daemon_pid;
+  GDBusConnection *connection;
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+} MockService;
+
+typedef struct
+{
+  GDBusConnection *connection;
+  GDBusMessage *reply;
+} DelayedReply;
+
+static void
+delayed_reply_free (gpointer p)
+{
+  DelayedReply *self = p;
+
+  g_object_unref (self->connection);
+  g_object_unref (self->reply);
+  g_free (self);
+}
+
+static gboolean
+send_delayed_reply_cb (gpointer user_data)
+{
+  DelayedReply *self = user_data;
+
+  g_dbus_connection_send_message (self->connection, self->reply,
+                                  G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                  NULL, NULL);
+  return G_SOURCE_REMOVE;
+}
+
+/* Called in the GDBus worker thread */
+static GDBusMessage *
+mock_portal_filter (GDBusConnection *connection,
+                    GDBusMessage *message,
+                    gboolean incoming,
+                    gpointer user_data)
+{
+  MockService *service = user_data;
+  DelayedReply *delayed;
+  GSource *source;
+  GVariant *body;
+  const gchar *interface_name;
+  const gchar *property;
+  guint delay_ms = 0;
+  gsize i;
+
+  if (!incoming
+      || g_dbus_message_get_message_type (message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL
+      || g_strcmp0 (g_dbus_message_get_path (message),
+                    "/org/freedesktop/portal/desktop") != 0
+      || g_strcmp0 (g_dbus_message_get_interface (message),
+                    "org.freedesktop.DBus.Properties") != 0
+      || g_strcmp0 (g_dbus_message_get_member (message), "Get") != 0)
+    return message;
+
+  body = g_dbus_message_get_body (message);
+
+  if (body == NULL || !g_variant_is_of_type (body, G_VARIANT_TYPE ("(ss)")))
+    return message;
+
+  g_variant_get (body, "(&s&s)", &interface_name, &property);
+  delayed = g_new0 (DelayedReply, 1);
+  delayed->connection = g_object_ref (connection);
+
+  for (i = 0; i < G_N_ELEMENTS (service->test->mock_interfaces); i++)
+    {
+      const MockPortalInterface *iface = &service->test->mock_interfaces[i];
+
+      if (iface->name != NULL
+          && strcmp (iface->name, interface_name) == 0
+          && strcmp (property, "version") == 0)
+        {
+          delayed->reply = g_dbus_message_new_method_reply (message);
+          g_dbus_message_set_body (delayed->reply,
+                                   g_variant_new ("(v)",
+                                                  g_variant_new_uint32 (iface->version)));
+          delay_ms = iface->delay_ms;
+          break;
+        }
+    }
+
+  if (delayed->reply == NULL)
+    delayed->reply = g_dbus_message_new_method_error (message,
+                                                      "org.freedesktop.DBus.Error.UnknownInterface",
+                                                      "No such interface '%s'",
+                                                      interface_name);
+
+  source = g_timeout_source_new (delay_ms);
+  g_source_set_callback (source, send_delayed_reply_cb, delayed,
+                         delayed_reply_free);
+  g_source_attach (source, service->context);
+  g_source_unref (source);
+
+  g_object_unref (message);
+  return NULL;
+}
+
+static gpointer
+mock_service_thread (gpointer user_data)
+{
+  MockService *service = user_data;
+
+  g_main_context_push_thread_default (service->context);
+  g_main_loop_run (service->loop);
+  g_main_context_pop_thread_default (service->context);
+  return NULL;
+}
+
+static void
+mock_service_request_name (MockService *service,
+                           const gchar *name)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+  guint32 result;
+
+  reply = g_dbus_connection_call_sync (service->connection,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "RequestName",
+                                       g_variant_new ("(su)", name, 4),
+                                       G_VARIANT_TYPE ("(u)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_get (reply, "(u)", &result);
+  /* DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER */
+  g_assert_cmpuint (result, ==, 1);
+}
+
+/*
+ * Returns: %FALSE if the test should be skipped
+ */
+static gboolean
+mock_service_start (MockService *service,
+                    const XdgPortalAsyncTest *test)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GString) address = g_string_new ("");
+  g_autofree gchar *dbus_daemon = NULL;
+  g_autofree gchar *config = NULL;
+  g_autofree gchar *config_path = NULL;
+  g_autofree gchar *config_arg = NULL;
+  const char *daemon_argv[] = { NULL, NULL, "--nofork", "--print-address=1", NULL };
+  int stdout_fd = -1;
+  gsize i;
+
+  dbus_daemon = g_find_program_in_path ("dbus-daemon");
+
+  if (dbus_daemon == NULL)
+    return FALSE;
+
+  service->test = test;
+  service->tmpdir = g_dir_make_tmp ("srt-test-xdg-portal-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  /* No <servicedir>, so that real portals cannot be activated */
+  config = g_strdup_printf ("<!DOCTYPE busconfig PUBLIC "
+                            "\"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\" "
+                            "\"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+                            "<busconfig>\n"
+                            "  <type>session</type>\n"
+                            "  <listen>unix:dir=%s</listen>\n"
+                            "  <policy context=\"default\">\n"
+                            "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+                            "    <allow eavesdrop=\"true\"/>\n"
+                            "    <allow own=\"*\"/>\n"
+                            "  </policy>\n"
+                            "</busconfig>\n",
+                            service->tmpdir);
+  config_path = g_build_filename (service->tmpdir, "session.conf", NULL);
+  g_file_set_contents (config_path, config, -1, &error);
+  g_assert_no_error (error);
+  config_arg = g_strdup_printf ("--config-file=%s", config_path);
+
+  daemon_argv[0] = dbus_daemon;
+  daemon_argv[1] = config_arg;
+  g_spawn_async_with_pipes (NULL, (gchar **) daemon_argv, NULL,
+                            G_SPAWN_DO_NOT_REAP_CHILD,
+                            NULL, NULL, &service->daemon_pid,
+                            NULL, &stdout_fd, NULL, &error);
+  g_assert_no_error (error);
+
+  while (TRUE)
+    {
+      char c;
+      ssize_t n = read (stdout_fd, &c, 1);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      g_assert_cmpint (n, ==, 1);
+
+      if (c == '\n')
+        break;
+
+      g_string_append_c (address, c);
+    }
+
+  close (stdout_fd);
+  service->address = g_string_free (g_steal_pointer (&address), FALSE);
+
+  service->connection = g_dbus_connection_new_for_address_sync (service->address,
+                                                                (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+                                                                 | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                                                                NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  service->context = g_main_context_new ();
+  service->loop = g_main_loop_new (service->context, FALSE);
+  service->thread = g_thread_new ("mock-portal", mock_service_thread, service);
+  g_dbus_connection_add_filter (service->connection, mock_portal_filter,
+                                service, NULL);
+
+  mock_service_request_name (service, "org.freedesktop.portal.Desktop");
+
+  for (i = 0; i < G_N_ELEMENTS (test->mock_backends); i++)
+    {
+      if (test->mock_backends[i] != NULL)
+        mock_service_request_name (service, test->mock_backends[i]);
+    }
+
+  return TRUE;
+}
+
+static void
+mock_service_stop (MockService *service)
+{
+  int wait_status;
+
+  if (service->connection != NULL)
+    g_dbus_connection_close_sync (service->connection, NULL, NULL);
+
+  if (service->thread != NULL)
+    {
+      g_main_loop_quit (service->loop);
+      g_thread_join (service->thread);
+    }
+
+  g_clear_object (&service->connection);
+  g_clear_pointer (&service->loop, g_main_loop_unref);
+  g_clear_pointer (&service->context, g_main_context_unref);
+
+  if (service->daemon_pid > 0)
+    {
+      kill (service->daemon_pid, SIGTERM);
+      g_assert_cmpint (waitpid (service->daemon_pid, &wait_status, 0),
+                       ==, service->daemon_pid);
+    }
+
+  if (service->tmpdir != NULL)
+    {
+      g_autofree gchar *config_path = g_build_filename (service->tmpdir,
+                                                        "session.conf",
+                                                        NULL);
+
+      g_unlink (config_path);
+      g_rmdir (service->tmpdir);
+    }
+
+  g_free (service->tmpdir);
+  g_free (service->address);
+}
+
+/*
+ * Run the real check-xdg-portal against mock portals that reply after
+ * a configurable delay, and check that every query is answered or
+ * abandoned within a single deadline.
+ */
+static void
+test_check_xdg_portal_async (Fixture *f,
+                             gconstpointer context)
+{
+  const char *helpers_path = g_getenv ("SRT_HELPERS_PATH");
+  g_autofree gchar *helper = NULL;
+
+  if (strcmp (_SRT_MULTIARCH, "") == 0)
+    {
+      g_test_skip ("Unsupported architecture");
+      return;
+    }
+
+  if (helpers_path == NULL)
+    {
+      g_test_skip ("SRT_HELPERS_PATH not set");
+      return;
+    }
+
+  if (g_file_test ("/.flatpak-info", G_FILE_TEST_IS_REGULAR))
+    {
+      g_test_skip ("Portal backends are not checked inside Flatpak");
+      return;
+    }
+
+  helper = g_build_filename (helpers_path,
+                             _SRT_MULTIARCH "-check-xdg-portal", NULL);
+
+  if (!g_file_test (helper, G_FILE_TEST_IS_EXECUTABLE))
+    {
+      g_test_skip ("check-xdg-portal helper not found");
+      return;
+    }
+
+  for (gsize i = 0; i < G_N_ELEMENTS (xdg_portal_async_test); i++)
+    {
+      const XdgPortalAsyncTest *t = &xdg_portal_async_test[i];
+      MockService service = {};
+      g_autoptr(GError) error = NULL;
+      g_autoptr(JsonNode) node = NULL;
+      g_auto(GStrv) envp = NULL;
+      g_autofree gchar *timeout_arg = NULL;
+      g_autofree gchar *output = NULL;
+      g_autofree gchar *child_stderr = NULL;
+      const char *helper_argv[] = { helper, NULL, NULL };
+      JsonObject *interfaces;
+      JsonObject *backends;
+      gint64 start;
+      int wait_status;
+      gsize j;
+
+      g_test_message ("%s", t->description);
+
+      if (!mock_service_start (&service, t))
+        {
+          g_test_skip ("dbus-daemon not found");
+          return;
+        }
+
+      envp = g_get_environ ();
+      envp = g_environ_setenv (envp, "DBUS_SESSION_BUS_ADDRESS",
+                               service.address, TRUE);
+      timeout_arg = g_strdup_printf ("--timeout=%s", t->timeout);
+      helper_argv[1] = timeout_arg;
+
+      start = g_get_monotonic_time ();
+      g_spawn_sync (NULL, (gchar **) helper_argv, envp, G_SPAWN_DEFAULT,
+                    NULL, NULL, &output, &child_stderr, &wait_status, &error);
+      g_assert_no_error (error);
+
+      /* Even if a peer never replies, the helper gives up at the
+       * deadline rather than waiting for the D-Bus method timeout */
+      g_assert_cmpint (g_get_monotonic_time () - start, <,
+                       (g_ascii_strtod (t->timeout, NULL) + 5) * G_USEC_PER_SEC);
+
+      g_test_message ("stderr: %s", child_stderr);
+      g_assert_true (WIFEXITED (wait_status));
+      g_assert_cmpint (WEXITSTATUS (wait_status), ==, t->exit_status);
+
+      if (t->expected_message != NULL)
+        g_assert_nonnull (strstr (child_stderr, t->expected_message));
+
+      node = json_from_string (output, &error);
+      g_assert_no_error (error);
+      g_assert_nonnull (node);
+
+      interfaces = json_object_get_object_member (json_node_get_object (node),
+                                                  "interfaces");
+      g_assert_nonnull (interfaces);
+
+      for (j = 0; t->expected_interfaces[j].name != NULL; j++)
+        {
+          const XdgPortalInterfaceTest *expected = &t->expected_interfaces[j];
+          JsonObject *iface = json_object_get_object_member (interfaces,
+                                                             expected->name);
+
+          g_assert_nonnull (iface);
+          g_assert_cmpint (json_object_get_boolean_member (iface, "available"),
+                           ==, expected->is_available);
+
+          if (expected->is_available)
+            g_assert_cmpint (json_object_get_int_member (iface, "version"),
+                             ==, expected->version);
+        }
+
+      backends = json_object_get_object_member (json_node_get_object (node),
+                                                "backends");
+      g_assert_nonnull (backends);
+
+      for (j = 0; t->expected_backends[j].name != NULL; j++)
+        {
+          const XdgPortalBackendTest *expected = &t->expected_backends[j];
+          JsonObject *backend = json_object_get_object_member (backends,
+                                                               expected->name);
+
+          g_assert_nonnull (backend);
+          g_assert_cmpint (json_object_get_boolean_member (backend, "available"),
+                           ==, expected->is_available);
+        }
+
+      mock_service_stop (&service);
+    }
+}
+
 int
 main (int argc,
       char **argv)
@@ -256,6 +771,8 @@ main (int argc,
   g_test_init (&argc, &argv, NULL);
   g_test_add ("/xdg-portal/test_check_xdg_portal", Fixture, NULL, setup,
               test_check_xdg_portal, teardown);
+  g_test_add ("/xdg-portal/async", Fixture, NULL, setup,
+              test_check_xdg_portal_async, teardown);
 
   ret = g_test_run ();
   _srt_global_teardown_sysroots ();